@@ -1,6 +1,8 @@
 struct ResourceHandle
 {
-    uint id: 27;
+    uint id: 20;
+    uint generation: 6;
+    uint is_cpu_only: 1;
     uint is_loaded: 1;
     uint type: 4;
 };
@@ -14,6 +16,8 @@ struct VertexOut
 struct RootConstants
 {
     ResourceHandle texture_to_blit;
+    uint uv_scale_x; // fixed point 65536 = 1.0
+    uint uv_scale_y; // fixed point 65536 = 1.0
 };
 
 sampler tex_sampler : register(s0);
@@ -22,5 +26,6 @@ ConstantBuffer<RootConstants> root_constants : register(b0, space0);
 float4 main(in VertexOut input) : SV_Target0
 {
     Texture2D<float4> tex = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.texture_to_blit.id)];
-    return tex.Sample(tex_sampler, input.tex_coord);
+    const float2 uv_scale = float2(root_constants.uv_scale_x, root_constants.uv_scale_y) / 65536.0f; // only part of the texture is rendered to
+    return tex.Sample(tex_sampler, input.tex_coord * uv_scale);
 }
\ No newline at end of file
@@ -23,6 +23,8 @@ struct ViewData {
     Quaternion forward;
     float2 viewport_size;
     float3 camera_world_position;
+    float2 render_resolution;
+    float2 uv_scale;
 };
 
 struct SurfaceInfo {
@@ -56,7 +58,9 @@ struct VertexCompressed {
 };
 
 struct ResourceHandle {
-    uint id: 27;
+    uint id: 20;
+    uint generation: 6;
+    uint is_cpu_only: 1;
     uint is_loaded: 1;
     uint type: 4;
 };
@@ -88,7 +92,7 @@ sampler tex_sampler : register(s0);
 sampler tex_sampler_clamp : register(s1);
 sampler cube_sampler : register(s2);
 
-#define MASK_ID ((1 << 27) - 1)
+#define MASK_ID ((1 << 20) - 1)
 #define MASK_IS_LOADED (1 << 27)
 #define PI 3.14159265358979f
 #define FULLBRIGHT_NITS 200.0f
@@ -290,9 +294,11 @@ void main(uint3 dispatch_thread_id : SV_DispatchThreadID) {
         accumulation_texture[dispatch_thread_id.xy] = float4(0.0, 0.0, 0.0, 0.0);
     }
 
-    // Get normalized screen UV coordinates, from -1.0 to +1.0
-    float2 resolution;
-    output_texture.GetDimensions(resolution.x, resolution.y);
+    ByteAddressBuffer view_data_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.view_data_buffer & MASK_ID)];
+    ViewData view_data = view_data_buffer.Load<ViewData>(root_constants.view_data_buffer_offset);
+
+    // Get normalized screen UV coordinates, from -1.0 to +1.0. Only the top left part of the textures is rendered to
+    const float2 resolution = view_data.render_resolution;
     float2 jitter = 0.0;
     if (root_constants.enable_anti_aliasing) {
         jitter = float2(
@@ -303,8 +309,6 @@ void main(uint3 dispatch_thread_id : SV_DispatchThreadID) {
     float2 uv = ((float2(dispatch_thread_id.xy) + jitter) / resolution) * 2.0 - 1.0;
     
     // Calculate view direction
-    ByteAddressBuffer view_data_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.view_data_buffer & MASK_ID)];
-    ViewData view_data = view_data_buffer.Load<ViewData>(root_constants.view_data_buffer_offset);
     const float3 view_direction_vs = normalize(float3(view_data.viewport_size * float2(uv.x, -uv.y), -1.0f));
     const float3 view_direction_ws = normalize(rotate_vector_by_quaternion(view_direction_vs, view_data.forward));
 
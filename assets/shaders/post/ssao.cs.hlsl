@@ -9,6 +9,8 @@ struct RootConstants {
     uint output_texture;
     uint packet_buffer;
     uint camera_matrices_offset;
+    uint uv_scale_x; // fixed point 65536 = 1.0
+    uint uv_scale_y; // fixed point 65536 = 1.0
 };
 ConstantBuffer<RootConstants> root_constants : register(b0, space0);
 
@@ -17,7 +19,7 @@ struct CameraMatricesPacket {
     float4x4 projection_matrix;
 };
 
-#define MASK_ID ((1 << 27) - 1)
+#define MASK_ID ((1 << 20) - 1)
 #define PI 3.14159265358979f
 
 sampler tex_sampler_clamp : register(s1);
@@ -71,6 +73,7 @@ void main(uint3 dispatch_thread_id : SV_DispatchThreadID) {
     const float radius = float(root_constants.radius) / 65536.0f;
     const float bias = float(root_constants.bias) / 65536.0f;
     const float strength = float(root_constants.strength) / 65536.0f;
+    const float2 uv_scale = float2(root_constants.uv_scale_x, root_constants.uv_scale_y) / 65536.0f;
 
     // Get position and normal of current pixel (worldspace)
     const int frame_index = root_constants.frame_index;
@@ -94,6 +97,7 @@ void main(uint3 dispatch_thread_id : SV_DispatchThreadID) {
         const float2 ndc_sample_pos = clip_sample_pos.xy / clip_sample_pos.w;
         float2 screen_sample_pos = 0.5 * (ndc_sample_pos + 1.0f);
         screen_sample_pos.y = 1.0 - screen_sample_pos.y; // otherwise the sample position will be upside down for some reason
+        screen_sample_pos = saturate(screen_sample_pos) * uv_scale; // only part of the texture is rendered to
 
         // Get a depth sample corresponding to that position
         const float sample_depth = position_texture.Sample(tex_sampler_clamp, screen_sample_pos).z;
@@ -18,7 +18,7 @@ struct SHCoefficients {
 };
 #define sizeof_shcoefficients (9 * 12)
 
-#define MASK_ID ((1 << 27) - 1)
+#define MASK_ID ((1 << 20) - 1)
 #define THREADGROUP_SIZE 128
 
 groupshared SHCoefficients tg_shared_buffer[THREADGROUP_SIZE * 2];
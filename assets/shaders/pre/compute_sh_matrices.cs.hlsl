@@ -19,7 +19,7 @@ struct SHCoefficients {
 };
 #define sizeof_shcoefficients (9 * 12)
 
-#define MASK_ID ((1 << 27) - 1)
+#define MASK_ID ((1 << 20) - 1)
 
 [numthreads(1, 1, 1)]
 void main(uint3 thread_id : SV_DispatchThreadID) {
@@ -17,7 +17,7 @@ struct SHCoefficients {
     float3 l22;
 };
 
-#define MASK_ID ((1 << 27) - 1)
+#define MASK_ID ((1 << 20) - 1)
 #define MASK_IS_LOADED (1 << 27)
 
 sampler cube_sampler : register(s2);
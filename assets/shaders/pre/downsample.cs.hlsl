@@ -8,7 +8,7 @@ struct RootConstants {
 };
 ConstantBuffer<RootConstants> root_constants : register(b0, space0);
 
-#define MASK_ID ((1 << 27) - 1)
+#define MASK_ID ((1 << 20) - 1)
 #define PI 3.14159265358979f
 
 template <typename T>
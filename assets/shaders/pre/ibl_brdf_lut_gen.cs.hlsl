@@ -4,7 +4,7 @@ struct RootConstants {
 };
 ConstantBuffer<RootConstants> root_constants : register(b0, space0);
 
-#define MASK_ID ((1 << 27) - 1)
+#define MASK_ID ((1 << 20) - 1)
 #define PI 3.14159265358979f
 
 // todo: this is duplicated code, might want to put this in a separate file and figure out how to include them in multiple shaders
@@ -27,12 +27,22 @@ struct ViewData {
     Quaternion forward;
     float2 viewport_size;
     float3 camera_world_position;
+    float2 render_resolution;
+    float2 uv_scale;
 };
 
-struct LightCounts {
+struct LightBufferHeader {
     uint n_directional_lights;
     uint n_point_lights;
     uint n_spot_lights;
+    uint directional_lights_offset;
+    uint point_lights_offset;
+    uint spot_lights_offset;
+    uint clusters_offset;
+    uint cluster_light_indices_offset;
+    uint3 cluster_grid_size;
+    float cluster_near;
+    float cluster_far;
 };
 
 struct LightDirectional {
@@ -41,13 +51,35 @@ struct LightDirectional {
     float3 direction;
 };
 
+struct LightPoint {
+    float3 color; // linear 0.0 - 1.0
+    float intensity; // in candela (lm/sr)
+    float3 position; // view space
+    float range;
+};
+
+struct LightSpot {
+    float3 color; // linear 0.0 - 1.0
+    float intensity; // in candela (lm/sr)
+    float3 position; // view space
+    float range;
+    float3 direction; // view space
+    float inner_cone_angle;
+    float outer_cone_angle;
+};
+
+struct LightCluster {
+    uint offset;
+    uint count;
+};
+
 struct SphericalHarmonicsMatrices {
     float4x4 r;
     float4x4 g;
     float4x4 b;
 };
 
-#define MASK_ID ((1 << 27) - 1)
+#define MASK_ID ((1 << 20) - 1)
 #define MASK_IS_LOADED (1 << 27)
 #define PI 3.14159265358979f
 #define FULLBRIGHT_NITS 200.0f
@@ -103,6 +135,28 @@ float3 mix(float3 x, float3 y, float a) {
     return x * (1-a) + y * a;
 }
 
+// Inverse square falloff, windowed so it smoothly reaches zero at the light's range, like KHR_lights_punctual suggests
+float distance_attenuation(float distance_squared, float range) {
+    float ratio = distance_squared / (range * range);
+    float window = saturate(1.0f - ratio * ratio);
+    return (window * window) / max(distance_squared, 0.0001f);
+}
+
+// `light_dir` points from the surface towards the light, `radiance` is the light arriving at the surface
+void add_light(float3 light_dir, float3 radiance, float3 normal, float3 view_direction_vs, float3 albedo, float roughness, float n_dot_v, float3 f, inout float3 diffuse, inout float3 specular) {
+    float n_dot_l = dot(normal, light_dir);
+    if (n_dot_l <= 0.0f) return;
+
+    diffuse += albedo * n_dot_l * radiance / PI;
+
+    float remapped_roughness = (roughness + 0.1f) / 1.1f;
+    const float3 h = normalize(-view_direction_vs + light_dir);
+    const float n_dot_h = saturate(dot(normal, h));
+    const float d = distribution_ggx(n_dot_h, remapped_roughness);
+    const float g = geometry_smith(n_dot_v, n_dot_l, (remapped_roughness + 1.0f) / 2.0f);
+    specular += radiance * (d * g * f) / (0.0001f + (4.0f * n_dot_l * n_dot_v)) * n_dot_l;
+}
+
 sampler tex_sampler : register(s0);
 sampler tex_sampler_clamp : register(s1);
 sampler cube_sampler : register(s2);
@@ -112,6 +166,7 @@ void main(uint3 dispatch_thread_id : SV_DispatchThreadID) {
     float3 out_value = float3(0.0, 0.0, 0.0);
     
     RWTexture2D<float4> output_texture = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.output_texture & MASK_ID)];
+    Texture2D<float4> position_texture = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.position_texture & MASK_ID)]; // view space
     Texture2D<float4> color_texture = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.color_texture & MASK_ID)];
     Texture2D<float4> normal_texture = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.normal_texture & MASK_ID)]; // view space
     Texture2D<float4> metal_roughness_texture = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.metal_roughness_texture & MASK_ID)];
@@ -120,14 +175,14 @@ void main(uint3 dispatch_thread_id : SV_DispatchThreadID) {
     Texture2D<float2> env_brdf_lut = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.env_brdf_lut & MASK_ID)];
     float4 color = color_texture[dispatch_thread_id.xy];
 
-    // Get normalized screen UV coordinates, from -1.0 to +1.0
-    float2 resolution;
-    color_texture.GetDimensions(resolution.x, resolution.y);
+    ByteAddressBuffer view_data_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.view_data_buffer & MASK_ID)];
+    ViewData view_data = view_data_buffer.Load<ViewData>(root_constants.view_data_buffer_offset);
+
+    // Get normalized screen UV coordinates, from -1.0 to +1.0. Only the top left part of the textures is rendered to
+    const float2 resolution = view_data.render_resolution;
     float2 uv = ((float2(dispatch_thread_id.xy) + 0.5) / resolution) * 2.0 - 1.0;
 
     // Calculate view direction
-    ByteAddressBuffer view_data_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.view_data_buffer & MASK_ID)];
-    ViewData view_data = view_data_buffer.Load<ViewData>(root_constants.view_data_buffer_offset);
     const float3 view_direction_vs = normalize(float3(view_data.viewport_size * float2(uv.x, -uv.y), -1.0f));
     const float3 view_direction_ws = rotate_vector_by_quaternion(view_direction_vs, view_data.forward);
     
@@ -146,6 +201,7 @@ void main(uint3 dispatch_thread_id : SV_DispatchThreadID) {
         return;
     }
     
+    float3 position = position_texture[dispatch_thread_id.xy].xyz;
     float3 normal = normal_texture[dispatch_thread_id.xy].xyz;
     float3 emission = emissive_texture[dispatch_thread_id.xy];
     float ssao = ssao_texture[dispatch_thread_id.xy];
@@ -154,10 +210,9 @@ void main(uint3 dispatch_thread_id : SV_DispatchThreadID) {
     float roughness = max(0.05f, pow(metal_roughness.g, 1.0f / 2.2f));
     
     // Get light buffer
-    ByteAddressBuffer packet_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.lights_buffer & MASK_ID)];
-    LightCounts light_counts = packet_buffer.Load<LightCounts>(0);
+    ByteAddressBuffer lights_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.lights_buffer & MASK_ID)];
+    LightBufferHeader lights = lights_buffer.Load<LightBufferHeader>(0);
     
-    // Process all directional lights
     float3 f0 = mix(0.04f, color.rgb, metallic);
     float3 reflect_dir = reflect(view_direction_vs, normal);
     float3 half_vector = normalize(-view_direction_vs + reflect_dir);
@@ -171,20 +226,44 @@ void main(uint3 dispatch_thread_id : SV_DispatchThreadID) {
     float3 diffuse = float3(0.0f, 0.0f, 0.0f);
     float3 specular = float3(0.0f, 0.0f, 0.0f);
     
+    // Process all directional lights
     const float3 f = specular_f;
-    for (int i = 0; i < light_counts.n_directional_lights; i++) {
-        LightDirectional light = packet_buffer.Load<LightDirectional>(12 + (28 * i));
-        float n_dot_l = dot(normal, -light.direction);
-        if (n_dot_l <= 0.0f) continue;
-        
-        diffuse += color.xyz * n_dot_l * light.intensity / PI;
-
-        float remapped_roughness = (roughness + 0.1f) / 1.1f;
-        const float3 h = normalize(-view_direction_vs + -light.direction);
-        const float n_dot_h = saturate(dot(normal, h));
-        const float d = distribution_ggx(n_dot_h, remapped_roughness);
-        const float g = geometry_smith(n_dot_v, n_dot_l, (remapped_roughness + 1.0f) / 2.0f);
-        specular += light.intensity * light.color * (d * g * f) / (0.0001f + (4.0f * n_dot_l * n_dot_v)) * n_dot_l;
+    for (uint i = 0; i < lights.n_directional_lights; i++) {
+        LightDirectional light = lights_buffer.Load<LightDirectional>(lights.directional_lights_offset + (28 * i));
+        add_light(-light.direction, light.color * light.intensity, normal, view_direction_vs, color.rgb, roughness, n_dot_v, f, diffuse, specular);
+    }
+
+    // Find the cluster this pixel is in, and only process the point and spot lights that were binned into it
+    const float depth = -position.z;
+    uint3 cluster_id;
+    cluster_id.xy = min((uint2)(float2(dispatch_thread_id.xy) / resolution * float2(lights.cluster_grid_size.xy)), lights.cluster_grid_size.xy - 1);
+    cluster_id.z = (depth < lights.cluster_near) 
+        ? 0 
+        : min(lights.cluster_grid_size.z - 1, 1 + (uint)floor(log(depth / lights.cluster_near) * (float)(lights.cluster_grid_size.z - 1) / log(lights.cluster_far / lights.cluster_near)));
+    const uint cluster_index = cluster_id.x + (cluster_id.y * lights.cluster_grid_size.x) + (cluster_id.z * lights.cluster_grid_size.x * lights.cluster_grid_size.y);
+    LightCluster cluster = lights_buffer.Load<LightCluster>(lights.clusters_offset + (8 * cluster_index));
+
+    for (uint i = 0; i < cluster.count; i++) {
+        const uint light_index = lights_buffer.Load(lights.cluster_light_indices_offset + (4 * (cluster.offset + i)));
+        if (light_index < lights.n_point_lights) {
+            LightPoint light = lights_buffer.Load<LightPoint>(lights.point_lights_offset + (32 * light_index));
+            const float3 to_light = light.position - position;
+            const float distance_squared = dot(to_light, to_light);
+            const float attenuation = distance_attenuation(distance_squared, light.range);
+            add_light(to_light * rsqrt(distance_squared), light.color * light.intensity * attenuation, normal, view_direction_vs, color.rgb, roughness, n_dot_v, f, diffuse, specular);
+        }
+        else {
+            LightSpot light = lights_buffer.Load<LightSpot>(lights.spot_lights_offset + (52 * (light_index - lights.n_point_lights)));
+            const float3 to_light = light.position - position;
+            const float distance_squared = dot(to_light, to_light);
+            const float3 light_dir = to_light * rsqrt(distance_squared);
+            const float cos_outer = cos(light.outer_cone_angle);
+            const float cos_inner = cos(light.inner_cone_angle);
+            float cone = saturate((dot(light.direction, -light_dir) - cos_outer) / max(cos_inner - cos_outer, 0.0001f));
+            cone *= cone;
+            const float attenuation = distance_attenuation(distance_squared, light.range) * cone;
+            add_light(light_dir, light.color * light.intensity * attenuation, normal, view_direction_vs, color.rgb, roughness, n_dot_v, f, diffuse, specular);
+        }
     }
     
     // Add emission - The glTF spec has this to say about emissive textures:
@@ -1,5 +1,7 @@
 struct ResourceHandle {
-    uint id: 27;
+    uint id: 20;
+    uint generation: 6;
+    uint is_cpu_only: 1;
     uint is_loaded: 1;
     uint type: 4;
 };
@@ -17,8 +19,9 @@ struct CameraMatricesPacket {
 };
 
 struct RootConstants {
-    uint packet_buffer;
+    uint camera_matrices_buffer;
     uint camera_matrices_offset;
+    uint draw_mesh_packet_buffer;
     uint draw_mesh_packet_offset;
     uint material_buffer;
 };
@@ -57,10 +60,10 @@ struct Material {
 
 sampler tex_sampler : register(s0);
 
-#define MASK_ID ((1 << 27) - 1)
+#define MASK_ID ((1 << 20) - 1)
 
 PixelOut main(in float4 position : SV_Position, in VertexOut input) {
-    ByteAddressBuffer packet_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.packet_buffer & MASK_ID)];
+    ByteAddressBuffer packet_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.draw_mesh_packet_buffer & MASK_ID)];
     DrawMeshPacket packet = packet_buffer.Load<DrawMeshPacket>(root_constants.draw_mesh_packet_offset);
 
     PixelOut output;
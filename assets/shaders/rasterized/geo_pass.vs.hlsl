@@ -28,7 +28,9 @@ struct VertexCompressed {
 };
 
 struct ResourceHandle {
-    uint id: 27;
+    uint id: 20;
+    uint generation: 6;
+    uint is_cpu_only: 1;
     uint is_loaded: 1;
     uint type: 4;
 };
@@ -46,10 +48,13 @@ struct CameraMatricesPacket {
 };
 
 struct RootConstants {
-    ResourceHandle packet_buffer;
+    ResourceHandle camera_matrices_buffer;
     uint camera_matrices_offset;
+    ResourceHandle draw_mesh_packet_buffer;
     uint draw_mesh_packet_offset;
     ResourceHandle material_buffer;
+    ResourceHandle instance_transforms_buffer;
+    uint instance_transforms_offset;
 };
 ConstantBuffer<RootConstants> root_constants : register(b0, space0);
 
@@ -62,10 +67,15 @@ struct VertexOut {
     float3 texcoord0_materialid : TEXCOORD0;
 };
 
-float4 main(in uint vertex_index : SV_VertexID, out VertexOut output) : SV_POSITION {
-    ByteAddressBuffer packet_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.packet_buffer.id)];
-    DrawMeshPacket draw_packet = packet_buffer.Load<DrawMeshPacket>(root_constants.draw_mesh_packet_offset);
-    CameraMatricesPacket camera_matrices = packet_buffer.Load<CameraMatricesPacket>(root_constants.camera_matrices_offset);
+float4 main(in uint vertex_index : SV_VertexID, in uint instance_index : SV_InstanceID, out VertexOut output) : SV_POSITION {
+    // These can all live in different draw packet pages
+    ByteAddressBuffer draw_mesh_packet_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.draw_mesh_packet_buffer.id)];
+    ByteAddressBuffer camera_matrices_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.camera_matrices_buffer.id)];
+    ByteAddressBuffer instance_transforms_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(root_constants.instance_transforms_buffer.id)];
+    DrawMeshPacket draw_packet = draw_mesh_packet_buffer.Load<DrawMeshPacket>(root_constants.draw_mesh_packet_offset);
+    CameraMatricesPacket camera_matrices = camera_matrices_buffer.Load<CameraMatricesPacket>(root_constants.camera_matrices_offset);
+    float4x4 instance_transform = instance_transforms_buffer.Load<float4x4>(root_constants.instance_transforms_offset + instance_index * 64);
+    float4x4 model_transform = mul(instance_transform, draw_packet.model_transform);
 
     ByteAddressBuffer vertex_buffer = ResourceDescriptorHeap[NonUniformResourceIndex(draw_packet.vertex_buffer.id)];
     VertexCompressed vert_compressed = vertex_buffer.Load<VertexCompressed>(vertex_index * sizeof(VertexCompressed));
@@ -87,15 +97,15 @@ float4 main(in uint vertex_index : SV_VertexID, out VertexOut output) : SV_POSIT
     vert.color.a = (float) vert_compressed.color_a / 1023.0f;
     vert.texcoord0 = vert_compressed.texcoord0;
     
-    float4 vert_pos = mul(draw_packet.model_transform, float4(vert.position, 1));
+    float4 vert_pos = mul(model_transform, float4(vert.position, 1));
     vert_pos = mul(camera_matrices.view_matrix, vert_pos);
     output.position = vert_pos.xyz;
     vert_pos = mul(camera_matrices.projection_matrix, vert_pos);
     
     output.color = vert.color;
-    output.normal = normalize(mul((float3x3)draw_packet.model_transform, vert.normal));
+    output.normal = normalize(mul((float3x3)model_transform, vert.normal));
     output.normal = normalize(mul((float3x3)camera_matrices.view_matrix, output.normal));
-    output.tangent.xyz = normalize(mul((float3x3)draw_packet.model_transform, vert.tangent.xyz));
+    output.tangent.xyz = normalize(mul((float3x3)model_transform, vert.tangent.xyz));
     output.tangent.xyz = normalize(mul((float3x3)camera_matrices.view_matrix, output.tangent.xyz));
     output.bitangent = cross(output.normal.xyz, output.tangent.xyz) * vert.tangent.w;
     output.texcoord0_materialid.xy = vert.texcoord0;
@@ -0,0 +1,80 @@
+#include "allocation_tracker.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace gfx::allocation_tracker {
+    static thread_local bool is_tracking = false;
+    static thread_local uint64_t n_allocations = 0;
+
+    void begin_scope() {
+        n_allocations = 0;
+        is_tracking = true;
+    }
+
+    uint64_t end_scope() {
+        is_tracking = false;
+        return n_allocations;
+    }
+
+#if TRACK_FRAME_ALLOCATIONS
+    static void* tracked_alloc(size_t size, size_t alignment) {
+        if (is_tracking) ++n_allocations;
+        if (size == 0) size = 1;
+#ifdef _WIN32
+        void* ptr = _aligned_malloc(size, alignment);
+#else
+        void* ptr = std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+#endif
+        return ptr;
+    }
+
+    static void tracked_free(void* ptr) {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        std::free(ptr);
+#endif
+    }
+#endif
+}
+
+#if TRACK_FRAME_ALLOCATIONS
+// Every allocation goes through the aligned allocator, so all the delete overloads can free the same way
+void* operator new(size_t size) {
+    void* ptr = gfx::allocation_tracker::tracked_alloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+void* operator new[](size_t size) {
+    void* ptr = gfx::allocation_tracker::tracked_alloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+    void* ptr = gfx::allocation_tracker::tracked_alloc(size, (size_t)alignment);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+    void* ptr = gfx::allocation_tracker::tracked_alloc(size, (size_t)alignment);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return gfx::allocation_tracker::tracked_alloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return gfx::allocation_tracker::tracked_alloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void operator delete(void* ptr) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+void operator delete[](void* ptr) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { gfx::allocation_tracker::tracked_free(ptr); }
+#endif
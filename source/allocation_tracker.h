@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+
+// When enabled, replaces the global `operator new` to count heap allocations, so the renderer can check that a frame
+// doesn't allocate anything once it's warmed up. Enable it with the `TRACK_FRAME_ALLOCATIONS` CMake option.
+#ifndef TRACK_FRAME_ALLOCATIONS
+#define TRACK_FRAME_ALLOCATIONS 0
+#endif
+
+namespace gfx::allocation_tracker {
+    // Starts counting allocations made by the calling thread. Other threads are not counted
+    void begin_scope();
+
+    // Stops counting, and returns the number of allocations since `begin_scope()`. Always returns 0 if tracking is disabled
+    uint64_t end_scope();
+}
@@ -0,0 +1,500 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <glm/glm.hpp>
+#include "bvh_packet_kernels.h"
+#include "wide_bvh.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+#define BVH_MAX_DEPTH 64 // Also the size of the traversal stack
+#define BVH_MAX_LEAF_SIZE 16 // Nodes with more triangles than this get split, even if SAH thinks that's worse
+#define BVH_MAX_BINS 64
+#define BVH_MIN_PARALLEL_BATCH 1024 // Fewer triangles than this per batch isn't worth waking up a thread for
+
+namespace gfx {
+    struct Bin {
+        BvhBounds bounds;
+        uint32_t count = 0;
+    };
+
+    struct Split {
+        int axis = -1; // -1 if there's no split that's better than making a leaf
+        uint32_t bin = 0; // Triangles in bins below this one go left
+        float cost = INFINITY;
+    };
+
+    struct BuildTask {
+        uint32_t node_index;
+        uint32_t first;
+        uint32_t count;
+        uint32_t depth;
+    };
+
+    // Per-primitive data that's only needed while building
+    struct BuildContext {
+        const BvhBuildSettings& settings;
+        ThreadPool* thread_pool;
+        const BvhBounds* bounds;
+        std::vector<glm::vec3> centroids;
+        std::vector<uint32_t> indices; // Partitioned in place, ends up in leaf order
+
+        void compute_bounds(uint32_t first, uint32_t count, BvhBounds& node_bounds, BvhBounds& centroid_bounds) const {
+            for (uint32_t i = first; i < first + count; ++i) {
+                node_bounds.grow(bounds[indices[i]]);
+                centroid_bounds.grow(centroids[indices[i]]);
+            }
+        }
+
+        uint32_t bin_index(glm::vec3 centroid, int axis, const BvhBounds& centroid_bounds) const {
+            const float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+            const float scale = (float)settings.n_bins / extent;
+            const uint32_t bin = (uint32_t)((centroid[axis] - centroid_bounds.min[axis]) * scale);
+            return std::min(bin, settings.n_bins - 1);
+        }
+
+        // `bins` has room for `n_bins` per axis
+        void bin_primitives(uint32_t first, uint32_t count, const BvhBounds& centroid_bounds, Bin* bins) const {
+            for (uint32_t i = first; i < first + count; ++i) {
+                const uint32_t index = indices[i];
+                for (int axis = 0; axis < 3; ++axis) {
+                    if (centroid_bounds.max[axis] <= centroid_bounds.min[axis]) continue;
+                    Bin& bin = bins[axis * settings.n_bins + bin_index(centroids[index], axis, centroid_bounds)];
+                    bin.bounds.grow(bounds[index]);
+                    bin.count++;
+                }
+            }
+        }
+
+        // Sweeps over the bins from both sides to find the plane with the lowest surface area heuristic cost
+        Split find_split(const Bin* bins, const BvhBounds& node_bounds, uint32_t count) const {
+            const uint32_t n_bins = settings.n_bins;
+            const float inv_area = 1.0f / std::max(node_bounds.area(), 1e-30f);
+            Split best;
+            for (int axis = 0; axis < 3; ++axis) {
+                const Bin* axis_bins = &bins[axis * n_bins];
+                float right_cost[BVH_MAX_BINS];
+                BvhBounds right_bounds;
+                uint32_t right_count = 0;
+                for (uint32_t i = n_bins - 1; i > 0; --i) {
+                    right_bounds.grow(axis_bins[i].bounds);
+                    right_count += axis_bins[i].count;
+                    right_cost[i] = right_bounds.area() * (float)right_count;
+                }
+
+                BvhBounds left_bounds;
+                uint32_t left_count = 0;
+                for (uint32_t i = 1; i < n_bins; ++i) {
+                    left_bounds.grow(axis_bins[i - 1].bounds);
+                    left_count += axis_bins[i - 1].count;
+                    if (left_count == 0 || left_count == count) continue;
+                    const float cost = settings.traversal_cost + (left_bounds.area() * (float)left_count + right_cost[i]) * inv_area;
+                    if (cost < best.cost) {
+                        best = { axis, i, cost };
+                    }
+                }
+            }
+            return best;
+        }
+    };
+
+    static void set_leaf(BvhNode& node, uint32_t first, uint32_t count) {
+        node.left_first = first;
+        node.count = count;
+    }
+
+    // Partitions the node's primitives and returns how many went left, or 0 if it should be a leaf
+    static uint32_t split_node(BuildContext& context, uint32_t first, uint32_t count, uint32_t depth, const BvhBounds& node_bounds, const BvhBounds& centroid_bounds, const Bin* bins) {
+        const BvhBuildSettings& settings = context.settings;
+        if (count <= settings.max_leaf_size || depth + 1 >= BVH_MAX_DEPTH) return 0;
+
+        const glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+        const int longest_axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+        uint32_t* begin = context.indices.data() + first;
+        uint32_t* end = begin + count;
+
+        // Every centroid is in the same spot, so no plane can separate them. Split them in half, if it's too many for one leaf
+        if (extent[longest_axis] <= 0.0f) {
+            return (count > BVH_MAX_LEAF_SIZE) ? count / 2 : 0;
+        }
+
+        if (settings.split_method == BvhSplitMethod::median) {
+            std::nth_element(begin, begin + count / 2, end, [&](uint32_t a, uint32_t b) {
+                return context.centroids[a][longest_axis] < context.centroids[b][longest_axis];
+            });
+            return count / 2;
+        }
+
+        // Only split if it's cheaper than intersecting every triangle, unless the leaf would get too big
+        const Split split = context.find_split(bins, node_bounds, count);
+        const float leaf_cost = (float)count;
+        if (split.axis == -1 || (split.cost >= leaf_cost && count <= BVH_MAX_LEAF_SIZE)) {
+            if (count <= BVH_MAX_LEAF_SIZE) return 0;
+            std::nth_element(begin, begin + count / 2, end, [&](uint32_t a, uint32_t b) {
+                return context.centroids[a][longest_axis] < context.centroids[b][longest_axis];
+            });
+            return count / 2;
+        }
+
+        const uint32_t* middle = std::partition(begin, end, [&](uint32_t index) {
+            return context.bin_index(context.centroids[index], split.axis, centroid_bounds) < split.bin;
+        });
+        const uint32_t n_left = (uint32_t)(middle - begin);
+        return (n_left == 0 || n_left == count) ? count / 2 : n_left;
+    }
+
+    // Builds a whole subtree on the calling thread. `nodes[node_index]` has to exist already
+    static void build_recursive(BuildContext& context, std::vector<BvhNode>& nodes, uint32_t node_index, uint32_t first, uint32_t count, uint32_t depth, Bin* bins) {
+        BvhBounds node_bounds, centroid_bounds;
+        context.compute_bounds(first, count, node_bounds, centroid_bounds);
+        nodes[node_index].min = node_bounds.min;
+        nodes[node_index].max = node_bounds.max;
+
+        if (context.settings.split_method == BvhSplitMethod::binned_sah && count > context.settings.max_leaf_size) {
+            std::fill(bins, bins + 3 * context.settings.n_bins, Bin{});
+            context.bin_primitives(first, count, centroid_bounds, bins);
+        }
+        const uint32_t n_left = split_node(context, first, count, depth, node_bounds, centroid_bounds, bins);
+        if (n_left == 0) {
+            set_leaf(nodes[node_index], first, count);
+            return;
+        }
+
+        const uint32_t left = (uint32_t)nodes.size();
+        nodes.emplace_back();
+        nodes.emplace_back();
+        nodes[node_index].left_first = left;
+        nodes[node_index].count = 0;
+        build_recursive(context, nodes, left, first, n_left, depth + 1, bins);
+        build_recursive(context, nodes, left + 1, first + n_left, count - n_left, depth + 1, bins);
+    }
+
+    // Same as one step of `build_recursive()`, but the bounds and bins are computed by all threads together.
+    // Returns how many triangles went left, or 0 if the node became a leaf
+    static uint32_t split_node_parallel(BuildContext& context, BvhNode& node, const BuildTask& task) {
+        ThreadPool& thread_pool = *context.thread_pool;
+        const uint32_t n_threads = thread_pool.n_threads();
+        const uint32_t n_bins = context.settings.n_bins;
+        const uint32_t batch_size = std::max(task.count / (n_threads * 4), (uint32_t)BVH_MIN_PARALLEL_BATCH);
+
+        auto thread_bounds = std::make_unique<BvhBounds[]>(n_threads * 2);
+        thread_pool.parallel_for(task.count, batch_size, [&](uint32_t begin, uint32_t end, uint32_t thread_index) {
+            context.compute_bounds(task.first + begin, end - begin, thread_bounds[thread_index * 2 + 0], thread_bounds[thread_index * 2 + 1]);
+        });
+        BvhBounds node_bounds, centroid_bounds;
+        for (uint32_t i = 0; i < n_threads; ++i) {
+            node_bounds.grow(thread_bounds[i * 2 + 0]);
+            centroid_bounds.grow(thread_bounds[i * 2 + 1]);
+        }
+        node.min = node_bounds.min;
+        node.max = node_bounds.max;
+
+        auto bins = std::make_unique<Bin[]>(n_threads * 3 * n_bins);
+        if (context.settings.split_method == BvhSplitMethod::binned_sah) {
+            thread_pool.parallel_for(task.count, batch_size, [&](uint32_t begin, uint32_t end, uint32_t thread_index) {
+                context.bin_primitives(task.first + begin, end - begin, centroid_bounds, &bins[thread_index * 3 * n_bins]);
+            });
+            for (uint32_t t = 1; t < n_threads; ++t) {
+                for (uint32_t i = 0; i < 3 * n_bins; ++i) {
+                    bins[i].bounds.grow(bins[t * 3 * n_bins + i].bounds);
+                    bins[i].count += bins[t * 3 * n_bins + i].count;
+                }
+            }
+        }
+        return split_node(context, task.first, task.count, task.depth, node_bounds, centroid_bounds, bins.get());
+    }
+
+    void build_bvh_nodes(const BvhBounds* bounds, uint32_t n_primitives, const BvhBuildSettings& settings_, ThreadPool* thread_pool, std::vector<BvhNode>& nodes, std::vector<uint32_t>& primitive_indices) {
+        BvhBuildSettings settings = settings_;
+        settings.n_bins = glm::clamp(settings.n_bins, 2u, (uint32_t)BVH_MAX_BINS);
+        settings.max_leaf_size = glm::clamp(settings.max_leaf_size, 1u, (uint32_t)BVH_MAX_LEAF_SIZE);
+        nodes.clear();
+
+        BuildContext context = { settings, thread_pool, bounds };
+        context.centroids.resize(n_primitives);
+        context.indices.resize(n_primitives);
+        auto prepare = [&](uint32_t begin, uint32_t end, uint32_t) {
+            for (uint32_t i = begin; i < end; ++i) {
+                context.centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+                context.indices[i] = i;
+            }
+        };
+        if (thread_pool) thread_pool->parallel_for(n_primitives, BVH_MIN_PARALLEL_BATCH * 4, prepare);
+        else prepare(0, n_primitives, 0);
+
+        nodes.reserve(std::max(n_primitives * 2, 1u));
+        nodes.emplace_back();
+        if (n_primitives == 0) {
+            nodes[0] = { glm::vec3(0.0f), 0, glm::vec3(0.0f), 0 };
+            primitive_indices.clear();
+            return;
+        }
+
+        // Split the big nodes at the top with all threads working on the same node. Once they're small enough, there's
+        // enough of them to give every thread its own subtree
+        std::vector<BuildTask> subtrees;
+        if (thread_pool && thread_pool->n_threads() > 1) {
+            std::vector<BuildTask> pending = { { 0, 0, n_primitives, 0 } };
+            while (!pending.empty()) {
+                const BuildTask task = pending.back();
+                pending.pop_back();
+                if (task.count < settings.parallel_threshold) {
+                    subtrees.push_back(task);
+                    continue;
+                }
+                const uint32_t n_left = split_node_parallel(context, nodes[task.node_index], task);
+                if (n_left == 0) {
+                    set_leaf(nodes[task.node_index], task.first, task.count);
+                    continue;
+                }
+                const uint32_t left = (uint32_t)nodes.size();
+                nodes.emplace_back();
+                nodes.emplace_back();
+                nodes[task.node_index].left_first = left;
+                nodes[task.node_index].count = 0;
+                pending.push_back({ left, task.first, n_left, task.depth + 1 });
+                pending.push_back({ left + 1, task.first + n_left, task.count - n_left, task.depth + 1 });
+            }
+        }
+        else {
+            subtrees.push_back({ 0, 0, n_primitives, 0 });
+        }
+
+        // Every subtree gets built into its own node list, and those get stitched onto the end afterwards. The subtree's root
+        // replaces the node that was already allocated for it
+        std::vector<std::vector<BvhNode>> subtree_nodes(subtrees.size());
+        auto build_subtrees = [&](uint32_t begin, uint32_t end, uint32_t) {
+            auto bins = std::make_unique<Bin[]>(3 * settings.n_bins);
+            for (uint32_t i = begin; i < end; ++i) {
+                subtree_nodes[i].reserve(subtrees[i].count * 2);
+                subtree_nodes[i].emplace_back();
+                build_recursive(context, subtree_nodes[i], 0, subtrees[i].first, subtrees[i].count, subtrees[i].depth, bins.get());
+            }
+        };
+        if (thread_pool && subtrees.size() > 1) thread_pool->parallel_for((uint32_t)subtrees.size(), 1, build_subtrees);
+        else build_subtrees(0, (uint32_t)subtrees.size(), 0);
+
+        for (size_t i = 0; i < subtrees.size(); ++i) {
+            const std::vector<BvhNode>& local_nodes = subtree_nodes[i];
+            const uint32_t offset = (uint32_t)nodes.size() - 1; // Local node 1 goes to `nodes.size()`
+            for (size_t j = 0; j < local_nodes.size(); ++j) {
+                BvhNode node = local_nodes[j];
+                if (node.count == 0) node.left_first += offset;
+                if (j == 0) nodes[subtrees[i].node_index] = node;
+                else nodes.push_back(node);
+            }
+        }
+        primitive_indices = std::move(context.indices);
+    }
+
+    void refit_bvh_nodes(std::vector<BvhNode>& nodes, const std::vector<uint32_t>& primitive_indices, const BvhBounds* bounds) {
+        // Children always come after their parent, so going backwards visits them first
+        for (size_t i = nodes.size(); i-- > 0;) {
+            BvhNode& node = nodes[i];
+            BvhBounds node_bounds;
+            if (node.count > 0) {
+                for (uint32_t j = node.left_first; j < node.left_first + node.count; ++j) {
+                    node_bounds.grow(bounds[primitive_indices[j]]);
+                }
+            }
+            else {
+                node_bounds.grow({ nodes[node.left_first].min, nodes[node.left_first].max });
+                node_bounds.grow({ nodes[node.left_first + 1].min, nodes[node.left_first + 1].max });
+            }
+            node.min = node_bounds.min;
+            node.max = node_bounds.max;
+        }
+    }
+
+    void Bvh::build(const glm::vec3* positions, uint32_t n_triangles, const BvhBuildSettings& settings, ThreadPool* thread_pool) {
+        PROFILE_ZONE("Bvh::build");
+        m_traversal_cost = settings.traversal_cost;
+        m_triangles.clear();
+
+        std::vector<BvhBounds> bounds(n_triangles);
+        auto compute_bounds = [&](uint32_t begin, uint32_t end, uint32_t) {
+            for (uint32_t i = begin; i < end; ++i) {
+                bounds[i] = {};
+                bounds[i].grow(positions[i * 3 + 0]);
+                bounds[i].grow(positions[i * 3 + 1]);
+                bounds[i].grow(positions[i * 3 + 2]);
+            }
+        };
+        if (thread_pool) thread_pool->parallel_for(n_triangles, BVH_MIN_PARALLEL_BATCH * 4, compute_bounds);
+        else compute_bounds(0, n_triangles, 0);
+        build_bvh_nodes(bounds.data(), n_triangles, settings, thread_pool, m_nodes, m_triangle_indices);
+
+        // Store the triangles in leaf order, so the leaves don't need an extra indirection
+        m_triangles.resize(n_triangles);
+        for (uint32_t i = 0; i < n_triangles; ++i) {
+            const glm::vec3* triangle = &positions[m_triangle_indices[i] * 3];
+            m_triangles[i] = { triangle[0], triangle[1] - triangle[0], triangle[2] - triangle[0] };
+        }
+    }
+
+    static float intersect_box(const BvhNode& node, glm::vec3 origin, glm::vec3 inv_direction, float t_min, float t_max) {
+        const glm::vec3 t0 = (node.min - origin) * inv_direction;
+        const glm::vec3 t1 = (node.max - origin) * inv_direction;
+        const glm::vec3 t_near = glm::min(t0, t1);
+        const glm::vec3 t_far = glm::max(t0, t1);
+        const float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, t_min));
+        const float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, t_max));
+        return (enter <= exit) ? enter : INFINITY;
+    }
+
+    // Möller-Trumbore, without culling
+    static bool intersect_triangle(glm::vec3 v0, glm::vec3 edge1, glm::vec3 edge2, glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, float& t, glm::vec2& barycentrics) {
+        const glm::vec3 p = glm::cross(direction, edge2);
+        const float det = glm::dot(edge1, p);
+        if (fabsf(det) < 1e-12f) return false;
+        const float inv_det = 1.0f / det;
+        const glm::vec3 s = origin - v0;
+        const float u = glm::dot(s, p) * inv_det;
+        if (u < 0.0f || u > 1.0f) return false;
+        const glm::vec3 q = glm::cross(s, edge1);
+        const float v = glm::dot(direction, q) * inv_det;
+        if (v < 0.0f || u + v > 1.0f) return false;
+        t = glm::dot(edge2, q) * inv_det;
+        if (t < t_min || t >= t_max) return false;
+        barycentrics = glm::vec2(u, v);
+        return true;
+    }
+
+    bool Bvh::intersect_closest(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, BvhHit& hit) const {
+        if (m_triangles.empty()) return false;
+        const glm::vec3 inv_direction = 1.0f / direction;
+        if (intersect_box(m_nodes[0], origin, inv_direction, t_min, t_max) == INFINITY) return false;
+
+        bool found_hit = false;
+        uint32_t stack[BVH_MAX_DEPTH];
+        uint32_t stack_size = 0;
+        uint32_t node_index = 0;
+        while (true) {
+            const BvhNode& node = m_nodes[node_index];
+            if (node.count > 0) {
+                for (uint32_t i = node.left_first; i < node.left_first + node.count; ++i) {
+                    const BvhTriangle& tri = m_triangles[i];
+                    float t;
+                    glm::vec2 barycentrics;
+                    if (intersect_triangle(tri.v0, tri.edge1, tri.edge2, origin, direction, t_min, t_max, t, barycentrics)) {
+                        t_max = t;
+                        hit = { t, barycentrics, i };
+                        found_hit = true;
+                    }
+                }
+            }
+            else {
+                // Visit the closest child first, and only push the other one if the ray hits it at all
+                const uint32_t left = node.left_first;
+                const float t_left = intersect_box(m_nodes[left], origin, inv_direction, t_min, t_max);
+                const float t_right = intersect_box(m_nodes[left + 1], origin, inv_direction, t_min, t_max);
+                if (t_left != INFINITY || t_right != INFINITY) {
+                    const bool left_first = t_left <= t_right;
+                    if (std::max(t_left, t_right) != INFINITY) stack[stack_size++] = left_first ? left + 1 : left;
+                    node_index = left_first ? left : left + 1;
+                    continue;
+                }
+            }
+
+            // Pop until we find a node that's still in front of the closest hit
+            bool found_node = false;
+            while (stack_size > 0) {
+                node_index = stack[--stack_size];
+                if (intersect_box(m_nodes[node_index], origin, inv_direction, t_min, t_max) != INFINITY) {
+                    found_node = true;
+                    break;
+                }
+            }
+            if (!found_node) break;
+        }
+
+        if (found_hit) hit.triangle_index = m_triangle_indices[hit.triangle_index];
+        return found_hit;
+    }
+
+    bool Bvh::intersect_any(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) const {
+        if (m_triangles.empty()) return false;
+        const glm::vec3 inv_direction = 1.0f / direction;
+        if (intersect_box(m_nodes[0], origin, inv_direction, t_min, t_max) == INFINITY) return false;
+
+        // Order doesn't matter here, any hit will do
+        uint32_t stack[BVH_MAX_DEPTH];
+        uint32_t stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const BvhNode& node = m_nodes[stack[--stack_size]];
+            if (node.count > 0) {
+                for (uint32_t i = node.left_first; i < node.left_first + node.count; ++i) {
+                    const BvhTriangle& tri = m_triangles[i];
+                    float t;
+                    glm::vec2 barycentrics;
+                    if (intersect_triangle(tri.v0, tri.edge1, tri.edge2, origin, direction, t_min, t_max, t, barycentrics)) return true;
+                }
+                continue;
+            }
+            const uint32_t left = node.left_first;
+            if (intersect_box(m_nodes[left], origin, inv_direction, t_min, t_max) != INFINITY) stack[stack_size++] = left;
+            if (intersect_box(m_nodes[left + 1], origin, inv_direction, t_min, t_max) != INFINITY) stack[stack_size++] = left + 1;
+        }
+        return false;
+    }
+
+    void Bvh::intersect_packet(RayPacket& packet, bool any_hit) const {
+        packet.hit = 0;
+        if (m_triangles.empty() || packet.active == 0) return;
+#if WIDE_BVH_X86
+        const SimdIsa isa = detect_simd_isa();
+        if (isa == SimdIsa::avx512) return bvh_intersect_packet_avx512(m_nodes.data(), m_triangles.data(), m_triangle_indices.data(), packet, any_hit);
+        if (isa == SimdIsa::avx2) return bvh_intersect_packet_avx2(m_nodes.data(), m_triangles.data(), m_triangle_indices.data(), packet, any_hit);
+        if (isa == SimdIsa::sse4) return bvh_intersect_packet_sse4(m_nodes.data(), m_triangles.data(), m_triangle_indices.data(), packet, any_hit);
+#endif
+        bvh_intersect_packet_scalar(m_nodes.data(), m_triangles.data(), m_triangle_indices.data(), packet, any_hit);
+    }
+
+    bool RayPacket::is_coherent() const {
+        for (int axis = 0; axis < 3; ++axis) {
+            bool any_positive = false;
+            bool any_negative = false;
+            for (uint32_t lanes = active; lanes != 0; lanes &= lanes - 1) {
+                const float d = direction[axis][count_trailing_zeros(lanes)];
+                if (d > 0.0f) any_positive = true;
+                else if (d < 0.0f) any_negative = true;
+                else return false; // Parallel to the axis, or NaN
+            }
+            if (any_positive && any_negative) return false;
+        }
+        return true;
+    }
+
+    float Bvh::sah_cost() const {
+        if (m_triangles.empty()) return 0.0f;
+        auto area = [](const BvhNode& node) {
+            const glm::vec3 extent = node.max - node.min;
+            return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+        };
+        const float inv_root_area = 1.0f / std::max(area(m_nodes[0]), 1e-30f);
+        float cost = 0.0f;
+        for (const BvhNode& node : m_nodes) {
+            cost += area(node) * inv_root_area * ((node.count > 0) ? (float)node.count : m_traversal_cost);
+        }
+        return cost;
+    }
+
+    uint32_t Bvh::depth() const {
+        if (m_triangles.empty()) return 0;
+        uint32_t max_depth = 0;
+        std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 1 } };
+        while (!stack.empty()) {
+            const auto [node_index, depth] = stack.back();
+            stack.pop_back();
+            max_depth = std::max(max_depth, depth);
+            if (m_nodes[node_index].count == 0) {
+                stack.push_back({ m_nodes[node_index].left_first, depth + 1 });
+                stack.push_back({ m_nodes[node_index].left_first + 1, depth + 1 });
+            }
+        }
+        return max_depth;
+    }
+}
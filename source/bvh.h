@@ -0,0 +1,111 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/common.hpp>
+
+#define RAY_PACKET_SIZE 16 // A multiple of every SIMD width, and 4x4 pixels for camera rays
+
+namespace gfx {
+    struct ThreadPool;
+
+    struct BvhNode {
+        glm::vec3 min;
+        uint32_t left_first; // First triangle for leaves, left child otherwise. The right child is always right after the left one
+        glm::vec3 max;
+        uint32_t count; // Number of triangles, 0 for inner nodes
+    };
+    static_assert(sizeof(BvhNode) == 32, "Two nodes should fit in a cache line");
+
+    struct BvhBounds {
+        glm::vec3 min = glm::vec3(+INFINITY);
+        glm::vec3 max = glm::vec3(-INFINITY);
+
+        void grow(glm::vec3 point) { min = glm::min(min, point); max = glm::max(max, point); }
+        void grow(const BvhBounds& other) { min = glm::min(min, other.min); max = glm::max(max, other.max); }
+        float area() const {
+            const glm::vec3 extent = max - min;
+            if (extent.x < 0.0f) return 0.0f; // Empty
+            return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+        }
+    };
+
+    struct BvhHit {
+        float t;
+        glm::vec2 barycentrics; // Weights of the triangle's second and third vertex
+        uint32_t triangle_index; // Index of the triangle in the positions the BVH was built from
+    };
+
+    struct BvhTriangle {
+        glm::vec3 v0;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+    };
+
+    // A batch of rays in SoA layout, traced together. Only the lanes set in `active` get traced, the others are left alone
+    struct alignas(64) RayPacket {
+        float origin[3][RAY_PACKET_SIZE];
+        float direction[3][RAY_PACKET_SIZE];
+        float t_min[RAY_PACKET_SIZE];
+        float t_max[RAY_PACKET_SIZE]; // Closest hit queries shorten this to the hit distance
+        float barycentrics[2][RAY_PACKET_SIZE];
+        uint32_t triangle_index[RAY_PACKET_SIZE];
+        uint32_t instance_index[RAY_PACKET_SIZE]; // Only filled in by `CpuTlas`
+        uint32_t instance_id[RAY_PACKET_SIZE];
+        uint32_t active = 0; // One bit per lane
+        uint32_t hit = 0; // Set by tracing, the active lanes that hit something
+
+        // Every active ray goes the same way on every axis, so the whole packet can be culled like a frustum
+        bool is_coherent() const;
+    };
+
+    enum class BvhSplitMethod {
+        binned_sah,
+        median, // Splits at the median centroid along the longest axis. Builds faster, traces slower
+    };
+
+    struct BvhBuildSettings {
+        BvhSplitMethod split_method = BvhSplitMethod::binned_sah;
+        uint32_t n_bins = 16;
+        uint32_t max_leaf_size = 4; // Nodes with this many triangles or fewer always become leaves
+        float traversal_cost = 1.0f; // Cost of visiting a node, relative to intersecting a triangle
+        uint32_t parallel_threshold = 16 * 1024; // Nodes with fewer triangles than this are built as a whole by a single thread
+    };
+
+    // Binned SAH build over any kind of primitive, given their bounds. Leaves index into `primitive_indices`, which holds the
+    // primitives in leaf order. `Bvh` uses this for triangles, `CpuTlas` for instances
+    void build_bvh_nodes(const BvhBounds* bounds, uint32_t n_primitives, const BvhBuildSettings& settings, ThreadPool* thread_pool,
+                         std::vector<BvhNode>& nodes, std::vector<uint32_t>& primitive_indices);
+
+    // Recomputes every node's bounds after the primitives moved, without changing the tree. Much faster than a rebuild,
+    // but the tree gets worse the further things move from where they were when it was built
+    void refit_bvh_nodes(std::vector<BvhNode>& nodes, const std::vector<uint32_t>& primitive_indices, const BvhBounds* bounds);
+
+    // Triangle BVH for ray queries on the CPU. Triangles are copied in, so the positions can go away after building.
+    // Both sides of every triangle are hit, like the TLAS instances the renderer creates
+    struct Bvh {
+        // `positions` is a non-indexed triangle list, like the position buffers the BLASes are built from.
+        // If `thread_pool` isn't null, big nodes are binned in parallel, and small subtrees are built in parallel
+        void build(const glm::vec3* positions, uint32_t n_triangles, const BvhBuildSettings& settings = {}, ThreadPool* thread_pool = nullptr);
+
+        bool intersect_closest(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, BvhHit& hit) const;
+        bool intersect_any(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) const; // Stops at the first hit, for shadow rays
+        // Traces the packet's active rays together, one node at a time. Fastest when they're coherent, since then whole
+        // subtrees get culled for the packet's frustum at once. Finds the same hits as tracing the rays one by one
+        void intersect_packet(RayPacket& packet, bool any_hit) const;
+
+        float sah_cost() const; // Expected cost of a random ray through the root, in triangle intersections
+        uint32_t depth() const;
+        uint32_t n_triangles() const { return (uint32_t)m_triangles.size(); }
+        const std::vector<BvhNode>& nodes() const { return m_nodes; }
+        const std::vector<uint32_t>& triangle_indices() const { return m_triangle_indices; } // Input triangle index for every triangle in leaf order
+
+    private:
+        std::vector<BvhNode> m_nodes; // Root first
+        std::vector<BvhTriangle> m_triangles; // In leaf order, so a leaf's triangles are next to each other
+        std::vector<uint32_t> m_triangle_indices; // Maps the leaf order back to the order the triangles were passed in
+        float m_traversal_cost = 1.0f;
+    };
+}
@@ -0,0 +1,522 @@
+// Builds BVHs over glTF scenes and measures how fast they build and trace, and checks them against brute force. The wide
+// BVHs get checked against the binary one, for every instruction set this machine supports. Then it compares the scene's
+// TLAS/BLAS against one flat BVH, traces ray streams as packets against tracing them one by one, and times TLAS builds and
+// refits for more and more instances of one model. Usage:
+//   bvh_benchmark [scene.gltf ...] [--rays n] [--threads n] [--bins n] [--leaf-size n] [--max-instances n] [--instance-model path]
+// Without scenes, it runs over every model in assets/models that loads
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "bvh.h"
+#include "wide_bvh.h"
+#include "cpu_acceleration_structure.h"
+#include "cpu_scene.h"
+#include "gltf_loader.h"
+#include "thread_pool.h"
+#include "log.h"
+
+#define N_BUILD_REPEATS 3 // Best of
+#define N_VALIDATION_RAYS 2048 // Brute force is slow, so only the first few rays of every set get checked
+#define PI 3.14159265358979f
+#define DEFAULT_INSTANCE_MODEL "assets/models/monke.gltf"
+#define STREAM_TILE_SIZE 4 // Camera rays go in 4x4 pixel tiles, one tile per packet
+#define SHADOW_RAY_OFFSET 1e-4f
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+struct RaySet {
+    const char* name;
+    std::vector<Ray> rays;
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static glm::vec3 random_direction(std::mt19937& rng) {
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    const float z = dist(rng) * 2.0f - 1.0f;
+    const float phi = dist(rng) * 2.0f * PI;
+    const float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+    return glm::vec3(r * cosf(phi), r * sinf(phi), z);
+}
+
+// "primary" rays come from outside the scene and aim at a point inside it, so they're coherent-ish and mostly hit the
+// outside of the scene, like camera rays. "random" rays start anywhere inside the scene and go any direction, like bounces
+static std::vector<RaySet> generate_rays(const gfx::BvhNode& root, uint32_t n_rays) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    auto random_point = [&]() { return root.min + (root.max - root.min) * glm::vec3(dist(rng), dist(rng), dist(rng)); };
+    const glm::vec3 center = (root.min + root.max) * 0.5f;
+    const float radius = std::max(glm::length(root.max - root.min), 1e-3f);
+
+    std::vector<RaySet> sets = { { "primary" }, { "random" } };
+    for (uint32_t i = 0; i < n_rays; ++i) {
+        const glm::vec3 origin = center + random_direction(rng) * radius;
+        sets[0].rays.push_back({ origin, glm::normalize(random_point() - origin) });
+        sets[1].rays.push_back({ random_point(), random_direction(rng) });
+    }
+    return sets;
+}
+
+// Camera rays from outside the scene, in screen tiles so the packets are coherent. Then, from wherever those hit, "shadow"
+// rays towards a directional light, and cosine weighted "diffuse" bounces, which are about as incoherent as rays get
+static std::vector<RaySet> generate_stream_rays(const gfx::CpuScene& scene, const std::vector<glm::vec3>& positions, uint32_t n_rays) {
+    const gfx::BvhNode& root = scene.tlas().nodes()[0];
+    const glm::vec3 center = (root.min + root.max) * 0.5f;
+    const float radius = std::max(glm::length(root.max - root.min), 1e-3f);
+    const glm::vec3 camera_position = center + glm::normalize(glm::vec3(1.0f, 0.6f, 1.4f)) * radius;
+    const glm::vec3 forward = glm::normalize(center - camera_position);
+    const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+    const glm::vec3 up = glm::cross(right, forward);
+    const uint32_t resolution = std::max((uint32_t)sqrtf((float)n_rays) / STREAM_TILE_SIZE, 1u) * STREAM_TILE_SIZE;
+    const float tan_half_fov = tanf(30.0f * PI / 180.0f);
+
+    std::vector<RaySet> sets = { { "primary" }, { "shadow" }, { "diffuse" } };
+    for (uint32_t tile_y = 0; tile_y < resolution; tile_y += STREAM_TILE_SIZE) {
+        for (uint32_t tile_x = 0; tile_x < resolution; tile_x += STREAM_TILE_SIZE) {
+            for (uint32_t y = tile_y; y < tile_y + STREAM_TILE_SIZE; ++y) {
+                for (uint32_t x = tile_x; x < tile_x + STREAM_TILE_SIZE; ++x) {
+                    const glm::vec2 ndc = (glm::vec2((float)x, (float)y) + 0.5f) / (float)resolution * 2.0f - 1.0f;
+                    const glm::vec3 direction = glm::normalize(forward + (right * ndc.x - up * ndc.y) * tan_half_fov);
+                    sets[0].rays.push_back({ camera_position, direction });
+                }
+            }
+        }
+    }
+
+    // Where each mesh's triangles start in `positions`
+    std::vector<uint32_t> mesh_offsets;
+    uint32_t n_triangles = 0;
+    for (const gfx::CpuMesh& mesh : scene.meshes) {
+        mesh_offsets.push_back(n_triangles);
+        n_triangles += (uint32_t)(mesh.positions.size() / 3);
+    }
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    const glm::vec3 light_direction = glm::normalize(glm::vec3(0.3f, 1.0f, 0.2f));
+    for (const Ray& ray : sets[0].rays) {
+        gfx::CpuHit hit;
+        if (!scene.trace(ray.origin, ray.direction, 0.0f, INFINITY, hit)) continue;
+        const glm::vec3* triangle = &positions[(mesh_offsets[hit.mesh_index] + hit.triangle_index) * 3];
+        glm::vec3 normal = glm::normalize(glm::cross(triangle[1] - triangle[0], triangle[2] - triangle[0]));
+        if (glm::dot(normal, ray.direction) > 0.0f) normal = -normal;
+        const glm::vec3 position = ray.origin + ray.direction * hit.t + normal * (SHADOW_RAY_OFFSET * radius);
+        sets[1].rays.push_back({ position, light_direction });
+
+        const glm::vec3 tangent = glm::normalize(glm::cross(normal, (fabsf(normal.x) > 0.5f) ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f)));
+        const glm::vec3 bitangent = glm::cross(normal, tangent);
+        const float r = sqrtf(dist(rng));
+        const float phi = dist(rng) * 2.0f * PI;
+        const glm::vec3 direction = tangent * (r * cosf(phi)) + bitangent * (r * sinf(phi)) + normal * sqrtf(std::max(0.0f, 1.0f - r * r));
+        sets[2].rays.push_back({ position, direction });
+    }
+    return sets;
+}
+
+// Returns rays per second. Closest hits go in `stream` itself
+static double trace_stream(const gfx::CpuScene& scene, gfx::RayStream& stream, bool any_hit, gfx::ThreadPool& thread_pool) {
+    const auto start_time = std::chrono::steady_clock::now();
+    if (any_hit) scene.trace_stream_any(stream, &thread_pool);
+    else scene.trace_stream(stream, &thread_pool);
+    return (double)stream.n_rays / seconds_since(start_time);
+}
+
+// Returns the number of rays where the stream's hits differ from tracing the rays one at a time. They should be exactly the same
+static uint32_t validate(const gfx::CpuScene& scene, const gfx::RayStream& stream, bool any_hit, const std::vector<Ray>& rays) {
+    uint32_t n_mismatches = 0;
+    for (uint32_t i = 0; i < (uint32_t)rays.size(); ++i) {
+        gfx::CpuHit expected;
+        const bool expected_hit = any_hit ? scene.trace_any(rays[i].origin, rays[i].direction, 0.0f, INFINITY)
+                                          : scene.trace(rays[i].origin, rays[i].direction, 0.0f, INFINITY, expected);
+        bool ok = (stream.is_hit(i) == expected_hit);
+        if (ok && expected_hit && !any_hit) ok = (stream.hit(i).t == expected.t) && (stream.hit(i).instance_id == expected.mesh_index);
+        if (!ok) n_mismatches++;
+    }
+    return n_mismatches;
+}
+
+static bool brute_force_closest(const std::vector<glm::vec3>& positions, const Ray& ray, float& closest_t) {
+    closest_t = INFINITY;
+    for (size_t i = 0; i + 2 < positions.size(); i += 3) {
+        const glm::vec3 edge1 = positions[i + 1] - positions[i];
+        const glm::vec3 edge2 = positions[i + 2] - positions[i];
+        const glm::vec3 p = glm::cross(ray.direction, edge2);
+        const float det = glm::dot(edge1, p);
+        if (fabsf(det) < 1e-12f) continue;
+        const float inv_det = 1.0f / det;
+        const glm::vec3 s = ray.origin - positions[i];
+        const float u = glm::dot(s, p) * inv_det;
+        if (u < 0.0f || u > 1.0f) continue;
+        const glm::vec3 q = glm::cross(s, edge1);
+        const float v = glm::dot(ray.direction, q) * inv_det;
+        if (v < 0.0f || u + v > 1.0f) continue;
+        const float t = glm::dot(edge2, q) * inv_det;
+        if (t >= 0.0f) closest_t = std::min(closest_t, t);
+    }
+    return closest_t != INFINITY;
+}
+
+// Returns the number of rays where the BVH disagrees with brute force
+static uint32_t validate(const gfx::Bvh& bvh, const std::vector<glm::vec3>& positions, const std::vector<Ray>& rays) {
+    uint32_t n_mismatches = 0;
+    const size_t n_rays = std::min(rays.size(), (size_t)N_VALIDATION_RAYS);
+    for (size_t i = 0; i < n_rays; ++i) {
+        float expected_t;
+        const bool expected_hit = brute_force_closest(positions, rays[i], expected_t);
+        gfx::BvhHit hit;
+        const bool closest_hit = bvh.intersect_closest(rays[i].origin, rays[i].direction, 0.0f, INFINITY, hit);
+        const bool any_hit = bvh.intersect_any(rays[i].origin, rays[i].direction, 0.0f, INFINITY);
+
+        bool ok = (closest_hit == expected_hit) && (any_hit == expected_hit);
+        if (ok && closest_hit) {
+            // Triangles that share an edge can both claim the hit, so only the distance has to match
+            const glm::vec3* triangle = &positions[hit.triangle_index * 3];
+            float hit_t;
+            ok = fabsf(hit.t - expected_t) <= 1e-4f * std::max(1.0f, expected_t)
+                && brute_force_closest({ triangle[0], triangle[1], triangle[2] }, rays[i], hit_t) && fabsf(hit_t - hit.t) <= 1e-4f * std::max(1.0f, hit_t);
+        }
+        if (!ok) n_mismatches++;
+    }
+    return n_mismatches;
+}
+
+// Returns the number of rays where the wide BVH's hits differ from the binary BVH's
+static uint32_t validate(const gfx::WideBvh& wide_bvh, const gfx::Bvh& bvh, const std::vector<Ray>& rays) {
+    uint32_t n_mismatches = 0;
+    for (const Ray& ray : rays) {
+        gfx::BvhHit expected, hit;
+        const bool expected_hit = bvh.intersect_closest(ray.origin, ray.direction, 0.0f, INFINITY, expected);
+        const bool closest_hit = wide_bvh.intersect_closest(ray.origin, ray.direction, 0.0f, INFINITY, hit);
+        const bool any_hit = wide_bvh.intersect_any(ray.origin, ray.direction, 0.0f, INFINITY);
+        bool ok = (closest_hit == expected_hit) && (any_hit == expected_hit);
+        if (ok && closest_hit) ok = fabsf(hit.t - expected.t) <= 1e-4f * std::max(1.0f, expected.t);
+        if (!ok) n_mismatches++;
+    }
+    return n_mismatches;
+}
+
+// Returns the number of rays where the two level structure's hits differ from one flat BVH over the same triangles. The
+// rays get transformed into object space instead of the triangles into world space, so the distances can round differently
+static uint32_t validate(const gfx::CpuTlas& tlas, const gfx::WideBvh& flat_bvh, const std::vector<Ray>& rays) {
+    uint32_t n_mismatches = 0;
+    for (const Ray& ray : rays) {
+        gfx::BvhHit expected;
+        gfx::CpuTlasHit hit;
+        const bool expected_hit = flat_bvh.intersect_closest(ray.origin, ray.direction, 0.0f, INFINITY, expected);
+        const bool closest_hit = tlas.intersect_closest(ray.origin, ray.direction, 0.0f, INFINITY, hit);
+        const bool any_hit = tlas.intersect_any(ray.origin, ray.direction, 0.0f, INFINITY);
+        bool ok = (closest_hit == expected_hit) && (any_hit == expected_hit);
+        if (ok && closest_hit) ok = fabsf(hit.t - expected.t) <= 1e-4f * std::max(1.0f, expected.t);
+        if (!ok) n_mismatches++;
+    }
+    return n_mismatches;
+}
+
+// Returns the number of rays where two TLASes over the same instances find different hits
+static uint32_t validate(const gfx::CpuTlas& tlas, const gfx::CpuTlas& expected_tlas, const std::vector<Ray>& rays) {
+    uint32_t n_mismatches = 0;
+    for (const Ray& ray : rays) {
+        gfx::CpuTlasHit expected, hit;
+        const bool expected_hit = expected_tlas.intersect_closest(ray.origin, ray.direction, 0.0f, INFINITY, expected);
+        const bool closest_hit = tlas.intersect_closest(ray.origin, ray.direction, 0.0f, INFINITY, hit);
+        const bool any_hit = tlas.intersect_any(ray.origin, ray.direction, 0.0f, INFINITY);
+        bool ok = (closest_hit == expected_hit) && (any_hit == expected_hit);
+        if (ok && closest_hit) ok = (hit.t == expected.t);
+        if (!ok) n_mismatches++;
+    }
+    return n_mismatches;
+}
+
+// Random rotation, and a position somewhere in grid cell `index` of a `grid_size`^3 grid
+static glm::mat4x3 random_instance_transform(std::mt19937& rng, uint32_t index, uint32_t grid_size, float spacing) {
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    const glm::vec3 cell = glm::vec3((float)(index % grid_size), (float)(index / grid_size % grid_size), (float)(index / grid_size / grid_size));
+    const glm::vec3 position = (cell + glm::vec3(dist(rng), dist(rng), dist(rng)) * 0.5f) * spacing;
+    glm::mat4 transform = glm::rotate(glm::translate(glm::mat4(1.0f), position), dist(rng) * 2.0f * PI, random_direction(rng));
+    return glm::mat4x3(transform);
+}
+
+// Returns rays per second
+template<bool AnyHit, typename BvhType, typename Hit = gfx::BvhHit>
+static double trace_rays(const BvhType& bvh, const std::vector<Ray>& rays, gfx::ThreadPool& thread_pool, uint64_t& n_hits) {
+    struct alignas(64) ThreadHits {
+        uint64_t n_hits = 0;
+    };
+    std::vector<ThreadHits> thread_hits(thread_pool.n_threads());
+
+    const auto start_time = std::chrono::steady_clock::now();
+    thread_pool.parallel_for((uint32_t)rays.size(), 4096, [&](uint32_t begin, uint32_t end, uint32_t thread_index) {
+        uint64_t hits = 0;
+        for (uint32_t i = begin; i < end; ++i) {
+            if constexpr (AnyHit) {
+                hits += bvh.intersect_any(rays[i].origin, rays[i].direction, 0.0f, INFINITY) ? 1 : 0;
+            }
+            else {
+                Hit hit;
+                hits += bvh.intersect_closest(rays[i].origin, rays[i].direction, 0.0f, INFINITY, hit) ? 1 : 0;
+            }
+        }
+        thread_hits[thread_index].n_hits += hits;
+    });
+    const double seconds = seconds_since(start_time);
+
+    n_hits = 0;
+    for (const ThreadHits& hits : thread_hits) n_hits += hits.n_hits;
+    return (double)rays.size() / seconds;
+}
+
+static std::vector<std::string> find_bundled_models() {
+    std::vector<std::string> paths;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator("assets/models", error)) {
+        const std::string extension = entry.path().extension().string();
+        if (extension == ".gltf" || extension == ".glb") paths.push_back(entry.path().generic_string());
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+int main(int n_args, char** args) {
+    std::vector<std::string> scene_paths;
+    uint32_t n_rays = 1 << 20;
+    uint32_t n_threads = 0;
+    uint32_t max_instances = 1000000;
+    std::string instance_model_path = DEFAULT_INSTANCE_MODEL;
+    gfx::BvhBuildSettings sah_settings;
+
+    for (int i = 1; i < n_args; ++i) {
+        const char* arg = args[i];
+        const int n_left = n_args - i - 1;
+        auto next_u32 = [&]() { return (uint32_t)strtoul(args[++i], nullptr, 10); };
+
+        if (strcmp(arg, "--rays") == 0 && n_left >= 1) n_rays = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--threads") == 0 && n_left >= 1) n_threads = next_u32();
+        else if (strcmp(arg, "--bins") == 0 && n_left >= 1) sah_settings.n_bins = next_u32();
+        else if (strcmp(arg, "--leaf-size") == 0 && n_left >= 1) sah_settings.max_leaf_size = next_u32();
+        else if (strcmp(arg, "--max-instances") == 0 && n_left >= 1) max_instances = next_u32();
+        else if (strcmp(arg, "--instance-model") == 0 && n_left >= 1) instance_model_path = args[++i];
+        else if (arg[0] != '-') scene_paths.push_back(arg);
+        else {
+            LOG(Error, "Unknown or incomplete argument \"%s\"", arg);
+            Log::flush();
+            return 1;
+        }
+    }
+    if (scene_paths.empty()) scene_paths = find_bundled_models();
+
+    // Same thread count rules as cpu_reference
+    gfx::ThreadPool thread_pool((n_threads > 0) ? std::max(n_threads, 2u) - 1 : gfx::ThreadPool::AUTO_WORKERS);
+    gfx::BvhBuildSettings median_settings = sah_settings;
+    median_settings.split_method = gfx::BvhSplitMethod::median;
+
+    struct BuildConfig {
+        const char* name;
+        const gfx::BvhBuildSettings* settings;
+        gfx::ThreadPool* thread_pool;
+    };
+    const BuildConfig build_configs[] = {
+        { "sah, 1 thread", &sah_settings, nullptr },
+        { "sah, pool", &sah_settings, &thread_pool },
+        { "median, 1 thread", &median_settings, nullptr },
+        { "median, pool", &median_settings, &thread_pool },
+    };
+
+    struct WideConfig {
+        const char* name;
+        gfx::SimdIsa isa;
+        uint32_t width;
+    };
+    const WideConfig wide_configs[] = {
+        { "scalar, 4 wide", gfx::SimdIsa::scalar, 4 },
+        { "sse4, 4 wide", gfx::SimdIsa::sse4, 4 },
+        { "scalar, 8 wide", gfx::SimdIsa::scalar, 8 },
+        { "avx2, 8 wide", gfx::SimdIsa::avx2, 8 },
+        { "avx512, 8 wide", gfx::SimdIsa::avx512, 8 },
+    };
+
+    uint32_t n_failed = 0;
+    printf("%u threads, %u rays per set, best instruction set: %s\n", thread_pool.n_threads(), n_rays, gfx::simd_isa_names[(int)gfx::detect_simd_isa()]);
+    for (const std::string& path : scene_paths) {
+        const auto model = gfx::decode_gltf(path);
+        if (!model) {
+            Log::flush();
+            printf("\n%s: failed to load, skipping\n", path.c_str());
+            continue;
+        }
+        const auto scene = gfx::create_cpu_scene_from_gltf(path, *model, &thread_pool);
+        const std::vector<glm::vec3> positions = scene->world_space_positions();
+        const uint32_t n_triangles = (uint32_t)(positions.size() / 3);
+        Log::flush();
+        printf("\n%s: %u triangles\n", path.c_str(), n_triangles);
+        if (n_triangles == 0) continue;
+
+        printf("  %-18s %10s %8s %6s %9s\n", "build", "ms", "nodes", "depth", "sah cost");
+        gfx::Bvh bvhs[2]; // The pooled SAH and median builds
+        for (const BuildConfig& config : build_configs) {
+            gfx::Bvh bvh;
+            double best_seconds = INFINITY;
+            for (int i = 0; i < N_BUILD_REPEATS; ++i) {
+                const auto start_time = std::chrono::steady_clock::now();
+                bvh.build(positions.data(), n_triangles, *config.settings, config.thread_pool);
+                best_seconds = std::min(best_seconds, seconds_since(start_time));
+            }
+            printf("  %-18s %10.3f %8zu %6u %9.2f\n", config.name, best_seconds * 1000.0, bvh.nodes().size(), bvh.depth(), bvh.sah_cost());
+            if (config.thread_pool) bvhs[(config.settings == &sah_settings) ? 0 : 1] = std::move(bvh);
+        }
+
+        printf("  %-18s %-8s %13s %13s %8s %10s\n", "trace", "rays", "closest Mr/s", "any Mr/s", "hit %", "mismatches");
+        const std::vector<RaySet> ray_sets = generate_rays(bvhs[0].nodes()[0], n_rays);
+        for (int i = 0; i < 2; ++i) {
+            for (const RaySet& set : ray_sets) {
+                uint64_t n_closest_hits, n_any_hits;
+                const double closest_rays_per_second = trace_rays<false>(bvhs[i], set.rays, thread_pool, n_closest_hits);
+                const double any_rays_per_second = trace_rays<true>(bvhs[i], set.rays, thread_pool, n_any_hits);
+                uint32_t n_mismatches = validate(bvhs[i], positions, set.rays);
+                if (n_closest_hits != n_any_hits) n_mismatches++;
+                n_failed += n_mismatches;
+                printf("  %-18s %-8s %13.3f %13.3f %8.1f %10u\n", (i == 0) ? "sah" : "median", set.name, closest_rays_per_second / 1e6,
+                    any_rays_per_second / 1e6, 100.0 * (double)n_closest_hits / (double)set.rays.size(), n_mismatches);
+            }
+        }
+
+        // Collapsed from the SAH build, and checked against it instead of brute force, so every ray gets checked
+        printf("  %-18s %10s %8s %8s %9s\n", "wide bvh", "ms", "nodes", "packets", "KiB");
+        gfx::WideBvh wide_bvhs[std::size(wide_configs)];
+        for (size_t i = 0; i < std::size(wide_configs); ++i) {
+            if (!gfx::is_simd_isa_supported(wide_configs[i].isa)) {
+                printf("  %-18s not supported on this machine\n", wide_configs[i].name);
+                continue;
+            }
+            const auto start_time = std::chrono::steady_clock::now();
+            wide_bvhs[i].build(bvhs[0], positions.data(), wide_configs[i].isa, wide_configs[i].width);
+            printf("  %-18s %10.3f %8zu %8zu %9.1f\n", wide_configs[i].name, seconds_since(start_time) * 1000.0, wide_bvhs[i].n_nodes(),
+                wide_bvhs[i].n_packets(), (double)wide_bvhs[i].size_in_bytes() / 1024.0);
+        }
+        printf("  %-18s %-8s %13s %13s %8s %10s\n", "trace", "rays", "closest Mr/s", "any Mr/s", "hit %", "mismatches");
+        for (size_t i = 0; i < std::size(wide_configs); ++i) {
+            if (!gfx::is_simd_isa_supported(wide_configs[i].isa)) continue;
+            for (const RaySet& set : ray_sets) {
+                uint64_t n_closest_hits, n_any_hits;
+                const double closest_rays_per_second = trace_rays<false>(wide_bvhs[i], set.rays, thread_pool, n_closest_hits);
+                const double any_rays_per_second = trace_rays<true>(wide_bvhs[i], set.rays, thread_pool, n_any_hits);
+                const uint32_t n_mismatches = validate(wide_bvhs[i], bvhs[0], set.rays);
+                n_failed += n_mismatches;
+                printf("  %-18s %-8s %13.3f %13.3f %8.1f %10u\n", wide_configs[i].name, set.name, closest_rays_per_second / 1e6,
+                    any_rays_per_second / 1e6, 100.0 * (double)n_closest_hits / (double)set.rays.size(), n_mismatches);
+            }
+        }
+
+        // What the scene's TLAS/BLAS costs over one flat BVH with every triangle in world space, both with the best instruction set
+        printf("  %-18s %-8s %13s %13s %8s %10s\n", "two level", "rays", "closest Mr/s", "any Mr/s", "hit %", "mismatches");
+        gfx::WideBvh flat_bvh;
+        flat_bvh.build(bvhs[0], positions.data());
+        for (const RaySet& set : ray_sets) {
+            uint64_t n_flat_hits, n_closest_hits, n_any_hits;
+            const double flat_rays_per_second = trace_rays<false>(flat_bvh, set.rays, thread_pool, n_flat_hits);
+            const double closest_rays_per_second = trace_rays<false, gfx::CpuTlas, gfx::CpuTlasHit>(scene->tlas(), set.rays, thread_pool, n_closest_hits);
+            const double any_rays_per_second = trace_rays<true>(scene->tlas(), set.rays, thread_pool, n_any_hits);
+            const uint32_t n_mismatches = validate(scene->tlas(), flat_bvh, set.rays);
+            printf("  %-18s %-8s %13.3f %13s %8.1f %10s\n", "flat", set.name, flat_rays_per_second / 1e6, "", 100.0 * (double)n_flat_hits / (double)set.rays.size(), "");
+            printf("  %-18s %-8s %13.3f %13.3f %8.1f %10u\n", "tlas", set.name, closest_rays_per_second / 1e6, any_rays_per_second / 1e6,
+                100.0 * (double)n_closest_hits / (double)set.rays.size(), n_mismatches);
+        }
+
+        // Ray streams against the same rays one at a time. Shadow rays only need any hit, the others need the closest one
+        printf("  %-18s %-8s %13s %13s %8s %10s\n", "stream", "rays", "single Mr/s", "stream Mr/s", "packet %", "mismatches");
+        for (const RaySet& set : generate_stream_rays(*scene, positions, n_rays)) {
+            if (set.rays.empty()) continue;
+            const bool any_hit = (strcmp(set.name, "shadow") == 0);
+            gfx::RayStream original_stream;
+            for (const Ray& ray : set.rays) original_stream.add(ray.origin, ray.direction, 0.0f, INFINITY);
+            uint32_t n_coherent_packets = 0;
+            for (const gfx::RayPacket& packet : original_stream.packets) n_coherent_packets += packet.is_coherent() ? 1 : 0;
+
+            uint64_t n_hits;
+            const double single_rays_per_second = any_hit ? trace_rays<true>(scene->tlas(), set.rays, thread_pool, n_hits)
+                                                          : trace_rays<false, gfx::CpuTlas, gfx::CpuTlasHit>(scene->tlas(), set.rays, thread_pool, n_hits);
+            gfx::RayStream stream = original_stream; // Closest hit queries shorten the rays, so every run needs a fresh copy
+            const double stream_rays_per_second = trace_stream(*scene, stream, any_hit, thread_pool);
+            const uint32_t n_mismatches = validate(*scene, stream, any_hit, set.rays);
+            n_failed += n_mismatches;
+            printf("  %-18s %-8s %13.3f %13.3f %8.1f %10u\n", any_hit ? "any" : "closest", set.name, single_rays_per_second / 1e6, stream_rays_per_second / 1e6,
+                100.0 * (double)n_coherent_packets / (double)original_stream.packets.size(), n_mismatches);
+        }
+    }
+
+    // TLAS scaling: one BLAS, instanced over a jittered grid with random rotations. After timing the build, every instance
+    // moves a bit, and the TLAS gets refit and rebuilt, to see how much slower the refit one traces
+    const auto instance_model = gfx::decode_gltf(instance_model_path);
+    const auto instance_scene = instance_model ? gfx::create_cpu_scene_from_gltf(instance_model_path, *instance_model, &thread_pool) : nullptr;
+    const std::vector<glm::vec3> instance_positions = instance_scene ? instance_scene->world_space_positions() : std::vector<glm::vec3>();
+    Log::flush();
+    if (max_instances > 0 && instance_positions.empty()) {
+        printf("\n%s: failed to load or has no triangles, skipping the TLAS benchmark\n", instance_model_path.c_str());
+    }
+    else if (max_instances > 0) {
+        gfx::CpuBlas blas;
+        blas.build(instance_positions.data(), (uint32_t)(instance_positions.size() / 3), &thread_pool);
+        const float spacing = glm::length(blas.bounds().max - blas.bounds().min);
+        printf("\ntlas: instances of %s (%u triangles)\n", instance_model_path.c_str(), blas.n_triangles());
+        printf("  %-10s %12s %12s %10s %-8s %13s %13s %10s\n", "instances", "build 1t ms", "build ms", "refit ms", "rays", "rebuilt Mr/s", "refit Mr/s", "mismatches");
+        for (uint32_t n_instances = 1; ; n_instances = (n_instances > max_instances / 10) ? max_instances : n_instances * 10) {
+            const uint32_t grid_size = (uint32_t)ceilf(cbrtf((float)n_instances) - 1e-3f);
+            std::mt19937 rng(n_instances);
+            std::vector<gfx::CpuRaytracingInstance> instances(n_instances);
+            for (uint32_t i = 0; i < n_instances; ++i) instances[i] = { random_instance_transform(rng, i, grid_size, spacing), i, &blas };
+
+            gfx::CpuTlas tlas;
+            double build_seconds[2] = { INFINITY, INFINITY }; // 1 thread, pool
+            for (int i = 0; i < N_BUILD_REPEATS; ++i) {
+                for (int j = 0; j < 2; ++j) {
+                    const auto start_time = std::chrono::steady_clock::now();
+                    tlas.build(instances, (j == 0) ? nullptr : &thread_pool);
+                    build_seconds[j] = std::min(build_seconds[j], seconds_since(start_time));
+                }
+            }
+
+            for (uint32_t i = 0; i < n_instances; ++i) instances[i].transform = random_instance_transform(rng, i, grid_size, spacing);
+            const auto start_time = std::chrono::steady_clock::now();
+            tlas.refit(instances, &thread_pool);
+            const double refit_seconds = seconds_since(start_time);
+            gfx::CpuTlas rebuilt_tlas;
+            rebuilt_tlas.build(instances, &thread_pool);
+
+            const std::vector<RaySet> ray_sets = generate_rays(rebuilt_tlas.nodes()[0], n_rays);
+            for (const RaySet& set : ray_sets) {
+                uint64_t n_rebuilt_hits, n_refit_hits;
+                const double rebuilt_rays_per_second = trace_rays<false, gfx::CpuTlas, gfx::CpuTlasHit>(rebuilt_tlas, set.rays, thread_pool, n_rebuilt_hits);
+                const double refit_rays_per_second = trace_rays<false, gfx::CpuTlas, gfx::CpuTlasHit>(tlas, set.rays, thread_pool, n_refit_hits);
+                const uint32_t n_mismatches = validate(tlas, rebuilt_tlas, std::vector<Ray>(set.rays.begin(), set.rays.begin() + std::min(set.rays.size(), (size_t)N_VALIDATION_RAYS)));
+                n_failed += n_mismatches;
+                if (&set == &ray_sets[0]) {
+                    printf("  %-10u %12.3f %12.3f %10.3f %-8s %13.3f %13.3f %10u\n", n_instances, build_seconds[0] * 1000.0, build_seconds[1] * 1000.0,
+                        refit_seconds * 1000.0, set.name, rebuilt_rays_per_second / 1e6, refit_rays_per_second / 1e6, n_mismatches);
+                }
+                else {
+                    printf("  %-10s %12s %12s %10s %-8s %13.3f %13.3f %10u\n", "", "", "", "", set.name, rebuilt_rays_per_second / 1e6, refit_rays_per_second / 1e6, n_mismatches);
+                }
+            }
+            if (n_instances == max_instances) break;
+        }
+    }
+
+    Log::flush();
+    if (n_failed > 0) {
+        printf("\n%u rays did not match brute force, the binary BVH, the rebuilt TLAS or single rays\n", n_failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,238 @@
+#pragma once
+// Packet traversal of the binary BVH, shared by every instruction set like wide_bvh_kernels.h. The entry points are defined
+// next to the wide BVH ones, in the wide_bvh_<isa>.cpp files that already have each instruction set's `Simd` type
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "bvh.h"
+#include "wide_bvh_kernels.h"
+
+#define RAY_PACKET_STACK_SIZE 128 // Every level pushes both children and pops one, and BVHs are at most 64 levels deep
+
+namespace gfx {
+    // Closest hit if `any_hit` is false. `triangle_indices` maps the leaf order back to the input order, like `Bvh` does
+    void bvh_intersect_packet_scalar(const BvhNode* nodes, const BvhTriangle* triangles, const uint32_t* triangle_indices, RayPacket& packet, bool any_hit);
+    void bvh_intersect_packet_sse4(const BvhNode* nodes, const BvhTriangle* triangles, const uint32_t* triangle_indices, RayPacket& packet, bool any_hit);
+    void bvh_intersect_packet_avx2(const BvhNode* nodes, const BvhTriangle* triangles, const uint32_t* triangle_indices, RayPacket& packet, bool any_hit);
+    void bvh_intersect_packet_avx512(const BvhNode* nodes, const BvhTriangle* triangles, const uint32_t* triangle_indices, RayPacket& packet, bool any_hit);
+
+    namespace {
+        // Range of origins, inverse directions and distances of a coherent packet's active rays
+        struct PacketFrustum {
+            float origin_min[3];
+            float origin_max[3];
+            float inv_direction_min[3];
+            float inv_direction_max[3];
+            bool is_positive[3];
+            float t_min;
+            float t_max;
+            bool is_valid; // False for incoherent packets, those can't be culled as a whole
+        };
+
+        inline PacketFrustum make_packet_frustum(const RayPacket& packet, const float (&inv_direction)[3][RAY_PACKET_SIZE]) {
+            PacketFrustum frustum;
+            frustum.is_valid = packet.is_coherent();
+            frustum.t_min = INFINITY;
+            frustum.t_max = -INFINITY;
+            for (int axis = 0; axis < 3; ++axis) {
+                frustum.origin_min[axis] = INFINITY;
+                frustum.origin_max[axis] = -INFINITY;
+                frustum.inv_direction_min[axis] = INFINITY;
+                frustum.inv_direction_max[axis] = -INFINITY;
+            }
+            for (uint32_t lanes = packet.active; lanes != 0; lanes &= lanes - 1) {
+                const int lane = count_trailing_zeros(lanes);
+                for (int axis = 0; axis < 3; ++axis) {
+                    frustum.origin_min[axis] = std::min(frustum.origin_min[axis], packet.origin[axis][lane]);
+                    frustum.origin_max[axis] = std::max(frustum.origin_max[axis], packet.origin[axis][lane]);
+                    frustum.inv_direction_min[axis] = std::min(frustum.inv_direction_min[axis], inv_direction[axis][lane]);
+                    frustum.inv_direction_max[axis] = std::max(frustum.inv_direction_max[axis], inv_direction[axis][lane]);
+                    frustum.is_positive[axis] = packet.direction[axis][lane] > 0.0f;
+                }
+                frustum.t_min = std::min(frustum.t_min, packet.t_min[lane]);
+                frustum.t_max = std::max(frustum.t_max, packet.t_max[lane]);
+            }
+
+            // Tiny directions give infinite inverses, and those turn into NaNs in the interval math below
+            for (int axis = 0; axis < 3; ++axis) {
+                frustum.is_valid = frustum.is_valid && std::isfinite(frustum.inv_direction_min[axis]) && std::isfinite(frustum.inv_direction_max[axis]);
+            }
+            return frustum;
+        }
+
+        // True if none of the frustum's rays can hit the box. Every ray's slab distances lie in the intervals computed here, and
+        // rounding is monotonic, so this never culls a box that one of the rays would hit
+        inline bool frustum_misses_box(const PacketFrustum& frustum, const BvhNode& node) {
+            float enter = frustum.t_min;
+            float exit = frustum.t_max;
+            for (int axis = 0; axis < 3; ++axis) {
+                const float near_plane = frustum.is_positive[axis] ? node.min[axis] : node.max[axis];
+                const float far_plane = frustum.is_positive[axis] ? node.max[axis] : node.min[axis];
+                auto plane_distances = [&](float plane, float& t_lowest, float& t_highest) {
+                    const float a = (plane - frustum.origin_max[axis]) * frustum.inv_direction_min[axis];
+                    const float b = (plane - frustum.origin_max[axis]) * frustum.inv_direction_max[axis];
+                    const float c = (plane - frustum.origin_min[axis]) * frustum.inv_direction_min[axis];
+                    const float d = (plane - frustum.origin_min[axis]) * frustum.inv_direction_max[axis];
+                    t_lowest = std::min(std::min(a, b), std::min(c, d));
+                    t_highest = std::max(std::max(a, b), std::max(c, d));
+                };
+                float near_lowest, near_highest, far_lowest, far_highest;
+                plane_distances(near_plane, near_lowest, near_highest);
+                plane_distances(far_plane, far_lowest, far_highest);
+                enter = std::max(enter, near_lowest);
+                exit = std::min(exit, far_highest);
+            }
+            return enter > exit;
+        }
+
+        // Slab test for every active lane, same math as `Bvh`'s single ray test. Returns the lanes that hit the box
+        template<typename Simd>
+        uint32_t intersect_box_packet(const BvhNode& node, const RayPacket& packet, const float (&inv_direction)[3][RAY_PACKET_SIZE], uint32_t lanes) {
+            constexpr int Width = Simd::width;
+            using Float = typename Simd::Float;
+            uint32_t result = 0;
+            for (int i = 0; i < RAY_PACKET_SIZE; i += Width) {
+                if (((lanes >> i) & ((1u << Width) - 1)) == 0) continue;
+                Float t_near[3], t_far[3];
+                for (int axis = 0; axis < 3; ++axis) {
+                    const Float origin = Simd::load(&packet.origin[axis][i]);
+                    const Float inv_dir = Simd::load(&inv_direction[axis][i]);
+                    const Float t0 = Simd::mul(Simd::sub(Simd::set1(node.min[axis]), origin), inv_dir);
+                    const Float t1 = Simd::mul(Simd::sub(Simd::set1(node.max[axis]), origin), inv_dir);
+                    t_near[axis] = Simd::min(t0, t1);
+                    t_far[axis] = Simd::max(t0, t1);
+                }
+                const Float enter = Simd::max(Simd::max(t_near[0], t_near[1]), Simd::max(t_near[2], Simd::load(&packet.t_min[i])));
+                const Float exit = Simd::min(Simd::min(t_far[0], t_far[1]), Simd::min(t_far[2], Simd::load(&packet.t_max[i])));
+                result |= Simd::to_bits(Simd::cmp_le(enter, exit)) << i;
+            }
+            return result & lanes;
+        }
+
+        // One triangle against every active lane, same math as the single ray tests. Closest hit queries write the hits to the
+        // packet. Returns the lanes that hit
+        template<typename Simd, bool AnyHit>
+        uint32_t intersect_triangle_packet(const BvhTriangle& triangle, uint32_t triangle_index, RayPacket& packet, uint32_t lanes) {
+            constexpr int Width = Simd::width;
+            using Float = typename Simd::Float;
+            const Float e1_x = Simd::set1(triangle.edge1.x), e1_y = Simd::set1(triangle.edge1.y), e1_z = Simd::set1(triangle.edge1.z);
+            const Float e2_x = Simd::set1(triangle.edge2.x), e2_y = Simd::set1(triangle.edge2.y), e2_z = Simd::set1(triangle.edge2.z);
+            auto dot = [](const Float& a_x, const Float& a_y, const Float& a_z, const Float& b_x, const Float& b_y, const Float& b_z) {
+                return Simd::add(Simd::add(Simd::mul(a_x, b_x), Simd::mul(a_y, b_y)), Simd::mul(a_z, b_z));
+            };
+
+            uint32_t result = 0;
+            for (int i = 0; i < RAY_PACKET_SIZE; i += Width) {
+                const uint32_t group_lanes = (lanes >> i) & ((1u << Width) - 1);
+                if (group_lanes == 0) continue;
+                const Float d_x = Simd::load(&packet.direction[0][i]), d_y = Simd::load(&packet.direction[1][i]), d_z = Simd::load(&packet.direction[2][i]);
+
+                // p = cross(direction, edge2)
+                const Float p_x = Simd::sub(Simd::mul(d_y, e2_z), Simd::mul(e2_y, d_z));
+                const Float p_y = Simd::sub(Simd::mul(d_z, e2_x), Simd::mul(e2_z, d_x));
+                const Float p_z = Simd::sub(Simd::mul(d_x, e2_y), Simd::mul(e2_x, d_y));
+                const Float det = dot(e1_x, e1_y, e1_z, p_x, p_y, p_z);
+                const Float inv_det = Simd::div(Simd::set1(1.0f), det);
+
+                const Float s_x = Simd::sub(Simd::load(&packet.origin[0][i]), Simd::set1(triangle.v0.x));
+                const Float s_y = Simd::sub(Simd::load(&packet.origin[1][i]), Simd::set1(triangle.v0.y));
+                const Float s_z = Simd::sub(Simd::load(&packet.origin[2][i]), Simd::set1(triangle.v0.z));
+                const Float u = Simd::mul(dot(s_x, s_y, s_z, p_x, p_y, p_z), inv_det);
+
+                // q = cross(s, edge1)
+                const Float q_x = Simd::sub(Simd::mul(s_y, e1_z), Simd::mul(e1_y, s_z));
+                const Float q_y = Simd::sub(Simd::mul(s_z, e1_x), Simd::mul(e1_z, s_x));
+                const Float q_z = Simd::sub(Simd::mul(s_x, e1_y), Simd::mul(e1_x, s_y));
+                const Float v = Simd::mul(dot(d_x, d_y, d_z, q_x, q_y, q_z), inv_det);
+                const Float t = Simd::mul(dot(e2_x, e2_y, e2_z, q_x, q_y, q_z), inv_det);
+
+                const Float zero = Simd::set1(0.0f);
+                const Float one = Simd::set1(1.0f);
+                typename Simd::Mask mask = Simd::cmp_ge(Simd::abs(det), Simd::set1(1e-12f));
+                mask = Simd::and_mask(mask, Simd::and_mask(Simd::cmp_ge(u, zero), Simd::cmp_le(u, one)));
+                mask = Simd::and_mask(mask, Simd::and_mask(Simd::cmp_ge(v, zero), Simd::cmp_le(Simd::add(u, v), one)));
+                mask = Simd::and_mask(mask, Simd::and_mask(Simd::cmp_ge(t, Simd::load(&packet.t_min[i])), Simd::cmp_lt(t, Simd::load(&packet.t_max[i]))));
+                uint32_t bits = Simd::to_bits(mask) & group_lanes;
+                if (bits == 0) continue;
+                result |= bits << i;
+
+                if constexpr (!AnyHit) {
+                    alignas(64) float t_values[Width], u_values[Width], v_values[Width];
+                    Simd::store(t_values, t);
+                    Simd::store(u_values, u);
+                    Simd::store(v_values, v);
+                    for (; bits != 0; bits &= bits - 1) {
+                        const int lane = count_trailing_zeros(bits);
+                        packet.t_max[i + lane] = t_values[lane];
+                        packet.barycentrics[0][i + lane] = u_values[lane];
+                        packet.barycentrics[1][i + lane] = v_values[lane];
+                        packet.triangle_index[i + lane] = triangle_index;
+                    }
+                }
+            }
+            return result;
+        }
+
+        template<typename Simd, bool AnyHit>
+        void traverse_packet(const BvhNode* nodes, const BvhTriangle* triangles, const uint32_t* triangle_indices, RayPacket& packet) {
+            constexpr int Width = Simd::width;
+            alignas(64) float inv_direction[3][RAY_PACKET_SIZE];
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int i = 0; i < RAY_PACKET_SIZE; i += Width) {
+                    Simd::store(&inv_direction[axis][i], Simd::div(Simd::set1(1.0f), Simd::load(&packet.direction[axis][i])));
+                }
+            }
+            const PacketFrustum frustum = make_packet_frustum(packet, inv_direction);
+
+            // Children get visited in the order the first ray would pass them, which is the order every ray would pass them
+            // if the packet is coherent
+            bool is_positive[3];
+            const int first_lane = count_trailing_zeros(packet.active);
+            for (int axis = 0; axis < 3; ++axis) is_positive[axis] = packet.direction[axis][first_lane] >= 0.0f;
+
+            struct StackEntry {
+                uint32_t node;
+                uint32_t lanes; // Lanes that hit the parent
+            };
+            StackEntry stack[RAY_PACKET_STACK_SIZE];
+            uint32_t stack_size = 0;
+            stack[stack_size++] = { 0, packet.active };
+
+            uint32_t hit_lanes = 0;
+            while (stack_size > 0) {
+                const StackEntry entry = stack[--stack_size];
+                uint32_t lanes = AnyHit ? (entry.lanes & ~hit_lanes) : entry.lanes;
+                if (lanes == 0) continue;
+
+                // The packet's t_max only ever gets shorter, so testing boxes when they're popped culls the ones behind a hit
+                const BvhNode& node = nodes[entry.node];
+                if (frustum.is_valid && frustum_misses_box(frustum, node)) continue;
+                lanes = intersect_box_packet<Simd>(node, packet, inv_direction, lanes);
+                if (lanes == 0) continue;
+
+                if (node.count > 0) {
+                    for (uint32_t i = node.left_first; i < node.left_first + node.count; ++i) {
+                        const uint32_t hits = intersect_triangle_packet<Simd, AnyHit>(triangles[i], triangle_indices[i], packet, lanes);
+                        hit_lanes |= hits;
+                        if constexpr (AnyHit) {
+                            lanes &= ~hits;
+                            if (lanes == 0) break;
+                        }
+                    }
+                    continue;
+                }
+
+                // Split axis is where the children's centers are furthest apart
+                const BvhNode& left = nodes[node.left_first];
+                const BvhNode& right = nodes[node.left_first + 1];
+                const glm::vec3 delta = (right.min + right.max) - (left.min + left.max);
+                const glm::vec3 abs_delta = glm::abs(delta);
+                const int axis = (abs_delta.x > abs_delta.y) ? ((abs_delta.x > abs_delta.z) ? 0 : 2) : ((abs_delta.y > abs_delta.z) ? 1 : 2);
+                const bool right_first = (delta[axis] < 0.0f) == is_positive[axis];
+                stack[stack_size++] = { right_first ? node.left_first : node.left_first + 1, lanes };
+                stack[stack_size++] = { right_first ? node.left_first + 1 : node.left_first, lanes };
+            }
+            packet.hit = hit_lanes;
+        }
+    }
+}
@@ -32,10 +32,12 @@ namespace gfx {
     }
 
     std::shared_ptr<CommandBuffer> CommandQueue::create_command_buffer(const Pipeline* pipeline, size_t frame_index) {
+        std::lock_guard lock(m_mutex);
+
         // Reuse if there's one available
         if (m_command_buffers_to_reuse.empty() == false) {
-            size_t index_to_reuse = m_command_buffers_to_reuse.front();
-            m_command_buffers_to_reuse.pop_front();
+            size_t index_to_reuse = m_command_buffers_to_reuse.back();
+            m_command_buffers_to_reuse.pop_back();
             m_in_flight_command_buffers.push_back(index_to_reuse);
             auto& cmd = m_command_buffer_pool[index_to_reuse];
             m_command_lists_to_execute.push_back(cmd);
@@ -60,32 +62,38 @@ namespace gfx {
     }
 
     void CommandQueue::execute() {
+        std::lock_guard lock(m_mutex);
+
         if (m_command_lists_to_execute.empty()) return;
 
-        std::vector<ID3D12CommandList*> cmds(m_command_lists_to_execute.size());
-        for (size_t i = 0; i < cmds.size(); ++i) {
+        m_command_lists_scratch.resize(m_command_lists_to_execute.size());
+        for (size_t i = 0; i < m_command_lists_scratch.size(); ++i) {
             auto cmd = m_command_lists_to_execute[i]->get();
             cmd->Close();
-            cmds[i] = cmd;
+            m_command_lists_scratch[i] = cmd;
         }
         
-        command_queue->ExecuteCommandLists((UINT)cmds.size(), cmds.data());
+        command_queue->ExecuteCommandLists((UINT)m_command_lists_scratch.size(), m_command_lists_scratch.data());
         m_command_lists_to_execute.clear();
     }
 
     int CommandQueue::clean_up_old_command_buffers(const uint64_t curr_finished_index) {
+        std::lock_guard lock(m_mutex);
+
         int n_cleaned_up = 0;
-        while (m_in_flight_command_buffers.empty() == false) {
-            auto id = m_in_flight_command_buffers.front();
+        while (n_cleaned_up < (int)m_in_flight_command_buffers.size()) {
+            auto id = m_in_flight_command_buffers[n_cleaned_up];
             if (m_command_buffer_pool[id]->is_finished(curr_finished_index)) {
                 // Add it to the reusable list
                 m_command_buffers_to_reuse.push_back(id);
-                m_in_flight_command_buffers.pop_front();
                 ++n_cleaned_up;
                 continue;
             } 
             break;
         }
+
+        // Only a handful are in flight at any time, so shifting the rest down is cheap, and unlike a deque it never allocates
+        m_in_flight_command_buffers.erase(m_in_flight_command_buffers.begin(), m_in_flight_command_buffers.begin() + n_cleaned_up);
         return n_cleaned_up;
     }
 }
@@ -1,7 +1,8 @@
 #pragma once
 #include <d3d12.h>
-#include <deque>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "common.h"
 
@@ -16,6 +17,7 @@ namespace gfx {
         compute
     };
 
+    // Safe to use from multiple threads. Command buffers get executed in the order they were created in
     struct CommandQueue {
         explicit CommandQueue(ID3D12Device* device, CommandBufferType type, const std::wstring& name = L"Unnamed command queue");
         std::shared_ptr<CommandBuffer> create_command_buffer(const Pipeline* pipeline, size_t frame_index);
@@ -27,9 +29,11 @@ namespace gfx {
 
     private:
         CommandBufferType m_type = CommandBufferType::none;
+        std::mutex m_mutex;
         std::vector<std::shared_ptr<CommandBuffer>> m_command_buffer_pool;
         std::vector<std::shared_ptr<CommandBuffer>> m_command_lists_to_execute;
-        std::deque<size_t> m_command_buffers_to_reuse;
-        std::deque<size_t> m_in_flight_command_buffers;
+        std::vector<ID3D12CommandList*> m_command_lists_scratch; // Kept around so `execute()` doesn't allocate every frame
+        std::vector<size_t> m_command_buffers_to_reuse;
+        std::vector<size_t> m_in_flight_command_buffers; // Oldest first
     };
 }
@@ -0,0 +1,323 @@
+#include "cpu_acceleration_structure.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <glm/glm.hpp>
+#include "bvh_packet_kernels.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+#define TLAS_STACK_SIZE 64
+#define TLAS_INSTANCE_BATCH_SIZE 4096
+#define RAY_STREAM_BATCH_SIZE 64 // Packets per batch
+
+namespace gfx {
+    void CpuBlas::build(const glm::vec3* positions, uint32_t n_triangles, ThreadPool* thread_pool) {
+        m_bvh.build(positions, n_triangles, {}, thread_pool);
+        m_wide_bvh.build(m_bvh, positions);
+        m_bounds = {};
+        if (n_triangles > 0) m_bounds = { m_bvh.nodes()[0].min, m_bvh.nodes()[0].max };
+    }
+
+    void CpuTlas::build(const std::vector<CpuRaytracingInstance>& instances, ThreadPool* thread_pool, const BvhBuildSettings& settings) {
+        PROFILE_ZONE("CpuTlas::build");
+        m_n_input_instances = instances.size();
+        m_instance_indices.clear();
+        for (uint32_t i = 0; i < (uint32_t)instances.size(); ++i) {
+            if (instances[i].blas && instances[i].blas->n_triangles() > 0) m_instance_indices.push_back(i);
+        }
+
+        // The bounds have to be there before the build, the instances can only be put in leaf order after it
+        m_bounds.resize(m_instance_indices.size());
+        m_leaf_order.resize(m_instance_indices.size());
+        m_instances.resize(m_instance_indices.size());
+        for (uint32_t i = 0; i < (uint32_t)m_leaf_order.size(); ++i) m_leaf_order[i] = i;
+        update_instances(instances, thread_pool);
+
+        build_bvh_nodes(m_bounds.data(), (uint32_t)m_bounds.size(), settings, thread_pool, m_nodes, m_leaf_order);
+        update_instances(instances, thread_pool);
+    }
+
+    void CpuTlas::refit(const std::vector<CpuRaytracingInstance>& instances, ThreadPool* thread_pool) {
+        PROFILE_ZONE("CpuTlas::refit");
+        assert(instances.size() == m_n_input_instances && "Refitting with different instances, build() instead");
+        update_instances(instances, thread_pool);
+        if (!m_instances.empty()) refit_bvh_nodes(m_nodes, m_leaf_order, m_bounds.data());
+    }
+
+    void CpuTlas::update_instances(const std::vector<CpuRaytracingInstance>& instances, ThreadPool* thread_pool) {
+        auto update = [&](uint32_t begin, uint32_t end, uint32_t) {
+            for (uint32_t i = begin; i < end; ++i) {
+                const uint32_t build_index = m_leaf_order[i];
+                const uint32_t instance_index = m_instance_indices[build_index];
+                const CpuRaytracingInstance& instance = instances[instance_index];
+
+                // World space bounds of the BLAS's bounds. Transforming the center and extent is the same as transforming all 8
+                // corners, with fewer instructions
+                const BvhBounds blas_bounds = instance.blas->bounds();
+                const glm::mat3 linear = glm::mat3(instance.transform);
+                const glm::vec3 center = instance.transform * glm::vec4((blas_bounds.min + blas_bounds.max) * 0.5f, 1.0f);
+                const glm::vec3 half_extent = (blas_bounds.max - blas_bounds.min) * 0.5f;
+                const glm::vec3 world_half_extent = glm::abs(linear[0]) * half_extent.x + glm::abs(linear[1]) * half_extent.y + glm::abs(linear[2]) * half_extent.z;
+                m_bounds[build_index] = { center - world_half_extent, center + world_half_extent };
+
+                m_instances[i] = {
+                    .world_to_object = glm::mat4x3(glm::inverse(glm::mat4(instance.transform))),
+                    .blas = instance.blas,
+                    .instance_index = instance_index,
+                    .instance_id = instance.instance_id,
+                };
+            }
+        };
+        if (thread_pool) thread_pool->parallel_for((uint32_t)m_instances.size(), TLAS_INSTANCE_BATCH_SIZE, update);
+        else update(0, (uint32_t)m_instances.size(), 0);
+    }
+
+    static float intersect_box(const BvhNode& node, glm::vec3 origin, glm::vec3 inv_direction, float t_min, float t_max) {
+        const glm::vec3 t0 = (node.min - origin) * inv_direction;
+        const glm::vec3 t1 = (node.max - origin) * inv_direction;
+        const glm::vec3 t_near = glm::min(t0, t1);
+        const glm::vec3 t_far = glm::max(t0, t1);
+        const float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, t_min));
+        const float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, t_max));
+        return (enter <= exit) ? enter : INFINITY;
+    }
+
+    bool CpuTlas::intersect_closest(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, CpuTlasHit& hit) const {
+        if (m_instances.empty()) return false;
+        const glm::vec3 inv_direction = 1.0f / direction;
+        if (intersect_box(m_nodes[0], origin, inv_direction, t_min, t_max) == INFINITY) return false;
+
+        bool found_hit = false;
+        uint32_t stack[TLAS_STACK_SIZE];
+        uint32_t stack_size = 0;
+        uint32_t node_index = 0;
+        while (true) {
+            const BvhNode& node = m_nodes[node_index];
+            if (node.count > 0) {
+                // The direction isn't normalized after the transform, so `t` means the same thing in both spaces
+                for (uint32_t i = node.left_first; i < node.left_first + node.count; ++i) {
+                    const Instance& instance = m_instances[i];
+                    const glm::vec3 object_origin = instance.world_to_object * glm::vec4(origin, 1.0f);
+                    const glm::vec3 object_direction = instance.world_to_object * glm::vec4(direction, 0.0f);
+                    BvhHit blas_hit;
+                    if (instance.blas->intersect_closest(object_origin, object_direction, t_min, t_max, blas_hit)) {
+                        t_max = blas_hit.t;
+                        hit = { blas_hit.t, blas_hit.barycentrics, instance.instance_index, instance.instance_id, blas_hit.triangle_index };
+                        found_hit = true;
+                    }
+                }
+            }
+            else {
+                // Visit the closest child first, and only push the other one if the ray hits it at all
+                const uint32_t left = node.left_first;
+                const float t_left = intersect_box(m_nodes[left], origin, inv_direction, t_min, t_max);
+                const float t_right = intersect_box(m_nodes[left + 1], origin, inv_direction, t_min, t_max);
+                if (t_left != INFINITY || t_right != INFINITY) {
+                    const bool left_first = t_left <= t_right;
+                    if (std::max(t_left, t_right) != INFINITY) stack[stack_size++] = left_first ? left + 1 : left;
+                    node_index = left_first ? left : left + 1;
+                    continue;
+                }
+            }
+
+            // Pop until we find a node that's still in front of the closest hit
+            bool found_node = false;
+            while (stack_size > 0) {
+                node_index = stack[--stack_size];
+                if (intersect_box(m_nodes[node_index], origin, inv_direction, t_min, t_max) != INFINITY) {
+                    found_node = true;
+                    break;
+                }
+            }
+            if (!found_node) break;
+        }
+        return found_hit;
+    }
+
+    bool CpuTlas::intersect_any(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) const {
+        if (m_instances.empty()) return false;
+        const glm::vec3 inv_direction = 1.0f / direction;
+
+        uint32_t stack[TLAS_STACK_SIZE];
+        uint32_t stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const BvhNode& node = m_nodes[stack[--stack_size]];
+            if (intersect_box(node, origin, inv_direction, t_min, t_max) == INFINITY) continue;
+            if (node.count > 0) {
+                for (uint32_t i = node.left_first; i < node.left_first + node.count; ++i) {
+                    const Instance& instance = m_instances[i];
+                    const glm::vec3 object_origin = instance.world_to_object * glm::vec4(origin, 1.0f);
+                    const glm::vec3 object_direction = instance.world_to_object * glm::vec4(direction, 0.0f);
+                    if (instance.blas->intersect_any(object_origin, object_direction, t_min, t_max)) return true;
+                }
+                continue;
+            }
+            stack[stack_size++] = node.left_first;
+            stack[stack_size++] = node.left_first + 1;
+        }
+        return false;
+    }
+
+    void CpuTlas::intersect_packet(RayPacket& packet, bool any_hit) const {
+        packet.hit = 0;
+        if (m_instances.empty() || packet.active == 0) return;
+
+        // An incoherent packet splits up right away, and then visits most nodes with only a lane or two active. Tracing its
+        // rays one by one through the wide BVHs is faster
+        if (!packet.is_coherent()) {
+            for (uint32_t lanes = packet.active; lanes != 0; lanes &= lanes - 1) {
+                const int lane = count_trailing_zeros(lanes);
+                const glm::vec3 origin = glm::vec3(packet.origin[0][lane], packet.origin[1][lane], packet.origin[2][lane]);
+                const glm::vec3 direction = glm::vec3(packet.direction[0][lane], packet.direction[1][lane], packet.direction[2][lane]);
+                if (any_hit) {
+                    if (intersect_any(origin, direction, packet.t_min[lane], packet.t_max[lane])) packet.hit |= 1u << lane;
+                    continue;
+                }
+                CpuTlasHit hit;
+                if (!intersect_closest(origin, direction, packet.t_min[lane], packet.t_max[lane], hit)) continue;
+                packet.t_max[lane] = hit.t;
+                packet.barycentrics[0][lane] = hit.barycentrics.x;
+                packet.barycentrics[1][lane] = hit.barycentrics.y;
+                packet.triangle_index[lane] = hit.triangle_index;
+                packet.instance_index[lane] = hit.instance_index;
+                packet.instance_id[lane] = hit.instance_id;
+                packet.hit |= 1u << lane;
+            }
+            return;
+        }
+
+        float inv_direction[3][RAY_PACKET_SIZE];
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int lane = 0; lane < RAY_PACKET_SIZE; ++lane) inv_direction[axis][lane] = 1.0f / packet.direction[axis][lane];
+        }
+        const PacketFrustum frustum = make_packet_frustum(packet, inv_direction);
+
+        struct StackEntry {
+            uint32_t node;
+            uint32_t lanes;
+        };
+        StackEntry stack[TLAS_STACK_SIZE * 2];
+        uint32_t stack_size = 0;
+        stack[stack_size++] = { 0, packet.active };
+        while (stack_size > 0) {
+            const StackEntry entry = stack[--stack_size];
+            uint32_t lanes = any_hit ? (entry.lanes & ~packet.hit) : entry.lanes;
+            if (lanes == 0) continue;
+
+            const BvhNode& node = m_nodes[entry.node];
+            if (frustum.is_valid && frustum_misses_box(frustum, node)) continue;
+            for (uint32_t bits = lanes; bits != 0; bits &= bits - 1) {
+                const int lane = count_trailing_zeros(bits);
+                const glm::vec3 origin = glm::vec3(packet.origin[0][lane], packet.origin[1][lane], packet.origin[2][lane]);
+                const glm::vec3 inv_dir = glm::vec3(inv_direction[0][lane], inv_direction[1][lane], inv_direction[2][lane]);
+                if (intersect_box(node, origin, inv_dir, packet.t_min[lane], packet.t_max[lane]) == INFINITY) lanes &= ~(1u << lane);
+            }
+            if (lanes == 0) continue;
+
+            if (node.count > 0) {
+                for (uint32_t i = node.left_first; i < node.left_first + node.count && lanes != 0; ++i) {
+                    // Same transform as the single ray path, so both find the same hits
+                    const Instance& instance = m_instances[i];
+                    RayPacket object_packet;
+                    object_packet.active = lanes;
+                    for (uint32_t bits = lanes; bits != 0; bits &= bits - 1) {
+                        const int lane = count_trailing_zeros(bits);
+                        const glm::vec3 origin = instance.world_to_object * glm::vec4(packet.origin[0][lane], packet.origin[1][lane], packet.origin[2][lane], 1.0f);
+                        const glm::vec3 direction = instance.world_to_object * glm::vec4(packet.direction[0][lane], packet.direction[1][lane], packet.direction[2][lane], 0.0f);
+                        for (int axis = 0; axis < 3; ++axis) {
+                            object_packet.origin[axis][lane] = origin[axis];
+                            object_packet.direction[axis][lane] = direction[axis];
+                        }
+                        object_packet.t_min[lane] = packet.t_min[lane];
+                        object_packet.t_max[lane] = packet.t_max[lane];
+                    }
+                    // The inactive lanes still get loaded by the SIMD kernels, so they need valid numbers
+                    for (uint32_t bits = ~lanes & ((1u << RAY_PACKET_SIZE) - 1); bits != 0; bits &= bits - 1) {
+                        const int lane = count_trailing_zeros(bits);
+                        for (int axis = 0; axis < 3; ++axis) {
+                            object_packet.origin[axis][lane] = 0.0f;
+                            object_packet.direction[axis][lane] = 1.0f;
+                        }
+                        object_packet.t_min[lane] = 0.0f;
+                        object_packet.t_max[lane] = 0.0f;
+                    }
+
+                    instance.blas->intersect_packet(object_packet, any_hit);
+                    packet.hit |= object_packet.hit;
+                    if (any_hit) {
+                        lanes &= ~object_packet.hit;
+                        continue;
+                    }
+                    for (uint32_t bits = object_packet.hit; bits != 0; bits &= bits - 1) {
+                        const int lane = count_trailing_zeros(bits);
+                        packet.t_max[lane] = object_packet.t_max[lane];
+                        packet.barycentrics[0][lane] = object_packet.barycentrics[0][lane];
+                        packet.barycentrics[1][lane] = object_packet.barycentrics[1][lane];
+                        packet.triangle_index[lane] = object_packet.triangle_index[lane];
+                        packet.instance_index[lane] = instance.instance_index;
+                        packet.instance_id[lane] = instance.instance_id;
+                    }
+                }
+                continue;
+            }
+
+            // Like the BLAS packets, visit the children in the order the rays pass them
+            const BvhNode& left = m_nodes[node.left_first];
+            const BvhNode& right = m_nodes[node.left_first + 1];
+            const glm::vec3 delta = (right.min + right.max) - (left.min + left.max);
+            const glm::vec3 abs_delta = glm::abs(delta);
+            const int axis = (abs_delta.x > abs_delta.y) ? ((abs_delta.x > abs_delta.z) ? 0 : 2) : ((abs_delta.y > abs_delta.z) ? 1 : 2);
+            const bool right_first = (delta[axis] < 0.0f) == frustum.is_positive[axis];
+            stack[stack_size++] = { right_first ? node.left_first : node.left_first + 1, lanes };
+            stack[stack_size++] = { right_first ? node.left_first + 1 : node.left_first, lanes };
+        }
+    }
+
+    void CpuTlas::intersect_stream(RayStream& stream, bool any_hit, ThreadPool* thread_pool) const {
+        auto trace = [&](uint32_t begin, uint32_t end, uint32_t) {
+            for (uint32_t i = begin; i < end; ++i) intersect_packet(stream.packets[i], any_hit);
+        };
+        if (thread_pool) thread_pool->parallel_for((uint32_t)stream.packets.size(), RAY_STREAM_BATCH_SIZE, trace);
+        else trace(0, (uint32_t)stream.packets.size(), 0);
+    }
+
+    void RayStream::add(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) {
+        const uint32_t lane = n_rays % RAY_PACKET_SIZE;
+        if (lane == 0) {
+            // Unused lanes get harmless values, the SIMD kernels load them even though they're inactive
+            RayPacket& packet = packets.emplace_back();
+            for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+                for (int axis = 0; axis < 3; ++axis) {
+                    packet.origin[axis][i] = 0.0f;
+                    packet.direction[axis][i] = 1.0f;
+                }
+                packet.t_min[i] = 0.0f;
+                packet.t_max[i] = 0.0f;
+            }
+        }
+        RayPacket& packet = packets.back();
+        for (int axis = 0; axis < 3; ++axis) {
+            packet.origin[axis][lane] = origin[axis];
+            packet.direction[axis][lane] = direction[axis];
+        }
+        packet.t_min[lane] = t_min;
+        packet.t_max[lane] = t_max;
+        packet.active |= 1u << lane;
+        n_rays++;
+    }
+
+    CpuTlasHit RayStream::hit(uint32_t ray_index) const {
+        const RayPacket& packet = packets[ray_index / RAY_PACKET_SIZE];
+        const uint32_t lane = ray_index % RAY_PACKET_SIZE;
+        return {
+            .t = packet.t_max[lane],
+            .barycentrics = glm::vec2(packet.barycentrics[0][lane], packet.barycentrics[1][lane]),
+            .instance_index = packet.instance_index[lane],
+            .instance_id = packet.instance_id[lane],
+            .triangle_index = packet.triangle_index[lane],
+        };
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/mat4x3.hpp>
+#include "bvh.h"
+#include "wide_bvh.h"
+
+namespace gfx {
+    struct ThreadPool;
+
+    // Bottom level: one mesh's triangles in object space. Built once, and shared by every instance that uses it
+    struct CpuBlas {
+        void build(const glm::vec3* positions, uint32_t n_triangles, ThreadPool* thread_pool = nullptr);
+
+        bool intersect_closest(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, BvhHit& hit) const { return m_wide_bvh.intersect_closest(origin, direction, t_min, t_max, hit); }
+        bool intersect_any(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) const { return m_wide_bvh.intersect_any(origin, direction, t_min, t_max); }
+        void intersect_packet(RayPacket& packet, bool any_hit) const { m_bvh.intersect_packet(packet, any_hit); } // Packets trace the binary BVH
+        BvhBounds bounds() const { return m_bounds; }
+        uint32_t n_triangles() const { return m_bvh.n_triangles(); }
+
+    private:
+        Bvh m_bvh;
+        WideBvh m_wide_bvh; // Collapsed from `m_bvh`, this is what rays get traced against
+        BvhBounds m_bounds;
+    };
+
+    // Same shape as the renderer's `RaytracingInstance`
+    struct CpuRaytracingInstance {
+        glm::mat4x3 transform; // Object space to world space
+        uint32_t instance_id; // Handed back in hits, like `CommittedInstanceID()`
+        const CpuBlas* blas;
+    };
+
+    struct CpuTlasHit {
+        float t;
+        glm::vec2 barycentrics; // Weights of the triangle's second and third vertex
+        uint32_t instance_index; // Index in the instances the TLAS was built from, like `CommittedInstanceIndex()`
+        uint32_t instance_id;
+        uint32_t triangle_index; // Within the BLAS, like `CommittedPrimitiveIndex()`
+    };
+
+    // Any number of rays, stored as packets in the order they were added. Rays that are next to each other should start close
+    // together and go roughly the same way, like camera rays in 4x4 pixel tiles or shadow rays towards the sun, so the packets
+    // are coherent. Everything else still works, one ray at a time
+    struct RayStream {
+        std::vector<RayPacket> packets;
+        uint32_t n_rays = 0;
+
+        void clear() { packets.clear(); n_rays = 0; }
+        void add(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max);
+        bool is_hit(uint32_t ray_index) const { return (packets[ray_index / RAY_PACKET_SIZE].hit >> (ray_index % RAY_PACKET_SIZE)) & 1; }
+        CpuTlasHit hit(uint32_t ray_index) const; // Only valid if `is_hit()`, and the stream was traced for the closest hits
+    };
+
+    // Top level: a BVH over the world space bounds of every instance. Rays get transformed into an instance's object space
+    // and traced against its BLAS, so moving instances around only needs a refit or a TLAS rebuild, never a BLAS rebuild.
+    // Instances with an empty BLAS are left out, they can't be hit anyway
+    struct CpuTlas {
+        void build(const std::vector<CpuRaytracingInstance>& instances, ThreadPool* thread_pool = nullptr, const BvhBuildSettings& settings = {});
+        // Updates the transforms without changing the tree. `instances` has to have the same instances and BLASes as the last
+        // `build()`, only the transforms can change. Traversal gets slower the further they move, rebuild every now and then
+        void refit(const std::vector<CpuRaytracingInstance>& instances, ThreadPool* thread_pool = nullptr);
+
+        bool intersect_closest(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, CpuTlasHit& hit) const;
+        bool intersect_any(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) const;
+        // Coherent packets go through the TLAS and the BLASes as a whole, the rest get traced one ray at a time
+        void intersect_packet(RayPacket& packet, bool any_hit) const;
+        void intersect_stream(RayStream& stream, bool any_hit, ThreadPool* thread_pool = nullptr) const;
+
+        uint32_t n_instances() const { return (uint32_t)m_instances.size(); }
+        const std::vector<BvhNode>& nodes() const { return m_nodes; }
+
+    private:
+        struct Instance {
+            glm::mat4x3 world_to_object;
+            const CpuBlas* blas;
+            uint32_t instance_index;
+            uint32_t instance_id;
+        };
+        void update_instances(const std::vector<CpuRaytracingInstance>& instances, ThreadPool* thread_pool);
+
+        std::vector<BvhNode> m_nodes;
+        std::vector<Instance> m_instances; // In leaf order
+        std::vector<BvhBounds> m_bounds; // World space, in the order the BVH was built from
+        std::vector<uint32_t> m_leaf_order; // Leaf order to build order
+        std::vector<uint32_t> m_instance_indices; // Build order to index in `instances`, skipping the empty BLASes
+        size_t m_n_input_instances = 0;
+    };
+}
@@ -0,0 +1,396 @@
+#include "cpu_pathtracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <glm/glm.hpp>
+#include <stb/stb_image_write.h>
+#include "cpu_scene.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "log.h"
+
+// Same constants as pathtrace.cs.hlsl
+#define PI 3.14159265358979f
+#define FULLBRIGHT_NITS 200.0f
+#define N_ACCUM_FRAMES 10240
+#define RAY_T_MAX 100000.0f
+
+namespace gfx {
+    // The functions below are straight ports of the ones in pathtrace.cs.hlsl, keep them in sync
+    static uint32_t pcg_hash(uint32_t input) {
+        const uint32_t state = input * 747796405u + 2891336453u;
+        const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    static float radical_inverse_vdc(uint32_t bits) {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return float(bits) * 2.3283064365386963e-10f; // / 0x100000000
+    }
+
+    // Material ids past the end of the material buffer (like 0xFFFF for "no material") read zeroes on the GPU, so they get this.
+    // Not the default constructed one, that has white multipliers and no textures
+    static const Material out_of_bounds_material = {
+        .color_multiplier = glm::vec4(0.0f),
+        .emissive_multiplier = glm::vec3(0.0f),
+        .color_texture = ResourceHandle{},
+        .normal_texture = ResourceHandle{},
+        .metal_roughness_texture = ResourceHandle{},
+        .emissive_texture = ResourceHandle{},
+        .normal_intensity = 0.0f,
+        .roughness_multiplier = 0.0f,
+        .metallic_multiplier = 0.0f,
+        .reserved = 0,
+    };
+
+    static glm::vec2 hammersley(uint32_t i, uint32_t n) {
+        return glm::vec2(float(i) / float(n), radical_inverse_vdc(i));
+    }
+
+    static glm::vec3 cosine_weighted_sample_diffuse(glm::vec2 xi, glm::vec3 n) {
+        const float phi = 2 * PI * xi.x;
+        const float cos_theta = sqrtf(1.0f - xi.y);
+        const float sin_theta = sqrtf(xi.y);
+        const glm::vec3 h = glm::vec3(sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta);
+
+        const glm::vec3 up = (fabsf(n.z) < 0.999f) ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+        const glm::vec3 tangent_x = glm::normalize(glm::cross(up, n));
+        const glm::vec3 tangent_y = glm::cross(n, tangent_x);
+        return (tangent_x * h.x) + (tangent_y * h.y) + (n * h.z);
+    }
+
+    static glm::vec3 importance_sample_ggx(glm::vec2 xi, glm::vec3 r, float roughness) {
+        const float a = roughness;
+        const float phi = 2 * PI * xi.x;
+        const float cos_theta = sqrtf((1 - xi.y) / (1 + (a * a - 1) * xi.y));
+        const float sin_theta = sqrtf(1 - cos_theta * cos_theta);
+        const glm::vec3 h = glm::vec3(sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta);
+
+        const glm::vec3 up = (fabsf(r.z) < 0.999f) ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+        const glm::vec3 tangent_x = glm::normalize(glm::cross(up, r));
+        const glm::vec3 tangent_y = glm::cross(r, tangent_x);
+        return (tangent_x * h.x) + (tangent_y * h.y) + (r * h.z);
+    }
+
+    static glm::vec3 fresnel_schlick(float cos_theta, glm::vec3 f0, float roughness) {
+        const glm::vec3 smooth = glm::vec3(1.0f - roughness);
+        return f0 + (glm::max(smooth, f0) - f0) * powf(1.0f - cos_theta, 5.0f);
+    }
+
+    static float geometry_schlick_ggx(float n_dot_v, float roughness) {
+        const float r = (roughness + 1.0f);
+        const float k = (r * r) / 8.0f;
+        return n_dot_v / (n_dot_v * (1.0f - k) + k);
+    }
+
+    static float saturate(float value) {
+        return glm::clamp(value, 0.0f, 1.0f);
+    }
+
+    struct SurfaceInfo {
+        glm::vec4 color;
+        glm::vec3 normal_pbr;
+        glm::vec3 normal_geo;
+        float roughness;
+        glm::vec3 emissive;
+        float metallic;
+    };
+
+    static SurfaceInfo get_surface_info(const CpuScene& scene, const CpuHit& hit) {
+        const CpuMesh& mesh = scene.meshes[hit.mesh_index];
+        const glm::mat3 obj_to_world = glm::mat3(mesh.global_transform);
+        const uint32_t vertex_index = hit.triangle_index * 3;
+
+        // Decompress vertices
+        glm::vec3 normals[3], tangents[3], bitangents[3];
+        glm::vec4 colors[3];
+        glm::vec2 texcoords[3];
+        for (uint32_t i = 0; i < 3; ++i) {
+            const VertexCompressed& vert = mesh.vertices[vertex_index + i];
+            normals[i] = (glm::vec3(vert.normal) - 127.0f) / 127.0f;
+            tangents[i] = (glm::vec3(vert.tangent) - 127.0f) / 127.0f;
+            const float tangent_sign = ((float)vert.flags1.tangent_sign * 2.0f) - 1.0f;
+            bitangents[i] = glm::cross(normals[i], tangents[i]) * tangent_sign;
+            colors[i] = glm::vec4(vert.color) / 1023.0f;
+            texcoords[i] = vert.texcoord0;
+        }
+        const uint32_t material_id = mesh.vertices[vertex_index].material_id;
+
+        // Interpolate vertices
+        SurfaceInfo info;
+        const glm::vec2 bary = hit.barycentrics;
+        const glm::vec2 texcoord0 = texcoords[0] + ((texcoords[1] - texcoords[0]) * bary.x) + ((texcoords[2] - texcoords[0]) * bary.y);
+        info.normal_geo = normals[0] + ((normals[1] - normals[0]) * bary.x) + ((normals[2] - normals[0]) * bary.y);
+        info.color = colors[0] + ((colors[1] - colors[0]) * bary.x) + ((colors[2] - colors[0]) * bary.y);
+        info.metallic = 0.0f;
+        info.roughness = 1.0f;
+        info.emissive = glm::vec3(0.0f);
+
+        // Transform to world space
+        info.normal_geo = obj_to_world * info.normal_geo;
+
+        const Material& material = (material_id < scene.materials.size()) ? scene.materials[material_id] : out_of_bounds_material;
+
+        // Color
+        if (material.color_texture.is_loaded != 0) {
+            info.color *= scene.textures[material.color_texture.id].sample(texcoord0);
+        }
+
+        // Normal
+        if (material.normal_texture.is_loaded != 0) {
+            glm::vec3 bitangent = bitangents[0] + ((bitangents[1] - bitangents[0]) * bary.x) + ((bitangents[2] - bitangents[0]) * bary.y);
+            glm::vec3 tangent = tangents[0] + ((tangents[1] - tangents[0]) * bary.x) + ((tangents[2] - tangents[0]) * bary.y);
+            tangent = obj_to_world * tangent;
+            bitangent = obj_to_world * bitangent;
+
+            const glm::vec3 tex_normal = (glm::vec3(scene.textures[material.normal_texture.id].sample(texcoord0)) * 2.0f) - 1.0f;
+            const glm::vec3 default_normal = glm::vec3(0.0f, 0.0f, 1.0f);
+            const glm::vec3 interpolated_normal = glm::mix(default_normal, tex_normal, material.normal_intensity);
+            info.normal_pbr = tangent * interpolated_normal.x + bitangent * interpolated_normal.y + info.normal_geo * interpolated_normal.z;
+        }
+        else {
+            info.normal_pbr = info.normal_geo;
+        }
+        info.normal_geo = glm::normalize(info.normal_geo);
+        info.normal_pbr = glm::normalize(info.normal_pbr);
+
+        // Metal & roughness
+        info.metallic = material.metallic_multiplier;
+        info.roughness = material.roughness_multiplier;
+        if (material.metal_roughness_texture.is_loaded != 0) {
+            const glm::vec4 metal_roughness = scene.textures[material.metal_roughness_texture.id].sample(texcoord0);
+            info.metallic *= metal_roughness.z;
+            info.roughness *= metal_roughness.y;
+        }
+
+        // Emissive
+        if (material.emissive_texture.is_loaded != 0) {
+            const glm::vec3 tex_emissive = glm::vec3(scene.textures[material.emissive_texture.id].sample(texcoord0));
+            info.emissive = tex_emissive * material.emissive_multiplier;
+        }
+
+        return info;
+    }
+
+    // One invocation of the compute shader, minus the accumulation. Returns the value that gets added to the accumulation buffer
+    static glm::vec3 trace_pixel(const CpuScene& scene, const CpuCamera& camera, const CpuPathTracerSettings& settings, uint32_t x, uint32_t y, uint32_t frame_index, uint64_t& n_rays) {
+        // Generate random number for this pixel
+        const uint32_t n_sample_indices = 67 * 67 * settings.n_bounces * settings.n_samples * N_ACCUM_FRAMES;
+        uint32_t sample_index = 0;
+        sample_index = (sample_index * 0) + (x % 67);
+        sample_index = (sample_index * 67) + (y % 67);
+        sample_index = (sample_index * N_ACCUM_FRAMES) + frame_index;
+        sample_index = pcg_hash(sample_index);
+
+        // Get normalized screen UV coordinates, from -1.0 to +1.0
+        const glm::vec2 resolution = glm::vec2((float)settings.width, (float)settings.height);
+        glm::vec2 jitter = glm::vec2(0.0f);
+        if (settings.enable_anti_aliasing) {
+            jitter = glm::vec2(
+                float((sample_index >> 0) % 256) / 256.0f,
+                float((sample_index >> 8) % 256) / 256.0f
+            );
+        }
+        const glm::vec2 uv = ((glm::vec2((float)x, (float)y) + jitter) / resolution) * 2.0f - 1.0f;
+
+        // Calculate view direction
+        const glm::vec3 view_direction_vs = glm::normalize(glm::vec3(camera.viewport_size * glm::vec2(uv.x, -uv.y), -1.0f));
+        const glm::vec3 view_direction_ws = glm::normalize(camera.rotation * view_direction_vs);
+
+        glm::vec3 light = glm::vec3(0.0f);
+        for (uint32_t s = 0; s < settings.n_samples; ++s) {
+            glm::vec3 ray_tint = glm::vec3(1.0f);
+            glm::vec3 ray_origin = camera.position;
+            glm::vec3 ray_direction = view_direction_ws;
+
+            for (uint32_t i = 0; i < settings.n_bounces; ++i) {
+                // Get new random number
+                sample_index = (sample_index * settings.n_bounces) + i;
+                sample_index = (sample_index * settings.n_samples) + s;
+                sample_index = pcg_hash(sample_index);
+
+                // Trace
+                CpuHit hit;
+                n_rays++;
+                if (!scene.trace(ray_origin, ray_direction, 0.0f, RAY_T_MAX, hit)) {
+                    // Miss? Sample sky
+                    const float multiplier = (i == 0) ? 0.5f : 1.0f;
+                    light += scene.sample_sky(ray_direction) * ray_tint * multiplier;
+                    break;
+                }
+
+                // Add contribution and pick a random direction along the normal for the next ray
+                const SurfaceInfo info = get_surface_info(scene, hit);
+                light += info.emissive * ray_tint * saturate(glm::dot(info.normal_pbr, -ray_direction));
+                ray_origin += hit.t * ray_direction;
+
+                const glm::vec3 f0 = glm::mix(glm::vec3(0.04f), glm::vec3(info.color), glm::vec3(info.metallic));
+                const uint32_t jittered_checkerboard = (x % 2) ^ (y % 2) ^ (frame_index % 2);
+                const float random_float = float(sample_index % 65536) / 65536.0f;
+
+                if (jittered_checkerboard && random_float > info.metallic) {
+                    // Diffuse
+                    ray_direction = cosine_weighted_sample_diffuse(hammersley(sample_index % n_sample_indices, n_sample_indices), info.normal_pbr);
+                    ray_origin += info.normal_geo * 0.0001f; // Bias against self intersection
+                    ray_tint *= glm::vec3(info.color);
+                }
+                else {
+                    // Specular
+                    const glm::vec3 reflection = glm::reflect(ray_direction, info.normal_pbr);
+                    const glm::vec2 xi = hammersley(sample_index % n_sample_indices, n_sample_indices);
+
+                    // Low roughness values cause float precision issues, which results in NaNs
+                    const float roughness2 = glm::clamp(info.roughness * info.roughness, 0.01f, 1.0f);
+                    ray_direction = importance_sample_ggx(xi, reflection, roughness2);
+                    ray_origin += ray_direction * 0.0001f; // Bias against self intersection
+
+                    const float n_dot_d = saturate(glm::dot(ray_direction, info.normal_pbr));
+                    const glm::vec3 specular_f = fresnel_schlick(n_dot_d, f0, roughness2);
+                    const float g = geometry_schlick_ggx(n_dot_d, roughness2);
+                    ray_tint *= specular_f * g;
+                }
+            }
+        }
+
+        // * 2 because we split the diffuse and specular terms
+        return 2.0f * light / (float)settings.n_samples;
+    }
+
+    // A run of tiles that one thread works through front to back, while other threads steal from the back
+    struct alignas(64) TileQueue {
+        std::mutex mutex;
+        uint32_t front = 0;
+        uint32_t back = 0;
+    };
+
+    struct alignas(64) WorkerStats {
+        uint64_t n_rays = 0;
+        uint64_t n_tiles_stolen = 0;
+    };
+
+    CpuImage CpuPathTracer::render(const CpuScene& scene, const CpuCamera& camera, ThreadPool& thread_pool) {
+        PROFILE_ZONE("CpuPathTracer::render");
+        const auto start_time = std::chrono::steady_clock::now();
+
+        CpuImage image;
+        image.width = settings.width;
+        image.height = settings.height;
+        image.pixels.resize((size_t)settings.width * (size_t)settings.height);
+
+        const uint32_t tile_size = std::max(settings.tile_size, 1u);
+        const uint32_t n_tiles_x = (settings.width + tile_size - 1) / tile_size;
+        const uint32_t n_tiles_y = (settings.height + tile_size - 1) / tile_size;
+        const uint32_t n_tiles = n_tiles_x * n_tiles_y;
+
+        // Every worker starts out with an equal run of neighbouring tiles, so they mostly touch the same parts of the BVH
+        const uint32_t n_workers = thread_pool.n_threads();
+        auto queues = std::make_unique<TileQueue[]>(n_workers);
+        auto worker_stats = std::make_unique<WorkerStats[]>(n_workers);
+        for (uint32_t i = 0; i < n_workers; ++i) {
+            queues[i].front = (uint32_t)((uint64_t)n_tiles * i / n_workers);
+            queues[i].back = (uint32_t)((uint64_t)n_tiles * (i + 1) / n_workers);
+        }
+
+        auto pop_tile = [&](uint32_t worker, uint32_t& tile) {
+            std::lock_guard lock(queues[worker].mutex);
+            if (queues[worker].front == queues[worker].back) return false;
+            tile = queues[worker].front++;
+            return true;
+        };
+
+        // Takes the back half of the first queue that still has tiles left
+        auto steal_tiles = [&](uint32_t worker) {
+            for (uint32_t offset = 1; offset < n_workers; ++offset) {
+                TileQueue& victim = queues[(worker + offset) % n_workers];
+                uint32_t stolen_front, stolen_back;
+                {
+                    std::lock_guard lock(victim.mutex);
+                    const uint32_t n_left = victim.back - victim.front;
+                    if (n_left == 0) continue;
+                    stolen_back = victim.back;
+                    stolen_front = victim.back - (n_left + 1) / 2;
+                    victim.back = stolen_front;
+                }
+                std::lock_guard lock(queues[worker].mutex);
+                queues[worker].front = stolen_front;
+                queues[worker].back = stolen_back;
+                worker_stats[worker].n_tiles_stolen += stolen_back - stolen_front;
+                return true;
+            }
+            return false;
+        };
+
+        thread_pool.parallel_for(n_workers, 1, [&](uint32_t begin, uint32_t, uint32_t) {
+            PROFILE_ZONE("Path trace tiles");
+            const uint32_t worker = begin;
+            uint64_t n_rays = 0;
+            uint32_t tile;
+            while (true) {
+                if (!pop_tile(worker, tile)) {
+                    if (steal_tiles(worker)) continue; // Someone might steal them right back before we get to them, so try again
+                    break;
+                }
+                const uint32_t x_begin = (tile % n_tiles_x) * tile_size;
+                const uint32_t y_begin = (tile / n_tiles_x) * tile_size;
+                const uint32_t x_end = std::min(x_begin + tile_size, settings.width);
+                const uint32_t y_end = std::min(y_begin + tile_size, settings.height);
+                for (uint32_t y = y_begin; y < y_end; ++y) {
+                    for (uint32_t x = x_begin; x < x_end; ++x) {
+                        // Same as the accumulation buffer after `n_frames` frames
+                        glm::vec4 accumulated = glm::vec4(0.0f);
+                        for (uint32_t frame = 0; frame < settings.n_frames; ++frame) {
+                            accumulated += glm::vec4(trace_pixel(scene, camera, settings, x, y, settings.first_frame_index + frame, n_rays), 1.0f);
+                        }
+                        image.pixels[(size_t)y * settings.width + x] = FULLBRIGHT_NITS * glm::vec3(accumulated) / std::max(accumulated.w, 1.0f);
+                    }
+                }
+            }
+            worker_stats[worker].n_rays += n_rays;
+        });
+
+        stats = {};
+        stats.n_tiles = n_tiles;
+        for (uint32_t i = 0; i < n_workers; ++i) {
+            stats.n_rays += worker_stats[i].n_rays;
+            stats.n_tiles_stolen += worker_stats[i].n_tiles_stolen;
+        }
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        return image;
+    }
+
+    bool CpuImage::write(const std::string& path) const {
+        if (path.ends_with(".hdr")) {
+            if (!stbi_write_hdr(path.c_str(), (int)width, (int)height, 3, (const float*)pixels.data())) {
+                LOG(Error, "Could not write image '%s'", path.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        if (path.ends_with(".pfm")) {
+            FILE* file = fopen(path.c_str(), "wb");
+            if (!file) {
+                LOG(Error, "Could not open '%s' for writing", path.c_str());
+                return false;
+            }
+            // Negative scale means little endian, and the rows go from the bottom to the top
+            fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+            for (uint32_t y = height; y > 0; --y) {
+                fwrite(&pixels[(size_t)(y - 1) * width], sizeof(glm::vec3), width, file);
+            }
+            fclose(file);
+            return true;
+        }
+
+        LOG(Error, "Unknown image format for '%s', use .hdr or .pfm", path.c_str());
+        return false;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace gfx {
+    struct CpuScene;
+    struct ThreadPool;
+
+    // Same values as the renderer's `ViewData`
+    struct CpuCamera {
+        glm::vec3 position{ 0.0f, 0.0f, 0.0f };
+        glm::quat rotation{ 1.0f, 0.0f, 0.0f, 0.0f };
+        glm::vec2 viewport_size{ 1.0f, 1.0f }; // tan(fov / 2) * aspect ratio, tan(fov / 2)
+    };
+
+    // Defaults match the root constants `Renderer` passes to pathtrace.cs.hlsl
+    struct CpuPathTracerSettings {
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        uint32_t n_samples = 4; // Rays per pixel per frame
+        uint32_t n_bounces = 4;
+        uint32_t n_frames = 16; // Accumulated like the GPU accumulation buffer
+        uint32_t first_frame_index = 0; // `frame_index` of the first frame, it seeds the random numbers
+        bool enable_anti_aliasing = true;
+        uint32_t tile_size = 16;
+    };
+
+    struct CpuRenderStats {
+        uint64_t n_rays = 0; // Every ray that got traced, including bounces
+        uint64_t n_tiles = 0;
+        uint64_t n_tiles_stolen = 0; // Tiles a thread took from another thread's queue
+        double seconds = 0.0;
+        double rays_per_second() const { return (seconds > 0.0) ? (double)n_rays / seconds : 0.0; }
+    };
+
+    // Linear HDR, the same values the path tracer writes to its output texture, top row first
+    struct CpuImage {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<glm::vec3> pixels;
+
+        bool write(const std::string& path) const; // .hdr (Radiance) or .pfm, depending on the extension
+    };
+
+    // Reference implementation of pathtrace.cs.hlsl: same random numbers, same sampling, same BRDF. Textures are always sampled
+    // from the top mip level, and the sky comes straight from the HDRI instead of a cube map, so expect small differences there.
+    // The image is split into tiles, each thread starts with its own run of tiles and steals from the others when it runs out
+    struct CpuPathTracer {
+        CpuPathTracerSettings settings;
+        CpuRenderStats stats; // Of the last `render()`
+
+        CpuImage render(const CpuScene& scene, const CpuCamera& camera, ThreadPool& thread_pool);
+    };
+}
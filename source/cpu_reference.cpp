@@ -0,0 +1,96 @@
+// Renders a glTF scene with the CPU path tracer, for machines without a GPU. Usage:
+//   cpu_reference [scene.gltf] [--output image.hdr|image.pfm] [--env sky.hdr] [--sky r g b] [--width w] [--height h]
+//                 [--samples n] [--bounces n] [--frames n] [--frame-index n] [--tile-size n] [--threads n] [--no-aa]
+//                 [--camera x y z pitch yaw roll] [--fov degrees]
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "cpu_pathtracer.h"
+#include "cpu_scene.h"
+#include "gltf_loader.h"
+#include "thread_pool.h"
+#include "log.h"
+
+int main(int n_args, char** args) {
+    // Same scene and camera as the renderer starts up with
+    std::string scene_path = "assets/models/ABeautifulGame/ABeautifulGame.gltf";
+    std::string output_path = "reference.hdr";
+    std::string environment_map_path;
+    glm::vec3 sky_color = glm::vec3(1.0f);
+    glm::vec3 camera_position = glm::vec3(-0.306728, 0.141196, 0.140617);
+    glm::vec3 camera_euler_angles = glm::vec3(-0.140000, -1.076000, 0.000000);
+    float fov = 70.0f;
+    uint32_t n_threads = 0;
+    gfx::CpuPathTracer path_tracer;
+
+    for (int i = 1; i < n_args; ++i) {
+        const char* arg = args[i];
+        const int n_left = n_args - i - 1;
+        auto next_u32 = [&]() { return (uint32_t)strtoul(args[++i], nullptr, 10); };
+        auto next_float = [&]() { return strtof(args[++i], nullptr); };
+
+        if (strcmp(arg, "--output") == 0 && n_left >= 1) output_path = args[++i];
+        else if (strcmp(arg, "--env") == 0 && n_left >= 1) environment_map_path = args[++i];
+        else if (strcmp(arg, "--sky") == 0 && n_left >= 3) { sky_color.r = next_float(); sky_color.g = next_float(); sky_color.b = next_float(); }
+        else if (strcmp(arg, "--width") == 0 && n_left >= 1) path_tracer.settings.width = next_u32();
+        else if (strcmp(arg, "--height") == 0 && n_left >= 1) path_tracer.settings.height = next_u32();
+        else if (strcmp(arg, "--samples") == 0 && n_left >= 1) path_tracer.settings.n_samples = next_u32();
+        else if (strcmp(arg, "--bounces") == 0 && n_left >= 1) path_tracer.settings.n_bounces = next_u32();
+        else if (strcmp(arg, "--frames") == 0 && n_left >= 1) path_tracer.settings.n_frames = next_u32();
+        else if (strcmp(arg, "--frame-index") == 0 && n_left >= 1) path_tracer.settings.first_frame_index = next_u32();
+        else if (strcmp(arg, "--tile-size") == 0 && n_left >= 1) path_tracer.settings.tile_size = next_u32();
+        else if (strcmp(arg, "--threads") == 0 && n_left >= 1) n_threads = next_u32();
+        else if (strcmp(arg, "--no-aa") == 0) path_tracer.settings.enable_anti_aliasing = false;
+        else if (strcmp(arg, "--fov") == 0 && n_left >= 1) fov = next_float();
+        else if (strcmp(arg, "--camera") == 0 && n_left >= 6) {
+            camera_position.x = next_float(); camera_position.y = next_float(); camera_position.z = next_float();
+            camera_euler_angles.x = next_float(); camera_euler_angles.y = next_float(); camera_euler_angles.z = next_float();
+        }
+        else if (arg[0] != '-') scene_path = arg;
+        else {
+            LOG(Error, "Unknown or incomplete argument \"%s\"", arg);
+            Log::flush();
+            return 1;
+        }
+    }
+
+    // 0 threads means one per hardware thread. The calling thread counts as one of them, and the pool always has at least one worker
+    gfx::ThreadPool thread_pool((n_threads > 0) ? std::max(n_threads, 2u) - 1 : gfx::ThreadPool::AUTO_WORKERS);
+
+    const auto model = gfx::decode_gltf(scene_path);
+    if (!model) {
+        Log::flush();
+        return 1;
+    }
+    const auto scene = gfx::create_cpu_scene_from_gltf(scene_path, *model, &thread_pool);
+    scene->sky_color = sky_color;
+    if (!environment_map_path.empty() && !scene->load_environment_map(environment_map_path)) {
+        Log::flush();
+        return 1;
+    }
+
+    const auto& settings = path_tracer.settings;
+    const float aspect_ratio = (float)settings.width / (float)settings.height;
+    const gfx::CpuCamera camera = {
+        .position = camera_position,
+        .rotation = glm::quat(camera_euler_angles),
+        .viewport_size = { tanf(glm::radians(fov) * 0.5f) * aspect_ratio, tanf(glm::radians(fov) * 0.5f) },
+    };
+
+    LOG(Info, "Rendering %ux%u, %u frames of %u samples with %u bounces, %zu triangles, %u threads", settings.width, settings.height,
+        settings.n_frames, settings.n_samples, settings.n_bounces, scene->n_triangles(), thread_pool.n_threads());
+    const gfx::CpuImage image = path_tracer.render(*scene, camera, thread_pool);
+
+    const auto& stats = path_tracer.stats;
+    LOG(Info, "Traced %llu rays in %.3f s, %.3f Mrays/s (%.3f Mrays/s per thread), %llu of %llu tiles were stolen",
+        (unsigned long long)stats.n_rays, stats.seconds, stats.rays_per_second() / 1e6, stats.rays_per_second() / 1e6 / thread_pool.n_threads(),
+        (unsigned long long)stats.n_tiles_stolen, (unsigned long long)stats.n_tiles);
+
+    const bool written = image.write(output_path);
+    if (written) LOG(Info, "Wrote '%s'", output_path.c_str());
+    Log::flush();
+    return written ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+#include "cpu_scene.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <tinygltf/tiny_gltf.h>
+#include <stb/stb_image.h>
+#include "gltf_loader.h"
+#include "thread_pool.h"
+#include "log.h"
+
+#define PI 3.14159265358979f
+
+namespace gfx {
+    glm::vec4 CpuTexture::sample(glm::vec2 uv) const {
+        if (pixels.empty()) return glm::vec4(0.0f);
+
+        // Texel centers are at .5, and both axes wrap around
+        const float x = uv.x * (float)width - 0.5f;
+        const float y = uv.y * (float)height - 0.5f;
+        const float x_floor = floorf(x);
+        const float y_floor = floorf(y);
+        const float fx = x - x_floor;
+        const float fy = y - y_floor;
+        auto wrap = [](float coord, uint32_t size) {
+            const int64_t i = (int64_t)coord % (int64_t)size;
+            return (uint32_t)((i < 0) ? i + size : i);
+        };
+        const uint32_t x0 = wrap(x_floor, width);
+        const uint32_t y0 = wrap(y_floor, height);
+        const uint32_t x1 = (x0 + 1 == width) ? 0 : x0 + 1;
+        const uint32_t y1 = (y0 + 1 == height) ? 0 : y0 + 1;
+
+        const glm::vec4 top = glm::mix(pixels[y0 * width + x0], pixels[y0 * width + x1], fx);
+        const glm::vec4 bottom = glm::mix(pixels[y1 * width + x0], pixels[y1 * width + x1], fx);
+        return glm::mix(top, bottom, fy);
+    }
+
+    bool CpuScene::load_environment_map(const std::string& path) {
+        int width, height;
+        stbi_set_flip_vertically_on_load(0);
+        float* data = stbi_loadf(path.c_str(), &width, &height, nullptr, 4);
+        if (!data) {
+            LOG(Error, "Failed to load environment map '%s'", path.c_str());
+            return false;
+        }
+
+        // The cube map conversion clamps these, some HDRIs have very high values
+        sky.width = (uint32_t)width;
+        sky.height = (uint32_t)height;
+        sky.pixels.resize((size_t)width * (size_t)height);
+        for (size_t i = 0; i < sky.pixels.size(); ++i) {
+            sky.pixels[i] = glm::min(glm::vec4(data[i * 4 + 0], data[i * 4 + 1], data[i * 4 + 2], data[i * 4 + 3]), glm::vec4(16000.0f));
+        }
+        stbi_image_free(data);
+        return true;
+    }
+
+    glm::vec3 CpuScene::sample_sky(glm::vec3 direction) const {
+        if (sky.pixels.empty()) return sky_color;
+
+        // Same mapping as hdri_to_cubemap.cs.hlsl, so we skip the cube map and sample the HDRI directly
+        const glm::vec3 dir = glm::normalize(direction);
+        const float spherical_u = atan2f(dir.z, dir.x) / (2.0f * PI) + 0.5f;
+        const float spherical_v = asinf(glm::clamp(dir.y, -1.0f, 1.0f)) / PI + 0.5f;
+        return glm::vec3(sky.sample(glm::vec2(1.0f - spherical_u, spherical_v)));
+    }
+
+    std::vector<glm::vec3> CpuScene::world_space_positions() const {
+        std::vector<glm::vec3> positions;
+        for (const CpuMesh& mesh : meshes) {
+            const size_t n_vertices = mesh.positions.size() - mesh.positions.size() % 3;
+            for (size_t i = 0; i < n_vertices; ++i) {
+                positions.push_back(glm::vec3(mesh.global_transform * glm::vec4(mesh.positions[i], 1.0f)));
+            }
+        }
+        return positions;
+    }
+
+    void CpuScene::build_acceleration_structure(ThreadPool* thread_pool) {
+        m_blases.clear();
+        m_blases.resize(meshes.size());
+        m_n_triangles = 0;
+
+        // Big meshes get the whole pool each, the rest get built side by side with one thread each, since the pool can't nest
+        std::vector<uint32_t> small_meshes;
+        for (uint32_t mesh_index = 0; mesh_index < (uint32_t)meshes.size(); ++mesh_index) {
+            const uint32_t n_triangles = (uint32_t)meshes[mesh_index].positions.size() / 3;
+            m_n_triangles += n_triangles;
+            if (thread_pool && n_triangles >= BvhBuildSettings{}.parallel_threshold) m_blases[mesh_index].build(meshes[mesh_index].positions.data(), n_triangles, thread_pool);
+            else small_meshes.push_back(mesh_index);
+        }
+        auto build_small_meshes = [&](uint32_t begin, uint32_t end, uint32_t) {
+            for (uint32_t i = begin; i < end; ++i) {
+                const CpuMesh& mesh = meshes[small_meshes[i]];
+                m_blases[small_meshes[i]].build(mesh.positions.data(), (uint32_t)mesh.positions.size() / 3);
+            }
+        };
+        if (thread_pool) thread_pool->parallel_for((uint32_t)small_meshes.size(), 1, build_small_meshes);
+        else build_small_meshes(0, (uint32_t)small_meshes.size(), 0);
+
+        m_tlas.build(instances(), thread_pool);
+        LOG(Debug, "CPU scene: built %zu BLASes over %zu triangles, and a TLAS with %zu nodes over %u instances", m_blases.size(), m_n_triangles,
+            m_tlas.nodes().size(), m_tlas.n_instances());
+    }
+
+    void CpuScene::update_transforms(ThreadPool* thread_pool, bool rebuild) {
+        assert(m_blases.size() == meshes.size() && "Meshes were added or removed, call build_acceleration_structure() instead");
+        if (rebuild) m_tlas.build(instances(), thread_pool);
+        else m_tlas.refit(instances(), thread_pool);
+    }
+
+    std::vector<CpuRaytracingInstance> CpuScene::instances() const {
+        std::vector<CpuRaytracingInstance> instances(meshes.size());
+        for (uint32_t mesh_index = 0; mesh_index < (uint32_t)meshes.size(); ++mesh_index) {
+            instances[mesh_index] = { glm::mat4x3(meshes[mesh_index].global_transform), mesh_index, &m_blases[mesh_index] };
+        }
+        return instances;
+    }
+
+    bool CpuScene::trace(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, CpuHit& hit) const {
+        CpuTlasHit tlas_hit;
+        if (!m_tlas.intersect_closest(origin, direction, t_min, t_max, tlas_hit)) return false;
+        hit = { tlas_hit.t, tlas_hit.barycentrics, tlas_hit.instance_id, tlas_hit.triangle_index };
+        return true;
+    }
+
+    bool CpuScene::trace_any(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) const {
+        return m_tlas.intersect_any(origin, direction, t_min, t_max);
+    }
+
+    // Like `upload_texture_from_gltf()`. Returns a handle with `is_loaded` set to 0 if the material doesn't have this texture
+    static ResourceHandle load_texture_from_gltf(const std::string& path, tinygltf::Model& model, CpuScene& scene, int texture_index, bool is_normal_map) {
+        ResourceHandle handle = ResourceHandle::none();
+        if (texture_index == -1) return handle;
+        tinygltf::Image& image = model.images.at(model.textures.at(texture_index).source);
+
+        // `decode_gltf()` already tried to load external images
+        if (image.image.empty()) {
+            LOG(Error, "CPU scene: could not load image '%s' from '%s'", image.uri.c_str(), path.c_str());
+            return handle;
+        }
+        if (image.bits != 8 || image.pixel_type != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE || (image.component != 1 && image.component != 2 && image.component != 4)) {
+            LOG(Error, "Unknown/unsupported pixel type in glTF image!");
+            return handle;
+        }
+
+        // Missing channels read as 0, and missing alpha as 1, like the GPU's r8 and rg8 formats
+        CpuTexture texture;
+        texture.width = (uint32_t)image.width;
+        texture.height = (uint32_t)image.height;
+        texture.pixels.resize((size_t)image.width * (size_t)image.height, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        for (size_t i = 0; i < texture.pixels.size(); ++i) {
+            for (int c = 0; c < image.component; ++c) {
+                texture.pixels[i][c] = (float)image.image[i * image.component + c] / 255.0f;
+            }
+        }
+
+        // Same as reconstruct_normal_map.cs.hlsl, for normal maps that only store X and Y
+        if (is_normal_map) {
+            for (glm::vec4& pixel : texture.pixels) {
+                if (pixel.b != 0.0f) continue;
+                const glm::vec2 src = glm::vec2(pixel) * 2.0f - 1.0f;
+                const float reconstructed_b = sqrtf(std::max(0.0f, 1.0f - src.x * src.x - src.y * src.y));
+                const glm::vec3 normal = glm::normalize(glm::vec3(src, reconstructed_b));
+                pixel = glm::vec4((normal + 1.0f) / 2.0f, pixel.a);
+            }
+        }
+
+        handle.id = (uint32_t)scene.textures.size();
+        handle.is_loaded = 1;
+        handle.type = (uint32_t)ResourceType::texture;
+        scene.textures.push_back(std::move(texture));
+        return handle;
+    }
+
+    static void traverse_nodes(CpuScene& scene, const std::vector<int>& node_indices, tinygltf::Model& model, const glm::mat4& parent_transform, const std::string& path) {
+        for (const int node_index : node_indices) {
+            const tinygltf::Node& node = model.nodes[node_index];
+            const glm::mat4 global_matrix = parent_transform * gltf_node_local_matrix(node);
+
+            if (node.mesh != -1) {
+                tinygltf::Mesh& mesh = model.meshes[node.mesh];
+                for (tinygltf::Primitive& primitive : mesh.primitives) {
+                    const std::vector<Vertex> vertices = parse_primitive(primitive, model, path);
+                    CompressedVertices compressed = compress_vertices(vertices, (uint16_t)((primitive.material == -1) ? 0xFFFF : primitive.material));
+
+                    CpuMesh cpu_mesh;
+                    cpu_mesh.name = mesh.name;
+                    cpu_mesh.positions.reserve(vertices.size());
+                    for (const Vertex& vertex : vertices) {
+                        cpu_mesh.positions.push_back(vertex.position);
+                    }
+                    cpu_mesh.vertices = std::move(compressed.vertices);
+                    cpu_mesh.position_offset = compressed.position_offset;
+                    cpu_mesh.position_scale = compressed.position_scale;
+                    cpu_mesh.global_transform = global_matrix;
+                    scene.meshes.push_back(std::move(cpu_mesh));
+                }
+            }
+
+            if (!node.children.empty()) {
+                traverse_nodes(scene, node.children, model, global_matrix, path);
+            }
+        }
+    }
+
+    std::unique_ptr<CpuScene> create_cpu_scene_from_gltf(const std::string& path, tinygltf::Model& model, ThreadPool* thread_pool) {
+        auto scene = std::make_unique<CpuScene>();
+
+        // Same values `create_scene_graph_from_gltf()` puts in the material buffer. Material ids index this array directly,
+        // instead of going through the renderer's material slots
+        for (const auto& model_material : model.materials) {
+            Material material;
+            if (model_material.pbrMetallicRoughness.baseColorFactor.size() == 4) {
+                material.color_multiplier.r = (float)model_material.pbrMetallicRoughness.baseColorFactor[0];
+                material.color_multiplier.g = (float)model_material.pbrMetallicRoughness.baseColorFactor[1];
+                material.color_multiplier.b = (float)model_material.pbrMetallicRoughness.baseColorFactor[2];
+                material.color_multiplier.a = (float)model_material.pbrMetallicRoughness.baseColorFactor[3];
+            }
+            if (model_material.emissiveFactor.size() == 3) {
+                material.emissive_multiplier.r = (float)model_material.emissiveFactor[0];
+                material.emissive_multiplier.g = (float)model_material.emissiveFactor[1];
+                material.emissive_multiplier.b = (float)model_material.emissiveFactor[2];
+            }
+            material.color_texture = load_texture_from_gltf(path, model, *scene, model_material.pbrMetallicRoughness.baseColorTexture.index, false);
+            material.normal_texture = load_texture_from_gltf(path, model, *scene, model_material.normalTexture.index, true);
+            material.metal_roughness_texture = load_texture_from_gltf(path, model, *scene, model_material.pbrMetallicRoughness.metallicRoughnessTexture.index, false);
+            material.emissive_texture = load_texture_from_gltf(path, model, *scene, model_material.emissiveTexture.index, false);
+            material.normal_intensity = 1.0f;
+            material.roughness_multiplier = 1.0f;
+            material.metallic_multiplier = 1.0f;
+            scene->materials.push_back(material);
+        }
+
+        const int scene_to_load = (model.defaultScene != -1) ? model.defaultScene : 0;
+        const auto& gltf_scene = model.scenes[scene_to_load];
+        LOG(Info, "Loading CPU scene \"%s\" from file \"%s\"", gltf_scene.name.c_str(), path.c_str());
+        traverse_nodes(*scene, gltf_scene.nodes, model, glm::mat4(1.0f), path);
+        scene->build_acceleration_structure(thread_pool);
+        return scene;
+    }
+}
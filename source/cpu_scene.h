@@ -0,0 +1,77 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include "gpu_structs.h"
+#include "cpu_acceleration_structure.h"
+
+namespace tinygltf {
+    class Model;
+}
+
+namespace gfx {
+    struct ThreadPool;
+
+    // Decoded texture, sampled the way the path tracer's wrapping bilinear sampler does, but always from the top mip level
+    struct CpuTexture {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<glm::vec4> pixels;
+
+        glm::vec4 sample(glm::vec2 uv) const;
+    };
+
+    // The same data a `SceneNodeMesh` uploads: the positions the BLAS is built from, and the compressed vertices the shaders read
+    struct CpuMesh {
+        std::string name;
+        std::vector<glm::vec3> positions;
+        std::vector<VertexCompressed> vertices;
+        glm::vec3 position_offset;
+        glm::vec3 position_scale;
+        glm::mat4 global_transform;
+    };
+
+    struct CpuHit {
+        float t;
+        glm::vec2 barycentrics; // Weights of the triangle's second and third vertex, like `CommittedTriangleBarycentrics()`
+        uint32_t mesh_index;
+        uint32_t triangle_index; // Within the mesh, like `CommittedPrimitiveIndex()`
+    };
+
+    // A glTF scene loaded the same way `create_scene_graph_from_gltf()` loads it, but into system memory instead of onto the GPU.
+    // `materials` has the same layout as the renderer's material buffer, and the texture handles in it index into `textures`
+    struct CpuScene {
+        std::vector<CpuMesh> meshes;
+        std::vector<Material> materials;
+        std::vector<CpuTexture> textures;
+        CpuTexture sky; // Equirectangular, like the HDRI the renderer turns into a cube map
+        glm::vec3 sky_color = glm::vec3(1.0f); // Used if there's no `sky`
+
+        bool load_environment_map(const std::string& path);
+        glm::vec3 sample_sky(glm::vec3 direction) const;
+
+        void build_acceleration_structure(ThreadPool* thread_pool = nullptr); // Has to be called after changing `meshes`
+        // Cheaper than `build_acceleration_structure()` if only the meshes' `global_transform`s changed. Refitting keeps the
+        // TLAS's tree and only updates its bounds, rebuilding makes a new tree but still reuses every mesh's BLAS
+        void update_transforms(ThreadPool* thread_pool = nullptr, bool rebuild = false);
+        bool trace(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, CpuHit& hit) const; // Closest hit, both sides of every triangle
+        bool trace_any(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) const;
+        // Traces many rays at once, see `RayStream`. Hits' instance ids are mesh indices. Don't pass a `thread_pool` from
+        // inside one of its own jobs, it can't nest
+        void trace_stream(RayStream& stream, ThreadPool* thread_pool = nullptr) const { m_tlas.intersect_stream(stream, false, thread_pool); }
+        void trace_stream_any(RayStream& stream, ThreadPool* thread_pool = nullptr) const { m_tlas.intersect_stream(stream, true, thread_pool); }
+        std::vector<glm::vec3> world_space_positions() const; // Every mesh's triangles in world space, one mesh after the other
+        const CpuTlas& tlas() const { return m_tlas; }
+        size_t n_triangles() const { return m_n_triangles; }
+
+    private:
+        std::vector<CpuRaytracingInstance> instances() const;
+
+        std::vector<CpuBlas> m_blases; // One per mesh, in object space
+        CpuTlas m_tlas; // Instance ids are mesh indices
+        size_t m_n_triangles = 0;
+    };
+
+    std::unique_ptr<CpuScene> create_cpu_scene_from_gltf(const std::string& path, tinygltf::Model& model, ThreadPool* thread_pool = nullptr);
+}
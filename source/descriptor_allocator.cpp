@@ -0,0 +1,105 @@
+#include "descriptor_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace gfx {
+    static uint32_t current_thread_shard(uint32_t shard_count) {
+        // Threads get their shard round robin the first time they allocate, which spreads a thread pool out evenly
+        static std::atomic<uint32_t> next_shard = 0;
+        thread_local const uint32_t shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+        return shard % shard_count;
+    }
+
+    DescriptorAllocator::DescriptorAllocator(uint32_t capacity, uint32_t stride) {
+        assert(stride != 0 && capacity % stride == 0);
+        m_capacity = capacity;
+        m_stride = stride;
+        m_shards = std::make_unique<Shard[]>(SHARD_COUNT);
+        m_generations = std::make_unique<std::atomic<uint8_t>[]>(capacity / stride);
+        for (uint32_t i = 0; i < capacity / stride; ++i) m_generations[i].store(0, std::memory_order_relaxed);
+    }
+
+    bool DescriptorAllocator::take_from_shard(Shard& shard, uint32_t& index) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.free_slots.empty()) return false;
+        index = shard.free_slots.back();
+        shard.free_slots.pop_back();
+        return true;
+    }
+
+    bool DescriptorAllocator::allocate(uint32_t& index, uint32_t& generation) {
+        Shard& own_shard = m_shards[current_thread_shard(SHARD_COUNT)];
+        bool found = take_from_shard(own_shard, index);
+
+        // Grab a batch of fresh slots, keep one and put the rest in this thread's shard
+        if (!found && m_fresh_cursor.load(std::memory_order_relaxed) < m_capacity) {
+            const uint32_t start = m_fresh_cursor.fetch_add(FRESH_BATCH_SIZE * m_stride, std::memory_order_relaxed);
+            if (start < m_capacity) {
+                const uint32_t end = std::min(start + FRESH_BATCH_SIZE * m_stride, m_capacity);
+                std::lock_guard<std::mutex> lock(own_shard.mutex);
+                for (uint32_t slot = end - m_stride; slot > start; slot -= m_stride) {
+                    own_shard.free_slots.push_back(slot);
+                }
+                index = start;
+                found = true;
+            }
+        }
+
+        // Out of fresh slots too, so see if another thread has some left
+        for (uint32_t i = 0; !found && i < SHARD_COUNT; ++i) {
+            found = take_from_shard(m_shards[i], index);
+        }
+        if (!found) return false;
+
+        generation = this->generation(index);
+        const uint32_t n_allocated = m_n_allocated.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint32_t peak = m_peak_allocated.load(std::memory_order_relaxed);
+        while (n_allocated > peak && !m_peak_allocated.compare_exchange_weak(peak, n_allocated, std::memory_order_relaxed)) {}
+        return true;
+    }
+
+    void DescriptorAllocator::free(uint32_t index, uint64_t frame_index) {
+        assert(index < m_capacity && index % m_stride == 0);
+
+        // Bump the generation right away, so stale handles get caught even before the slot is reused
+        auto& generation = m_generations[index / m_stride];
+        generation.store((generation.load(std::memory_order_relaxed) + 1) & GENERATION_MASK, std::memory_order_relaxed);
+        m_n_allocated.fetch_sub(1, std::memory_order_relaxed);
+
+        Shard& own_shard = m_shards[current_thread_shard(SHARD_COUNT)];
+        std::lock_guard<std::mutex> lock(own_shard.mutex);
+        own_shard.pending_frees.push_back({ index, frame_index });
+    }
+
+    void DescriptorAllocator::recycle(uint64_t completed_frame_index) {
+        for (uint32_t i = 0; i < SHARD_COUNT; ++i) {
+            Shard& shard = m_shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            // Frees can come from different threads, so they're not necessarily in frame order
+            for (size_t j = 0; j < shard.pending_frees.size();) {
+                if (shard.pending_frees[j].frame_index >= completed_frame_index) {
+                    ++j;
+                    continue;
+                }
+                shard.free_slots.push_back(shard.pending_frees[j].index);
+                shard.pending_frees[j] = shard.pending_frees.back();
+                shard.pending_frees.pop_back();
+            }
+        }
+    }
+
+    DescriptorAllocatorStats DescriptorAllocator::stats() const {
+        uint32_t n_pending_free = 0;
+        for (uint32_t i = 0; i < SHARD_COUNT; ++i) {
+            std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+            n_pending_free += (uint32_t)m_shards[i].pending_frees.size();
+        }
+        return DescriptorAllocatorStats{
+            .n_allocated = m_n_allocated.load(std::memory_order_relaxed),
+            .peak_allocated = m_peak_allocated.load(std::memory_order_relaxed),
+            .n_pending_free = n_pending_free,
+        };
+    }
+}
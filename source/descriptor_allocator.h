@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace gfx {
+    struct DescriptorAllocatorStats {
+        uint32_t n_allocated = 0; // Slots handed out and not freed yet
+        uint32_t peak_allocated = 0;
+        uint32_t n_pending_free = 0; // Freed, but the GPU might still be using them
+    };
+
+    // Hands out descriptor slots from several threads at once. Every thread gets its own shard of the free list, so loader threads
+    // don't fight over one lock, and fresh slots are taken from a shared cursor in batches. Freed slots go on the shard's pending list,
+    // and only get reused after `recycle()` is told the frame that freed them is done on the GPU. That's the same as
+    // `Device::completed_frame_index()`: every frame before it is done, so a slot freed during frame n comes back once it's past n.
+    // Each slot has a generation counter that goes up when it's freed, so handles to a slot that was freed since can be caught.
+    // This only hands out indices, so it can be driven without a GPU.
+    struct DescriptorAllocator {
+        static constexpr uint32_t GENERATION_BITS = 6;
+        static constexpr uint32_t GENERATION_MASK = (1 << GENERATION_BITS) - 1;
+
+        DescriptorAllocator(uint32_t capacity, uint32_t stride); // Slots are `stride` indices apart, starting at 0
+
+        bool allocate(uint32_t& index, uint32_t& generation); // Returns false if every slot is in use
+        void free(uint32_t index, uint64_t frame_index); // The slot can be reused once the GPU finished `frame_index`
+        void recycle(uint64_t completed_frame_index); // Makes the slots that were freed before `completed_frame_index` available again
+
+        uint32_t generation(uint32_t index) const { return m_generations[index / m_stride].load(std::memory_order_relaxed); }
+        bool is_current(uint32_t index, uint32_t generation) const { return index < m_capacity && this->generation(index) == generation; }
+        DescriptorAllocatorStats stats() const;
+
+    private:
+        static constexpr uint32_t SHARD_COUNT = 8;
+        static constexpr uint32_t FRESH_BATCH_SIZE = 64; // Slots a shard takes from the cursor at once
+
+        struct PendingFree {
+            uint32_t index;
+            uint64_t frame_index;
+        };
+        struct alignas(64) Shard {
+            std::mutex mutex;
+            std::vector<uint32_t> free_slots;
+            std::vector<PendingFree> pending_frees;
+        };
+
+        bool take_from_shard(Shard& shard, uint32_t& index);
+
+        uint32_t m_capacity = 0;
+        uint32_t m_stride = 1;
+        std::atomic<uint32_t> m_fresh_cursor = 0; // Slots from here on were never handed out
+        std::unique_ptr<Shard[]> m_shards;
+        std::unique_ptr<std::atomic<uint8_t>[]> m_generations; // One per slot
+        std::atomic<uint32_t> m_n_allocated = 0;
+        std::atomic<uint32_t> m_peak_allocated = 0;
+    };
+}
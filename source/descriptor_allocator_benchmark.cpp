@@ -0,0 +1,163 @@
+// Has several threads allocate and free descriptor slots at the same time, like loader threads creating and unloading textures,
+// and measures throughput against one free list behind one lock, which is what the descriptor heap used to do. Every slot gets
+// checked for being handed out twice at once. Usage:
+//   descriptor_allocator_benchmark [--max-threads n] [--ops n] [--capacity n]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "descriptor_allocator.h"
+#include "log.h"
+
+#define N_REPEATS 3 // Best of
+#define MAX_HELD_PER_THREAD 256 // Slots a thread holds on to before it starts freeing them
+
+// One deque behind one mutex, frees deferred by frame like the sharded allocator, so the two do the same work
+struct LockedDequeAllocator {
+    LockedDequeAllocator(uint32_t capacity) {
+        for (uint32_t i = 0; i < capacity; ++i) free_slots.push_back(i);
+    }
+
+    bool allocate(uint32_t& index, uint32_t& generation) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_slots.empty()) return false;
+        index = free_slots.front();
+        free_slots.pop_front();
+        generation = 0;
+        return true;
+    }
+
+    void free(uint32_t index, uint64_t frame_index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending_frees.push_back({ index, frame_index });
+    }
+
+    void recycle(uint64_t completed_frame_index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::erase_if(pending_frees, [&](const std::pair<uint32_t, uint64_t>& pending) {
+            if (pending.second >= completed_frame_index) return false;
+            free_slots.push_back(pending.first);
+            return true;
+        });
+    }
+
+    std::mutex mutex;
+    std::deque<uint32_t> free_slots;
+    std::vector<std::pair<uint32_t, uint64_t>> pending_frees;
+};
+
+struct RunResult {
+    double seconds = 0.0;
+    uint32_t n_double_allocations = 0;
+};
+
+// Every thread does `n_ops` allocations and frees in random order, while the calling thread plays the frame loop and recycles
+template<typename Allocator>
+static RunResult run(Allocator& allocator, uint32_t capacity, uint32_t n_threads, uint32_t n_ops) {
+    std::vector<std::atomic<uint8_t>> in_use(capacity);
+    std::atomic<uint64_t> frame_index = 0;
+    std::atomic<uint32_t> n_threads_done = 0;
+    std::atomic<uint32_t> n_double_allocations = 0;
+
+    const auto start_time = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < n_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            std::vector<uint32_t> held;
+            held.reserve(MAX_HELD_PER_THREAD);
+            for (uint32_t op = 0; op < n_ops; ++op) {
+                if (held.size() < MAX_HELD_PER_THREAD && (held.empty() || rng() % 2 == 0)) {
+                    uint32_t index = 0;
+                    uint32_t generation = 0;
+                    if (!allocator.allocate(index, generation)) continue;
+                    if (in_use[index].exchange(1) != 0) n_double_allocations++;
+                    held.push_back(index);
+                }
+                else {
+                    const size_t i = rng() % held.size();
+                    in_use[held[i]].store(0);
+                    allocator.free(held[i], frame_index.load(std::memory_order_relaxed));
+                    held[i] = held.back();
+                    held.pop_back();
+                }
+            }
+            for (uint32_t index : held) {
+                in_use[index].store(0);
+                allocator.free(index, frame_index.load(std::memory_order_relaxed));
+            }
+            n_threads_done++;
+        });
+    }
+    while (n_threads_done.load() < n_threads) {
+        // The GPU lags two frames behind
+        const uint64_t frame = ++frame_index;
+        allocator.recycle(frame >= 2 ? frame - 2 : 0);
+        std::this_thread::yield();
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    allocator.recycle(frame_index.load() + 1);
+    return RunResult{ seconds, n_double_allocations.load() };
+}
+
+int main(int n_args, char** args) {
+    uint32_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    uint32_t n_ops = 200000;
+    uint32_t capacity = 1 << 20;
+
+    for (int i = 1; i < n_args; ++i) {
+        const char* arg = args[i];
+        const int n_left = n_args - i - 1;
+        auto next_u32 = [&]() { return (uint32_t)strtoul(args[++i], nullptr, 10); };
+
+        if (strcmp(arg, "--max-threads") == 0 && n_left >= 1) max_threads = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--ops") == 0 && n_left >= 1) n_ops = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--capacity") == 0 && n_left >= 1) capacity = std::max(next_u32(), 1u);
+        else {
+            LOG(Error, "Unknown or incomplete argument \"%s\"", arg);
+            Log::flush();
+            return 1;
+        }
+    }
+
+    printf("%u hardware threads, %u operations per thread, %u slots\n", std::thread::hardware_concurrency(), n_ops, capacity);
+    printf("  %-8s %14s %14s %10s %8s\n", "threads", "sharded Mop/s", "locked Mop/s", "speedup", "valid");
+    uint32_t n_invalid = 0;
+    for (uint32_t n_threads = 1; ; n_threads = std::min(n_threads * 2, max_threads)) {
+        double best_sharded = INFINITY;
+        double best_locked = INFINITY;
+        bool valid = true;
+        for (int i = 0; i < N_REPEATS; ++i) {
+            gfx::DescriptorAllocator sharded(capacity, 1);
+            const RunResult sharded_result = run(sharded, capacity, n_threads, n_ops);
+            best_sharded = std::min(best_sharded, sharded_result.seconds);
+            valid &= sharded_result.n_double_allocations == 0 && sharded.stats().n_allocated == 0 && sharded.stats().n_pending_free == 0;
+
+            LockedDequeAllocator locked(capacity);
+            const RunResult locked_result = run(locked, capacity, n_threads, n_ops);
+            best_locked = std::min(best_locked, locked_result.seconds);
+            valid &= locked_result.n_double_allocations == 0;
+        }
+        n_invalid += valid ? 0 : 1;
+
+        const double total_ops = (double)n_threads * n_ops / 1e6;
+        printf("  %-8u %14.2f %14.2f %9.2fx %8s\n", n_threads, total_ops / best_sharded, total_ops / best_locked, best_locked / best_sharded, valid ? "yes" : "NO");
+        if (n_threads == max_threads) break;
+    }
+
+    Log::flush();
+    if (n_invalid > 0) {
+        printf("\n%u runs handed out a slot twice, or lost track of one\n", n_invalid);
+        return 1;
+    }
+    return 0;
+}
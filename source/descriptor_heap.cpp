@@ -2,17 +2,21 @@
 
 #include <d3d12.h>
 #include <dxgi1_6.h>
+#include <stdexcept>
 
 #include "common.h"
 #include "device.h"
+#include "log.h"
 
 namespace gfx {
-    DescriptorHeap::DescriptorHeap(const Device& device, D3D12_DESCRIPTOR_HEAP_TYPE type, D3D12_DESCRIPTOR_HEAP_FLAGS flags, uint32_t n_descriptors) {
+    DescriptorHeap::DescriptorHeap(const Device& device, D3D12_DESCRIPTOR_HEAP_TYPE type, D3D12_DESCRIPTOR_HEAP_FLAGS flags, uint32_t n_descriptors)
+        : m_allocator(n_descriptors * 2, 2) {
         const D3D12_DESCRIPTOR_HEAP_DESC desc = {
             .Type = type,
             .NumDescriptors = static_cast<UINT>(n_descriptors * 2),
             .Flags = flags,
         };
+        assert(n_descriptors * 2 <= (1 << 20) && "Descriptor indices have to fit in a resource handle");
 
         validate(device.device->CreateDescriptorHeap(&desc, IID_PPV_ARGS(&heap)));
 
@@ -21,35 +25,40 @@ namespace gfx {
         m_capacity = n_descriptors * 2;
     }
     
-    // Returns the CPU descriptor handle as a size_t
     ResourceHandle DescriptorHeap::alloc_descriptor(ResourceType type) {
-        // Find index - if there's a descriptor we can recycle, get the first one, otherwise just get the next new one
-        uint32_t index;
-        if (m_available_recycled_descriptor_indices.empty() == false) {
-            index = m_available_recycled_descriptor_indices.front();
-            m_available_recycled_descriptor_indices.pop_front();
-        } else {
-            index = m_alloc_index;
-            m_alloc_index += 2;
+        uint32_t index = 0;
+        uint32_t generation = 0;
+        if (!m_allocator.allocate(index, generation)) {
+            LOG(Fatal, "Descriptor heap is full (%u descriptors)", m_capacity);
+            throw std::runtime_error("Descriptor heap is full");
         }
         assert(index % 2 == 0);
-        assert(m_alloc_index % 2 == 0);
-        assert(index < m_capacity);
 
         return ResourceHandle {
             .id = index,
+            .generation = generation,
             .type = static_cast<uint32_t>(type),
         };
     }
 
-    void DescriptorHeap::free_descriptor(ResourceHandle id) {
-        m_available_recycled_descriptor_indices.push_back(id.id);
-        id.is_loaded = 0;
-        id.id = ~0;
-        id.type = static_cast<uint64_t>(ResourceType::none);
+    void DescriptorHeap::free_descriptor(ResourceHandle& id, uint64_t frame_index) {
+        assert(is_valid(id) && "Descriptor was already freed");
+        m_allocator.free(id.id, frame_index);
+        id = ResourceHandle::none();
+    }
+
+    void DescriptorHeap::recycle_descriptors(uint64_t completed_frame_index) {
+        m_allocator.recycle(completed_frame_index);
+    }
+
+    bool DescriptorHeap::is_valid(const ResourceHandle& id) const {
+        // UAVs live right after the SRV, and share its generation
+        const uint32_t slot = id.id & ~1u;
+        return m_allocator.is_current(slot, id.generation);
     }
 
     D3D12_CPU_DESCRIPTOR_HANDLE DescriptorHeap::fetch_cpu_handle(const ResourceHandle& id) {
+        assert(is_valid(id) && "Handle points to a descriptor that was freed");
         D3D12_CPU_DESCRIPTOR_HANDLE new_handle = m_start_cpu;
         new_handle.ptr += id.id * m_descriptor_size;
         return new_handle;
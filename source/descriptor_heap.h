@@ -1,27 +1,30 @@
 #pragma once
 #include <d3d12.h>
-#include <queue>
 
 #include "common.h"
+#include "descriptor_allocator.h"
 #include "resource.h"
 
 namespace gfx {
     struct Device;
 
+    // Safe to allocate and free descriptors from multiple threads
     struct DescriptorHeap {
         DescriptorHeap(const Device& device, D3D12_DESCRIPTOR_HEAP_TYPE type, D3D12_DESCRIPTOR_HEAP_FLAGS flags, uint32_t n_descriptors);
         ResourceHandle alloc_descriptor(ResourceType type);
-        void free_descriptor(ResourceHandle id);
+        void free_descriptor(ResourceHandle& id, uint64_t frame_index); // Clears the handle. The descriptor gets reused once the GPU finished `frame_index`
+        void recycle_descriptors(uint64_t completed_frame_index);
+        bool is_valid(const ResourceHandle& id) const; // False if the descriptor was freed since the handle was made
         D3D12_CPU_DESCRIPTOR_HANDLE fetch_cpu_handle(const ResourceHandle& id);
+        DescriptorAllocatorStats stats() const { return m_allocator.stats(); }
 
     public:
         ComPtr<ID3D12DescriptorHeap> heap = nullptr;
 
     private:
         uint32_t m_capacity = 0;
-        uint32_t m_alloc_index = 0;
         size_t m_descriptor_size = 0;
         D3D12_CPU_DESCRIPTOR_HANDLE m_start_cpu = {};
-        std::deque<uint32_t> m_available_recycled_descriptor_indices;
+        DescriptorAllocator m_allocator; // Every allocation is 2 descriptors, the second one is for the UAV
     };
 }
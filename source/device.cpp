@@ -17,10 +17,15 @@
 #include "scene.h"
 #include "input.h"
 #include "fence.h"
+#include "profiler.h"
 #include <winerror.h>
 
 #define MAX_QUERY_COUNT 1024
 #define DEBUG_PRINT_GPU_PROFILING 0
+#define PLACED_HEAP_SIZE (128 * 1024 * 1024)
+#define PLACED_UPLOAD_HEAP_SIZE (32 * 1024 * 1024)
+#define STAGING_RING_SIZE (64 * 1024 * 1024)
+#define STAGING_MAX_CHUNK_SIZE (16 * 1024 * 1024) // Bigger uploads are split up, so they can stream through the ring
 
 namespace gfx {
     const char* breadcrumb_op_names[49] = {
@@ -155,6 +160,9 @@ namespace gfx {
         if (device == nullptr) {
             throw std::exception();
         }
+        if (FAILED(adapter.As(&m_adapter))) {
+            LOG(Warning, "Can't query the video memory budget, heap pools won't have a budget");
+        }
 
         if (debug_layer_enabled) {
             validate(device->QueryInterface(m_device_debug.GetAddressOf()));
@@ -180,6 +188,44 @@ namespace gfx {
         m_upload_queue = std::make_shared<CommandQueue>(device.Get(), CommandBufferType::compute, L"Upload command queue");
         m_swapchain = std::make_shared<Swapchain>(*this, *m_queue_gfx, *m_heap_rtv, m_framebuffer_format);
         m_upload_queue_completion_fence = std::make_shared<Fence>(*this);
+        // Buffers and textures each get their own pools, which keeps it working on resource heap tier 1 too
+        auto make_heap_pool = [this](HeapPoolType type, const char* name, uint64_t heap_size, uint64_t granularity, D3D12_HEAP_TYPE heap_type, D3D12_HEAP_FLAGS heap_flags) {
+            auto pool = std::make_shared<HeapPool>();
+            pool->allocator = HeapAllocator(heap_size, granularity, [this, pool = pool.get(), name, heap_type, heap_flags](uint32_t heap_index, uint64_t size) {
+                // If the heap can't be made, the allocation fails, and the resource becomes a committed one instead
+                ComPtr<ID3D12Heap> heap;
+                const HRESULT hr = try_create_heap(std::string(name) + " " + std::to_string(heap_index), size, heap_type, heap_flags, heap);
+                if (SUCCEEDED(hr)) pool->heaps.push_back(heap);
+                else LOG(Warning, "Could not create %s %u (%llu bytes), error 0x%08X", name, heap_index, (unsigned long long)size, (unsigned)hr);
+                return SUCCEEDED(hr);
+            });
+            m_heap_pools[(size_t)type] = pool;
+        };
+        make_heap_pool(HeapPoolType::buffers, "Buffer heap", PLACED_HEAP_SIZE, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT, D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS);
+        make_heap_pool(HeapPoolType::textures, "Texture heap", PLACED_HEAP_SIZE, D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT, D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES);
+        make_heap_pool(HeapPoolType::upload, "Upload heap", PLACED_UPLOAD_HEAP_SIZE, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT, D3D12_HEAP_TYPE_UPLOAD, D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS);
+        update_memory_budgets();
+
+        // Resources are put in a category based on their usage, unless their name says they're something more specific
+        m_memory_tracker->add_category_rule("Staging ring", "Staging ring");
+        m_memory_tracker->add_category_rule("Draw packet page", "Draw packets");
+        m_memory_tracker->add_category_rule("(blas scratch buffer)", "BLAS scratch");
+        m_memory_tracker->add_category_rule("(tlas scratch buffer)", "TLAS scratch");
+        m_memory_tracker->add_category_rule("(tlas instance descs)", "TLAS instances");
+
+        m_uploads = UploadQueue(UploadQueueFuncs{
+            .create_command_buffer = [this](const Pipeline* pipeline, uint64_t fence_value) { return m_upload_queue->create_command_buffer(pipeline, fence_value); },
+            .submit = [this](uint64_t fence_value) {
+                m_upload_queue->execute();
+                m_upload_queue_completion_fence->gpu_signal(m_upload_queue, fence_value);
+                m_upload_queue_completion_fence->gpu_wait(m_queue_gfx, fence_value);
+            },
+            .completed_fence_value = [this]() { return m_upload_queue_completion_fence->completed_value(); },
+            .cpu_wait = [this](uint64_t fence_value) { m_upload_queue_completion_fence->cpu_wait(fence_value); },
+        }, STAGING_RING_SIZE);
+        m_staging_buffer = create_buffer("Staging ring buffer", STAGING_RING_SIZE, nullptr, ResourceUsage::cpu_writable);
+        const D3D12_RANGE read_range = { 0, 0 };
+        validate(m_staging_buffer.resource->handle->Map(0, &read_range, (void**)&m_staging_buffer_mapped));
 
         {
             std::lock_guard<std::mutex> lock(mutex_thread_shared_globals);
@@ -273,20 +319,18 @@ namespace gfx {
         device_lost_thread.join();
 
         // Finish any queued uploads
-        m_upload_queue_completion_fence->gpu_signal(m_upload_queue, m_upload_fence_value_when_done);
-        m_upload_queue->execute();
-        m_upload_queue_completion_fence->cpu_wait(m_upload_fence_value_when_done);
+        m_uploads.wait_idle();
 
         // Wait for GPU to finish
         m_swapchain->flush(m_queue_gfx);
 
         // Clean up in a certain order
-        while (!m_resources_to_unload.empty() || !m_temp_upload_buffers.empty()) {
+        while (!m_resources_to_unload.empty() || m_uploads.has_kept_alive_resources()) {
             begin_frame();
             end_frame();
             clean_up_old_resources();
         }
-        m_temp_upload_buffers.clear();
+        m_uploads = UploadQueue();
         m_swapchain.reset();
         m_curr_bound_pipeline.reset();
         m_curr_pass_cmd.reset();
@@ -311,29 +355,39 @@ namespace gfx {
     }
 
     std::shared_ptr<Pipeline> Device::create_raster_pipeline(const std::string& name, const std::string& vertex_shader_path, const std::string& pixel_shader_path, const std::initializer_list<ResourceHandlePair> render_targets, const ResourceHandlePair depth_target) {
-        std::vector<DXGI_FORMAT> render_target_formats;
-        DXGI_FORMAT depth_target_format = DXGI_FORMAT_UNKNOWN;
+        std::vector<PixelFormat> render_target_formats;
+        PixelFormat depth_target_format = PixelFormat::none;
 
         // If we specify render targets, specify the formats
         for (auto& render_target : render_targets) {
             const auto& resource = render_target.resource;
             const auto& texture = resource->expect_texture();
-            render_target_formats.emplace_back(pixel_format_to_dx12(texture.pixel_format));
-        }
-
-        // Otherwise, assume swapchain target and get its format
-        if (render_target_formats.empty()) {
-            render_target_formats.push_back(m_swapchain->curr_framebuffer()->GetDesc().Format);
+            render_target_formats.emplace_back(texture.pixel_format);
         }
 
         // Get depth format
         if (depth_target.handle.type != (uint32_t)ResourceType::none) {
             const auto& resource = depth_target.resource;
             const auto& texture = resource->expect_texture();
-            depth_target_format = pixel_format_to_dx12(texture.pixel_format);
+            depth_target_format = texture.pixel_format;
+        }
+
+        return create_raster_pipeline(name, vertex_shader_path, pixel_shader_path, render_target_formats, depth_target_format);
+    }
+
+    std::shared_ptr<Pipeline> Device::create_raster_pipeline(const std::string& name, const std::string& vertex_shader_path, const std::string& pixel_shader_path, const std::vector<PixelFormat>& render_target_formats, const PixelFormat depth_target_format) {
+        std::vector<DXGI_FORMAT> render_target_formats_dx12;
+        for (const PixelFormat format : render_target_formats) {
+            render_target_formats_dx12.push_back(pixel_format_to_dx12(format));
         }
 
-        return std::make_shared<Pipeline>(*this, name, vertex_shader_path, pixel_shader_path, render_target_formats, depth_target_format);
+        // Otherwise, assume swapchain target
+        if (render_target_formats_dx12.empty()) {
+            render_target_formats_dx12.push_back(pixel_format_to_dx12(m_framebuffer_format));
+        }
+
+        const DXGI_FORMAT depth_target_format_dx12 = (depth_target_format != PixelFormat::none) ? pixel_format_to_dx12(depth_target_format) : DXGI_FORMAT_UNKNOWN;
+        return std::make_shared<Pipeline>(*this, name, vertex_shader_path, pixel_shader_path, render_target_formats_dx12, depth_target_format_dx12);
     }
 
     std::shared_ptr<Pipeline> Device::create_compute_pipeline(const std::string& name, const std::string& compute_shader_path) {
@@ -355,16 +409,23 @@ namespace gfx {
             m_width = width;
             m_height = height;
         }
-        m_upload_queue->execute();
-        m_upload_queue_completion_fence->gpu_signal(m_upload_queue, m_upload_fence_value_when_done);
-        m_upload_queue_completion_fence->cpu_wait(m_upload_fence_value_when_done);
+
+        // Rendering waits for the uploads on the GPU, the CPU doesn't have to wait for them
+        flush_upload_queue();
         m_swapchain->next_framebuffer();
         m_queue_gfx->clean_up_old_command_buffers(m_swapchain->current_fence_completed_value());
-        m_upload_queue->clean_up_old_command_buffers(m_upload_fence_value_when_done);
+        m_upload_queue->clean_up_old_command_buffers(m_upload_queue_completion_fence->completed_value());
+        m_newly_loaded_resources.clear();
         clean_up_old_resources();
+        const uint64_t completed_frame_index = m_swapchain->current_fence_completed_value();
+        m_heap_bindless->recycle_descriptors(completed_frame_index);
+        m_heap_rtv->recycle_descriptors(completed_frame_index);
+        m_heap_dsv->recycle_descriptors(completed_frame_index);
+        update_memory_budgets();
     }
 
     void Device::end_frame() {
+        PROFILE_ZONE("Device::end_frame");
         m_swapchain->prepare_present(m_curr_pass_cmd);
         m_queue_gfx->execute();
         m_swapchain->synchronize(m_queue_gfx);
@@ -372,22 +433,40 @@ namespace gfx {
         glfwPollEvents();
         glfwSwapBuffers(m_window_glfw);
 
-        if (m_gpu_profiling) {
-            std::vector<uint64_t> timestamps;
-            timestamps.resize(m_query_labels.size() * 2);
-            readback_buffer(m_query_buffer, 0, timestamps.size() * sizeof(uint64_t), timestamps.data());
-            std::vector<float> pipeline_times;
-            pipeline_times.resize(m_query_labels.size());
+        if (m_gpu_profiling && !m_query_labels.empty()) {
+            // These keep their capacity between frames, so this doesn't allocate once the number of passes settles
+            m_query_timestamps.resize(m_query_labels.size() * 2);
+            readback_buffer(m_query_buffer, 0, (uint32_t)(m_query_timestamps.size() * sizeof(uint64_t)), m_query_timestamps.data());
+            m_query_pipeline_times.resize(m_query_labels.size());
             float total = 0.0f;
             for (int i = 0; i < m_query_labels.size(); ++i) {
-                pipeline_times[i] = ((float)(timestamps[i*2 + 1] - timestamps[i*2 + 0])) / m_timestamp_frequency;
-                total += pipeline_times[i];
+                m_query_pipeline_times[i] = ((float)(m_query_timestamps[i*2 + 1] - m_query_timestamps[i*2 + 0])) / m_timestamp_frequency;
+                total += m_query_pipeline_times[i];
+            }
+            m_gpu_frame_time = total;
+
+            // Put the passes on the profiler's clock. The calibration gives a GPU timestamp and a QPC value taken at the same time,
+            // and sampling QPC next to `now_ns()` gives the offset between QPC and the profiler's clock
+            UINT64 gpu_calibration = 0, qpc_calibration = 0;
+            LARGE_INTEGER qpc_frequency, qpc_now;
+            m_queue_gfx->command_queue->GetClockCalibration(&gpu_calibration, &qpc_calibration);
+            QueryPerformanceFrequency(&qpc_frequency);
+            QueryPerformanceCounter(&qpc_now);
+            const int64_t profiler_now_ns = profiler::now_ns();
+            auto qpc_to_ns = [&](int64_t qpc) { return (double)qpc * 1'000'000'000.0 / (double)qpc_frequency.QuadPart; };
+            const double calibration_ns = qpc_to_ns((int64_t)qpc_calibration) + ((double)profiler_now_ns - qpc_to_ns(qpc_now.QuadPart));
+            auto gpu_to_ns = [&](uint64_t timestamp) {
+                return (int64_t)(calibration_ns + ((double)timestamp - (double)gpu_calibration) * 1'000'000'000.0 / (double)m_timestamp_frequency);
+            };
+            const uint64_t profiled_frame = (uint64_t)frame_index();
+            for (int i = 0; i < m_query_labels.size(); ++i) {
+                profiler::add_gpu_pass(profiled_frame, m_query_labels[i]->get_name(), gpu_to_ns(m_query_timestamps[i*2 + 0]), gpu_to_ns(m_query_timestamps[i*2 + 1]));
             }
 
 #if DEBUG_PRINT_GPU_PROFILING
             LOG(Debug, "----------------------------------------GPU PROFILING----------------------------------------");
             for (int i = 0; i < m_query_labels.size(); ++i) {
-                LOG(Debug, "%56s: %.3f ms (%2.1f%%)", m_query_labels[i].c_str(), pipeline_times[i] * 1000.f, 100.f * pipeline_times[i] / total);
+                LOG(Debug, "%56s: %.3f ms (%2.1f%%)", m_query_labels[i]->get_name().c_str(), m_query_pipeline_times[i] * 1000.f, 100.f * m_query_pipeline_times[i] / total);
             }
 
             // Warn if we drop below 60 fps, error if we drop below 30 fps, cuz then there's 
@@ -398,26 +477,32 @@ namespace gfx {
         }
     }
 
-    void Device::set_graphics_root_constants(const std::vector<uint32_t>& constants) {
-        auto gfx_cmd = m_curr_pass_cmd->get();
-        UINT index = 0;
-        for (const auto& constant : constants) {
-            gfx_cmd->SetGraphicsRoot32BitConstant(0, constant, index++);
-        }
+    void Device::set_graphics_root_constants(std::span<const uint32_t> constants) {
+        if (constants.empty()) return;
+        m_curr_pass_cmd->get()->SetGraphicsRoot32BitConstants(0, (UINT)constants.size(), constants.data(), 0);
     }
 
-    void Device::set_compute_root_constants(const std::vector<uint32_t>& constants) {
-        auto gfx_cmd = m_curr_pass_cmd->get();
-        UINT index = 0;
-        for (const auto& constant : constants) {
-            gfx_cmd->SetComputeRoot32BitConstant(0, constant, index++);
-        }
+    void Device::set_graphics_root_constants(std::initializer_list<uint32_t> constants) {
+        set_graphics_root_constants(std::span<const uint32_t>(constants.begin(), constants.size()));
+    }
+
+    void Device::set_compute_root_constants(std::span<const uint32_t> constants) {
+        if (constants.empty()) return;
+        m_curr_pass_cmd->get()->SetComputeRoot32BitConstants(0, (UINT)constants.size(), constants.data(), 0);
+    }
+
+    void Device::set_compute_root_constants(std::initializer_list<uint32_t> constants) {
+        set_compute_root_constants(std::span<const uint32_t>(constants.begin(), constants.size()));
     }
 
     int Device::frame_index() {
         return m_swapchain->current_frame_index();
     }
 
+    uint64_t Device::completed_frame_index() {
+        return m_swapchain->current_fence_completed_value();
+    }
+
     bool Device::supports(RendererFeature feature) {
         D3D12_FEATURE_DATA_D3D12_OPTIONS5 feature_opt5{};
 
@@ -429,13 +514,22 @@ namespace gfx {
                     sizeof(feature_opt5)
                 ))) return false;
                 return (feature_opt5.RaytracingTier != D3D12_RAYTRACING_TIER_NOT_SUPPORTED);
+            case RendererFeature::mixed_resource_heaps: {
+                D3D12_FEATURE_DATA_D3D12_OPTIONS feature_opt{};
+                if (FAILED(device->CheckFeatureSupport(
+                    D3D12_FEATURE_D3D12_OPTIONS,
+                    &feature_opt,
+                    sizeof(feature_opt)
+                ))) return false;
+                return (feature_opt.ResourceHeapTier >= D3D12_RESOURCE_HEAP_TIER_2);
+            }
             default: 
                 return false;
         }
     }
 
-    void Device::begin_raster_pass(std::shared_ptr<Pipeline> pipeline, RasterPassInfo&& render_pass_info) {
-        // Create command buffer for this pass
+    void Device::begin_raster_pass(std::shared_ptr<Pipeline> pipeline, const RasterPassInfo& render_pass_info) {
+        // Create command buffer for this pass. Barriers that were queued before this get recorded along with the render target transitions
         m_curr_pass_cmd = m_queue_gfx->create_command_buffer(pipeline.get(), m_swapchain->current_frame_index());
 
         if (m_gpu_profiling) {
@@ -447,24 +541,12 @@ namespace gfx {
 
         // Set up pipeline
         m_curr_bound_pipeline = pipeline;
-        ID3D12DescriptorHeap* heaps[] = {
-            m_heap_bindless->heap.Get(),
-        };
-        m_curr_pass_cmd->get()->SetDescriptorHeaps(1, heaps);
-        m_curr_pass_cmd->get()->SetPipelineState(m_curr_bound_pipeline->pipeline_state.Get());
-        m_curr_pass_cmd->get()->SetGraphicsRootSignature(m_curr_bound_pipeline->root_signature.Get());
-
-        D3D12_VIEWPORT viewport{};
-        D3D12_RECT scissor{};
-        bool have_rtv = false;
-        bool have_dsv = false;
-        std::vector<D3D12_CPU_DESCRIPTOR_HANDLE> rtv_handles;
-        D3D12_CPU_DESCRIPTOR_HANDLE dsv_handle{};
+        RasterPassState state{};
 
         // If the color target is the swapchain, prepare the swapchain for that
-        if (render_pass_info.color_targets.empty()) {
+        if (render_pass_info.color_targets[0].resource == nullptr) {
             m_swapchain->prepare_render(m_curr_pass_cmd);
-            viewport = {
+            state.viewport = {
                 .TopLeftX = 0.0f,
                 .TopLeftY = 0.0f,
                 .Width = (FLOAT)m_width,
@@ -472,27 +554,26 @@ namespace gfx {
                 .MinDepth = 0.0f,
                 .MaxDepth = 1.0f,
             };
-            scissor = {
+            state.scissor = {
                 .left = 0,
                 .top = 0,
                 .right = (LONG)m_width,
                 .bottom = (LONG)m_height,
             };
-            rtv_handles.push_back(m_swapchain->curr_framebuffer_rtv());
-            have_rtv = true;
+            state.rtv_handles[state.n_rtv_handles++] = m_swapchain->curr_framebuffer_rtv();
         }
 
         // Otherwise, if the color target is a texture, transition the texture to render target, and then bind it
         else {
             for (auto& color_target : render_pass_info.color_targets) {
+                if (color_target.resource == nullptr) break;
                 auto& texture = color_target.resource;
-                auto gfx_cmd = m_curr_pass_cmd->get();
 
                 transition_resource(m_curr_pass_cmd, texture, D3D12_RESOURCE_STATE_RENDER_TARGET);
                 auto rtv_handle = m_heap_rtv->fetch_cpu_handle(texture->expect_texture().rtv_handle);
-                rtv_handles.push_back(rtv_handle);
+                state.rtv_handles[state.n_rtv_handles++] = rtv_handle;
 
-                viewport = {
+                state.viewport = {
                     .TopLeftX = 0.0f,
                     .TopLeftY = 0.0f,
                     .Width = (FLOAT)texture->expect_texture().width,
@@ -500,7 +581,7 @@ namespace gfx {
                     .MinDepth = 0.0f,
                     .MaxDepth = 1.0f,
                 };
-                scissor = {
+                state.scissor = {
                     .left = 0,
                     .top = 0,
                     .right = (LONG)texture->expect_texture().width,
@@ -512,37 +593,110 @@ namespace gfx {
                     auto clear_color = &texture->expect_texture().clear_color;
                     m_curr_pass_cmd->get()->ClearRenderTargetView(rtv_handle, &clear_color->r, 0, nullptr);
                 }
+                else if (texture->expect_texture().needs_discard) {
+                    execute_resource_transitions(m_curr_pass_cmd);
+                    m_curr_pass_cmd->get()->DiscardResource(texture->handle.Get(), nullptr);
+                }
+                texture->expect_texture().needs_discard = false;
             }
-            have_rtv = true;
         }
 
         // If we have a depth buffer, bind it too
         if ((ResourceType)render_pass_info.depth_target.handle.type == ResourceType::texture) {
             auto& texture = render_pass_info.depth_target.resource;
-            auto gfx_cmd = m_curr_pass_cmd->get();
 
             transition_resource(m_curr_pass_cmd, texture, D3D12_RESOURCE_STATE_DEPTH_WRITE);
-            dsv_handle = m_heap_dsv->fetch_cpu_handle(texture->expect_texture().dsv_handle);
-            m_curr_pass_cmd->get()->ClearDepthStencilView(dsv_handle, D3D12_CLEAR_FLAG_DEPTH, texture->expect_texture().clear_color.x, 0, 0, nullptr);
+            execute_resource_transitions(m_curr_pass_cmd); // Queued aliasing barriers have to come before the clear
+            state.dsv_handle = m_heap_dsv->fetch_cpu_handle(texture->expect_texture().dsv_handle);
+            m_curr_pass_cmd->get()->ClearDepthStencilView(state.dsv_handle, D3D12_CLEAR_FLAG_DEPTH, texture->expect_texture().clear_color.x, 0, 0, nullptr);
+            texture->expect_texture().needs_discard = false;
+
+            state.have_dsv = true;
+        }
 
-            have_dsv = true;
+        if (render_pass_info.viewport_size.x > 0 && render_pass_info.viewport_size.y > 0) {
+            state.viewport.Width = (FLOAT)render_pass_info.viewport_size.x;
+            state.viewport.Height = (FLOAT)render_pass_info.viewport_size.y;
+            state.scissor.right = (LONG)render_pass_info.viewport_size.x;
+            state.scissor.bottom = (LONG)render_pass_info.viewport_size.y;
         }
         
         execute_resource_transitions(m_curr_pass_cmd);
-        m_curr_pass_cmd->get()->RSSetViewports(1, &viewport);
-        m_curr_pass_cmd->get()->RSSetScissorRects(1, &scissor);
-        m_curr_pass_cmd->get()->OMSetRenderTargets(
-            have_rtv ? (UINT)rtv_handles.size() : 0,
-            have_rtv ? rtv_handles.data() : nullptr,
+        m_curr_raster_pass_state = state;
+        bind_raster_pass_state(*m_curr_pass_cmd);
+    }
+
+    void Device::bind_raster_pass_state(CommandBuffer& cmd) {
+        const RasterPassState& state = m_curr_raster_pass_state;
+        ID3D12DescriptorHeap* heaps[] = {
+            m_heap_bindless->heap.Get(),
+        };
+        cmd.get()->SetDescriptorHeaps(1, heaps);
+        cmd.get()->SetPipelineState(m_curr_bound_pipeline->pipeline_state.Get());
+        cmd.get()->SetGraphicsRootSignature(m_curr_bound_pipeline->root_signature.Get());
+        cmd.get()->RSSetViewports(1, &state.viewport);
+        cmd.get()->RSSetScissorRects(1, &state.scissor);
+        cmd.get()->OMSetRenderTargets(
+            state.n_rtv_handles,
+            state.n_rtv_handles > 0 ? state.rtv_handles.data() : nullptr,
             false, 
-            have_dsv ? &dsv_handle : nullptr
+            state.have_dsv ? &state.dsv_handle : nullptr
         );
     }
 
+    std::span<RasterPassRecorder> Device::fork_raster_pass(uint32_t n_recorders) {
+        if (!m_curr_bound_pipeline) {
+            LOG(Error, "Attempt to fork a raster pass without a pipeline set! Did you forget to call `begin_raster_pass()`?");
+            return {};
+        }
+
+        // Command buffers are executed in the order they were created, so create them all here, on this thread
+        if (m_raster_pass_recorders.size() < n_recorders) {
+            m_raster_pass_recorders.resize(n_recorders);
+        }
+        for (uint32_t i = 0; i < n_recorders; ++i) {
+            auto& recorder = m_raster_pass_recorders[i];
+            recorder.cmd = m_queue_gfx->create_command_buffer(m_curr_bound_pipeline.get(), m_swapchain->current_frame_index());
+            recorder.pipeline = m_curr_bound_pipeline.get();
+            bind_raster_pass_state(*recorder.cmd);
+        }
+
+        // Anything recorded on the device from here on, like ending the pass, should end up after the recorders
+        m_curr_pass_cmd = m_queue_gfx->create_command_buffer(m_curr_bound_pipeline.get(), m_swapchain->current_frame_index());
+        bind_raster_pass_state(*m_curr_pass_cmd);
+
+        return { m_raster_pass_recorders.data(), n_recorders };
+    }
+
+    void RasterPassRecorder::set_graphics_root_constants(std::span<const uint32_t> constants) {
+        if (constants.empty()) return;
+        cmd->get()->SetGraphicsRoot32BitConstants(0, (UINT)constants.size(), constants.data(), 0);
+    }
+
+    void RasterPassRecorder::set_graphics_root_constants(std::initializer_list<uint32_t> constants) {
+        set_graphics_root_constants(std::span<const uint32_t>(constants.begin(), constants.size()));
+    }
+
+    void RasterPassRecorder::draw_vertices(uint32_t n_vertices, uint32_t n_instances) {
+        cmd->get()->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        cmd->get()->DrawInstanced(n_vertices, n_instances, 0, 0);
+    }
+
+    void RasterPassRecorder::draw_indirect(const ResourceHandlePair& commands, uint32_t offset, uint32_t n_draws) {
+        if (!pipeline->indirect_draw_signature) {
+            LOG(Error, "Pipeline \"%s\" does not support indirect draws! Did you forget to call `enable_indirect_draws()`?", pipeline->name.c_str());
+            return;
+        }
+        if (n_draws == 0) return;
+
+        cmd->get()->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        cmd->get()->ExecuteIndirect(pipeline->indirect_draw_signature.Get(), n_draws, commands.resource->handle.Get(), offset, nullptr, 0);
+    }
+
     void Device::end_raster_pass() {
         if (m_gpu_profiling) {
             m_curr_pass_cmd->get()->EndQuery(m_query_heap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, m_query_labels.size() * 2 + 1);
-            m_query_labels.push_back(m_curr_bound_pipeline->get_name());
+            m_query_labels.push_back(m_curr_bound_pipeline);
             transition_resource(m_curr_pass_cmd, m_query_buffer.resource, D3D12_RESOURCE_STATE_COPY_DEST);
             execute_resource_transitions(m_curr_pass_cmd);
             m_curr_pass_cmd->get()->ResolveQueryData(m_query_heap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 0, m_query_labels.size() * 2, m_query_buffer.resource->handle.Get(), 0);
@@ -552,7 +706,7 @@ namespace gfx {
     void Device::begin_compute_pass(std::shared_ptr<Pipeline> pipeline, bool async) {
         // Create command buffer for this pass
         if (async) {
-            m_curr_pass_cmd = m_upload_queue->create_command_buffer(pipeline.get(), ++m_upload_fence_value_when_done);
+            m_curr_pass_cmd = m_uploads.create_command_buffer(pipeline.get());
             m_curr_pipeline_is_async = true;
         }
         else {
@@ -575,23 +729,29 @@ namespace gfx {
         m_curr_pass_cmd->get()->SetPipelineState(m_curr_bound_pipeline->pipeline_state.Get());
         m_curr_pass_cmd->get()->SetComputeRootSignature(m_curr_bound_pipeline->root_signature.Get());
         m_curr_pass_cmd->get()->SetName(async ? L"Async compute pass" : L"Compute pass");	
+
+        // Record any barriers that were queued before the pass began
+        execute_resource_transitions(m_curr_pass_cmd);
     }
 
     void Device::end_compute_pass() {
         if (m_gpu_profiling) {
             m_curr_pass_cmd->get()->EndQuery(m_query_heap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, m_query_labels.size() * 2 + 1);
-            m_query_labels.push_back(m_curr_bound_pipeline->get_name());
+            m_query_labels.push_back(m_curr_bound_pipeline);
             transition_resource(m_curr_pass_cmd, m_query_buffer.resource, D3D12_RESOURCE_STATE_COPY_DEST);
             execute_resource_transitions(m_curr_pass_cmd);
             m_curr_pass_cmd->get()->ResolveQueryData(m_query_heap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 0, m_query_labels.size() * 2, m_query_buffer.resource->handle.Get(), 0);
         }
+
+        // Barriers queued after this belong to the graphics queue again
+        m_curr_pipeline_is_async = false;
     }
 
     void Device::dispatch_threadgroups(uint32_t x, uint32_t y, uint32_t z) {
         m_curr_pass_cmd->get()->Dispatch(x, y, z);
     }
 
-    void Device::draw_vertices(uint32_t n_vertices) {
+    void Device::draw_vertices(uint32_t n_vertices, uint32_t n_instances) {
         if (!m_curr_bound_pipeline) {
             LOG(Error, "Attempt to record draw call without a pipeline set! Did you forget to call `begin_raster_pass()`?");
             return;
@@ -602,7 +762,37 @@ namespace gfx {
 
         // Record draw call
         gfx_cmd->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-        gfx_cmd->DrawInstanced(n_vertices, 1, 0, 0);
+        gfx_cmd->DrawInstanced(n_vertices, n_instances, 0, 0);
+    }
+
+    void Device::enable_indirect_draws(const std::shared_ptr<Pipeline>& pipeline, uint32_t first_root_constant, uint32_t n_root_constants) {
+        // Each command sets some of the root constants, and then draws
+        D3D12_INDIRECT_ARGUMENT_DESC arguments[2] = {};
+        arguments[0].Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT;
+        arguments[0].Constant.RootParameterIndex = 0;
+        arguments[0].Constant.DestOffsetIn32BitValues = first_root_constant;
+        arguments[0].Constant.Num32BitValuesToSet = n_root_constants;
+        arguments[1].Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW;
+
+        const D3D12_COMMAND_SIGNATURE_DESC desc = {
+            .ByteStride = n_root_constants * sizeof(uint32_t) + sizeof(D3D12_DRAW_ARGUMENTS),
+            .NumArgumentDescs = 2,
+            .pArgumentDescs = arguments,
+        };
+        validate(device->CreateCommandSignature(&desc, pipeline->root_signature.Get(), IID_PPV_ARGS(&pipeline->indirect_draw_signature)));
+    }
+
+    void Device::draw_indirect(const ResourceHandlePair& commands, uint32_t offset, uint32_t n_draws) {
+        if (!m_curr_bound_pipeline) {
+            LOG(Error, "Attempt to record draw call without a pipeline set! Did you forget to call `begin_raster_pass()`?");
+            return;
+        }
+
+        RasterPassRecorder recorder = {
+            .cmd = m_curr_pass_cmd,
+            .pipeline = m_curr_bound_pipeline.get(),
+        };
+        recorder.draw_indirect(commands, offset, n_draws);
     }
 
     D3D12_UNORDERED_ACCESS_VIEW_DESC make_texture_uav_desc(DXGI_FORMAT format, TextureType type, int depth, int mip_slice) {
@@ -673,7 +863,6 @@ namespace gfx {
         const auto resource = std::make_shared<Resource>(ResourceType::texture);
         resource->usage = usage;
         resource->expect_texture() = {
-            .data = static_cast<uint8_t*>(data),
             .width = width,
             .height = height,
             .depth = depth,
@@ -707,19 +896,8 @@ namespace gfx {
         }
         resource_desc.MipLevels = (UINT16)mip_levels;
 
-        D3D12_HEAP_PROPERTIES heap_properties = {};
-        heap_properties.Type = D3D12_HEAP_TYPE_DEFAULT;
-
-        const auto upload_size = width * height * depth * size_per_pixel(pixel_format);
         auto descriptor = m_heap_bindless->fetch_cpu_handle(id);
-        validate(device->CreateCommittedResource(
-            &heap_properties,
-            D3D12_HEAP_FLAG_NONE,
-            &resource_desc,
-            D3D12_RESOURCE_STATE_COPY_DEST,
-            nullptr,
-            IID_PPV_ARGS(&resource->handle)
-        ));
+        create_resource(*resource, resource_desc, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_COPY_DEST);
         resource->current_state = D3D12_RESOURCE_STATE_COPY_DEST;
         auto srv_desc = make_texture_srv_desc(resource_desc.Format, type, mip_levels);
         device->CreateShaderResourceView(resource->handle.Get(), &srv_desc, descriptor);
@@ -757,69 +935,61 @@ namespace gfx {
             device->CreateUnorderedAccessView(resource->handle.Get(), nullptr, &uav_desc, uav_descriptor);
         }
 
-        // We need to copy the texture from an upload buffer
+        // We need to copy the texture from the staging ring. Rows in there need a 256 byte aligned pitch, so they're copied over one by one
         if (data) {
-            const auto upload_buffer_id = create_buffer("Upload buffer", upload_size, data, ResourceUsage::cpu_writable);
-            queue_unload_bindless_resource(upload_buffer_id);
-
-            const auto& upload_buffer = upload_buffer_id.resource;
-
-            auto texture_size_box = D3D12_BOX{
-                .left = 0,
-                .top = 0,
-                .front = 0,
-                .right = width,
-                .bottom = height,
-                .back = depth,
-            };
-
-            auto texture_copy_source = D3D12_TEXTURE_COPY_LOCATION{
-                .pResource = upload_buffer->handle.Get(),
-                .Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT,
-                .PlacedFootprint = {
-                    .Offset = 0,
-                    .Footprint = {
-                        .Format = pixel_format_to_dx12(resource->expect_texture().pixel_format),
-                        .Width = resource->expect_texture().width,
-                        .Height = resource->expect_texture().height,
-                        .Depth = resource->expect_texture().depth,
-                        .RowPitch = resource->expect_texture().width * static_cast<uint32_t>(size_per_pixel(pixel_format)),
+            const StagingRowLayout rows = staging_row_layout((uint64_t)width * size_per_pixel(pixel_format), D3D12_TEXTURE_DATA_PITCH_ALIGNMENT, STAGING_MAX_CHUNK_SIZE);
+            const uint64_t row_size = rows.row_size;
+            const uint64_t row_pitch = rows.row_pitch;
+            const uint32_t max_rows_per_copy = rows.max_rows_per_copy;
+            const uint8_t* source_data = (const uint8_t*)data;
+
+            // Cubemap faces are separate subresources, 3D texture slices are all in subresource 0
+            for (uint32_t slice = 0; slice < depth; ++slice) {
+                for (uint32_t y = 0; y < height; y += max_rows_per_copy) {
+                    const uint32_t n_rows = std::min(max_rows_per_copy, height - y);
+                    const uint64_t offset = m_uploads.allocate_staging(n_rows * row_pitch, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+                    for (uint32_t row = 0; row < n_rows; ++row) {
+                        memcpy(m_staging_buffer_mapped + offset + row * row_pitch, source_data + ((uint64_t)slice * height + y + row) * row_size, row_size);
                     }
-                }
-            };
-
-            auto texture_copy_dest = D3D12_TEXTURE_COPY_LOCATION{
-                .pResource = resource->handle.Get(),
-                .Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
-                .SubresourceIndex = 0,
-            };
 
-            // todo: determine whether i want this to be in a separate update_texture() function
-            ++m_upload_fence_value_when_done;
-            const auto upload_command_buffer = m_upload_queue->create_command_buffer(nullptr, m_upload_fence_value_when_done);
-            const auto cmd = upload_command_buffer->get();
-
-            switch (type) {
-            case TextureType::tex_2d:
-            case TextureType::tex_3d:
-                cmd->CopyTextureRegion(&texture_copy_dest, 0, 0, 0, &texture_copy_source, &texture_size_box);
-                break;
-            case TextureType::tex_cube:
-                texture_copy_source.PlacedFootprint.Footprint.Depth = 1;
-                texture_size_box.back = 1;
-                for (uint32_t i = 0; i < 6; ++i) {
-                    texture_copy_dest.SubresourceIndex = i;
-                    texture_copy_source.PlacedFootprint.Offset = i * height * texture_copy_source.PlacedFootprint.Footprint.RowPitch;
-                    cmd->CopyTextureRegion(&texture_copy_dest, 0, 0, 0, &texture_copy_source, &texture_size_box);
+                    const auto texture_copy_source = D3D12_TEXTURE_COPY_LOCATION{
+                        .pResource = m_staging_buffer.resource->handle.Get(),
+                        .Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT,
+                        .PlacedFootprint = {
+                            .Offset = offset,
+                            .Footprint = {
+                                .Format = pixel_format_to_dx12(pixel_format),
+                                .Width = width,
+                                .Height = n_rows,
+                                .Depth = 1,
+                                .RowPitch = (UINT)row_pitch,
+                            }
+                        }
+                    };
+                    const auto texture_copy_dest = D3D12_TEXTURE_COPY_LOCATION{
+                        .pResource = resource->handle.Get(),
+                        .Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
+                        .SubresourceIndex = (type == TextureType::tex_cube) ? slice * (uint32_t)mip_levels : 0,
+                    };
+                    const auto source_box = D3D12_BOX{
+                        .left = 0,
+                        .top = 0,
+                        .front = 0,
+                        .right = width,
+                        .bottom = n_rows,
+                        .back = 1,
+                    };
+                    const uint32_t dest_z = (type == TextureType::tex_3d) ? slice : 0;
+                    m_uploads.copy_command_buffer()->get()->CopyTextureRegion(&texture_copy_dest, 0, y, dest_z, &texture_copy_source, &source_box);
                 }
-                break;
             }
 
-            m_temp_upload_buffers.push_back(UploadQueueKeepAlive{ m_upload_fence_value_when_done, upload_buffer });
+            m_uploads.track_load(id.id);
         }
 
-        id.is_loaded = true; // todo, only set this to true when the upload command buffer finished (when the fence value was reached)
+        id.is_loaded = (data == nullptr); // Uploaded textures show up in `newly_loaded_resources()` once the copy is done
         resource->name = name;
+        track_memory(*resource, (data == nullptr && usage == ResourceUsage::compute_write) ? "Compute targets" : "Textures");
         resource->handle->SetName(std::wstring(name.begin(), name.end()).c_str());
         resource->subresource_handles = mip_handles;
 
@@ -860,7 +1030,6 @@ namespace gfx {
         const auto resource = std::make_shared<Resource>(ResourceType::buffer);
         resource->usage = usage;
         resource->expect_buffer() = {
-            .data = data,
             .size = size,
         };
 
@@ -882,14 +1051,7 @@ namespace gfx {
         else if (usage == ResourceUsage::cpu_writable)   heap_properties.Type = D3D12_HEAP_TYPE_UPLOAD;
 
         resource->current_state = D3D12_RESOURCE_STATE_COMMON;
-        validate(device->CreateCommittedResource(
-            &heap_properties,
-            D3D12_HEAP_FLAG_NONE,
-            &resource_desc,
-            resource->current_state,
-            nullptr,
-            IID_PPV_ARGS(&resource->handle)
-        ));
+        create_resource(*resource, resource_desc, heap_properties.Type, resource->current_state);
 
         // Allocate and create a shader resource view in the bindless descriptor heap
         const D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc {
@@ -937,25 +1099,26 @@ namespace gfx {
             resource->handle->Unmap(0, &range);
         }
         else if (data) {
-            // Create upload buffer containing the data
-            const auto upload_buffer_id = create_buffer("Upload buffer", size, data, ResourceUsage::cpu_writable);
-            const auto& upload_buffer = upload_buffer_id.resource;
-            queue_unload_bindless_resource(upload_buffer_id);
-
-            // Upload the data to the destination buffer
-            ++m_upload_fence_value_when_done;
-            auto cmd = m_upload_queue->create_command_buffer(nullptr, m_upload_fence_value_when_done);
-            transition_resource(cmd, resource, D3D12_RESOURCE_STATE_COPY_DEST);
-            execute_resource_transitions(cmd);
-            cmd->get()->CopyBufferRegion(resource->handle.Get(), 0, upload_buffer->handle.Get(), 0, size);
+            // Copy the data to the destination buffer through the staging ring, in chunks if it's big
+            for (uint64_t chunk_start = 0; chunk_start < size; chunk_start += STAGING_MAX_CHUNK_SIZE) {
+                const uint64_t chunk_size = std::min((uint64_t)STAGING_MAX_CHUNK_SIZE, size - chunk_start);
+                const uint64_t offset = m_uploads.allocate_staging(chunk_size, 16);
+                memcpy(m_staging_buffer_mapped + offset, (const uint8_t*)data + chunk_start, chunk_size);
+
+                auto cmd = m_uploads.copy_command_buffer();
+                transition_resource(cmd, resource, D3D12_RESOURCE_STATE_COPY_DEST);
+                execute_resource_transitions(cmd);
+                cmd->get()->CopyBufferRegion(resource->handle.Get(), chunk_start, m_staging_buffer.resource->handle.Get(), offset, chunk_size);
+            }
+            auto cmd = m_uploads.copy_command_buffer();
             transition_resource(cmd, resource, D3D12_RESOURCE_STATE_COMMON);
             execute_resource_transitions(cmd);
-            m_temp_upload_buffers.push_back(UploadQueueKeepAlive{ m_upload_fence_value_when_done, upload_buffer });
         }
 
         auto name_str = std::wstring(name.begin(), name.end());
         resource->handle->SetName(name_str.c_str());
         resource->name = name;
+        track_memory(*resource, (usage == ResourceUsage::cpu_writable) ? "Upload buffers" : (usage == ResourceUsage::cpu_read_write) ? "Readback buffers" : "Buffers");
 
         // Store the resource data in the device struct
         id.is_loaded = true;
@@ -968,7 +1131,6 @@ namespace gfx {
         const auto resource = std::make_shared<Resource>(ResourceType::texture);
         resource->usage = extra_usage;
         resource->expect_texture() = {
-            .data = nullptr,
             .width = width,
             .height = height,
             .pixel_format = pixel_format,
@@ -1012,6 +1174,7 @@ namespace gfx {
         auto name_str = std::wstring(name.begin(), name.end());
         resource->handle->SetName(name_str.c_str());
         resource->name = name;
+        track_memory(*resource, "Render targets");
 
         // todo: make this its own function or combine this function using some type of flag, I've repeated this 3 times now
         // Create SRV
@@ -1069,7 +1232,6 @@ namespace gfx {
         // Make texture resource
         const auto resource = std::make_shared<Resource>(ResourceType::texture);
         resource->expect_texture() = {
-            .data = nullptr,
             .width = width,
             .height = height,
             .pixel_format = pixel_format,
@@ -1114,6 +1276,7 @@ namespace gfx {
         auto name_str = std::wstring(name.begin(), name.end());
         resource->handle->SetName(name_str.c_str());
         resource->name = name;
+        track_memory(*resource, "Depth targets");
 
         // Allocate SRV id, so we can store it in the resources map
         // However, since this is a depth texture, we can't actually create a SRV for this
@@ -1150,21 +1313,21 @@ namespace gfx {
         if (texture.rtv_handle.type != (uint32_t)ResourceType::none) {
             std::optional<glm::vec4> clear_color{};
             if (texture.clear_on_begin) clear_color = texture.clear_color;
-            m_heap_rtv->free_descriptor(resource->expect_texture().rtv_handle);
+            free_descriptors(handle);
             handle = create_render_target(resource->name, width, height, texture.pixel_format, clear_color, resource->usage);
             return;
         }
 
         // If it's a depth target, create a new depth target
         if (texture.dsv_handle.type != (uint32_t)ResourceType::none) {
-            m_heap_dsv->free_descriptor(resource->expect_texture().dsv_handle);
+            free_descriptors(handle);
             handle = create_depth_target(resource->name, width, height, texture.pixel_format, texture.clear_color.r);
             return;
         }
 
         // If it's a render texture (compute shader render target), resize it
         if (texture.is_compute_render_target) {
-            m_heap_bindless->free_descriptor(handle.handle);
+            free_descriptors(handle);
             handle = load_texture(resource->name, width, height, 1, nullptr, texture.pixel_format, TextureType::tex_2d, resource->usage);
             return;
         }
@@ -1172,6 +1335,99 @@ namespace gfx {
         throw std::runtime_error("todo: when resizing regular textures, resize and copy the data to a new texture");
     }
 
+    void Device::get_allocation_info(const ResourceHandlePair& texture, uint64_t& size, uint64_t& alignment) const {
+        const D3D12_RESOURCE_DESC resource_desc = texture.resource->handle->GetDesc();
+        const D3D12_RESOURCE_ALLOCATION_INFO info = device->GetResourceAllocationInfo(0, 1, &resource_desc);
+        size = info.SizeInBytes;
+        alignment = info.Alignment;
+    }
+
+    ComPtr<ID3D12Heap> Device::create_heap(const std::string& name, uint64_t size, D3D12_HEAP_TYPE type, D3D12_HEAP_FLAGS flags) {
+        ComPtr<ID3D12Heap> heap;
+        validate(try_create_heap(name, size, type, flags, heap));
+        return heap;
+    }
+
+    HRESULT Device::try_create_heap(const std::string& name, uint64_t size, D3D12_HEAP_TYPE type, D3D12_HEAP_FLAGS flags, ComPtr<ID3D12Heap>& heap) {
+        D3D12_HEAP_DESC heap_desc = {
+            .SizeInBytes = size,
+            .Properties = {
+                .Type = type,
+            },
+            .Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT,
+            .Flags = flags,
+        };
+        const HRESULT hr = device->CreateHeap(&heap_desc, IID_PPV_ARGS(&heap));
+        if (FAILED(hr)) return hr;
+        auto name_str = std::wstring(name.begin(), name.end());
+        heap->SetName(name_str.c_str());
+        return hr;
+    }
+
+    void Device::place_texture(ResourceHandlePair& handle, ID3D12Heap* heap, uint64_t offset) {
+        auto& resource = handle.resource;
+        auto& texture = resource->expect_texture();
+        const bool is_render_target = texture.rtv_handle.type != (uint32_t)ResourceType::none;
+        const bool is_depth_target = texture.dsv_handle.type != (uint32_t)ResourceType::none;
+        assert(resource->subresource_handles.empty() && "Placing textures with mipmaps isn't supported");
+
+        // Same description as the committed resource, it just lives somewhere else now
+        const D3D12_RESOURCE_DESC resource_desc = resource->handle->GetDesc();
+        D3D12_CLEAR_VALUE clear_value = { .Format = resource_desc.Format };
+        if (is_depth_target) {
+            clear_value.DepthStencil = { .Depth = 1.0f, .Stencil = 0 };
+        }
+        else {
+            clear_value.Color[0] = texture.clear_color.r;
+            clear_value.Color[1] = texture.clear_color.g;
+            clear_value.Color[2] = texture.clear_color.b;
+            clear_value.Color[3] = texture.clear_color.a;
+        }
+        const D3D12_RESOURCE_STATES initial_state = is_render_target ? D3D12_RESOURCE_STATE_RENDER_TARGET
+                                                  : is_depth_target ? D3D12_RESOURCE_STATE_DEPTH_WRITE
+                                                  : D3D12_RESOURCE_STATE_COMMON;
+        validate(device->CreatePlacedResource(
+            heap,
+            offset,
+            &resource_desc,
+            initial_state,
+            (is_render_target || is_depth_target) ? &clear_value : nullptr,
+            IID_PPV_ARGS(&resource->handle)
+        ));
+        resource->current_state = initial_state;
+        resource->placement = nullptr; // If it was in one of the heap pools before, that memory can go now
+        resource->memory_record = nullptr; // Its memory belongs to the heap now, whoever made the heap tracks that, see `track_heap_memory()`
+        texture.needs_discard = is_render_target || is_depth_target; // Placed memory starts out uninitialized
+        auto name_str = std::wstring(resource->name.begin(), resource->name.end());
+        resource->handle->SetName(name_str.c_str());
+
+        // Point the existing descriptors at the new resource
+        if (!is_depth_target) {
+            const auto srv_desc = make_texture_srv_desc(resource_desc.Format, TextureType::tex_2d, 1);
+            device->CreateShaderResourceView(resource->handle.Get(), &srv_desc, m_heap_bindless->fetch_cpu_handle(handle.handle));
+        }
+        if (resource_desc.Flags & D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS) {
+            auto uav_id = handle.handle;
+            uav_id.id += 1;
+            const auto uav_desc = make_texture_uav_desc(resource_desc.Format, TextureType::tex_2d, 1, 0);
+            device->CreateUnorderedAccessView(resource->handle.Get(), nullptr, &uav_desc, m_heap_bindless->fetch_cpu_handle(uav_id));
+        }
+        if (is_render_target) {
+            D3D12_RENDER_TARGET_VIEW_DESC rtv_desc = {
+                .Format = resource_desc.Format,
+                .ViewDimension = D3D12_RTV_DIMENSION_TEXTURE2D,
+            };
+            device->CreateRenderTargetView(resource->handle.Get(), &rtv_desc, m_heap_rtv->fetch_cpu_handle(texture.rtv_handle));
+        }
+        if (is_depth_target) {
+            D3D12_DEPTH_STENCIL_VIEW_DESC dsv_desc = {
+                .Format = resource_desc.Format,
+                .ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D,
+            };
+            device->CreateDepthStencilView(resource->handle.Get(), &dsv_desc, m_heap_dsv->fetch_cpu_handle(texture.dsv_handle));
+        }
+    }
+
     void Device::update_buffer(const ResourceHandlePair& buffer, const uint32_t offset, const uint32_t n_bytes, const void* data) {
         // todo: handle case for buffers that are not visible from cpu
         if ((buffer.resource->usage != ResourceUsage::cpu_read_write) && (buffer.resource->usage != ResourceUsage::cpu_writable)) {
@@ -1266,6 +1522,52 @@ namespace gfx {
         execute_resource_transitions(m_curr_pass_cmd);
     }
 
+    void Device::queue_resource_transition(const ResourceHandlePair& resource, ResourceUsage usage) {
+        if (resource.resource == nullptr) return;
+
+        // Going from unordered access to unordered access isn't a transition, but the previous writes still need to finish
+        const D3D12_RESOURCE_STATES new_state = resource_usage_to_dx12_state(usage);
+        if (new_state == D3D12_RESOURCE_STATE_UNORDERED_ACCESS && resource.resource->current_state == new_state) {
+            queue_uav_barrier(resource);
+            return;
+        }
+        transition_resource(m_curr_pass_cmd, resource.resource, new_state);
+    }
+
+    void Device::queue_uav_barrier(const ResourceHandlePair& resource) {
+        if (resource.resource == nullptr) return;
+
+        m_resource_barriers.emplace_back(D3D12_RESOURCE_BARRIER {
+            .Type = D3D12_RESOURCE_BARRIER_TYPE_UAV,
+            .Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+            .UAV = {
+                .pResource = resource.resource->handle.Get(),
+            },
+        });
+    }
+
+    void Device::queue_aliasing_barrier(const ResourceHandlePair& resource) {
+        if (resource.resource == nullptr) return;
+
+        // No "before" resource, so this waits for whatever else used the memory
+        if (resource.resource->type == ResourceType::texture) {
+            auto& texture = resource.resource->expect_texture();
+            texture.needs_discard = (texture.rtv_handle.type != (uint32_t)ResourceType::none) || (texture.dsv_handle.type != (uint32_t)ResourceType::none);
+        }
+        m_resource_barriers.emplace_back(D3D12_RESOURCE_BARRIER {
+            .Type = D3D12_RESOURCE_BARRIER_TYPE_ALIASING,
+            .Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+            .Aliasing = {
+                .pResourceBefore = nullptr,
+                .pResourceAfter = resource.resource->handle.Get(),
+            },
+        });
+    }
+
+    void Device::flush_upload_queue() {
+        m_uploads.flush();
+    }
+
     ResourceHandlePair Device::create_acceleration_structure(const std::string& name, const size_t size) {
         // Create engine resource
         const auto resource = std::make_shared<Resource>(ResourceType::acceleration_structure);
@@ -1286,17 +1588,8 @@ namespace gfx {
         resource_desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
         resource_desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS | D3D12_RESOURCE_FLAG_RAYTRACING_ACCELERATION_STRUCTURE;
         
-        D3D12_HEAP_PROPERTIES heap_properties = {.Type = D3D12_HEAP_TYPE_DEFAULT};
-
         resource->current_state = D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE;
-        validate(device->CreateCommittedResource(
-            &heap_properties,
-            D3D12_HEAP_FLAG_NONE,
-            &resource_desc,
-            resource->current_state,
-            nullptr,
-            IID_PPV_ARGS(&resource->handle)
-        ));
+        create_resource(*resource, resource_desc, D3D12_HEAP_TYPE_DEFAULT, resource->current_state);
 
         // Allocate and create a shader resource view in the bindless descriptor heap
         const D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc {
@@ -1315,6 +1608,7 @@ namespace gfx {
         auto name_str = std::wstring(name.begin(), name.end());
         resource->handle->SetName(name_str.c_str());
         resource->name = name;
+        track_memory(*resource, "Acceleration structures");
 
         // Store the resource data in the device struct
         id.is_loaded = true;
@@ -1323,8 +1617,7 @@ namespace gfx {
     }
 
     ResourceHandlePair Device::create_blas(const std::string& name, const ResourceHandlePair& position_buffer, const ResourceHandlePair& index_buffer, const uint32_t vertex_count, const uint32_t index_count) {
-        ++m_upload_fence_value_when_done;
-        auto cmd = m_upload_queue->create_command_buffer(nullptr, m_upload_fence_value_when_done);
+        auto cmd = m_uploads.create_command_buffer();
 
         const D3D12_RAYTRACING_GEOMETRY_DESC geo_desc = {
             .Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES,
@@ -1363,14 +1656,12 @@ namespace gfx {
         };
 
         cmd->get_rt()->BuildRaytracingAccelerationStructure(&build_acc_desc, 0, nullptr);
-        m_temp_upload_buffers.push_back(UploadQueueKeepAlive{ m_upload_fence_value_when_done, scratch_buffer.resource });
+        m_uploads.keep_alive(scratch_buffer.resource);
 
         return dest_acc_structure;
     }
 
     ResourceHandlePair Device::create_tlas(const std::string& name, const std::vector<RaytracingInstance>& instances) {
-        ++m_upload_fence_value_when_done;
-
         std::vector<D3D12_RAYTRACING_INSTANCE_DESC> dx12_instances;
         dx12_instances.reserve(instances.size());
         for (const auto& instance : instances) {
@@ -1387,10 +1678,8 @@ namespace gfx {
             dx12_instances.emplace_back(instance_desc);
         }
 
-        auto instance_descs = create_buffer(name + " (tlas instance descs)", sizeof(dx12_instances[0]) * dx12_instances.size(), dx12_instances.data(), ResourceUsage::non_pixel_shader_read);
-        m_upload_queue->execute();
-        m_upload_queue_completion_fence->gpu_signal(m_upload_queue, m_upload_fence_value_when_done);
-        m_upload_queue_completion_fence->cpu_wait(m_upload_fence_value_when_done);
+        // The build can read the instances straight from an upload heap, so there's no copy to wait for
+        auto instance_descs = create_buffer(name + " (tlas instance descs)", sizeof(dx12_instances[0]) * dx12_instances.size(), dx12_instances.data(), ResourceUsage::cpu_writable);
 
         const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS build_acc_inputs = {
             .Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL,
@@ -1400,7 +1689,6 @@ namespace gfx {
         };
         D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuild_info{};
         device5()->GetRaytracingAccelerationStructurePrebuildInfo(&build_acc_inputs, &prebuild_info);
-        instance_descs.resource->current_state = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
 
         auto scratch_buffer = create_buffer(name + " (tlas scratch buffer)", prebuild_info.ScratchDataSizeInBytes, nullptr, ResourceUsage::compute_write);
         auto dest_acc_structure = create_acceleration_structure(name + " (tlas)", prebuild_info.ResultDataMaxSizeInBytes);
@@ -1413,9 +1701,9 @@ namespace gfx {
             .ScratchAccelerationStructureData = scratch_buffer.resource->handle->GetGPUVirtualAddress(),
         };
 
-        auto cmd = m_upload_queue->create_command_buffer(nullptr, m_upload_fence_value_when_done);
+        auto cmd = m_uploads.create_command_buffer();
         cmd->get_rt()->BuildRaytracingAccelerationStructure(&build_acc_desc, 0, nullptr);
-        m_temp_upload_buffers.push_back(UploadQueueKeepAlive{ m_upload_fence_value_when_done, scratch_buffer.resource });
+        m_uploads.keep_alive(scratch_buffer.resource);
 
         return dest_acc_structure;
     }
@@ -1425,7 +1713,7 @@ namespace gfx {
         if (current_state == new_state) return;
 
         if (m_curr_pipeline_is_async) {
-            m_temp_upload_buffers.push_back(UploadQueueKeepAlive{ m_upload_fence_value_when_done, resource });
+            m_uploads.keep_alive(resource);
         }
 
         if (resource->current_state == D3D12_RESOURCE_STATE_UNORDERED_ACCESS) {
@@ -1554,22 +1842,133 @@ namespace gfx {
             if ((int)m_swapchain->current_fence_completed_value() < desired_completed_fence_value) break;
 
             // Destroy, Erase, Improve (memory usage) - good Meshuggah album btw, go listen to it
+            free_descriptors(resource);
             m_resources_to_unload.pop_front();
         }
 
-        while (!m_temp_upload_buffers.empty()) {
-            // Get the next entry in the unload queue
-            auto& upload_data = m_temp_upload_buffers.front();
+        // Upload and scratch buffers the upload queue is done with, and the textures that finished uploading
+        m_uploads.update(m_newly_loaded_resources);
+    }
 
-            // If it's still potentially being used, end the loop here, because all subsequent queue entries have
-            // the equal or higher desired fence values
-            if (m_upload_queue_completion_fence->reached_value(upload_data.upload_queue_fence_value) == false) break;
+    void Device::free_descriptors(ResourceHandlePair& resource) {
+        if (resource.resource == nullptr || resource.handle.is_cpu_only) return;
 
-            // Destroy, Erase, Improve (memory usage) - good Meshuggah album btw, go listen to it
-            m_temp_upload_buffers.pop_front();
+        // Until the first `begin_frame()` the frame index is still -1, those frees count as frame 0 so they get recycled eventually
+        uint64_t frame_index = m_swapchain->current_frame_index();
+        if (frame_index == SIZE_MAX) frame_index = 0;
+
+        // Another copy of the handle might have been unloaded already
+        if (resource.handle.type != (uint32_t)ResourceType::none && m_heap_bindless->is_valid(resource.handle)) {
+            m_heap_bindless->free_descriptor(resource.handle, frame_index);
+        }
+        for (auto& subresource_handle : resource.resource->subresource_handles) {
+            if (m_heap_bindless->is_valid(subresource_handle)) m_heap_bindless->free_descriptor(subresource_handle, frame_index);
+        }
+        resource.resource->subresource_handles.clear();
+
+        if (resource.resource->type == ResourceType::texture) {
+            auto& texture = resource.resource->expect_texture();
+            if (texture.rtv_handle.type != (uint32_t)ResourceType::none) m_heap_rtv->free_descriptor(texture.rtv_handle, frame_index);
+            if (texture.dsv_handle.type != (uint32_t)ResourceType::none) m_heap_dsv->free_descriptor(texture.dsv_handle, frame_index);
         }
     }
-    
+
+    void Device::create_resource(Resource& resource, D3D12_RESOURCE_DESC resource_desc, D3D12_HEAP_TYPE heap_type, D3D12_RESOURCE_STATES initial_state) {
+        // Render targets and depth targets are few and big, and get recreated on resize, so they're better off with their own allocation
+        std::shared_ptr<HeapPool> pool = nullptr;
+        if (resource_desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER) {
+            if (heap_type == D3D12_HEAP_TYPE_DEFAULT) pool = m_heap_pools[(size_t)HeapPoolType::buffers];
+            else if (heap_type == D3D12_HEAP_TYPE_UPLOAD) pool = m_heap_pools[(size_t)HeapPoolType::upload];
+        }
+        else if (heap_type == D3D12_HEAP_TYPE_DEFAULT && (resource_desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL)) == 0) {
+            pool = m_heap_pools[(size_t)HeapPoolType::textures];
+        }
+
+        if (pool) {
+            // Small textures can use 4 KB alignment instead of 64 KB, but only if the driver says it's fine for this one
+            D3D12_RESOURCE_ALLOCATION_INFO info{};
+            if (resource_desc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER) {
+                resource_desc.Alignment = D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT;
+                info = device->GetResourceAllocationInfo(0, 1, &resource_desc);
+                if (info.Alignment != D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT) resource_desc.Alignment = 0;
+            }
+            if (resource_desc.Alignment == 0) info = device->GetResourceAllocationInfo(0, 1, &resource_desc);
+
+            // Really big resources would mostly leave the rest of a heap unusable, so those get their own allocation too
+            HeapAllocation allocation{};
+            ComPtr<ID3D12Heap> heap;
+            if (info.SizeInBytes <= pool->allocator.heap_size() / 2) {
+                // Another thread can add a heap to the pool as soon as the lock is released, which moves the heap list around, so grab the heap now
+                std::lock_guard<std::mutex> lock(pool->mutex);
+                allocation = pool->allocator.allocate(info.SizeInBytes, info.Alignment);
+                if (allocation.is_valid()) heap = pool->heaps[allocation.heap];
+                else LOG(Warning, "Heap pool is over its memory budget or couldn't grow, creating a committed resource instead");
+            }
+
+            if (allocation.is_valid()) {
+                validate(device->CreatePlacedResource(
+                    heap.Get(),
+                    allocation.offset,
+                    &resource_desc,
+                    initial_state,
+                    nullptr,
+                    IID_PPV_ARGS(&resource.handle)
+                ));
+                resource.placement = std::shared_ptr<void>(pool.get(), [pool, allocation](void*) mutable {
+                    std::lock_guard<std::mutex> lock(pool->mutex);
+                    pool->allocator.free(allocation);
+                });
+                return;
+            }
+        }
+
+        const D3D12_HEAP_PROPERTIES heap_properties = { .Type = heap_type };
+        resource_desc.Alignment = 0;
+        validate(device->CreateCommittedResource(
+            &heap_properties,
+            D3D12_HEAP_FLAG_NONE,
+            &resource_desc,
+            initial_state,
+            nullptr,
+            IID_PPV_ARGS(&resource.handle)
+        ));
+    }
+
+    void Device::track_memory(Resource& resource, const char* default_category) {
+        // Placed resources count what they take up in their heap, so padding is included, but the rest of the heap isn't
+        const D3D12_RESOURCE_DESC resource_desc = resource.handle->GetDesc();
+        const uint64_t size = device->GetResourceAllocationInfo(0, 1, &resource_desc).SizeInBytes;
+        D3D12_HEAP_PROPERTIES heap_properties{};
+        const bool in_system_memory = SUCCEEDED(resource.handle->GetHeapProperties(&heap_properties, nullptr))
+            && (heap_properties.Type == D3D12_HEAP_TYPE_UPLOAD || heap_properties.Type == D3D12_HEAP_TYPE_READBACK);
+
+        const uint64_t id = m_memory_tracker->track(resource.name, _resource_type_names[(size_t)resource.type], default_category, in_system_memory ? size : 0, in_system_memory ? 0 : size);
+        resource.memory_record = make_memory_record(m_memory_tracker, id);
+    }
+
+    std::shared_ptr<void> Device::track_heap_memory(const std::string& name, uint64_t size, const char* category) {
+        return make_memory_record(m_memory_tracker, m_memory_tracker->track(name, "Heap", category, 0, size));
+    }
+
+    void Device::update_memory_budgets() {
+        if (m_adapter == nullptr) return;
+
+        // The pools can grow into whatever is left of the budget the OS gives us. Upload heaps live in system memory on discrete GPUs
+        DXGI_QUERY_VIDEO_MEMORY_INFO local_memory{};
+        DXGI_QUERY_VIDEO_MEMORY_INFO non_local_memory{};
+        if (FAILED(m_adapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &local_memory))) return;
+        if (FAILED(m_adapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_NON_LOCAL, &non_local_memory))) return;
+        const uint64_t local_headroom = (local_memory.Budget > local_memory.CurrentUsage) ? (local_memory.Budget - local_memory.CurrentUsage) : 0;
+        const uint64_t non_local_headroom = (non_local_memory.Budget > non_local_memory.CurrentUsage) ? (non_local_memory.Budget - non_local_memory.CurrentUsage) : 0;
+
+        for (size_t i = 0; i < m_heap_pools.size(); ++i) {
+            auto& pool = m_heap_pools[i];
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            const uint64_t headroom = ((HeapPoolType)i == HeapPoolType::upload) ? non_local_headroom : local_headroom;
+            pool->allocator.set_budget(pool->allocator.stats().total_heap_bytes + headroom);
+        }
+    }
+
     void Device::execute_resource_transitions(std::shared_ptr<CommandBuffer> cmd) {
         if (m_resource_barriers.empty()) return;
 
@@ -4,15 +4,20 @@
 #include <dxgi1_6.h>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <array>
 #include <queue>
+#include <span>
 #include <thread>
 
 #include "common.h"
 #include "glfw/glfw3.h"
 #include "glm/matrix.hpp"
+#include "heap_allocator.h"
+#include "memory_tracker.h"
 #include "resource.h"
+#include "upload_queue.h"
 
 namespace gfx {
     struct CommandBuffer;
@@ -24,15 +29,13 @@ namespace gfx {
     struct Transform;
     struct Fence;
 
+    constexpr size_t max_color_targets = D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT;
+
     struct RasterPassInfo {
-        std::vector<ResourceHandlePair> color_targets; // If empty, it will instead use the swapchain framebuffer as a color target
+        std::array<ResourceHandlePair, max_color_targets> color_targets; // Unused slots are left empty. If they're all empty, it will instead use the swapchain framebuffer as a color target
         ResourceHandlePair depth_target; // Optional; passing `ResourceHandle::none()` will disable depth testing
         bool clear_on_begin = true;
-    };
-
-    struct UploadQueueKeepAlive {
-        size_t upload_queue_fence_value; // If the upload queue fence has this value, the resource has been uploaded, the upload buffer can be removed, and the handle's `is_loaded` flag should be set
-        std::shared_ptr<Resource> upload_buffer; // Temporary buffer that will be copied to the destination resource
+        glm::uvec2 viewport_size = { 0, 0 }; // Only renders to the top left corner of the targets if set. Leaving it at zero covers the whole target
     };
 
     struct ResourceTransitionInfo {
@@ -50,9 +53,36 @@ namespace gfx {
         ResourceHandlePair blas;
     };
 
+    // Records draws into a command buffer of its own, so several threads can each record part of the same raster pass. See `Device::fork_raster_pass()`
+    struct RasterPassRecorder {
+        void set_graphics_root_constants(std::span<const uint32_t> constants);
+        void set_graphics_root_constants(std::initializer_list<uint32_t> constants);
+        void draw_vertices(uint32_t n_vertices, uint32_t n_instances = 1);
+        void draw_indirect(const ResourceHandlePair& commands, uint32_t offset, uint32_t n_draws);
+
+        std::shared_ptr<CommandBuffer> cmd;
+        Pipeline* pipeline = nullptr;
+    };
+
     enum class RendererFeature : int {
         none =       0,
         raytracing = 1,
+        mixed_resource_heaps = 2, // Render targets, depth targets and other textures can be placed in the same heap
+    };
+
+    enum class HeapPoolType {
+        buffers = 0,
+        textures, // Textures that aren't render targets or depth targets, those get their own allocation
+        upload,
+        count
+    };
+
+    // Heaps that resources get placed in, so they don't each need their own allocation. The resources placed in it share ownership,
+    // so their memory can be given back whenever the last reference to one goes away, from any thread
+    struct HeapPool {
+        std::mutex mutex;
+        HeapAllocator allocator;
+        std::vector<ComPtr<ID3D12Heap>> heaps; // Grows while `allocator` allocates, so only touch this with `mutex` held
     };
 
     struct Device {
@@ -70,16 +100,24 @@ namespace gfx {
         void set_full_screen(bool full_screen);
         void begin_frame();
         void end_frame();
-        void set_graphics_root_constants(const std::vector<uint32_t>& constants);
-        void set_compute_root_constants(const std::vector<uint32_t>& constants);
+        void set_graphics_root_constants(std::span<const uint32_t> constants);
+        void set_graphics_root_constants(std::initializer_list<uint32_t> constants);
+        void set_compute_root_constants(std::span<const uint32_t> constants);
+        void set_compute_root_constants(std::initializer_list<uint32_t> constants);
         int frame_index();
+        uint64_t completed_frame_index(); // The GPU is completely done with every frame before this index. The fence starts at 0, so this frame itself isn't guaranteed to be done
+        float gpu_frame_time() const { return m_gpu_frame_time; } // Sum of all pass timings of the last measured frame, in seconds. Stays 0 if GPU profiling is disabled
         bool supports(RendererFeature feature);
 
         // Rasterization
         std::shared_ptr<Pipeline> create_raster_pipeline(const std::string& name, const std::string& vertex_shader_path, const std::string& pixel_shader_path, const std::initializer_list<ResourceHandlePair> render_targets, const ResourceHandlePair depth_target = { ResourceHandle::none(), nullptr });
-        void begin_raster_pass(std::shared_ptr<Pipeline> pipeline, RasterPassInfo&& render_pass_info);
+        std::shared_ptr<Pipeline> create_raster_pipeline(const std::string& name, const std::string& vertex_shader_path, const std::string& pixel_shader_path, const std::vector<PixelFormat>& render_target_formats, PixelFormat depth_target_format); // Doesn't touch any resources, so it's safe to call from any thread. No render target formats means the swapchain
+        void begin_raster_pass(std::shared_ptr<Pipeline> pipeline, const RasterPassInfo& render_pass_info);
         void end_raster_pass();
-        void draw_vertices(uint32_t n_vertices);
+        std::span<RasterPassRecorder> fork_raster_pass(uint32_t n_recorders); // Splits the current raster pass over `n_recorders` command buffers, with the pass already bound. They get submitted in order, before anything recorded on the device after this call. Each recorder can only be used by one thread at a time
+        void draw_vertices(uint32_t n_vertices, uint32_t n_instances = 1);
+        void enable_indirect_draws(const std::shared_ptr<Pipeline>& pipeline, uint32_t first_root_constant, uint32_t n_root_constants); // Indirect draw commands for this pipeline then consist of `n_root_constants` root constants, followed by `D3D12_DRAW_ARGUMENTS`
+        void draw_indirect(const ResourceHandlePair& commands, uint32_t offset, uint32_t n_draws); // Executes `n_draws` commands from a buffer, starting at byte `offset`. The buffer has to be in the generic read or indirect argument state
 
         // Compute
         std::shared_ptr<Pipeline> create_compute_pipeline(const std::string& name, const std::string& compute_shader_path);
@@ -94,11 +132,23 @@ namespace gfx {
         ResourceHandlePair create_render_target(const std::string& name, uint32_t width, uint32_t height, PixelFormat pixel_format, std::optional<glm::vec4> clear_color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), ResourceUsage extra_usage = ResourceUsage::none);
         ResourceHandlePair create_depth_target(const std::string& name, uint32_t width, uint32_t height, PixelFormat pixel_format, float clear_value = 1.0f);
         void resize_texture(ResourceHandlePair& texture, const uint32_t width, const uint32_t height);
+        void get_allocation_info(const ResourceHandlePair& texture, uint64_t& size, uint64_t& alignment) const; // How much heap memory the texture needs if it gets placed
+        ComPtr<ID3D12Heap> create_heap(const std::string& name, uint64_t size, D3D12_HEAP_TYPE type = D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_FLAGS flags = D3D12_HEAP_FLAG_ALLOW_ALL_BUFFERS_AND_TEXTURES);
+        std::shared_ptr<void> track_heap_memory(const std::string& name, uint64_t size, const char* category); // For heaps made with `create_heap()`, counts as video memory until the record is released
+        void place_texture(ResourceHandlePair& texture, ID3D12Heap* heap, uint64_t offset); // Moves the texture into a heap, keeping its descriptors. Its contents are lost
         void update_buffer(const ResourceHandlePair& buffer, const uint32_t offset, const uint32_t n_bytes, const void* data);
         void readback_buffer(const ResourceHandlePair& buffer, const uint32_t offset, const uint32_t n_bytes, void* destination);
         void queue_unload_bindless_resource(ResourceHandlePair resource);
         void use_resource(const ResourceHandlePair& resource, const ResourceUsage usage = ResourceUsage::read);
         void use_resources(const std::initializer_list<ResourceTransitionInfo>& resources);
+        void queue_resource_transition(const ResourceHandlePair& resource, ResourceUsage usage); // Like `use_resource()`, but the barrier is recorded along with any other queued ones when the next pass begins
+        void queue_uav_barrier(const ResourceHandlePair& resource); // Makes later unordered access wait for earlier writes to this resource to finish, recorded when the next pass begins
+        void queue_aliasing_barrier(const ResourceHandlePair& resource); // Makes a placed resource the one using its memory, after other resources sharing that memory were used. Recorded when the next pass begins
+        void flush_upload_queue(); // Submits all pending uploads, and makes the graphics queue wait for them on the GPU
+        std::span<const uint32_t> newly_loaded_resources() const { return m_newly_loaded_resources; } // IDs of the textures that finished uploading during the last `begin_frame()`. Handles copied before that still have `is_loaded` unset
+        const HeapAllocatorStats& heap_pool_stats(HeapPoolType type) const { return m_heap_pools[(size_t)type]->allocator.stats(); } // Not synchronized with other threads creating resources, only use it for displaying stats
+        const StagingRingStats& staging_ring_stats() const { return m_uploads.staging_ring_stats(); } // Running totals, sample them every frame to get the upload throughput
+        const MemoryTracker& memory_tracker() const { return *m_memory_tracker; } // How much memory the resources that are still alive take up
 
         // Raytracing resources
         ResourceHandlePair create_acceleration_structure(const std::string& name, const size_t size);
@@ -110,9 +160,25 @@ namespace gfx {
         HWND window_hwnd = nullptr;
 
     private:
+        // Everything needed to bind the current raster pass again on another command buffer
+        struct RasterPassState {
+            D3D12_VIEWPORT viewport{};
+            D3D12_RECT scissor{};
+            std::array<D3D12_CPU_DESCRIPTOR_HANDLE, max_color_targets> rtv_handles{};
+            UINT n_rtv_handles = 0;
+            D3D12_CPU_DESCRIPTOR_HANDLE dsv_handle{};
+            bool have_dsv = false;
+        };
+
+        void bind_raster_pass_state(CommandBuffer& cmd);
         void transition_resource(std::shared_ptr<CommandBuffer> cmd, std::shared_ptr<Resource> resource, D3D12_RESOURCE_STATES new_state, uint32_t subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
         int find_dominant_monitor(); // Returns the index of the monitor the window overlaps with most
         void clean_up_old_resources();
+        void free_descriptors(ResourceHandlePair& resource); // Frees every descriptor the resource has, once the GPU is done with the current frame
+        HRESULT try_create_heap(const std::string& name, uint64_t size, D3D12_HEAP_TYPE type, D3D12_HEAP_FLAGS flags, ComPtr<ID3D12Heap>& heap); // Like `create_heap()`, but returns the error instead of crashing
+        void create_resource(Resource& resource, D3D12_RESOURCE_DESC resource_desc, D3D12_HEAP_TYPE heap_type, D3D12_RESOURCE_STATES initial_state); // Places it in a heap pool if it fits in one, otherwise makes a committed resource
+        void update_memory_budgets();
+        void track_memory(Resource& resource, const char* default_category); // Call once the resource has its name
         void execute_resource_transitions(std::shared_ptr<CommandBuffer> cmd);
         ID3D12Device5* device5();
 
@@ -130,9 +196,12 @@ namespace gfx {
 
         // Profiling
         ComPtr<ID3D12QueryHeap> m_query_heap = nullptr;
-        std::vector<std::string> m_query_labels;
+        std::vector<std::shared_ptr<Pipeline>> m_query_labels; // Pipeline for each pair of timestamps, so we can print their names
+        std::vector<uint64_t> m_query_timestamps;
+        std::vector<float> m_query_pipeline_times;
         ResourceHandlePair m_query_buffer{};
         float m_timestamp_frequency = 1.0f;
+        float m_gpu_frame_time = 0.0f;
 
         // Swapchain
         std::shared_ptr<Swapchain> m_swapchain = nullptr;
@@ -148,14 +217,21 @@ namespace gfx {
         // Resource management
         std::shared_ptr<CommandQueue> m_upload_queue = nullptr; // Command queue for uploading resources to the GPU
         std::shared_ptr<Fence> m_upload_queue_completion_fence = nullptr;
-        size_t m_upload_fence_value_when_done = 0; // The value the upload queue fence will signal when it's done uploading
-        std::deque<UploadQueueKeepAlive> m_temp_upload_buffers; // Temporary upload buffer to be unloaded after it's done uploading. The integer is upload queue fence value before it should be unloaded
+        ComPtr<IDXGIAdapter3> m_adapter = nullptr; // Used to query the memory budget
+        std::array<std::shared_ptr<HeapPool>, (size_t)HeapPoolType::count> m_heap_pools;
+        UploadQueue m_uploads; // Fence values, staging ring and keep-alives for `m_upload_queue`
+        ResourceHandlePair m_staging_buffer; // Upload heap memory behind the staging ring in `m_uploads`
+        uint8_t* m_staging_buffer_mapped = nullptr; // Stays mapped for its whole lifetime
+        std::shared_ptr<MemoryTracker> m_memory_tracker = std::make_shared<MemoryTracker>(); // Shared with the resources, so they can untrack themselves after the device is gone
+        std::vector<uint32_t> m_newly_loaded_resources;
         std::deque<std::pair<ResourceHandlePair, int>> m_resources_to_unload; // Resources to unload. The integer determines when it should be unloaded
         std::vector<D3D12_RESOURCE_BARRIER> m_resource_barriers; // Enqueued resource barriers
 
         // Rendering context
         std::shared_ptr<Pipeline> m_curr_bound_pipeline = nullptr; // Will point to a valid pipeline after calling begin_render_pass(), and will be null after calling end_render_pass()
         std::shared_ptr<CommandBuffer> m_curr_pass_cmd; // The command buffer used for this pass
+        RasterPassState m_curr_raster_pass_state{};
+        std::vector<RasterPassRecorder> m_raster_pass_recorders; // Handed out by `fork_raster_pass()`, kept around so it doesn't allocate every frame
         bool m_curr_pipeline_is_async = false; // If the current pipeline is async, we need to keep track of resources differently 
     };
 };
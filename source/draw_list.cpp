@@ -0,0 +1,74 @@
+#include "draw_list.h"
+
+#include <cstring>
+#include "scene.h"
+
+namespace gfx {
+    void SceneDrawList::build(SceneNode* root) {
+        m_mesh_nodes.clear();
+        m_light_nodes.clear();
+        m_packets.clear();
+        collect_nodes(root);
+        ++m_version;
+    }
+
+    void SceneDrawList::collect_nodes(SceneNode* node) {
+        if (!node) return;
+
+        if (node->type == SceneNodeType::mesh) {
+            node->expect_mesh().draw_index = (uint32_t)m_mesh_nodes.size();
+            m_mesh_nodes.push_back(node);
+            m_packets.push_back(make_packet(node));
+        }
+        else if (node->type == SceneNodeType::light) {
+            m_light_nodes.push_back(node);
+        }
+
+        for (auto& child : node->children) {
+            collect_nodes(child.get());
+        }
+    }
+
+    PacketDrawMesh SceneDrawList::make_packet(SceneNode* node) const {
+        return PacketDrawMesh{
+            .model_transform = node->cached_global_transform,
+            .position_offset = glm::vec4(node->position_offset, 0.0f),
+            .position_scale = glm::vec4(node->position_scale, 0.0f),
+            .vertex_buffer = node->expect_mesh().vertex_buffer,
+        };
+    }
+
+    void SceneDrawList::patch_node(SceneNode* node) {
+        const uint32_t draw_index = node->expect_mesh().draw_index;
+        if (draw_index >= m_mesh_nodes.size() || m_mesh_nodes[draw_index] != node) {
+            LOG(Warning, "Node \"%s\" is not in this draw list", node->name.c_str());
+            return;
+        }
+        m_packets[draw_index] = make_packet(node);
+        ++m_version;
+    }
+
+    void SceneDrawList::set_instance_count(uint32_t n_instances) {
+        if (n_instances == m_n_instances) return;
+        m_n_instances = n_instances;
+        ++m_version;
+    }
+
+    void SceneDrawList::write_gpu_data(void* destination, uint32_t destination_buffer, uint32_t destination_offset) const {
+        IndirectDrawCommand* commands = (IndirectDrawCommand*)destination;
+        const uint32_t packets_offset = destination_offset + n_draws() * sizeof(IndirectDrawCommand);
+        for (uint32_t i = 0; i < n_draws(); ++i) {
+            commands[i] = IndirectDrawCommand{
+                .draw_mesh_packet_buffer = destination_buffer,
+                .draw_mesh_packet_offset = packets_offset + i * (uint32_t)sizeof(PacketDrawMesh),
+                .draw = {
+                    .VertexCountPerInstance = m_mesh_nodes[i]->expect_mesh().n_vertices,
+                    .InstanceCount = m_n_instances,
+                    .StartVertexLocation = 0,
+                    .StartInstanceLocation = 0,
+                },
+            };
+        }
+        memcpy(commands + n_draws(), m_packets.data(), m_packets.size() * sizeof(PacketDrawMesh));
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "resource.h"
+
+namespace gfx {
+    struct SceneNode;
+
+    // One entry in an indirect draw argument buffer, matching the command signature set up by `Device::enable_indirect_draws()`
+    struct IndirectDrawCommand {
+        uint32_t draw_mesh_packet_buffer; // Root constants that change per draw
+        uint32_t draw_mesh_packet_offset;
+        D3D12_DRAW_ARGUMENTS draw;
+    };
+    static_assert(sizeof(IndirectDrawCommand) == 24);
+
+    // Every mesh in a scene, in a form that can be copied straight into an indirect argument buffer. It's built once when the scene
+    // is loaded, and only needs to be patched when a mesh node changes, so drawing a static scene doesn't need to walk the scene graph.
+    // `version()` changes whenever the contents do, which tells the renderer when its GPU copies are out of date.
+    struct SceneDrawList {
+        void build(SceneNode* root);
+        void patch_node(SceneNode* node); // Call after changing a mesh node's transform, `set_node_transform()` does this already
+        void set_instance_count(uint32_t n_instances); // Every draw in the list gets drawn this many times
+
+        // Writes the commands, followed by a `PacketDrawMesh` for each of them, to `destination`. That memory lives at `destination_offset`
+        // in the buffer with handle `destination_buffer`, so the commands can point to their packets
+        void write_gpu_data(void* destination, uint32_t destination_buffer, uint32_t destination_offset) const;
+        static size_t gpu_data_size(uint32_t n_draws) { return n_draws * (sizeof(IndirectDrawCommand) + sizeof(PacketDrawMesh)); }
+
+        uint32_t n_draws() const { return (uint32_t)m_mesh_nodes.size(); }
+        uint64_t version() const { return m_version; }
+        std::span<SceneNode* const> light_nodes() const { return m_light_nodes; }
+
+    private:
+        void collect_nodes(SceneNode* node);
+        PacketDrawMesh make_packet(SceneNode* node) const;
+
+        std::vector<SceneNode*> m_mesh_nodes;
+        std::vector<SceneNode*> m_light_nodes;
+        std::vector<PacketDrawMesh> m_packets; // One for each mesh node
+        uint32_t m_n_instances = 1;
+        uint64_t m_version = 1;
+    };
+}
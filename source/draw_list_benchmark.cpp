@@ -0,0 +1,156 @@
+// Measures what submitting a scene's draws costs the CPU every frame: walking the scene graph and recording every mesh like the
+// geometry pass used to, against a persistent `SceneDrawList` that's only rewritten when something moves. Doesn't touch the GPU,
+// draws go into a stub command stream. Usage:
+//   draw_list_benchmark [--max-meshes n] [--frames n] [--moving n]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "draw_list.h"
+#include "scene.h"
+#include "log.h"
+
+#define MESHES_PER_GROUP 16 // glTF nodes usually hold a few primitives each, so meshes are grouped under empty nodes
+#define DRAW_LIST_BUFFER 7 // Made up bindless handle for the draw list buffer
+
+// Stand-in for a command list, only remembers the commands
+struct StubCommandStream {
+    void set_root_constants(std::initializer_list<uint32_t> constants) { commands.insert(commands.end(), constants.begin(), constants.end()); }
+    void draw(uint32_t n_vertices, uint32_t n_instances) { commands.push_back(n_vertices); commands.push_back(n_instances); }
+    void draw_indirect(uint32_t buffer, uint32_t offset, uint32_t n_draws) { commands.push_back(buffer); commands.push_back(offset); commands.push_back(n_draws); }
+    std::vector<uint32_t> commands;
+};
+
+struct BenchmarkScene {
+    gfx::SceneNode root{ gfx::SceneNodeType::root };
+    std::vector<gfx::SceneNode*> mesh_nodes;
+    std::unordered_map<uint32_t, size_t> vertex_buffer_sizes; // Like the renderer's resource map, which the old path looked the vertex counts up in
+};
+
+static void build_scene(BenchmarkScene& scene, uint32_t n_meshes) {
+    std::mt19937 rng(n_meshes);
+    std::uniform_real_distribution<float> position_dist(-100.0f, 100.0f);
+    std::shared_ptr<gfx::SceneNode> group;
+    for (uint32_t i = 0; i < n_meshes; ++i) {
+        if (i % MESHES_PER_GROUP == 0) {
+            group = std::make_shared<gfx::SceneNode>(gfx::SceneNodeType::empty);
+            group->cached_global_transform = glm::mat4(1.0f);
+            scene.root.children.push_back(group);
+        }
+        auto mesh_node = std::make_shared<gfx::SceneNode>(gfx::SceneNodeType::mesh);
+        mesh_node->cached_global_transform = glm::translate(glm::mat4(1.0f), glm::vec3(position_dist(rng), position_dist(rng), position_dist(rng)));
+        mesh_node->position_offset = glm::vec3(-1.0f);
+        mesh_node->position_scale = glm::vec3(2.0f);
+        mesh_node->expect_mesh().vertex_buffer = gfx::ResourceHandle{ .id = 1000 + i, .type = (uint32_t)gfx::ResourceType::buffer };
+        mesh_node->expect_mesh().n_vertices = 3 * (1 + (uint32_t)rng() % 4096);
+        scene.vertex_buffer_sizes[1000 + i] = mesh_node->expect_mesh().n_vertices * sizeof(gfx::VertexCompressed);
+        scene.mesh_nodes.push_back(mesh_node.get());
+        group->children.push_back(mesh_node);
+    }
+    scene.root.expect_root().draw_list.build(&scene.root);
+}
+
+// What `traverse_scene_raster()` did for every mesh, every frame
+static void record_scene_graph(const BenchmarkScene& scene, gfx::SceneNode* node, std::vector<gfx::PacketDrawMesh>& packets, StubCommandStream& stream) {
+    if (node->type == gfx::SceneNodeType::mesh) {
+        packets.push_back(gfx::PacketDrawMesh{
+            .model_transform = node->cached_global_transform,
+            .position_offset = glm::vec4(node->position_offset, 0.0f),
+            .position_scale = glm::vec4(node->position_scale, 0.0f),
+            .vertex_buffer = node->expect_mesh().vertex_buffer,
+        });
+        const size_t n_vertices = scene.vertex_buffer_sizes.at(node->expect_mesh().vertex_buffer.id) / sizeof(gfx::VertexCompressed);
+        stream.set_root_constants({ 1, 0, 2, (uint32_t)((packets.size() - 1) * sizeof(gfx::PacketDrawMesh)), 3, 4, 0 });
+        stream.draw((uint32_t)n_vertices, 1);
+    }
+    for (const auto& child : node->children) {
+        record_scene_graph(scene, child.get(), packets, stream);
+    }
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int n_args, char** args) {
+    uint32_t max_meshes = 100000;
+    uint32_t n_frames = 100;
+    uint32_t n_moving = 16;
+
+    for (int i = 1; i < n_args; ++i) {
+        const char* arg = args[i];
+        const int n_left = n_args - i - 1;
+        auto next_u32 = [&]() { return (uint32_t)strtoul(args[++i], nullptr, 10); };
+
+        if (strcmp(arg, "--max-meshes") == 0 && n_left >= 1) max_meshes = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--frames") == 0 && n_left >= 1) n_frames = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--moving") == 0 && n_left >= 1) n_moving = next_u32();
+        else {
+            LOG(Error, "Unknown or incomplete argument \"%s\"", arg);
+            Log::flush();
+            return 1;
+        }
+    }
+
+    printf("%u frames per measurement, %u moving meshes\n", n_frames, n_moving);
+    printf("  %-10s %16s %16s %16s\n", "meshes", "graph walk us", "static list us", "moving list us");
+    for (uint32_t n_meshes = 1000; ; n_meshes = (n_meshes > max_meshes / 10) ? max_meshes : n_meshes * 10) {
+        BenchmarkScene scene;
+        build_scene(scene, n_meshes);
+        gfx::SceneDrawList& draw_list = scene.root.expect_root().draw_list;
+        std::vector<uint8_t> gpu_data(gfx::SceneDrawList::gpu_data_size(draw_list.n_draws()));
+        std::vector<gfx::PacketDrawMesh> packets;
+        StubCommandStream stream;
+
+        // Old path: every mesh gets a new packet and its own draw
+        auto start_time = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < n_frames; ++frame) {
+            packets.clear();
+            stream.commands.clear();
+            record_scene_graph(scene, &scene.root, packets, stream);
+        }
+        const double graph_walk_seconds = seconds_since(start_time) / n_frames;
+
+        // Draw list, nothing moves: the GPU copy is still up to date, so this is one indirect draw
+        uint64_t uploaded_version = 0;
+        auto submit_draw_list = [&]() {
+            stream.commands.clear();
+            if (uploaded_version != draw_list.version()) {
+                draw_list.write_gpu_data(gpu_data.data(), DRAW_LIST_BUFFER, 0);
+                uploaded_version = draw_list.version();
+            }
+            stream.set_root_constants({ 1, 0, 0, 0, 3, 4, 0 });
+            stream.draw_indirect(DRAW_LIST_BUFFER, 0, draw_list.n_draws());
+        };
+        submit_draw_list();
+        start_time = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < n_frames; ++frame) {
+            submit_draw_list();
+        }
+        const double static_list_seconds = seconds_since(start_time) / n_frames;
+
+        // Draw list, a few meshes move every frame: those get patched, and the GPU copy gets rewritten
+        start_time = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < n_frames; ++frame) {
+            for (uint32_t i = 0; i < std::min(n_moving, n_meshes); ++i) {
+                gfx::SceneNode* node = scene.mesh_nodes[(frame * n_moving + i) % n_meshes];
+                node->cached_global_transform = glm::translate(node->cached_global_transform, glm::vec3(0.0f, 0.01f, 0.0f));
+                draw_list.patch_node(node);
+            }
+            submit_draw_list();
+        }
+        const double moving_list_seconds = seconds_since(start_time) / n_frames;
+
+        printf("  %-10u %16.2f %16.2f %16.2f\n", n_meshes, graph_walk_seconds * 1e6, static_list_seconds * 1e6, moving_list_seconds * 1e6);
+        if (n_meshes == max_meshes) break;
+    }
+
+    Log::flush();
+    return 0;
+}
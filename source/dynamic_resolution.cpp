@@ -0,0 +1,72 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace gfx {
+    DynamicResolutionController::DynamicResolutionController(const DynamicResolutionSettings& settings) {
+        assert(settings.min_scale > 0.0f && settings.min_scale <= settings.max_scale);
+        assert(settings.lower_threshold < settings.upper_threshold && "Thresholds need a gap between them, otherwise the scale keeps changing");
+        m_settings = settings;
+        m_scale = settings.max_scale;
+    }
+
+    void DynamicResolutionController::reset(float scale) {
+        m_scale = quantize(std::clamp(scale, m_settings.min_scale, m_settings.max_scale));
+        m_has_history = false;
+        m_cooldown = 0;
+    }
+
+    float DynamicResolutionController::quantize(float scale) const {
+        if (m_settings.scale_granularity <= 0.0f) return scale;
+        // Round down, so scaling down never ends up a step short, and scaling up never overshoots
+        const float quantized = std::floor(scale / m_settings.scale_granularity + 1e-4f) * m_settings.scale_granularity;
+        return std::clamp(quantized, m_settings.min_scale, m_settings.max_scale);
+    }
+
+    float DynamicResolutionController::update(float gpu_frame_time, float cpu_frame_time) {
+        // Smooth out the measurements, a single slow frame shouldn't change the resolution
+        if (!m_has_history) {
+            m_average_gpu_frame_time = gpu_frame_time;
+            m_average_cpu_frame_time = cpu_frame_time;
+            m_has_history = true;
+        }
+        else {
+            m_average_gpu_frame_time += (gpu_frame_time - m_average_gpu_frame_time) * m_settings.smoothing;
+            m_average_cpu_frame_time += (cpu_frame_time - m_average_cpu_frame_time) * m_settings.smoothing;
+        }
+
+        if (m_cooldown > 0) {
+            --m_cooldown;
+            return m_scale;
+        }
+        if (m_average_gpu_frame_time <= 0.0f) return m_scale;
+
+        // Aim for the middle of the two thresholds, so the next frames land between them
+        const float budget = m_settings.target_frame_time;
+        const float goal = budget * 0.5f * (m_settings.lower_threshold + m_settings.upper_threshold);
+        float new_scale = m_scale;
+        if (m_average_gpu_frame_time > budget * m_settings.upper_threshold && m_average_gpu_frame_time > m_average_cpu_frame_time) {
+            const float goal_time = std::max(goal, m_average_cpu_frame_time);
+            const float wanted_scale = m_scale * std::sqrt(goal_time / m_average_gpu_frame_time);
+            new_scale = std::max(wanted_scale, m_scale - m_settings.max_step_down);
+        }
+        else if (m_average_gpu_frame_time < budget * m_settings.lower_threshold) {
+            const float wanted_scale = m_scale * std::sqrt(goal / m_average_gpu_frame_time);
+            new_scale = std::min(wanted_scale, m_scale + m_settings.max_step_up);
+        }
+        new_scale = quantize(std::clamp(new_scale, m_settings.min_scale, m_settings.max_scale));
+        // Rounding down can take a full step down past the limit, use the step above it then
+        if (new_scale < m_scale - m_settings.max_step_down - 1e-4f) {
+            new_scale = std::min(new_scale + m_settings.scale_granularity, m_scale);
+        }
+        if (new_scale == m_scale) return m_scale;
+
+        // Predict what the GPU time will be at the new scale, so the average doesn't have to catch up from the old one
+        m_average_gpu_frame_time *= (new_scale * new_scale) / (m_scale * m_scale);
+        m_scale = new_scale;
+        m_cooldown = m_settings.cooldown_frames;
+        return m_scale;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+
+namespace gfx {
+    struct DynamicResolutionSettings {
+        float target_frame_time = 1.0f / 60.0f; // Frame time budget, in seconds
+        float min_scale = 0.5f;
+        float max_scale = 1.0f;
+        float lower_threshold = 0.85f; // Scale up when the GPU time drops below this fraction of the budget
+        float upper_threshold = 1.0f; // Scale down when the GPU time goes above this fraction of the budget
+        float smoothing = 0.1f; // How much each new frame time counts towards the running average, between 0 and 1
+        float max_step_up = 0.05f; // Biggest increase in scale per adjustment. Going up is done carefully, so it doesn't overshoot and drop frames
+        float max_step_down = 0.15f; // Biggest decrease in scale per adjustment
+        float scale_granularity = 1.0f / 64.0f; // Scales are rounded to multiples of this, so tiny adjustments don't change the resolution every frame
+        uint32_t cooldown_frames = 4; // Frames to wait after a change before adjusting again, since GPU timings lag a few frames behind
+    };
+
+    // Picks a resolution scale based on measured frame times. GPU time is assumed to scale with the number of pixels, so the scale that
+    // would hit the budget is estimated as the square root of how far off the frame time is. Between the two thresholds nothing changes,
+    // which keeps the resolution from bouncing back and forth. If the CPU takes longer than the GPU, lowering the resolution wouldn't
+    // make the frame any faster, so it won't scale down further than what it takes for the GPU to keep up with the CPU.
+    // This doesn't touch the GPU, so recorded frame time traces can be fed straight into it.
+    struct DynamicResolutionController {
+        DynamicResolutionController() = default;
+        explicit DynamicResolutionController(const DynamicResolutionSettings& settings);
+
+        // Frame times in seconds. Returns the scale to render the next frame at
+        float update(float gpu_frame_time, float cpu_frame_time);
+        void reset(float scale); // Jumps to this scale, and forgets the frame time history
+
+        float scale() const { return m_scale; }
+        float average_gpu_frame_time() const { return m_average_gpu_frame_time; }
+        float average_cpu_frame_time() const { return m_average_cpu_frame_time; }
+        const DynamicResolutionSettings& settings() const { return m_settings; }
+
+    private:
+        float quantize(float scale) const;
+
+        DynamicResolutionSettings m_settings{};
+        float m_scale = 1.0f;
+        float m_average_gpu_frame_time = 0.0f;
+        float m_average_cpu_frame_time = 0.0f;
+        bool m_has_history = false;
+        uint32_t m_cooldown = 0;
+    };
+}
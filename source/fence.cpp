@@ -34,4 +34,8 @@ namespace gfx {
     bool Fence::reached_value(size_t value) {
         return fence->GetCompletedValue() >= value;
     }
+
+    size_t Fence::completed_value() const {
+        return fence->GetCompletedValue();
+    }
 }
@@ -15,6 +15,7 @@ namespace gfx {
         void gpu_wait(std::shared_ptr<CommandQueue> queue, size_t value) const;
         void gpu_signal(std::shared_ptr<CommandQueue> queue, size_t value) const;
         bool reached_value(size_t value);
+        size_t completed_value() const;
 
         ComPtr<ID3D12Fence> fence;
         HANDLE event_handle;
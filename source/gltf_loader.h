@@ -0,0 +1,26 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include "gpu_structs.h"
+
+namespace tinygltf {
+    class Model;
+    class Node;
+    struct Primitive;
+}
+
+// Everything about glTF files that doesn't need a GPU, shared by the renderer and the CPU-only tools
+namespace gfx {
+    struct CompressedVertices {
+        std::vector<VertexCompressed> vertices;
+        glm::vec3 position_offset; // Position 0 maps to this
+        glm::vec3 position_scale; // Position 65535 maps to `position_offset + position_scale`
+    };
+
+    std::shared_ptr<tinygltf::Model> decode_gltf(const std::string& path); // Only touches the CPU, so it's safe to call from any thread. Returns nullptr if it failed
+    std::vector<Vertex> parse_primitive(tinygltf::Primitive& primitive, tinygltf::Model& model, const std::string& path); // Non-indexed triangle list
+    glm::mat4 gltf_node_local_matrix(const tinygltf::Node& node);
+    CompressedVertices compress_vertices(const std::vector<Vertex>& vertices, uint16_t material_id); // Pass 0xFFFF for the default material
+}
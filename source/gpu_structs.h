@@ -0,0 +1,106 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+// Plain data that the shaders read as-is. There's no D3D12 in here, so tools that only run on the CPU can use these too
+namespace gfx {
+    // General
+    enum class ResourceType {
+        none = 0,
+        texture,
+        buffer,
+        scene,
+        acceleration_structure
+    };
+    inline const char* _resource_type_names[] = { "None", "Texture", "Buffer", "Scene", "Acceleration structure" };
+
+    enum class ResourceUsage : uint8_t {
+        none = 0,
+        read,
+        render_target,
+        depth_target,
+        compute_write,
+        pixel_shader_read,
+        non_pixel_shader_read,
+        cpu_writable,
+        cpu_read_write,
+        acceleration_structure
+    };
+
+    struct ResourceHandle {
+        uint32_t id : 20; // Index into the bindless descriptor heap, or into the renderer's own list if `is_cpu_only` is set
+        uint32_t generation : 6; // Goes up every time the descriptor is freed, so handles to something that was unloaded can be caught
+        uint32_t is_cpu_only : 1; // Doesn't correspond to a GPU descriptor, like scenes
+        uint32_t is_loaded : 1;
+        uint32_t type : 4;
+        bool operator==(const ResourceHandle& rhs) {
+            // Same slot from a different generation is a different resource
+            if (id != rhs.id || generation != rhs.generation || is_cpu_only != rhs.is_cpu_only) return false;
+            // We only really need to check if the IDs are identical, but we should sanity check the rest too
+            assert(type == rhs.type);
+            assert(is_loaded == rhs.is_loaded);
+            return true;
+        }
+        static ResourceHandle none() {
+            return ResourceHandle{
+                .id = 0,
+                .is_loaded = 0,
+                .type = (uint32_t)ResourceType::none,
+            };
+        }
+        uint32_t key() const { // Unique for every resource that's alive, so it can be used to look them up
+            return id | is_cpu_only << 20;
+        }
+        uint32_t as_u32() const {
+            return id | generation << 20 | is_cpu_only << 26 | is_loaded << 27 | type << 28;
+        }
+        uint32_t as_u32_uav() const {
+            return (id+1) | generation << 20 | is_cpu_only << 26 | is_loaded << 27 | type << 28;
+        }
+    };
+
+    struct Vertex {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec4 tangent;
+        glm::vec4 color;
+        glm::vec2 texcoord0;
+        uint32_t material_id;
+    };
+
+    struct VertexFlags1 {
+        uint8_t tangent_sign : 1; // Tangent vector's sign. 1 = positive, 0 = negative
+        uint8_t _reserved : 7;
+    };
+    struct VertexFlags2 {
+        uint8_t _reserved : 8;
+    };
+
+    struct VertexCompressed {
+        glm::u16vec3 position; // 1.14 fixed point positions that need to be dequantized by the mesh's corresponding scaling vectors
+        uint16_t material_id; // Index into the material array. 0xFFFF means no material -> use default material
+        glm::u8vec3 normal; // Normal vector, where 0 = -1.0, 127 = 0.0, 254 = +1.0, kinda like a normal map texture
+        VertexFlags1 flags1;
+        glm::u8vec3 tangent; // Tangent vector, where 0 = -1.0, 127 = 0.0, 254 = +1.0, just like the normal vector
+        VertexFlags2 flags2;
+        glm::u16vec4 color; // Linear RGB 0-1023 for SDR, with brighter HDR colors above that. Alpha is in range 0 - 1023, and values above that should be clamped to 1023 (1.0)
+        glm::vec2 texcoord0;
+    };
+
+    struct Material {
+        glm::vec4 color_multiplier = { 1.0f, 1.0f, 1.0f, 1.0f }; // Color to multiply the color texture with.
+        glm::vec3 emissive_multiplier = { 1.0f, 1.0f, 1.0f }; // Color to multiply the emissive texture with.
+        ResourceHandle color_texture = ResourceHandle::none(); // If set to none, a default value of { 1, 1, 1, 1 } will be used.
+        ResourceHandle normal_texture = ResourceHandle::none(); // If set to none, a default value of { 0.5, 0.5, 1.0 } will be used.
+        ResourceHandle metal_roughness_texture = ResourceHandle::none(); // If set to none, a default value of { 0.0, 1.0 } will be used.
+        ResourceHandle emissive_texture = ResourceHandle::none(); // If set to none, a default value of { 0, 0, 0 } will be used.
+        float normal_intensity = 1.0f; // Used to interpolate between { 0.5, 0.5, 1.0 } and the sampled normal map value. Can go beyond 1.0 to make the normal map more intense
+        float roughness_multiplier = 1.0f; // Will be multipled with the sampled roughness texture value
+        float metallic_multiplier = 1.0f; // Will be multiplied with the sample metallic texture value
+        uint64_t reserved = 0; // This makes the struct size 64 bytes, perfect for cache lines
+    };
+}
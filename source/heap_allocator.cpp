@@ -0,0 +1,219 @@
+#include "heap_allocator.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include "log.h"
+
+namespace gfx {
+    HeapAllocator::HeapAllocator(uint64_t heap_size, uint64_t granularity, CreateHeapFunc create_heap) {
+        assert(granularity != 0 && (granularity & (granularity - 1)) == 0 && "Granularity should be a power of 2");
+        m_heap_size = heap_size;
+        m_granularity = granularity;
+        m_create_heap = std::move(create_heap);
+        for (auto& free_lists : m_free_lists) {
+            std::fill(std::begin(free_lists), std::end(free_lists), NONE);
+        }
+    }
+
+    void HeapAllocator::size_class(uint64_t size, uint32_t& fl, uint32_t& sl) {
+        // Small sizes all get an exact class in the first row, the rest are split into 16 steps per power of 2
+        if (size < SL_COUNT) {
+            fl = 0;
+            sl = (uint32_t)size;
+            return;
+        }
+        fl = (uint32_t)std::bit_width(size) - 1;
+        sl = (uint32_t)(size >> (fl - SL_BITS)) & (SL_COUNT - 1);
+    }
+
+    uint32_t HeapAllocator::find_free_block(uint64_t size) const {
+        // Round up to the next class, so every block in the class we land in is big enough
+        if (size >= SL_COUNT) {
+            const uint32_t fl = (uint32_t)std::bit_width(size) - 1;
+            size += (1ull << (fl - SL_BITS)) - 1;
+        }
+        uint32_t fl, sl;
+        size_class(size, fl, sl);
+
+        uint32_t sl_bitmap = m_sl_bitmaps[fl] & (~0u << sl);
+        if (sl_bitmap == 0) {
+            // Nothing in this row, take the smallest class of the next row that has something
+            const uint64_t fl_bitmap = (fl + 1 < FL_COUNT) ? (m_fl_bitmap & (~0ull << (fl + 1))) : 0;
+            if (fl_bitmap == 0) return NONE;
+            fl = (uint32_t)std::countr_zero(fl_bitmap);
+            sl_bitmap = m_sl_bitmaps[fl];
+        }
+        sl = (uint32_t)std::countr_zero(sl_bitmap);
+        return m_free_lists[fl][sl];
+    }
+
+    uint32_t HeapAllocator::new_block() {
+        if (!m_unused_blocks.empty()) {
+            const uint32_t block = m_unused_blocks.back();
+            m_unused_blocks.pop_back();
+            m_blocks[block] = Block{};
+            return block;
+        }
+        m_blocks.emplace_back();
+        return (uint32_t)m_blocks.size() - 1;
+    }
+
+    void HeapAllocator::insert_free_block(uint32_t block) {
+        uint32_t fl, sl;
+        size_class(m_blocks[block].size, fl, sl);
+        const uint32_t head = m_free_lists[fl][sl];
+        m_blocks[block].is_free = true;
+        m_blocks[block].prev_free = NONE;
+        m_blocks[block].next_free = head;
+        if (head != NONE) m_blocks[head].prev_free = block;
+        m_free_lists[fl][sl] = block;
+        m_fl_bitmap |= 1ull << fl;
+        m_sl_bitmaps[fl] |= 1u << sl;
+    }
+
+    void HeapAllocator::remove_free_block(uint32_t block) {
+        uint32_t fl, sl;
+        size_class(m_blocks[block].size, fl, sl);
+        Block& b = m_blocks[block];
+        if (b.prev_free != NONE) m_blocks[b.prev_free].next_free = b.next_free;
+        else m_free_lists[fl][sl] = b.next_free;
+        if (b.next_free != NONE) m_blocks[b.next_free].prev_free = b.prev_free;
+        b.prev_free = NONE;
+        b.next_free = NONE;
+        b.is_free = false;
+
+        if (m_free_lists[fl][sl] == NONE) {
+            m_sl_bitmaps[fl] &= ~(1u << sl);
+            if (m_sl_bitmaps[fl] == 0) m_fl_bitmap &= ~(1ull << fl);
+        }
+    }
+
+    void HeapAllocator::release_block(uint32_t block) {
+        // Absorb the next block if it's free
+        const uint32_t next = m_blocks[block].next_physical;
+        if (next != NONE && m_blocks[next].is_free) {
+            remove_free_block(next);
+            m_blocks[block].size += m_blocks[next].size;
+            m_blocks[block].next_physical = m_blocks[next].next_physical;
+            if (m_blocks[next].next_physical != NONE) m_blocks[m_blocks[next].next_physical].prev_physical = block;
+            m_unused_blocks.push_back(next);
+        }
+
+        // And let the previous block absorb this one if that one's free
+        const uint32_t prev = m_blocks[block].prev_physical;
+        if (prev != NONE && m_blocks[prev].is_free) {
+            remove_free_block(prev);
+            m_blocks[prev].size += m_blocks[block].size;
+            m_blocks[prev].next_physical = m_blocks[block].next_physical;
+            if (m_blocks[block].next_physical != NONE) m_blocks[m_blocks[block].next_physical].prev_physical = prev;
+            m_unused_blocks.push_back(block);
+            block = prev;
+        }
+
+        insert_free_block(block);
+    }
+
+    uint32_t HeapAllocator::split_block(uint32_t block, uint64_t size) {
+        assert(size < m_blocks[block].size);
+        const uint32_t rest = new_block();
+        Block& b = m_blocks[block];
+        Block& r = m_blocks[rest];
+        r.offset = b.offset + size;
+        r.size = b.size - size;
+        r.heap = b.heap;
+        r.prev_physical = block;
+        r.next_physical = b.next_physical;
+        if (b.next_physical != NONE) m_blocks[b.next_physical].prev_physical = rest;
+        b.next_physical = rest;
+        b.size = size;
+        return rest;
+    }
+
+    uint32_t HeapAllocator::add_heap() {
+        if (m_budget != 0 && m_stats.total_heap_bytes + m_heap_size > m_budget) return NONE;
+        const uint32_t heap_index = m_stats.n_heaps;
+        if (!m_create_heap || !m_create_heap(heap_index, m_heap_size)) return NONE;
+
+        const uint32_t block = new_block();
+        m_blocks[block].offset = 0;
+        m_blocks[block].size = m_heap_size;
+        m_blocks[block].heap = heap_index;
+        insert_free_block(block);
+
+        m_stats.n_heaps += 1;
+        m_stats.total_heap_bytes += m_heap_size;
+        LOG(Debug, "Heap allocator: created heap %u (%llu bytes)", heap_index, (unsigned long long)m_heap_size);
+        return block;
+    }
+
+    HeapAllocation HeapAllocator::allocate(uint64_t size, uint64_t alignment) {
+        assert(alignment != 0 && (alignment & (alignment - 1)) == 0 && "Alignment should be a power of 2");
+        size = std::max((size + m_granularity - 1) & ~(m_granularity - 1), m_granularity);
+        alignment = std::max(alignment, m_granularity);
+        if (size > m_heap_size) return HeapAllocation{};
+
+        // Offsets are always a multiple of the granularity, so this is the most padding we could need to align a block
+        const uint64_t max_padding = alignment - m_granularity;
+        auto fits = [&](uint32_t block) {
+            const uint64_t aligned_offset = (m_blocks[block].offset + alignment - 1) & ~(alignment - 1);
+            return aligned_offset + size <= m_blocks[block].offset + m_blocks[block].size;
+        };
+
+        // Most blocks are already aligned, so try without padding first, that way the search doesn't skip over a class that fits
+        uint32_t block = find_free_block(size);
+        if (block == NONE || !fits(block)) block = find_free_block(size + max_padding);
+        if (block == NONE) {
+            // The new heap starts out as one free block at offset 0, which is aligned to anything
+            block = add_heap();
+            if (block == NONE) {
+                m_stats.n_failed_allocations += 1;
+                return HeapAllocation{};
+            }
+        }
+        remove_free_block(block);
+
+        // Give the padding in front back to the free lists, and the part that's left over at the end too
+        const uint64_t padding = ((m_blocks[block].offset + alignment - 1) & ~(alignment - 1)) - m_blocks[block].offset;
+        if (padding > 0) {
+            const uint32_t aligned_block = split_block(block, padding);
+            release_block(block);
+            block = aligned_block;
+        }
+        if (m_blocks[block].size > size) {
+            const uint32_t rest = split_block(block, size);
+            release_block(rest);
+        }
+
+        m_stats.n_allocations += 1;
+        m_stats.bytes_allocated += size;
+        return HeapAllocation{
+            .heap = m_blocks[block].heap,
+            .block = block,
+            .offset = m_blocks[block].offset,
+            .size = size,
+        };
+    }
+
+    void HeapAllocator::free(HeapAllocation& allocation) {
+        if (!allocation.is_valid()) return;
+        assert(!m_blocks[allocation.block].is_free && m_blocks[allocation.block].offset == allocation.offset && "Heap allocation was freed twice");
+        m_stats.n_allocations -= 1;
+        m_stats.bytes_allocated -= allocation.size;
+        release_block(allocation.block);
+        allocation = HeapAllocation{};
+    }
+
+    uint64_t HeapAllocator::largest_free_block() const {
+        if (m_fl_bitmap == 0) return 0;
+        const uint32_t fl = 63 - (uint32_t)std::countl_zero(m_fl_bitmap);
+        const uint32_t sl = 31 - (uint32_t)std::countl_zero(m_sl_bitmaps[fl]);
+
+        // Blocks in the same class can still differ in size, so check all of them
+        uint64_t largest = 0;
+        for (uint32_t block = m_free_lists[fl][sl]; block != NONE; block = m_blocks[block].next_free) {
+            largest = std::max(largest, m_blocks[block].size);
+        }
+        return largest;
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace gfx {
+    struct HeapAllocation {
+        uint32_t heap = ~0u; // Index of the heap this allocation lives in, in the order the heaps were created
+        uint32_t block = ~0u; // Needed to free it again
+        uint64_t offset = 0; // Byte offset into that heap
+        uint64_t size = 0;
+        bool is_valid() const { return heap != ~0u; }
+    };
+
+    struct HeapAllocatorStats {
+        uint64_t total_heap_bytes = 0; // Size of all heaps combined, whether they're in use or not
+        uint64_t bytes_allocated = 0;
+        uint64_t n_allocations = 0;
+        uint64_t n_failed_allocations = 0; // Didn't fit anywhere, and a new heap would have gone over the budget
+        uint32_t n_heaps = 0;
+    };
+
+    // Places allocations in a set of fixed size heaps, using a two level segregated fit (TLSF) allocator. Free blocks are sorted into
+    // size classes: the first level is the power of 2 below the size, the second level splits that range up into 16 linear steps.
+    // Finding a free block that fits is a couple of bit scans, and freeing merges the block with its free neighbours right away, so
+    // both are constant time. When nothing fits, a new heap is made, unless that would go over the budget.
+    // This only does the bookkeeping: the heaps themselves come from `create_heap`, so it can be driven without a GPU.
+    struct HeapAllocator {
+        // Should create a heap of `size` bytes that can be found again by `heap_index`. Returns false if that failed
+        using CreateHeapFunc = std::function<bool(uint32_t heap_index, uint64_t size)>;
+
+        HeapAllocator() : HeapAllocator(0, 1, nullptr) {}
+        HeapAllocator(uint64_t heap_size, uint64_t granularity, CreateHeapFunc create_heap); // Sizes and offsets are multiples of `granularity`
+
+        // Returns an invalid allocation if it's bigger than a heap, or if it would go over the budget. `alignment` has to be a power of 2
+        HeapAllocation allocate(uint64_t size, uint64_t alignment);
+        void free(HeapAllocation& allocation);
+
+        void set_budget(uint64_t budget) { m_budget = budget; } // Maximum total heap size, 0 means no limit
+        uint64_t budget() const { return m_budget; }
+        uint64_t heap_size() const { return m_heap_size; }
+        uint64_t largest_free_block() const; // Biggest allocation that fits without making a new heap, if the alignment works out
+        const HeapAllocatorStats& stats() const { return m_stats; }
+
+    private:
+        static constexpr uint32_t SL_BITS = 4;
+        static constexpr uint32_t SL_COUNT = 1 << SL_BITS;
+        static constexpr uint32_t FL_COUNT = 64;
+        static constexpr uint32_t NONE = ~0u;
+
+        struct Block {
+            uint64_t offset = 0;
+            uint64_t size = 0;
+            uint32_t heap = NONE;
+            uint32_t prev_physical = NONE; // Neighbours in the same heap, by offset
+            uint32_t next_physical = NONE;
+            uint32_t prev_free = NONE; // Neighbours in the same free list
+            uint32_t next_free = NONE;
+            bool is_free = false;
+        };
+
+        static void size_class(uint64_t size, uint32_t& fl, uint32_t& sl);
+        uint32_t find_free_block(uint64_t size) const;
+        uint32_t new_block();
+        void insert_free_block(uint32_t block);
+        void remove_free_block(uint32_t block);
+        void release_block(uint32_t block); // Marks it as free, merges it with free neighbours, and puts it in a free list
+        uint32_t split_block(uint32_t block, uint64_t size); // Cuts the block down to `size` bytes, returns the rest as a new block
+        uint32_t add_heap(); // Returns the free block covering the new heap, or NONE if it couldn't be made
+
+        CreateHeapFunc m_create_heap;
+        uint64_t m_heap_size = 0;
+        uint64_t m_granularity = 1;
+        uint64_t m_budget = 0;
+        std::vector<Block> m_blocks;
+        std::vector<uint32_t> m_unused_blocks; // Indices into `m_blocks` that can be reused
+        uint64_t m_fl_bitmap = 0; // Bit per first level class that has any free blocks
+        uint32_t m_sl_bitmaps[FL_COUNT] = {}; // Bit per second level class that has any free blocks
+        uint32_t m_free_lists[FL_COUNT][SL_COUNT];
+        HeapAllocatorStats m_stats;
+    };
+}
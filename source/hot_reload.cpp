@@ -0,0 +1,152 @@
+#include "hot_reload.h"
+
+#include <algorithm>
+#include <cassert>
+#include "log.h"
+
+namespace gfx {
+    static std::string normalize_path(const std::string& path) {
+        return std::filesystem::path(path).lexically_normal().generic_string();
+    }
+
+    FileWatcher::FileWatcher(const std::string& directory) {
+        m_directory = directory;
+        m_write_times = scan();
+    }
+
+    std::unordered_map<std::string, std::filesystem::file_time_type> FileWatcher::scan() const {
+        std::unordered_map<std::string, std::filesystem::file_time_type> write_times;
+        std::error_code error;
+        auto iterator = std::filesystem::recursive_directory_iterator(m_directory, error);
+        for (; !error && iterator != std::filesystem::recursive_directory_iterator(); iterator.increment(error)) {
+            if (!iterator->is_regular_file(error)) continue;
+            const auto write_time = iterator->last_write_time(error);
+            if (error) continue; // Probably deleted while we were looking at it
+            write_times[normalize_path(iterator->path().string())] = write_time;
+        }
+        return write_times;
+    }
+
+    std::vector<std::string> FileWatcher::poll() {
+        std::vector<std::string> changed;
+        for (const auto& [path, write_time] : scan()) {
+            const auto known = m_write_times.find(path);
+            if (known != m_write_times.end() && known->second == write_time) continue;
+
+            // Report it once it stopped changing
+            const auto pending = m_pending.find(path);
+            if (pending != m_pending.end() && pending->second == write_time) {
+                m_write_times[path] = write_time;
+                m_pending.erase(pending);
+                changed.push_back(path);
+                continue;
+            }
+            m_pending[path] = write_time;
+        }
+        std::sort(changed.begin(), changed.end());
+        return changed;
+    }
+
+    PipelineHotReload::PipelineHotReload(const std::string& directory, uint64_t frames_in_flight, SourceFilesFunc source_files) {
+        m_watcher = FileWatcher(directory);
+        m_frames_in_flight = frames_in_flight;
+        m_source_files = std::move(source_files);
+    }
+
+    PipelineHotReload::~PipelineHotReload() {
+        stop();
+    }
+
+    std::vector<std::string> PipelineHotReload::find_source_files(const Entry& entry) const {
+        std::vector<std::string> files;
+        for (const auto& shader_path : entry.shader_paths) {
+            for (const auto& file : m_source_files ? m_source_files(shader_path) : std::vector<std::string>{ shader_path }) {
+                files.push_back(normalize_path(file));
+            }
+        }
+        return files;
+    }
+
+    void PipelineHotReload::add_pipeline(std::shared_ptr<Pipeline>& pipeline, const std::vector<std::string>& shader_paths, BuildFunc build) {
+        assert(!m_thread.joinable() && "Pipelines can't be added while the hot reload thread is running");
+        Entry entry = {
+            .pipeline = &pipeline,
+            .shader_paths = shader_paths,
+            .build = std::move(build),
+        };
+        entry.source_files = find_source_files(entry);
+        m_entries.push_back(std::move(entry));
+    }
+
+    void PipelineHotReload::start(std::chrono::milliseconds poll_interval) {
+        if (m_thread.joinable()) return;
+        m_stopping = false;
+        m_thread = std::thread([this, poll_interval]() {
+            std::unique_lock lock(m_thread_mutex);
+            while (!m_wake_thread.wait_for(lock, poll_interval, [this]() { return m_stopping; })) {
+                lock.unlock();
+                rebuild_changed();
+                lock.lock();
+            }
+        });
+    }
+
+    void PipelineHotReload::stop() {
+        if (!m_thread.joinable()) return;
+        {
+            std::lock_guard lock(m_thread_mutex);
+            m_stopping = true;
+        }
+        m_wake_thread.notify_all();
+        m_thread.join();
+    }
+
+    uint32_t PipelineHotReload::rebuild_changed() {
+        const std::vector<std::string> changed = m_watcher.poll();
+        if (changed.empty()) return 0;
+
+        uint32_t n_rebuilt = 0;
+        for (uint32_t i = 0; i < (uint32_t)m_entries.size(); ++i) {
+            Entry& entry = m_entries[i];
+            const bool is_affected = std::any_of(changed.begin(), changed.end(), [&](const std::string& path) {
+                return std::find(entry.source_files.begin(), entry.source_files.end(), path) != entry.source_files.end();
+            });
+            if (!is_affected) continue;
+
+            // The includes might have changed too
+            entry.source_files = find_source_files(entry);
+
+            LOG(Info, "Hot reload: rebuilding pipeline for '%s'", entry.shader_paths.front().c_str());
+            std::shared_ptr<Pipeline> pipeline = entry.build();
+            if (!pipeline) {
+                LOG(Error, "Hot reload: '%s' failed to compile, keeping the old pipeline", entry.shader_paths.front().c_str());
+                continue;
+            }
+
+            // If it was rebuilt before and that one didn't get swapped in yet, this one replaces it
+            std::lock_guard lock(m_rebuilt_mutex);
+            const auto previous = std::find_if(m_rebuilt.begin(), m_rebuilt.end(), [&](const Rebuilt& rebuilt) { return rebuilt.entry == i; });
+            if (previous != m_rebuilt.end()) previous->pipeline = std::move(pipeline);
+            else m_rebuilt.push_back(Rebuilt{ i, std::move(pipeline) });
+            ++n_rebuilt;
+        }
+        return n_rebuilt;
+    }
+
+    uint32_t PipelineHotReload::apply(uint64_t frame_index, uint64_t completed_frame_index) {
+        // Let go of the old pipelines the GPU is done with. The fence starts at 0, so only the frames before `completed_frame_index` are done
+        std::erase_if(m_retired, [&](const Retired& retired) { return retired.frame_index < completed_frame_index; });
+
+        std::vector<Rebuilt> rebuilt;
+        {
+            std::lock_guard lock(m_rebuilt_mutex);
+            rebuilt.swap(m_rebuilt);
+        }
+        for (auto& [entry, pipeline] : rebuilt) {
+            std::shared_ptr<Pipeline>& current = *m_entries[entry].pipeline;
+            m_retired.push_back(Retired{ std::move(current), frame_index + m_frames_in_flight });
+            current = std::move(pipeline);
+        }
+        return (uint32_t)rebuilt.size();
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace gfx {
+    struct Pipeline;
+
+    // Finds files in a directory (and its subdirectories) that were added or changed, by comparing their last write times.
+    // Editors don't always write a file in one go, so a change is only reported once the write time stayed the same for one poll
+    struct FileWatcher {
+        FileWatcher() = default;
+        explicit FileWatcher(const std::string& directory); // Files that already exist don't count as changes
+
+        std::vector<std::string> poll(); // Returns the paths that changed since they were last reported, with '/' as the separator
+
+    private:
+        std::unordered_map<std::string, std::filesystem::file_time_type> scan() const;
+
+        std::string m_directory;
+        std::unordered_map<std::string, std::filesystem::file_time_type> m_write_times; // As of the last time they were reported
+        std::unordered_map<std::string, std::filesystem::file_time_type> m_pending; // Changed, but might still be being written
+    };
+
+    // Rebuilds pipelines on a background thread when one of their shaders, or a file those include, changes on disk. Rebuilt pipelines
+    // are only swapped in by `apply()`, which should be called between frames, and the old ones are kept alive until the frames
+    // that could still be using them are done on the GPU. If a rebuild fails, the old pipeline just stays in use.
+    // Pipelines are only passed around as pointers, and building them is a callback, so it can be driven without a GPU.
+    struct PipelineHotReload {
+        using BuildFunc = std::function<std::shared_ptr<Pipeline>()>; // Should return nullptr if the shaders didn't compile
+        using SourceFilesFunc = std::function<std::vector<std::string>(const std::string& shader_path)>; // The shader and everything it includes
+
+        PipelineHotReload(const std::string& directory, uint64_t frames_in_flight, SourceFilesFunc source_files);
+        ~PipelineHotReload();
+        PipelineHotReload(const PipelineHotReload&) = delete;
+        PipelineHotReload& operator=(const PipelineHotReload&) = delete;
+
+        // `pipeline` gets replaced by `apply()`, so it has to stay where it is. Should be called before `start()`
+        void add_pipeline(std::shared_ptr<Pipeline>& pipeline, const std::vector<std::string>& shader_paths, BuildFunc build);
+        void start(std::chrono::milliseconds poll_interval); // Calls `rebuild_changed()` on a background thread every `poll_interval`
+        void stop();
+
+        uint32_t rebuild_changed(); // Rebuilds the pipelines affected by changed files on the calling thread, returns how many were rebuilt
+        uint32_t apply(uint64_t frame_index, uint64_t completed_frame_index); // Swaps in rebuilt pipelines, returns how many were swapped
+        uint32_t n_retired() const { return (uint32_t)m_retired.size(); } // Old pipelines that are still waiting for the GPU
+
+    private:
+        struct Entry {
+            std::shared_ptr<Pipeline>* pipeline;
+            std::vector<std::string> shader_paths;
+            std::vector<std::string> source_files; // Only touched by whoever calls `rebuild_changed()`
+            BuildFunc build;
+        };
+        struct Rebuilt {
+            uint32_t entry;
+            std::shared_ptr<Pipeline> pipeline;
+        };
+        struct Retired {
+            std::shared_ptr<Pipeline> pipeline;
+            uint64_t frame_index; // Can be released once the GPU is past this frame
+        };
+
+        std::vector<std::string> find_source_files(const Entry& entry) const;
+
+        FileWatcher m_watcher;
+        uint64_t m_frames_in_flight = 0;
+        SourceFilesFunc m_source_files;
+        std::vector<Entry> m_entries;
+        std::mutex m_rebuilt_mutex;
+        std::vector<Rebuilt> m_rebuilt; // Finished rebuilds that haven't been swapped in yet
+        std::vector<Retired> m_retired; // Only touched by `apply()`, so it's always on the same thread
+        std::thread m_thread;
+        std::mutex m_thread_mutex;
+        std::condition_variable m_wake_thread;
+        bool m_stopping = false;
+    };
+}
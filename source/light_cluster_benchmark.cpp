@@ -0,0 +1,134 @@
+// Bins random point lights into the light cluster grid and measures how long it takes, single threaded and on the pool.
+// Every build gets checked by sampling points in the view frustum: each light that reaches a point has to be in that
+// point's cluster. Usage:
+//   light_cluster_benchmark [--max-lights n] [--threads n] [--samples n]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+#include "light_clusters.h"
+#include "thread_pool.h"
+#include "log.h"
+
+#define N_BUILD_REPEATS 5 // Best of
+#define CLUSTER_NEAR 0.05f // Same as the renderer
+#define CLUSTER_FAR 200.0f
+#define MAX_LIGHT_INDICES (1 << 24) // Way more than the renderer allows, so nothing gets dropped and every light can be checked
+#define BOUNDARY_EPSILON 1e-3f // Sample points this close to a cluster edge could round into the neighbour, those are skipped
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns the cluster a view space point is in, or UINT32_MAX if it's too close to an edge to tell
+static uint32_t find_cluster(glm::vec3 position, glm::vec2 viewport_size) {
+    using Grid = gfx::LightClusterGrid;
+    const float depth = -position.z;
+    float slice_f = 0.0f;
+    if (depth >= CLUSTER_NEAR) {
+        slice_f = 1.0f + logf(depth / CLUSTER_NEAR) / logf(CLUSTER_FAR / CLUSTER_NEAR) * (float)(Grid::size_z - 1);
+        if (fabsf(slice_f - roundf(slice_f)) < BOUNDARY_EPSILON) return UINT32_MAX;
+    }
+    const float tile_x_f = (position.x / (depth * viewport_size.x) * 0.5f + 0.5f) * (float)Grid::size_x;
+    const float tile_y_f = (0.5f - position.y / (depth * viewport_size.y) * 0.5f) * (float)Grid::size_y;
+    if (fabsf(tile_x_f - roundf(tile_x_f)) < BOUNDARY_EPSILON || fabsf(tile_y_f - roundf(tile_y_f)) < BOUNDARY_EPSILON) return UINT32_MAX;
+    const uint32_t slice = std::min((uint32_t)slice_f, Grid::size_z - 1);
+    return (uint32_t)tile_x_f + (uint32_t)tile_y_f * Grid::size_x + slice * Grid::n_tiles;
+}
+
+// Random point inside the view frustum, between `near` and `far`
+static glm::vec3 random_point_in_frustum(std::mt19937& rng, glm::vec2 viewport_size, float near, float far) {
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    const float depth = near + (far - near) * dist(rng);
+    return glm::vec3((dist(rng) * 2.0f - 1.0f) * depth * viewport_size.x, (dist(rng) * 2.0f - 1.0f) * depth * viewport_size.y, -depth);
+}
+
+// Returns the number of light/point pairs where the light reaches the point, but isn't in the point's cluster
+static uint32_t validate(const gfx::LightClusterGrid& grid, const std::vector<gfx::ClusterLightBounds>& lights, glm::vec2 viewport_size, uint32_t n_samples) {
+    std::mt19937 rng(5678);
+    uint32_t n_missing = 0;
+    for (uint32_t i = 0; i < n_samples; ++i) {
+        // Half of the points close to the camera, where the clusters are small
+        const glm::vec3 point = random_point_in_frustum(rng, viewport_size, CLUSTER_NEAR, (i % 2 == 0) ? 10.0f : CLUSTER_FAR);
+        const uint32_t cluster_index = find_cluster(point, viewport_size);
+        if (cluster_index == UINT32_MAX) continue;
+        const gfx::LightCluster& cluster = grid.clusters[cluster_index];
+        const uint32_t* begin = grid.light_indices.data() + cluster.offset;
+        const uint32_t* end = begin + cluster.count;
+        for (uint32_t light = 0; light < (uint32_t)lights.size(); ++light) {
+            const glm::vec3 delta = point - lights[light].position;
+            if (glm::dot(delta, delta) > lights[light].radius * lights[light].radius) continue;
+            if (std::find(begin, end, light) == end) n_missing++;
+        }
+    }
+    return n_missing;
+}
+
+int main(int n_args, char** args) {
+    uint32_t max_lights = 100000;
+    uint32_t n_threads = 0;
+    uint32_t n_samples = 2000;
+
+    for (int i = 1; i < n_args; ++i) {
+        const char* arg = args[i];
+        const int n_left = n_args - i - 1;
+        auto next_u32 = [&]() { return (uint32_t)strtoul(args[++i], nullptr, 10); };
+
+        if (strcmp(arg, "--max-lights") == 0 && n_left >= 1) max_lights = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--threads") == 0 && n_left >= 1) n_threads = next_u32();
+        else if (strcmp(arg, "--samples") == 0 && n_left >= 1) n_samples = next_u32();
+        else {
+            LOG(Error, "Unknown or incomplete argument \"%s\"", arg);
+            Log::flush();
+            return 1;
+        }
+    }
+
+    // Same thread count rules as cpu_reference
+    gfx::ThreadPool thread_pool((n_threads > 0) ? std::max(n_threads, 2u) - 1 : gfx::ThreadPool::AUTO_WORKERS);
+    gfx::ThreadPool single_thread(0); // No workers, so the calling thread does all the work
+    const glm::vec2 viewport_size = glm::vec2(tanf(0.5f * 1.2f) * 16.0f / 9.0f, tanf(0.5f * 1.2f)); // ~70 degrees vertical, 16:9
+
+    printf("%u threads, %u sample points per check\n", thread_pool.n_threads(), n_samples);
+    printf("  %-10s %12s %12s %12s %14s %10s\n", "lights", "1 thread ms", "pool ms", "indices", "lights/cluster", "missing");
+    uint32_t n_failed = 0;
+    for (uint32_t n_lights = 1000; ; n_lights = (n_lights > max_lights / 10) ? max_lights : n_lights * 10) {
+        // Lights spread out over the first 50 meters, where a scene would actually have them, and sized like lamps
+        std::mt19937 rng(n_lights);
+        std::uniform_real_distribution<float> radius_dist(0.5f, 5.0f);
+        std::vector<gfx::ClusterLightBounds> lights(n_lights);
+        for (gfx::ClusterLightBounds& light : lights) {
+            light.position = random_point_in_frustum(rng, viewport_size, 0.0f, 50.0f);
+            light.radius = radius_dist(rng);
+        }
+
+        gfx::LightClusterGrid grid;
+        double build_seconds[2] = { INFINITY, INFINITY }; // 1 thread, pool
+        for (int i = 0; i < N_BUILD_REPEATS; ++i) {
+            for (int j = 0; j < 2; ++j) {
+                const auto start_time = std::chrono::steady_clock::now();
+                grid.build((j == 0) ? single_thread : thread_pool, lights, viewport_size, CLUSTER_NEAR, CLUSTER_FAR, MAX_LIGHT_INDICES);
+                build_seconds[j] = std::min(build_seconds[j], seconds_since(start_time));
+            }
+        }
+
+        uint32_t n_non_empty_clusters = 0;
+        for (const gfx::LightCluster& cluster : grid.clusters) n_non_empty_clusters += (cluster.count > 0) ? 1 : 0;
+        const uint32_t n_missing = validate(grid, lights, viewport_size, n_samples) + grid.n_dropped_light_indices;
+        n_failed += n_missing;
+        printf("  %-10u %12.3f %12.3f %12zu %14.1f %10u\n", n_lights, build_seconds[0] * 1000.0, build_seconds[1] * 1000.0, grid.light_indices.size(),
+            (double)grid.light_indices.size() / (double)std::max(n_non_empty_clusters, 1u), n_missing);
+        if (n_lights == max_lights) break;
+    }
+
+    Log::flush();
+    if (n_failed > 0) {
+        printf("\n%u lights were missing from the cluster they reach\n", n_failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "light_clusters.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define LIGHT_CLUSTERS_USE_SSE 1
+#else
+#define LIGHT_CLUSTERS_USE_SSE 0
+#endif
+
+namespace gfx {
+    #define LIGHT_CLUSTERS_BATCH_SIZE 1024
+
+    void LightClusterGrid::build(ThreadPool& thread_pool, std::span<const ClusterLightBounds> lights, glm::vec2 viewport_size, float near, float far, uint32_t max_light_indices) {
+        if (viewport_size != m_viewport_size || near != m_near || far != m_far) {
+            update_cluster_bounds(viewport_size, near, far);
+        }
+
+        // Convert the lights to separate arrays. The padding gets an empty depth range, so it never ends up in a cluster
+        m_n_lights = (uint32_t)lights.size();
+        const uint32_t n_lights_padded = (m_n_lights + 3) & ~3;
+        m_light_x.resize(n_lights_padded);
+        m_light_y.resize(n_lights_padded);
+        m_light_depth.resize(n_lights_padded);
+        m_light_radius.resize(n_lights_padded);
+        m_light_depth_min.resize(n_lights_padded, +INFINITY);
+        m_light_depth_max.resize(n_lights_padded, -INFINITY);
+        thread_pool.parallel_for(m_n_lights, LIGHT_CLUSTERS_BATCH_SIZE, [&](uint32_t begin, uint32_t end, uint32_t) {
+            for (uint32_t i = begin; i < end; ++i) {
+                m_light_x[i] = lights[i].position.x;
+                m_light_y[i] = lights[i].position.y;
+                m_light_depth[i] = -lights[i].position.z;
+                m_light_radius[i] = lights[i].radius;
+                m_light_depth_min[i] = m_light_depth[i] - lights[i].radius;
+                m_light_depth_max[i] = m_light_depth[i] + lights[i].radius;
+            }
+        });
+        for (uint32_t i = m_n_lights; i < n_lights_padded; ++i) {
+            m_light_depth_min[i] = +INFINITY;
+            m_light_depth_max[i] = -INFINITY;
+        }
+
+        // Each slice gets binned by one thread, so threads never write to the same clusters
+        thread_pool.parallel_for(size_z, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+            for (uint32_t slice = begin; slice < end; ++slice) {
+                bin_slice(slice);
+            }
+        });
+
+        // Figure out where each slice ends up in the final index list
+        uint32_t slice_offsets[size_z];
+        uint32_t n_total_indices = 0;
+        for (uint32_t slice = 0; slice < size_z; ++slice) {
+            slice_offsets[slice] = n_total_indices;
+            n_total_indices += (uint32_t)m_slice_sorted_indices[slice].size();
+        }
+        const uint32_t n_light_indices = std::min(n_total_indices, max_light_indices);
+        n_dropped_light_indices = n_total_indices - n_light_indices;
+        light_indices.resize(n_light_indices);
+        clusters.resize(n_clusters);
+
+        // Stitch the slices together
+        thread_pool.parallel_for(size_z, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+            for (uint32_t slice = begin; slice < end; ++slice) {
+                uint32_t offset = slice_offsets[slice];
+                for (uint32_t tile = 0; tile < n_tiles; ++tile) {
+                    const uint32_t count = m_slice_tile_counts[slice][tile];
+                    const uint32_t start = std::min(offset, n_light_indices);
+                    const uint32_t end = std::min(offset + count, n_light_indices);
+                    clusters[tile + slice * n_tiles] = LightCluster{ .offset = start, .count = end - start };
+                    offset += count;
+                }
+
+                const auto& sorted_indices = m_slice_sorted_indices[slice];
+                const uint32_t start = std::min(slice_offsets[slice], n_light_indices);
+                const uint32_t end = std::min(slice_offsets[slice] + (uint32_t)sorted_indices.size(), n_light_indices);
+                std::copy(sorted_indices.begin(), sorted_indices.begin() + (end - start), light_indices.begin() + start);
+            }
+        });
+    }
+
+    void LightClusterGrid::update_cluster_bounds(glm::vec2 viewport_size, float near, float far) {
+        m_viewport_size = viewport_size;
+        m_near = near;
+        m_far = far;
+
+        m_slice_depths[0] = 0.0f;
+        for (uint32_t slice = 1; slice <= size_z; ++slice) {
+            m_slice_depths[slice] = near * powf(far / near, (float)(slice - 1) / (float)(size_z - 1));
+        }
+
+        m_cluster_min_x.resize(n_clusters);
+        m_cluster_max_x.resize(n_clusters);
+        m_cluster_min_y.resize(n_clusters);
+        m_cluster_max_y.resize(n_clusters);
+        for (uint32_t slice = 0; slice < size_z; ++slice) {
+            const float depth_start = m_slice_depths[slice];
+            const float depth_end = m_slice_depths[slice + 1];
+            for (uint32_t y = 0; y < size_y; ++y) {
+                const float ndc_top = 1.0f - 2.0f * (float)y / (float)size_y;
+                const float ndc_bottom = 1.0f - 2.0f * (float)(y + 1) / (float)size_y;
+                for (uint32_t x = 0; x < size_x; ++x) {
+                    const float ndc_left = 2.0f * (float)x / (float)size_x - 1.0f;
+                    const float ndc_right = 2.0f * (float)(x + 1) / (float)size_x - 1.0f;
+
+                    // The tile frustum widens with depth, so the bounds come from whichever end of the slice is more extreme
+                    const uint32_t cluster = x + y * size_x + slice * n_tiles;
+                    m_cluster_min_x[cluster] = std::min(depth_start * ndc_left, depth_end * ndc_left) * viewport_size.x;
+                    m_cluster_max_x[cluster] = std::max(depth_start * ndc_right, depth_end * ndc_right) * viewport_size.x;
+                    m_cluster_min_y[cluster] = std::min(depth_start * ndc_bottom, depth_end * ndc_bottom) * viewport_size.y;
+                    m_cluster_max_y[cluster] = std::max(depth_start * ndc_top, depth_end * ndc_top) * viewport_size.y;
+                }
+            }
+        }
+    }
+
+    void LightClusterGrid::bin_slice(uint32_t slice) {
+        auto& hits = m_slice_hits[slice];
+        hits.clear();
+
+        // Find all lights that overlap this slice's depth range, 4 at a time
+        const float depth_start = m_slice_depths[slice];
+        const float depth_end = m_slice_depths[slice + 1];
+        const uint32_t n_lights_padded = (uint32_t)m_light_depth_min.size();
+#if LIGHT_CLUSTERS_USE_SSE
+        const __m128 slice_start = _mm_set1_ps(depth_start);
+        const __m128 slice_end = _mm_set1_ps(depth_end);
+        for (uint32_t i = 0; i < n_lights_padded; i += 4) {
+            const __m128 overlaps = _mm_and_ps(
+                _mm_cmple_ps(_mm_loadu_ps(&m_light_depth_min[i]), slice_end),
+                _mm_cmpge_ps(_mm_loadu_ps(&m_light_depth_max[i]), slice_start)
+            );
+            int mask = _mm_movemask_ps(overlaps);
+            while (mask != 0) {
+                const uint32_t lane = (mask & 1) ? 0 : (mask & 2) ? 1 : (mask & 4) ? 2 : 3;
+                mask &= mask - 1;
+                bin_light_in_slice(slice, i + lane, hits);
+            }
+        }
+#else
+        for (uint32_t i = 0; i < n_lights_padded; ++i) {
+            if (m_light_depth_min[i] <= depth_end && m_light_depth_max[i] >= depth_start) {
+                bin_light_in_slice(slice, i, hits);
+            }
+        }
+#endif
+
+        // Counting sort by tile, so each cluster's lights end up next to each other
+        uint32_t* tile_counts = m_slice_tile_counts[slice];
+        std::fill(tile_counts, tile_counts + n_tiles, 0);
+        for (const uint32_t hit : hits) {
+            ++tile_counts[hit >> 24];
+        }
+        uint32_t tile_cursors[n_tiles];
+        uint32_t cursor = 0;
+        for (uint32_t tile = 0; tile < n_tiles; ++tile) {
+            tile_cursors[tile] = cursor;
+            cursor += tile_counts[tile];
+        }
+        auto& sorted_indices = m_slice_sorted_indices[slice];
+        sorted_indices.resize(hits.size());
+        for (const uint32_t hit : hits) {
+            sorted_indices[tile_cursors[hit >> 24]++] = hit & 0x00FFFFFF;
+        }
+    }
+
+    void LightClusterGrid::bin_light_in_slice(uint32_t slice, uint32_t light_index, std::vector<uint32_t>& hits) {
+        const float x = m_light_x[light_index];
+        const float y = m_light_y[light_index];
+        const float depth = m_light_depth[light_index];
+        const float radius = m_light_radius[light_index];
+
+        // Only look at the part of the slice the light overlaps with, and find the range of tiles its bounding box projects to.
+        // The projected size of a box edge is largest at whichever end of that depth range is closest to the edge's sign.
+        const float depth_start = m_slice_depths[slice];
+        const float depth_end = m_slice_depths[slice + 1];
+        const float near_depth = std::max({ depth_start, depth - radius, 0.0001f });
+        const float far_depth = std::max(std::min(depth_end, depth + radius), near_depth);
+        const float left = x - radius;
+        const float right = x + radius;
+        const float bottom = y - radius;
+        const float top = y + radius;
+        const float ndc_left = left / (((left < 0.0f) ? near_depth : far_depth) * m_viewport_size.x);
+        const float ndc_right = right / (((right > 0.0f) ? near_depth : far_depth) * m_viewport_size.x);
+        const float ndc_bottom = bottom / (((bottom < 0.0f) ? near_depth : far_depth) * m_viewport_size.y);
+        const float ndc_top = top / (((top > 0.0f) ? near_depth : far_depth) * m_viewport_size.y);
+        if (ndc_right < -1.0f || ndc_left > 1.0f || ndc_top < -1.0f || ndc_bottom > 1.0f) return;
+
+        const uint32_t tile_x_start = (uint32_t)std::clamp((ndc_left * 0.5f + 0.5f) * (float)size_x, 0.0f, (float)(size_x - 1));
+        const uint32_t tile_x_end = (uint32_t)std::clamp((ndc_right * 0.5f + 0.5f) * (float)size_x, 0.0f, (float)(size_x - 1));
+        const uint32_t tile_y_start = (uint32_t)std::clamp((0.5f - ndc_top * 0.5f) * (float)size_y, 0.0f, (float)(size_y - 1));
+        const uint32_t tile_y_end = (uint32_t)std::clamp((0.5f - ndc_bottom * 0.5f) * (float)size_y, 0.0f, (float)(size_y - 1));
+
+        // Then do a proper sphere vs box test against each of those clusters
+        const float distance_z = std::max({ depth_start - depth, depth - depth_end, 0.0f });
+        const float distance_z_squared = distance_z * distance_z;
+        const float radius_squared = radius * radius;
+        const uint32_t slice_first_cluster = slice * n_tiles;
+
+        for (uint32_t tile_y = tile_y_start; tile_y <= tile_y_end; ++tile_y) {
+#if LIGHT_CLUSTERS_USE_SSE
+            // Rows are 16 tiles wide, so we can always test 4 neighbouring tiles at once, and mask out the ones outside the range
+            const __m128 center_x = _mm_set1_ps(x);
+            const __m128 center_y = _mm_set1_ps(y);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 max_distance_xy = _mm_set1_ps(radius_squared - distance_z_squared);
+            for (uint32_t tile_x = tile_x_start & ~3; tile_x <= tile_x_end; tile_x += 4) {
+                const uint32_t cluster = slice_first_cluster + tile_x + tile_y * size_x;
+                const __m128 distance_x = _mm_max_ps(_mm_max_ps(
+                    _mm_sub_ps(_mm_loadu_ps(&m_cluster_min_x[cluster]), center_x),
+                    _mm_sub_ps(center_x, _mm_loadu_ps(&m_cluster_max_x[cluster]))), zero);
+                const __m128 distance_y = _mm_max_ps(_mm_max_ps(
+                    _mm_sub_ps(_mm_loadu_ps(&m_cluster_min_y[cluster]), center_y),
+                    _mm_sub_ps(center_y, _mm_loadu_ps(&m_cluster_max_y[cluster]))), zero);
+                const __m128 distance_squared = _mm_add_ps(_mm_mul_ps(distance_x, distance_x), _mm_mul_ps(distance_y, distance_y));
+                int mask = _mm_movemask_ps(_mm_cmple_ps(distance_squared, max_distance_xy));
+                while (mask != 0) {
+                    const uint32_t lane = (mask & 1) ? 0 : (mask & 2) ? 1 : (mask & 4) ? 2 : 3;
+                    mask &= mask - 1;
+                    const uint32_t x_index = tile_x + lane;
+                    if (x_index < tile_x_start || x_index > tile_x_end) continue;
+                    hits.push_back(((x_index + tile_y * size_x) << 24) | light_index);
+                }
+            }
+#else
+            for (uint32_t tile_x = tile_x_start; tile_x <= tile_x_end; ++tile_x) {
+                const uint32_t cluster = slice_first_cluster + tile_x + tile_y * size_x;
+                const float distance_x = std::max({ m_cluster_min_x[cluster] - x, x - m_cluster_max_x[cluster], 0.0f });
+                const float distance_y = std::max({ m_cluster_min_y[cluster] - y, y - m_cluster_max_y[cluster], 0.0f });
+                if (distance_x * distance_x + distance_y * distance_y + distance_z_squared <= radius_squared) {
+                    hits.push_back(((tile_x + tile_y * size_x) << 24) | light_index);
+                }
+            }
+#endif
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+namespace gfx {
+    struct ThreadPool;
+
+    struct ClusterLightBounds {
+        glm::vec3 position; // View space
+        float radius; // Distance after which the light has no influence anymore
+    };
+
+    struct LightCluster {
+        uint32_t offset; // Index of the first entry in the light index list
+        uint32_t count; // Number of light indices for this cluster
+    };
+
+    // Bins lights into a froxel grid, so the lighting pass only has to loop over the lights that can actually reach a pixel.
+    // Tiles split up the screen evenly, depth slices are exponentially distributed between `near` and `far`, and slice 0 covers
+    // everything closer than `near`. Tile rows go from the top of the screen to the bottom, like the pixels do.
+    struct LightClusterGrid {
+        static constexpr uint32_t size_x = 16;
+        static constexpr uint32_t size_y = 9;
+        static constexpr uint32_t size_z = 24;
+        static constexpr uint32_t n_tiles = size_x * size_y;
+        static constexpr uint32_t n_clusters = n_tiles * size_z;
+
+        // `viewport_size` is the tangent of half the field of view, horizontally and vertically
+        void build(ThreadPool& thread_pool, std::span<const ClusterLightBounds> lights, glm::vec2 viewport_size, float near, float far, uint32_t max_light_indices);
+
+        std::vector<LightCluster> clusters; // Indexed by `x + y * size_x + z * n_tiles`
+        std::vector<uint32_t> light_indices; // Compact list of indices into the `lights` span passed to `build()`
+        uint32_t n_dropped_light_indices = 0; // If the index list would've exceeded `max_light_indices`, the clusters at the far end lose their lights
+
+    private:
+        void update_cluster_bounds(glm::vec2 viewport_size, float near, float far);
+        void bin_slice(uint32_t slice);
+        void bin_light_in_slice(uint32_t slice, uint32_t light_index, std::vector<uint32_t>& hits);
+
+        glm::vec2 m_viewport_size = { 0.0f, 0.0f };
+        float m_near = 0.0f;
+        float m_far = 0.0f;
+        float m_slice_depths[size_z + 1] = {}; // Start and end depth (positive, into the screen) of each slice
+
+        // View space bounds of the tiles at the start and end depth of each slice. Stored as separate arrays so 4 tiles can be tested at once
+        std::vector<float> m_cluster_min_x;
+        std::vector<float> m_cluster_max_x;
+        std::vector<float> m_cluster_min_y;
+        std::vector<float> m_cluster_max_y;
+
+        // Lights converted to separate arrays, padded to a multiple of 4. Depth is the distance into the screen
+        uint32_t m_n_lights = 0;
+        std::vector<float> m_light_x;
+        std::vector<float> m_light_y;
+        std::vector<float> m_light_depth;
+        std::vector<float> m_light_radius;
+        std::vector<float> m_light_depth_min;
+        std::vector<float> m_light_depth_max;
+
+        // Per slice scratch data. Each slice is binned by one thread, so these never need to be synchronized
+        std::vector<uint32_t> m_slice_hits[size_z]; // (tile << 24) | light index
+        std::vector<uint32_t> m_slice_sorted_indices[size_z]; // Light indices sorted by tile
+        uint32_t m_slice_tile_counts[size_z][n_tiles] = {};
+    };
+}
@@ -0,0 +1,371 @@
+#include "light_tree.h"
+
+#include <algorithm>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+namespace gfx {
+    #define LIGHT_TREE_N_BUCKETS 12
+    #define PI 3.14159265358979f
+
+    static float luminance(const glm::vec3 color) {
+        return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+    }
+
+    static float safe_sqrt(const float value) {
+        return sqrtf(std::max(value, 0.0f));
+    }
+
+    // cos(max(0, a - b)) and sin(max(0, a - b)), from the sines and cosines of a and b
+    static float cos_sub_clamped(const float sin_a, const float cos_a, const float sin_b, const float cos_b) {
+        if (cos_a > cos_b) return 1.0f;
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+
+    static float sin_sub_clamped(const float sin_a, const float cos_a, const float sin_b, const float cos_b) {
+        if (cos_a > cos_b) return 0.0f;
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+
+    static LightTreeNode empty_node() {
+        return LightTreeNode{
+            .bounds_min = glm::vec3(+INFINITY),
+            .child_or_emitter = 0,
+            .bounds_max = glm::vec3(-INFINITY),
+            .power = 0.0f,
+            .axis = glm::vec3(0.0f, 0.0f, 1.0f),
+            .cos_theta_o = 1.0f,
+            .cos_theta_e = 1.0f,
+            .parent = ~0u,
+        };
+    }
+
+    // Smallest cone containing both cones
+    static void merge_cones(glm::vec3& axis_a, float& cos_theta_a, const glm::vec3 axis_b, const float cos_theta_b) {
+        const float theta_a = acosf(glm::clamp(cos_theta_a, -1.0f, 1.0f));
+        const float theta_b = acosf(glm::clamp(cos_theta_b, -1.0f, 1.0f));
+        const float theta_d = acosf(glm::clamp(glm::dot(axis_a, axis_b), -1.0f, 1.0f));
+
+        // One cone might already contain the other
+        if (std::min(theta_d + theta_b, PI) <= theta_a) return;
+        if (std::min(theta_d + theta_a, PI) <= theta_b) {
+            axis_a = axis_b;
+            cos_theta_a = cos_theta_b;
+            return;
+        }
+
+        const float theta_o = (theta_a + theta_d + theta_b) * 0.5f;
+        const glm::vec3 rotation_axis = glm::cross(axis_a, axis_b);
+        if (theta_o >= PI || glm::dot(rotation_axis, rotation_axis) < 1e-12f) {
+            cos_theta_a = -1.0f;
+            return;
+        }
+
+        // Rotate the first axis towards the second one, so the new cone just touches the far sides of both
+        axis_a = glm::normalize(glm::angleAxis(theta_o - theta_a, glm::normalize(rotation_axis)) * axis_a);
+        cos_theta_a = cosf(theta_o);
+    }
+
+    static void merge_nodes(LightTreeNode& a, const LightTreeNode& b) {
+        if (b.power <= 0.0f) return;
+        if (a.power <= 0.0f) {
+            a = b;
+            return;
+        }
+        a.bounds_min = glm::min(a.bounds_min, b.bounds_min);
+        a.bounds_max = glm::max(a.bounds_max, b.bounds_max);
+        a.power += b.power;
+        merge_cones(a.axis, a.cos_theta_o, b.axis, b.cos_theta_o);
+        a.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    }
+
+    static LightTreeNode bounds_from_emitter(const LightTreeEmitter& emitter) {
+        LightTreeNode node = empty_node();
+        switch (emitter.type) {
+        case LightTreeEmitterType::point:
+            node.bounds_min = emitter.positions[0];
+            node.bounds_max = emitter.positions[0];
+            node.power = 4.0f * PI * luminance(emitter.radiance);
+            node.cos_theta_o = -1.0f; // Emits in all directions
+            node.cos_theta_e = 0.0f;
+            break;
+        case LightTreeEmitterType::spot: {
+            node.bounds_min = emitter.positions[0];
+            node.bounds_max = emitter.positions[0];
+            node.power = 2.0f * PI * (1.0f - emitter.cos_outer_cone_angle) * luminance(emitter.radiance);
+            node.axis = glm::normalize(emitter.direction);
+            node.cos_theta_o = emitter.cos_inner_cone_angle;
+            node.cos_theta_e = cosf(acosf(emitter.cos_outer_cone_angle) - acosf(emitter.cos_inner_cone_angle));
+            break;
+        }
+        case LightTreeEmitterType::triangle: {
+            const glm::vec3 cross = glm::cross(emitter.positions[1] - emitter.positions[0], emitter.positions[2] - emitter.positions[0]);
+            const float area = glm::length(cross) * 0.5f;
+            node.bounds_min = glm::min(emitter.positions[0], glm::min(emitter.positions[1], emitter.positions[2]));
+            node.bounds_max = glm::max(emitter.positions[0], glm::max(emitter.positions[1], emitter.positions[2]));
+            node.power = luminance(emitter.radiance) * area * PI * (emitter.double_sided ? 2.0f : 1.0f);
+            if (area > 0.0f) node.axis = cross / (area * 2.0f);
+            node.cos_theta_o = emitter.double_sided ? -1.0f : 1.0f;
+            node.cos_theta_e = 0.0f;
+            break;
+        }
+        }
+        return node;
+    }
+
+    // Surface area heuristic, extended with how spread out the emission directions are (M_Omega in the paper)
+    static float orientation_cost(const LightTreeNode& node) {
+        if (node.power <= 0.0f) return 0.0f;
+        const glm::vec3 size = glm::max(node.bounds_max - node.bounds_min, glm::vec3(0.0f));
+        const float area = 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+
+        const float theta_o = acosf(glm::clamp(node.cos_theta_o, -1.0f, 1.0f));
+        const float theta_e = acosf(glm::clamp(node.cos_theta_e, -1.0f, 1.0f));
+        const float theta_w = std::min(theta_o + theta_e, PI);
+        const float sin_theta_o = sinf(theta_o);
+        const float m_omega = 2.0f * PI * (1.0f - node.cos_theta_o) +
+            PI / 2.0f * (2.0f * theta_w * sin_theta_o - cosf(theta_o - 2.0f * theta_w) - 2.0f * theta_o * sin_theta_o + node.cos_theta_o);
+
+        // Points have no area, but should still prefer being grouped with nearby points, so add a tiny bit
+        return node.power * m_omega * (area + 1e-6f);
+    }
+
+    void LightTree::build(std::vector<LightTreeEmitter> new_emitters) {
+        emitters = std::move(new_emitters);
+        nodes.clear();
+        m_emitter_leaves.assign(emitters.size(), ~0u);
+        if (emitters.empty()) return;
+
+        m_emitter_bounds.clear();
+        m_emitter_bounds.reserve(emitters.size());
+        m_build_order.clear();
+        m_build_order.reserve(emitters.size());
+        for (uint32_t i = 0; i < (uint32_t)emitters.size(); ++i) {
+            m_emitter_bounds.push_back(bounds_from_emitter(emitters[i]));
+            m_build_order.push_back(i);
+        }
+
+        // Every split adds 2 nodes, and we always split until there's 1 emitter left
+        nodes.reserve(emitters.size() * 2 - 1);
+        nodes.push_back(empty_node());
+        build_node(0, 0, (uint32_t)emitters.size());
+
+        m_emitter_bounds.clear();
+        m_emitter_bounds.shrink_to_fit();
+        m_build_order.clear();
+        m_build_order.shrink_to_fit();
+    }
+
+    void LightTree::build_node(const uint32_t node_index, const uint32_t begin, const uint32_t end) {
+        const uint32_t parent = nodes[node_index].parent;
+        if (end - begin == 1) {
+            const uint32_t emitter_index = m_build_order[begin];
+            nodes[node_index] = m_emitter_bounds[emitter_index];
+            nodes[node_index].child_or_emitter = emitter_index | LightTreeNode::leaf_flag;
+            nodes[node_index].parent = parent;
+            m_emitter_leaves[emitter_index] = node_index;
+            return;
+        }
+
+        LightTreeNode node = empty_node();
+        glm::vec3 centroid_min = glm::vec3(+INFINITY);
+        glm::vec3 centroid_max = glm::vec3(-INFINITY);
+        for (uint32_t i = begin; i < end; ++i) {
+            const LightTreeNode& bounds = m_emitter_bounds[m_build_order[i]];
+            const glm::vec3 centroid = (bounds.bounds_min + bounds.bounds_max) * 0.5f;
+            centroid_min = glm::min(centroid_min, centroid);
+            centroid_max = glm::max(centroid_max, centroid);
+            merge_nodes(node, bounds);
+        }
+        if (node.power <= 0.0f) {
+            // Nothing below here emits anything, but it still needs to be a valid box for the importance function
+            node.bounds_min = centroid_min;
+            node.bounds_max = centroid_max;
+        }
+
+        // Find the cheapest split using buckets along each axis
+        const glm::vec3 node_size = node.bounds_max - node.bounds_min;
+        const float max_extent = std::max(node_size.x, std::max(node_size.y, node_size.z));
+        float best_cost = INFINITY;
+        int best_axis = -1;
+        int best_bucket = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float extent = centroid_max[axis] - centroid_min[axis];
+            if (extent <= 0.0f) continue;
+
+            LightTreeNode buckets[LIGHT_TREE_N_BUCKETS];
+            for (auto& bucket : buckets) bucket = empty_node();
+            for (uint32_t i = begin; i < end; ++i) {
+                const LightTreeNode& bounds = m_emitter_bounds[m_build_order[i]];
+                const float centroid = (bounds.bounds_min[axis] + bounds.bounds_max[axis]) * 0.5f;
+                const int bucket = std::min((int)((centroid - centroid_min[axis]) / extent * LIGHT_TREE_N_BUCKETS), LIGHT_TREE_N_BUCKETS - 1);
+                merge_nodes(buckets[bucket], bounds);
+            }
+
+            // Thin boxes get split along their long side, even if the orientation cones suggest otherwise
+            const float regularization = (node_size[axis] > 0.0f) ? (max_extent / node_size[axis]) : 1.0f;
+            for (int split = 0; split < LIGHT_TREE_N_BUCKETS - 1; ++split) {
+                LightTreeNode below = empty_node();
+                LightTreeNode above = empty_node();
+                for (int i = 0; i <= split; ++i) merge_nodes(below, buckets[i]);
+                for (int i = split + 1; i < LIGHT_TREE_N_BUCKETS; ++i) merge_nodes(above, buckets[i]);
+                const float cost = regularization * (orientation_cost(below) + orientation_cost(above));
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bucket = split;
+                }
+            }
+        }
+
+        // Partition the emitters. If all the centroids are in the same spot, or the buckets ended up lopsided, just split them in half
+        uint32_t middle = begin + (end - begin) / 2;
+        if (best_axis != -1) {
+            const float extent = centroid_max[best_axis] - centroid_min[best_axis];
+            const auto* first = m_build_order.data() + begin;
+            const auto* split = std::partition(m_build_order.data() + begin, m_build_order.data() + end, [&](const uint32_t emitter_index) {
+                const LightTreeNode& bounds = m_emitter_bounds[emitter_index];
+                const float centroid = (bounds.bounds_min[best_axis] + bounds.bounds_max[best_axis]) * 0.5f;
+                const int bucket = std::min((int)((centroid - centroid_min[best_axis]) / extent * LIGHT_TREE_N_BUCKETS), LIGHT_TREE_N_BUCKETS - 1);
+                return bucket <= best_bucket;
+            });
+            const uint32_t split_index = begin + (uint32_t)(split - first);
+            if (split_index != begin && split_index != end) middle = split_index;
+        }
+
+        const uint32_t first_child = (uint32_t)nodes.size();
+        node.child_or_emitter = first_child;
+        node.parent = parent;
+        nodes[node_index] = node;
+        nodes.push_back(empty_node());
+        nodes.push_back(empty_node());
+        nodes[first_child + 0].parent = node_index;
+        nodes[first_child + 1].parent = node_index;
+        build_node(first_child + 0, begin, middle);
+        build_node(first_child + 1, middle, end);
+    }
+
+    float LightTree::importance(const LightTreeNode& node, const glm::vec3 position, const glm::vec3 normal) const {
+        if (node.power <= 0.0f) return 0.0f;
+
+        // Clamp the distance to half the box diagonal, so points inside or close to big nodes don't blow up
+        const glm::vec3 center = (node.bounds_min + node.bounds_max) * 0.5f;
+        const float radius_squared = glm::dot(node.bounds_max - center, node.bounds_max - center);
+        const float center_distance_squared = glm::dot(position - center, position - center);
+        const float distance_squared = std::max({ center_distance_squared, sqrtf(radius_squared), 1e-8f });
+
+        // Angle between the light's axis and the shading point
+        const glm::vec3 to_point = (center_distance_squared > 0.0f) ? glm::normalize(position - center) : glm::vec3(0.0f);
+        const float cos_theta_w = glm::dot(node.axis, to_point);
+        const float sin_theta_w = safe_sqrt(1.0f - cos_theta_w * cos_theta_w);
+
+        // Angle the node's bounding sphere takes up as seen from the shading point. If we're inside it, it could be any direction
+        float cos_theta_b = -1.0f;
+        if (center_distance_squared > radius_squared) {
+            cos_theta_b = safe_sqrt(1.0f - radius_squared / center_distance_squared);
+        }
+        const float sin_theta_b = safe_sqrt(1.0f - cos_theta_b * cos_theta_b);
+
+        // Smallest angle between the shading point and any emission direction in the cone
+        const float sin_theta_o = safe_sqrt(1.0f - node.cos_theta_o * node.cos_theta_o);
+        const float cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+        const float sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+        const float cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta_p <= node.cos_theta_e) return 0.0f;
+
+        float result = node.power * cos_theta_p / distance_squared;
+
+        // Smallest angle between the surface normal and any direction towards the node
+        if (normal != glm::vec3(0.0f)) {
+            const float cos_theta_i = fabsf(glm::dot(to_point, normal));
+            const float sin_theta_i = safe_sqrt(1.0f - cos_theta_i * cos_theta_i);
+            result *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+        }
+
+        return std::max(result, 0.0f);
+    }
+
+    LightTreeSample LightTree::sample(const glm::vec3 position, const glm::vec3 normal, float u) const {
+        if (nodes.empty()) return { 0, 0.0f };
+        if (nodes[0].is_leaf()) {
+            if (importance(nodes[0], position, normal) <= 0.0f) return { 0, 0.0f };
+            return { nodes[0].child_or_emitter & ~LightTreeNode::leaf_flag, 1.0f };
+        }
+
+        uint32_t node_index = 0;
+        float pdf = 1.0f;
+        while (!nodes[node_index].is_leaf()) {
+            const uint32_t first_child = nodes[node_index].child_or_emitter;
+            const float importance_a = importance(nodes[first_child + 0], position, normal);
+            const float importance_b = importance(nodes[first_child + 1], position, normal);
+            if (importance_a + importance_b <= 0.0f) return { 0, 0.0f };
+
+            // Pick a child, and remap `u` so it can be used again for the next level
+            const float probability_a = importance_a / (importance_a + importance_b);
+            if (u < probability_a) {
+                u = std::min(u / probability_a, 0x1.fffffep-1f);
+                pdf *= probability_a;
+                node_index = first_child + 0;
+            }
+            else {
+                u = std::min((u - probability_a) / (1.0f - probability_a), 0x1.fffffep-1f);
+                pdf *= 1.0f - probability_a;
+                node_index = first_child + 1;
+            }
+        }
+
+        return { nodes[node_index].child_or_emitter & ~LightTreeNode::leaf_flag, pdf };
+    }
+
+    float LightTree::pdf(const glm::vec3 position, const glm::vec3 normal, const uint32_t emitter_index) const {
+        if (emitter_index >= m_emitter_leaves.size()) return 0.0f;
+
+        uint32_t node_index = m_emitter_leaves[emitter_index];
+        if (node_index == 0) return (importance(nodes[0], position, normal) > 0.0f) ? 1.0f : 0.0f;
+
+        // Walk up from the leaf, multiplying the probability of picking each node on the way
+        float pdf = 1.0f;
+        while (node_index != 0) {
+            const uint32_t first_child = nodes[nodes[node_index].parent].child_or_emitter;
+            const float importance_a = importance(nodes[first_child + 0], position, normal);
+            const float importance_b = importance(nodes[first_child + 1], position, normal);
+            if (importance_a + importance_b <= 0.0f) return 0.0f;
+            pdf *= ((node_index == first_child) ? importance_a : importance_b) / (importance_a + importance_b);
+            node_index = nodes[node_index].parent;
+        }
+        return pdf;
+    }
+
+    std::vector<uint8_t> LightTree::to_gpu_buffer() const {
+        const LightTreeBufferHeader header = {
+            .n_nodes = (uint32_t)nodes.size(),
+            .n_emitters = (uint32_t)emitters.size(),
+            .nodes_offset = 64,
+            .emitters_offset = 64 + (uint32_t)(nodes.size() * sizeof(LightTreeNode)),
+        };
+
+        std::vector<uint8_t> buffer(header.emitters_offset + emitters.size() * sizeof(LightTreeEmitterGpu), 0);
+        memcpy(buffer.data(), &header, sizeof(header));
+        if (!nodes.empty()) memcpy(buffer.data() + header.nodes_offset, nodes.data(), nodes.size() * sizeof(LightTreeNode));
+
+        LightTreeEmitterGpu* gpu_emitters = (LightTreeEmitterGpu*)(buffer.data() + header.emitters_offset);
+        for (size_t i = 0; i < emitters.size(); ++i) {
+            const LightTreeEmitter& emitter = emitters[i];
+            gpu_emitters[i] = LightTreeEmitterGpu{
+                .position0 = emitter.positions[0],
+                .type = emitter.type,
+                .position1 = emitter.positions[1],
+                .cos_inner_cone_angle = emitter.cos_inner_cone_angle,
+                .position2 = emitter.positions[2],
+                .cos_outer_cone_angle = emitter.cos_outer_cone_angle,
+                .radiance = emitter.radiance,
+                .double_sided = emitter.double_sided ? 1u : 0u,
+                .direction = emitter.direction,
+                .padding = 0,
+            };
+        }
+
+        return buffer;
+    }
+}
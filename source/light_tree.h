@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/vec3.hpp>
+
+namespace gfx {
+    enum class LightTreeEmitterType : uint32_t {
+        point,
+        spot,
+        triangle,
+    };
+
+    // Anything in the scene that emits light from a position. Directional lights and the sky are infinitely far away, so those are sampled separately
+    struct LightTreeEmitter {
+        LightTreeEmitterType type;
+        glm::vec3 radiance; // Point and spot lights: color * intensity (candela). Triangles: emitted radiance
+        glm::vec3 positions[3]; // Point and spot lights only use the first one
+        glm::vec3 direction; // Spot light direction, unused for point lights and triangles
+        float cos_inner_cone_angle = 1.0f; // Only used for spot lights
+        float cos_outer_cone_angle = 1.0f; // Only used for spot lights
+        bool double_sided = false; // Only used for triangles
+    };
+
+    struct LightTreeNode {
+        glm::vec3 bounds_min;
+        uint32_t child_or_emitter; // Interior node: index of the first child, the second one comes right after it. Leaf: emitter index | `leaf_flag`
+        glm::vec3 bounds_max;
+        float power; // Total emitted power of everything below this node
+        glm::vec3 axis; // Center of the cone that contains all emission normals below this node
+        float cos_theta_o; // Half angle of that normal cone
+        float cos_theta_e; // How far beyond the normal cone light can still be emitted
+        uint32_t parent; // `~0u` for the root
+        uint32_t padding[2];
+
+        static constexpr uint32_t leaf_flag = 0x80000000;
+        bool is_leaf() const { return (child_or_emitter & leaf_flag) != 0; }
+    };
+    static_assert(sizeof(LightTreeNode) == 64);
+
+    // Same data as `LightTreeEmitter`, laid out for the shaders
+    struct LightTreeEmitterGpu {
+        glm::vec3 position0;
+        LightTreeEmitterType type;
+        glm::vec3 position1;
+        float cos_inner_cone_angle;
+        glm::vec3 position2;
+        float cos_outer_cone_angle;
+        glm::vec3 radiance;
+        uint32_t double_sided;
+        glm::vec3 direction;
+        uint32_t padding;
+    };
+    static_assert(sizeof(LightTreeEmitterGpu) == 80);
+
+    // Layout of the start of the buffer returned by `LightTree::to_gpu_buffer()`. Offsets are in bytes, from the start of the buffer
+    struct LightTreeBufferHeader {
+        uint32_t n_nodes;
+        uint32_t n_emitters;
+        uint32_t nodes_offset;
+        uint32_t emitters_offset;
+    };
+
+    struct LightTreeSample {
+        uint32_t emitter_index;
+        float pdf; // Probability of picking this emitter, 0 if nothing can light the shading point
+    };
+
+    // Bounding volume hierarchy over emitters, where every node also stores the emitted power and a cone bounding the emission directions.
+    // Sampling walks down the tree, picking a child based on how much it could contribute to the shading point, so with thousands of lights
+    // the ones that are close and facing the right way get picked most of the time. Based on "Importance Sampling of Many Lights With
+    // Adaptive Tree Splitting" (Conty Estevez & Kulla, 2018), with the importance function from pbrt-v4.
+    struct LightTree {
+        void build(std::vector<LightTreeEmitter> new_emitters);
+
+        // `u` is a uniform random number in [0, 1). `normal` can be zero if the shading point isn't on a surface
+        LightTreeSample sample(glm::vec3 position, glm::vec3 normal, float u) const;
+
+        // Probability of `sample()` returning this emitter, needed for multiple importance sampling. Summed over all emitters this can be a
+        // bit less than 1: the walk down the tree can end up in a node where neither child can light the point, and then there's no sample
+        float pdf(glm::vec3 position, glm::vec3 normal, uint32_t emitter_index) const;
+
+        // Header, followed by the nodes and the emitters
+        std::vector<uint8_t> to_gpu_buffer() const;
+
+        std::vector<LightTreeEmitter> emitters;
+        std::vector<LightTreeNode> nodes; // Root is at index 0
+
+    private:
+        void build_node(uint32_t node_index, uint32_t begin, uint32_t end);
+        float importance(const LightTreeNode& node, glm::vec3 position, glm::vec3 normal) const;
+
+        std::vector<LightTreeNode> m_emitter_bounds; // Leaf node for each emitter, used while building
+        std::vector<uint32_t> m_build_order; // Emitter indices, partitioned in place while building
+        std::vector<uint32_t> m_emitter_leaves; // Node index for each emitter
+    };
+}
@@ -0,0 +1,91 @@
+#include "linear_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include "log.h"
+
+namespace gfx {
+    LinearAllocator::LinearAllocator(uint32_t page_size, uint32_t alignment, CreatePageFunc create_page) {
+        assert(alignment != 0 && (alignment & (alignment - 1)) == 0 && "Alignment must be a power of 2");
+        m_page_size = page_size;
+        m_alignment = alignment;
+        m_create_page = std::move(create_page);
+    }
+
+    void LinearAllocator::begin_frame(uint64_t frame_index, uint64_t completed_frame_index) {
+        m_frame_index = frame_index;
+        m_curr_page = ~0u;
+        m_cursor = 0;
+
+        // Recycle every page the GPU is done with. This keeps the order, so the oldest pages get reused first.
+        // The fence starts at 0, so frame `completed_frame_index` itself might not have finished yet
+        size_t n_still_used = 0;
+        for (uint32_t page_index : m_used_pages) {
+            if (m_pages[page_index].last_used_frame < completed_frame_index) {
+                m_free_pages.push_back(page_index);
+            }
+            else {
+                m_used_pages[n_still_used++] = page_index;
+            }
+        }
+        m_used_pages.resize(n_still_used);
+
+        m_stats.bytes_allocated_last_frame = m_stats.bytes_allocated_this_frame;
+        m_stats.bytes_allocated_this_frame = 0;
+        m_stats.n_allocations_this_frame = 0;
+    }
+
+    LinearAllocation LinearAllocator::allocate(uint32_t size) {
+        // Move on to another page if this one doesn't fit
+        uint32_t offset = m_cursor;
+        if (m_curr_page == ~0u || offset + size > m_pages[m_curr_page].size) {
+            m_curr_page = acquire_page(size);
+            offset = 0;
+        }
+
+        Page& page = m_pages[m_curr_page];
+        page.last_used_frame = m_frame_index;
+        m_cursor = (offset + size + m_alignment - 1) & ~(m_alignment - 1);
+
+        m_stats.bytes_allocated_this_frame += size;
+        m_stats.n_allocations_this_frame += 1;
+        if (m_stats.bytes_allocated_this_frame > m_stats.peak_bytes_per_frame) {
+            m_stats.peak_bytes_per_frame = m_stats.bytes_allocated_this_frame;
+        }
+
+        return LinearAllocation{
+            .page = m_curr_page,
+            .offset = offset,
+            .cpu_address = (uint8_t*)page.cpu_address + offset,
+        };
+    }
+
+    uint32_t LinearAllocator::acquire_page(uint32_t min_size) {
+        // Try to find a free page that's big enough
+        for (size_t i = 0; i < m_free_pages.size(); ++i) {
+            const uint32_t page_index = m_free_pages[i];
+            if (m_pages[page_index].size >= min_size) {
+                m_free_pages.erase(m_free_pages.begin() + i);
+                m_used_pages.push_back(page_index);
+                return page_index;
+            }
+        }
+
+        // Otherwise make a new one, rounded up to a whole number of pages
+        const uint32_t page_size = ((std::max(min_size, 1u) + m_page_size - 1) / m_page_size) * m_page_size;
+        const uint32_t page_index = (uint32_t)m_pages.size();
+        void* cpu_address = m_create_page(page_index, page_size);
+        assert(cpu_address != nullptr && "Failed to create linear allocator page");
+        LOG(Debug, "Linear allocator: created page %u (%u bytes)", page_index, page_size);
+
+        m_pages.push_back(Page{
+            .cpu_address = cpu_address,
+            .size = page_size,
+            .last_used_frame = m_frame_index,
+        });
+        m_used_pages.push_back(page_index);
+        m_stats.n_pages += 1;
+        m_stats.total_page_bytes += page_size;
+        return page_index;
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace gfx {
+    struct LinearAllocation {
+        uint32_t page = ~0u; // Index of the page this allocation lives in, in the order the pages were created
+        uint32_t offset = 0; // Byte offset into that page
+        void* cpu_address = nullptr;
+    };
+
+    struct LinearAllocatorStats {
+        uint64_t bytes_allocated_this_frame = 0;
+        uint64_t bytes_allocated_last_frame = 0;
+        uint64_t peak_bytes_per_frame = 0;
+        uint64_t n_allocations_this_frame = 0;
+        uint64_t total_page_bytes = 0; // Size of all pages combined, whether they're in use or not
+        uint32_t n_pages = 0;
+    };
+
+    // Hands out short-lived memory for a single frame, by bumping a cursor through fixed size pages. Pages stay mapped the whole time,
+    // and are only reused once the GPU is done with every frame that used them, so the allocator needs to know which frame the GPU
+    // has finished last. If all the pages are still in use, it asks for a new one instead of running out.
+    // This only does the bookkeeping: the memory itself comes from `create_page`, so it can be driven without a GPU.
+    struct LinearAllocator {
+        // Should create a page of `size` bytes, and return a CPU pointer to it that stays valid for the lifetime of the allocator
+        using CreatePageFunc = std::function<void*(uint32_t page_index, uint32_t size)>;
+
+        LinearAllocator() = default;
+        LinearAllocator(uint32_t page_size, uint32_t alignment, CreatePageFunc create_page);
+
+        // `completed_frame_index` is what `Device::completed_frame_index()` returns, every page only used by earlier frames gets recycled
+        void begin_frame(uint64_t frame_index, uint64_t completed_frame_index);
+
+        // Allocations bigger than the page size get a page of their own
+        LinearAllocation allocate(uint32_t size);
+
+        const LinearAllocatorStats& stats() const { return m_stats; }
+
+    private:
+        struct Page {
+            void* cpu_address = nullptr;
+            uint32_t size = 0;
+            uint64_t last_used_frame = 0;
+        };
+
+        uint32_t acquire_page(uint32_t min_size);
+
+        CreatePageFunc m_create_page;
+        uint32_t m_page_size = 0;
+        uint32_t m_alignment = 1;
+        uint64_t m_frame_index = 0;
+        std::vector<Page> m_pages;
+        std::vector<uint32_t> m_free_pages; // Pages no frame in flight is using
+        std::vector<uint32_t> m_used_pages; // Pages used by the current frame or by frames the GPU might still be working on
+        uint32_t m_curr_page = ~0u;
+        uint32_t m_cursor = 0;
+        LinearAllocatorStats m_stats;
+    };
+}
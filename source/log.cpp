@@ -1,99 +1,427 @@
-#include "Log.h"
+#include "log.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <chrono>
+#include <cstring>
+#include <ctime>
 #include <mutex>
 #include <stdarg.h>
 #include <stdio.h>
-#include <iostream>
+#include <thread>
 
 #ifdef _WIN32
 #include <Windows.h>
 #endif
 
+#define LOG_RING_SIZE 1024 // Messages that can be queued before callers have to wait, has to be a power of 2
+#define LOG_MAX_ARGS 16
+#define LOG_STRING_CAPACITY 768 // Bytes for the copies of a message's string arguments, longer strings are cut off
+#define LOG_LINE_SIZE 4096
+#define LOG_BATCH_SIZE (64 * 1024) // Lines are collected and written in one go, as long as they have the same color
+#define LOG_IDLE_SLEEP_MS 1
+#define LOG_FULL_SLEEP_US 100
+
 namespace Log {
-    std::mutex mutex;
+    struct Record {
+        std::atomic<uint64_t> sequence;
+        Level level;
+        uint32_t n_args;
+        time_t time;
+        const char* format;
+        Arg args[LOG_MAX_ARGS]; // String arguments point into `strings`, as an offset
+        char strings[LOG_STRING_CAPACITY];
+    };
 
-    void write(const Level level, const char* message, ...) {
-        if (level < Log::min_level) return;
-        if (level == Level::Disabled) return;
+    // Bounded multi-producer queue, where each slot's sequence number says whose turn it is: a producer can fill slot `i` once its
+    // sequence is `i`, and the log thread can read it once it's `i + 1`. After reading it's bumped to `i + LOG_RING_SIZE` for the next lap
+    struct Logger {
+        Logger();
+        void thread_main();
+        uint32_t drain(); // Returns the number of messages written
 
-        std::lock_guard<std::mutex> lock(mutex);
+        Record records[LOG_RING_SIZE];
+        alignas(64) std::atomic<uint64_t> enqueue_position = 0;
+        alignas(64) std::atomic<uint64_t> n_written = 0; // Everything before this position is written
+        uint64_t dequeue_position = 0; // Only touched by the log thread
+        std::thread thread;
 
-        char msg_buf[4096] = {0};
-        int offset = 0;
+        std::mutex output_mutex; // Held while writing, so the output can't be switched halfway through a batch
+        FILE* output_file = nullptr;
+        char line[LOG_LINE_SIZE];
+        char batch[LOG_BATCH_SIZE];
+        size_t batch_size = 0;
+        int batch_color = -1;
+        FILE* batch_stream = nullptr;
+    };
+
+    constexpr uint32_t log_level_colors[] = {
+        7,  // debug: light grey
+        15, // info: white
+        14, // warn: yellow
+        4,  // error: red
+        12, // fatal: dark red
+    };
+
+    constexpr const char* log_level_names[] = {
+        "[DEBUG] ",
+        "[INFO]  ",
+        "[WARN]  ",
+        "[ERROR] ",
+        "[FATAL] ",
+    };
+
+    static Logger& logger() {
+        // Never destroyed, so static destructors can still log. Whatever is queued at exit gets written by the `atexit()` handler
+        static Logger* logger = []() {
+            Logger* new_logger = new Logger();
+            std::atexit([]() { flush(); });
+            return new_logger;
+        }();
+        return *logger;
+    }
+
+    Logger::Logger() {
+        for (uint64_t i = 0; i < LOG_RING_SIZE; ++i) {
+            records[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        thread = std::thread(&Logger::thread_main, this);
+        thread.detach();
+    }
+
+    // Formats one conversion from the format string, with our own length modifier so it matches how the argument was stored
+    static int format_arg(char* buffer, size_t size, const char* spec, size_t spec_length, const Arg* arg, const char* strings) {
+        char conversion = spec[spec_length - 1];
+        char length[3] = {};
+        const char* length_start = spec + spec_length - 1;
+        while (length_start > spec && strchr("hlzjtLw", length_start[-1])) --length_start;
+        memcpy(length, length_start, std::min<size_t>(spec + spec_length - 1 - length_start, 2));
 
-        constexpr uint32_t log_level_colors[] = { 
-            7,  // debug: light grey
-            15, // info: white
-            14, // warn: yellow
-            4,  // error: red
-            12, // fatal: dark red
+        // Keep the flags, width and precision, and put the right length modifier back in
+        char new_spec[32];
+        const size_t prefix_length = std::min<size_t>(length_start - spec, sizeof(new_spec) - 4);
+        memcpy(new_spec, spec, prefix_length);
+        char* end = new_spec + prefix_length;
+
+        if (!arg) return snprintf(buffer, size, "(missing)");
+        const uint64_t bits = (arg->type == ArgType::floating_point) ? (uint64_t)arg->f : arg->u;
+        switch (conversion) {
+        case 'd': case 'i': {
+            int64_t value = (arg->type == ArgType::floating_point) ? (int64_t)arg->f : arg->i;
+            if (length[0] == 0) value = (int)value;
+            else if (strcmp(length, "h") == 0) value = (short)value;
+            else if (strcmp(length, "hh") == 0) value = (signed char)value;
+            else if (strcmp(length, "l") == 0) value = (long)value;
+            memcpy(end, "lld", 4);
+            return snprintf(buffer, size, new_spec, (long long)value);
+        }
+        case 'u': case 'o': case 'x': case 'X': case 'c': {
+            uint64_t value = bits;
+            if (length[0] == 0) value = (unsigned int)value;
+            else if (strcmp(length, "h") == 0) value = (unsigned short)value;
+            else if (strcmp(length, "hh") == 0) value = (unsigned char)value;
+            else if (strcmp(length, "l") == 0) value = (unsigned long)value;
+            if (conversion == 'c') {
+                end[0] = 'c';
+                end[1] = 0;
+                return snprintf(buffer, size, new_spec, (int)value);
+            }
+            end[0] = 'l';
+            end[1] = 'l';
+            end[2] = conversion;
+            end[3] = 0;
+            return snprintf(buffer, size, new_spec, (unsigned long long)value);
+        }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+            const double value = (arg->type == ArgType::floating_point) ? arg->f : (arg->type == ArgType::signed_int) ? (double)arg->i : (double)arg->u;
+            end[0] = conversion;
+            end[1] = 0;
+            return snprintf(buffer, size, new_spec, value);
+        }
+        case 's': // `%ls` and `%ws` too, wide strings were converted when they were queued
+            memcpy(end, "s", 2);
+            return snprintf(buffer, size, new_spec, (arg->type == ArgType::string) ? strings + arg->u : "(not a string)");
+        case 'p':
+            memcpy(end, "p", 2);
+            return snprintf(buffer, size, new_spec, arg->p);
+        }
+        return snprintf(buffer, size, "(bad format)");
+    }
+
+    // Same as the old `vsnprintf()`, except the arguments come from the record
+    static int format_message(char* buffer, size_t size, const Record& record) {
+        size_t offset = 0;
+        uint32_t next_arg = 0;
+        auto append = [&](int n) {
+            if (n > 0) offset = std::min(offset + (size_t)n, size - 1);
         };
 
+        for (const char* c = record.format; *c && offset < size - 1;) {
+            if (*c != '%') {
+                buffer[offset++] = *c++;
+                continue;
+            }
+            if (c[1] == '%') {
+                buffer[offset++] = '%';
+                c += 2;
+                continue;
+            }
+
+            // %[flags][width][.precision][length]conversion, with `*` taking the width or precision from the arguments
+            char spec[32];
+            size_t spec_length = 0;
+            auto copy = [&](char ch) { if (spec_length < sizeof(spec) - 8) spec[spec_length++] = ch; };
+            auto copy_number = [&]() {
+                if (*c == '*') {
+                    const Arg* arg = (next_arg < record.n_args) ? &record.args[next_arg++] : nullptr;
+                    char number[24];
+                    snprintf(number, sizeof(number), "%d", arg ? (int)arg->i : 0);
+                    for (const char* n = number; *n; ++n) copy(*n);
+                    ++c;
+                    return;
+                }
+                while (*c >= '0' && *c <= '9') copy(*c++);
+            };
+            copy(*c++);
+            while (*c && strchr("-+ #0", *c)) copy(*c++);
+            copy_number();
+            if (*c == '.') {
+                copy(*c++);
+                copy_number();
+            }
+            while (*c && strchr("hlzjtLw", *c)) copy(*c++);
+            if (!*c) break;
+            copy(*c++);
+            spec[spec_length] = 0;
+
+            const Arg* arg = (next_arg < record.n_args) ? &record.args[next_arg++] : nullptr;
+            append(format_arg(buffer + offset, size - offset, spec, spec_length, arg, record.strings));
+        }
+        buffer[offset] = 0;
+        return (int)offset;
+    }
+
+    static void flush_batch(Logger& log) {
+        if (log.batch_size == 0) return;
 #ifdef _WIN32
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        HANDLE hConsole = NULL;
+        // Only touch the console colors once per batch, instead of twice per line
+        HANDLE console = NULL;
+        CONSOLE_SCREEN_BUFFER_INFO csbi{};
+        if (Log::color && !log.output_file) {
+            console = GetStdHandle(log.batch_stream == stderr ? STD_ERROR_HANDLE : STD_OUTPUT_HANDLE);
+            GetConsoleScreenBufferInfo(console, &csbi);
+            SetConsoleTextAttribute(console, (WORD)log.batch_color);
+        }
 #endif
+        fwrite(log.batch, 1, log.batch_size, log.batch_stream);
+        fflush(log.batch_stream);
+#ifdef _WIN32
+        if (console) SetConsoleTextAttribute(console, csbi.wAttributes);
+#endif
+        log.batch_size = 0;
+    }
 
-        if (Log::color) {
-            const uint32_t color_value = log_level_colors[(size_t)level];
+    static void write_line(Logger& log, const Record& record) {
+        int offset = 0;
+        const size_t size = sizeof(log.line) - 8; // Room for the color reset and the newline
+        const bool use_color = Log::color && !log.output_file;
 
-            #ifdef _WIN32
-            hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-            GetConsoleScreenBufferInfo(hConsole, &csbi);
-            SetConsoleTextAttribute(hConsole, *(WORD*)(&color_value));
-            #else
+#ifndef _WIN32
+        if (use_color) {
             constexpr int color_mapping[] = {
                 0, 4, 2, 6, 1, 5, 3, 7
             };
+            const uint32_t color_value = log_level_colors[(size_t)record.level];
             const int code = color_mapping[color_value & 0x07] + 30;
-            if (color_value >= 0x08)    offset += snprintf(msg_buf, sizeof(msg_buf) - offset, "\e[1;%im", code);
-            else                        offset += snprintf(msg_buf, sizeof(msg_buf) - offset, "\e[%im", code);
-            #endif
+            if (color_value >= 0x08)    offset += snprintf(log.line, size - offset, "\x1b[1;%im", code);
+            else                        offset += snprintf(log.line, size - offset, "\x1b[%im", code);
         }
+#endif
 
         if (Log::display_time) {
-            time_t now = time(NULL);
             struct tm local_time;
             #if defined(_WIN32)
-            localtime_s(&local_time, &now); // windows
-            #else 
-            localtime_r(&now, &local_time); // linux
+            localtime_s(&local_time, &record.time); // windows
+            #else
+            localtime_r(&record.time, &local_time); // linux
             #endif
             offset += snprintf(
-                msg_buf + offset, sizeof(msg_buf) - offset,
+                log.line + offset, size - offset,
                 "[%02i:%02i:%02i] ",
-                local_time.tm_hour,    
-                local_time.tm_min,    
+                local_time.tm_hour,
+                local_time.tm_min,
                 local_time.tm_sec
             );
         }
 
         if (Log::display_log_level) {
-            const char* log_level_names[] = { 
-                "[DEBUG] ", 
-                "[INFO]  ", 
-                "[WARN]  ", 
-                "[ERROR] ", 
-                "[FATAL] ",
-            };
-            offset += snprintf(msg_buf + offset, sizeof(msg_buf) - offset, log_level_names[(size_t)level]);
+            offset += snprintf(log.line + offset, size - offset, "%s", log_level_names[(size_t)record.level]);
         }
 
-        va_list args;
-        va_start(args, message);
-        offset += vsnprintf(msg_buf + offset, sizeof(msg_buf) - offset, message, args);
-        va_end(args);
+        offset += format_message(log.line + offset, size - offset, record);
 
-        if (level >= Level::Error)  std::cerr << msg_buf << std::endl;
-        else                        std::cout << msg_buf << std::endl;
-        
-        if (Log::color) {
-#ifdef _WIN32
-            SetConsoleTextAttribute(hConsole, csbi.wAttributes);
-#else
-            offset += snprintf(msg_buf + offset, sizeof(msg_buf) - offset, "\e[0m");
+#ifndef _WIN32
+        if (use_color) offset += snprintf(log.line + offset, sizeof(log.line) - offset, "\x1b[0m");
 #endif
+        log.line[offset++] = '\n';
+
+        // Start a new batch if this line needs a different color or stream
+        FILE* stream = log.output_file ? log.output_file : (record.level >= Level::Error) ? stderr : stdout;
+        const int color = (int)log_level_colors[(size_t)record.level];
+        if (stream != log.batch_stream || (use_color && color != log.batch_color) || log.batch_size + offset > sizeof(log.batch)) {
+            flush_batch(log);
+            log.batch_stream = stream;
+            log.batch_color = color;
+        }
+        memcpy(log.batch + log.batch_size, log.line, offset);
+        log.batch_size += offset;
+    }
+
+    uint32_t Logger::drain() {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        uint32_t n_drained = 0;
+        while (true) {
+            Record& record = records[dequeue_position & (LOG_RING_SIZE - 1)];
+            if (record.sequence.load(std::memory_order_acquire) != dequeue_position + 1) break;
+            write_line(*this, record);
+            record.sequence.store(dequeue_position + LOG_RING_SIZE, std::memory_order_release);
+            ++dequeue_position;
+            ++n_drained;
+
+            // Don't let callers wait on a flush for too long when a lot is being logged
+            if ((n_drained & 63) == 0) {
+                flush_batch(*this);
+                n_written.store(dequeue_position, std::memory_order_release);
+            }
+        }
+        flush_batch(*this);
+        n_written.store(dequeue_position, std::memory_order_release);
+        return n_drained;
+    }
+
+    void Logger::thread_main() {
+        while (true) {
+            if (drain() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(LOG_IDLE_SLEEP_MS));
+        }
+    }
+
+    // Copies as much of the string as fits in `room` bytes, plus a terminator. Returns the length without the terminator
+    static size_t copy_string(char* out, size_t room, const char* string) {
+        const size_t length = std::min(strlen(string), room - 1);
+        memcpy(out, string, length);
+        out[length] = 0;
+        return length;
+    }
+
+    // Same, but converts to UTF-8 on the way. wchar_t is UTF-16 on Windows and UTF-32 elsewhere. A character that doesn't fit
+    // completely is left out, so the result is always valid UTF-8
+    static size_t copy_wide_string(char* out, size_t room, const wchar_t* string) {
+        size_t length = 0;
+        for (const wchar_t* c = string; *c; ++c) {
+            uint32_t code_point = (uint32_t)*c;
+            if (sizeof(wchar_t) == 2 && code_point >= 0xD800 && code_point < 0xDC00 && c[1] >= 0xDC00 && c[1] < 0xE000) {
+                code_point = 0x10000 + ((code_point - 0xD800) << 10) + ((uint32_t)c[1] - 0xDC00);
+                ++c;
+            }
+            if ((code_point >= 0xD800 && code_point < 0xE000) || code_point > 0x10FFFF) code_point = 0xFFFD; // Unpaired surrogate
+
+            char encoded[4];
+            size_t n_bytes;
+            if (code_point < 0x80) {
+                encoded[0] = (char)code_point;
+                n_bytes = 1;
+            }
+            else if (code_point < 0x800) {
+                encoded[0] = (char)(0xC0 | (code_point >> 6));
+                encoded[1] = (char)(0x80 | (code_point & 0x3F));
+                n_bytes = 2;
+            }
+            else if (code_point < 0x10000) {
+                encoded[0] = (char)(0xE0 | (code_point >> 12));
+                encoded[1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+                encoded[2] = (char)(0x80 | (code_point & 0x3F));
+                n_bytes = 3;
+            }
+            else {
+                encoded[0] = (char)(0xF0 | (code_point >> 18));
+                encoded[1] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+                encoded[2] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+                encoded[3] = (char)(0x80 | (code_point & 0x3F));
+                n_bytes = 4;
+            }
+            if (length + n_bytes > room - 1) break;
+            memcpy(out + length, encoded, n_bytes);
+            length += n_bytes;
+        }
+        out[length] = 0;
+        return length;
+    }
+
+    void push(Level level, const char* format, const Arg* args, uint32_t n_args) {
+        Logger& log = logger();
+
+        // Claim a slot. If the ring is full, wait for the log thread to make room
+        uint64_t position = log.enqueue_position.load(std::memory_order_relaxed);
+        Record* record;
+        uint32_t n_full_waits = 0;
+        while (true) {
+            record = &log.records[position & (LOG_RING_SIZE - 1)];
+            const int64_t diff = (int64_t)(record->sequence.load(std::memory_order_acquire) - position);
+            if (diff == 0) {
+                if (log.enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                // Full. Sleep instead of spinning if it stays full, so the log thread gets the core it needs to catch up
+                if (++n_full_waits < 16) std::this_thread::yield();
+                else std::this_thread::sleep_for(std::chrono::microseconds(LOG_FULL_SLEEP_US));
+                position = log.enqueue_position.load(std::memory_order_relaxed);
+            }
+            else {
+                position = log.enqueue_position.load(std::memory_order_relaxed);
+            }
         }
+
+        record->level = level;
+        record->time = time(NULL);
+        record->format = format;
+        record->n_args = std::min(n_args, (uint32_t)LOG_MAX_ARGS);
+        size_t string_offset = 0;
+        for (uint32_t i = 0; i < record->n_args; ++i) {
+            record->args[i] = args[i];
+            if (args[i].type != ArgType::string && args[i].type != ArgType::wide_string) continue;
+
+            // Copy the string, since it might be gone by the time the log thread gets to it
+            const size_t room = LOG_STRING_CAPACITY - string_offset;
+            char* out = record->strings + string_offset;
+            const size_t length = (args[i].type == ArgType::wide_string && args[i].ws) ? copy_wide_string(out, room, args[i].ws)
+                                : copy_string(out, room, (args[i].type == ArgType::string && args[i].s) ? args[i].s : "(null)");
+            record->args[i].type = ArgType::string;
+            record->args[i].u = string_offset;
+            string_offset += std::min(length + 1, room - 1);
+        }
+        record->sequence.store(position + 1, std::memory_order_release);
+
+        if (level >= Level::Fatal) flush();
+    }
+
+    bool flush(uint32_t timeout_ms) {
+        Logger& log = logger();
+        const uint64_t target = log.enqueue_position.load(std::memory_order_acquire);
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (log.n_written.load(std::memory_order_acquire) < target) {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    void set_output_file(const char* path) {
+        Logger& log = logger();
+        flush();
+        std::lock_guard<std::mutex> lock(log.output_mutex);
+        if (log.output_file) fclose(log.output_file);
+        log.output_file = path ? fopen(path, "wb") : nullptr;
+        log.batch_stream = nullptr;
     }
 }
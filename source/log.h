@@ -1,3 +1,7 @@
+#pragma once
+#include <cstdint>
+#include <type_traits>
+
 namespace Log {
     enum class Level {
         Debug = 0,
@@ -17,7 +21,60 @@ namespace Log {
     constexpr bool display_log_level = true;
     constexpr bool color = true;
 
-    void write(const Level level, const char* message, ...);
+    // Arguments are stored as-is and formatted later on the log thread, only strings get copied. Wide strings (`%ls`, or `%ws` like
+    // MSVC) are converted to UTF-8 when they're copied, so by the time the log thread sees them they're plain strings
+    enum class ArgType : uint8_t {
+        signed_int,
+        unsigned_int,
+        floating_point,
+        pointer,
+        string,
+        wide_string,
+    };
+
+    struct Arg {
+        ArgType type;
+        union {
+            int64_t i;
+            uint64_t u;
+            double f;
+            const void* p;
+            const char* s;
+            const wchar_t* ws;
+        };
+    };
+
+    inline Arg make_arg(const char* s) { Arg arg{ ArgType::string }; arg.s = s; return arg; }
+    inline Arg make_arg(char* s) { Arg arg{ ArgType::string }; arg.s = s; return arg; }
+    inline Arg make_arg(const wchar_t* s) { Arg arg{ ArgType::wide_string }; arg.ws = s; return arg; }
+    inline Arg make_arg(wchar_t* s) { Arg arg{ ArgType::wide_string }; arg.ws = s; return arg; }
+    template<typename T>
+    Arg make_arg(T value) {
+        Arg arg{};
+        if constexpr (std::is_floating_point_v<T>) { arg.type = ArgType::floating_point; arg.f = (double)value; }
+        else if constexpr (std::is_enum_v<T>) { arg.type = ArgType::signed_int; arg.i = (int64_t)value; }
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) { arg.type = ArgType::signed_int; arg.i = (int64_t)value; }
+        else if constexpr (std::is_integral_v<T>) { arg.type = ArgType::unsigned_int; arg.u = (uint64_t)value; }
+        else if constexpr (std::is_pointer_v<T> || std::is_null_pointer_v<T>) { arg.type = ArgType::pointer; arg.p = (const void*)value; }
+        else static_assert(std::is_void_v<T>, "Log arguments have to be numbers, pointers or C strings, use .c_str() for std::string");
+        return arg;
+    }
+
+    void push(Level level, const char* format, const Arg* args, uint32_t n_args);
+
+    // Queues the message, the log thread formats and writes it. `message` isn't copied, so it has to be a string literal.
+    // Fatal messages wait for everything before them to be written, so they show up even if the program dies right after.
+    // Error and Fatal go to stderr, the rest to stdout, unless there's an output file
+    template<typename... Args>
+    void write(const Level level, const char* message, Args... args) {
+        if (level < Log::min_level) return;
+        if (level == Level::Disabled) return;
+        const Arg packed_args[] = { make_arg(args)..., Arg{} };
+        push(level, message, packed_args, (uint32_t)sizeof...(Args));
+    }
+
+    bool flush(uint32_t timeout_ms = 1000); // Waits until everything that was queued so far is written. Returns false if that took too long
+    void set_output_file(const char* path); // Write to this file instead of the console. Pass nullptr to go back to the console
 }
 
 // Shorthand macro to save us typing
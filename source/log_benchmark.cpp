@@ -0,0 +1,181 @@
+// Has several threads log at the same time and measures how long `LOG()` keeps the caller busy, against the old logger that
+// formatted and wrote on the calling thread under one lock. Two cases: a short burst, like loading a scene, which fits in the
+// ring, and a sustained flood that doesn't, so callers end up waiting on the log thread. Usage:
+//   log_benchmark [--threads n] [--burst n] [--sustained n] [--output path]
+// The line counts are per thread. Output goes to a file, /dev/null by default, so the console isn't what gets measured
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <stdarg.h>
+#include <thread>
+#include <vector>
+#include "log.h"
+
+#define N_REPEATS 3 // Best of, by p50
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+// What `Log::write()` used to be: format on the calling thread, then write and flush the line, all under one global mutex
+struct SyncLogger {
+    std::mutex mutex;
+    FILE* file = nullptr;
+
+    void write(Log::Level level, const char* message, ...) {
+        constexpr const char* level_names[] = { "[DEBUG] ", "[INFO]  ", "[WARN]  ", "[ERROR] ", "[FATAL] " };
+        std::lock_guard<std::mutex> lock(mutex);
+        char line[4096];
+        const time_t now = time(NULL);
+        struct tm local_time;
+        #if defined(_WIN32)
+        localtime_s(&local_time, &now);
+        #else
+        localtime_r(&now, &local_time);
+        #endif
+        int offset = snprintf(line, sizeof(line), "[%02i:%02i:%02i] %s", local_time.tm_hour, local_time.tm_min, local_time.tm_sec, level_names[(size_t)level]);
+        va_list args;
+        va_start(args, message);
+        offset += vsnprintf(line + offset, sizeof(line) - offset, message, args);
+        va_end(args);
+        offset = std::min(offset, (int)sizeof(line) - 2);
+        line[offset++] = '\n';
+        fwrite(line, 1, offset, file);
+        fflush(file); // `std::endl`
+    }
+};
+
+struct RunResult {
+    double p50_us = INFINITY;
+    double p99_us = INFINITY;
+    double max_us = INFINITY;
+    double calls_per_second = 0.0; // Until the last caller returned
+    double lines_per_second = 0.0; // Until everything was written
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Every thread logs `n_lines` lines of the usual kind as fast as it can, timing each call. `flush` waits until it's all written
+template<typename LogFunc, typename FlushFunc>
+static RunResult run(uint32_t n_threads, uint32_t n_lines, LogFunc log, FlushFunc flush) {
+    std::vector<std::vector<float>> latencies_us(n_threads, std::vector<float>(n_lines));
+    std::atomic<uint32_t> n_ready = 0;
+    std::atomic<bool> go = false;
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < n_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            n_ready++;
+            while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            for (uint32_t i = 0; i < n_lines; ++i) {
+                const auto call_start = std::chrono::steady_clock::now();
+                log(t, i);
+                latencies_us[t][i] = (float)(seconds_since(call_start) * 1e6);
+            }
+        });
+    }
+    while (n_ready.load() < n_threads) std::this_thread::yield();
+
+    const auto start_time = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (std::thread& thread : threads) thread.join();
+    const double call_seconds = seconds_since(start_time);
+    flush();
+    const double total_seconds = seconds_since(start_time);
+
+    std::vector<float> all_latencies;
+    all_latencies.reserve((size_t)n_threads * n_lines);
+    for (const std::vector<float>& thread_latencies : latencies_us) all_latencies.insert(all_latencies.end(), thread_latencies.begin(), thread_latencies.end());
+    std::sort(all_latencies.begin(), all_latencies.end());
+
+    const double n_total = (double)all_latencies.size();
+    RunResult result;
+    result.p50_us = all_latencies[all_latencies.size() / 2];
+    result.p99_us = all_latencies[std::min(all_latencies.size() - 1, (size_t)(n_total * 0.99))];
+    result.max_us = all_latencies.back();
+    result.calls_per_second = n_total / call_seconds;
+    result.lines_per_second = n_total / total_seconds;
+    return result;
+}
+
+template<typename LogFunc, typename FlushFunc>
+static RunResult best_of(uint32_t n_threads, uint32_t n_lines, LogFunc log, FlushFunc flush) {
+    RunResult best;
+    for (int repeat = 0; repeat < N_REPEATS; ++repeat) {
+        const RunResult result = run(n_threads, n_lines, log, flush);
+        if (result.p50_us < best.p50_us) best = result;
+    }
+    return best;
+}
+
+static void print_result(const char* mode, const char* logger, uint32_t n_lines, const RunResult& result) {
+    printf("  %-10s %-6s %10u %10.2f %10.2f %12.1f %12.2f %12.2f\n", mode, logger, n_lines, result.p50_us, result.p99_us, result.max_us,
+        result.calls_per_second / 1e6, result.lines_per_second / 1e6);
+}
+
+int main(int n_args, char** args) {
+    uint32_t n_threads = 8;
+    uint32_t n_burst_lines = 100;
+    uint32_t n_sustained_lines = 100'000;
+    const char* output_path = NULL_DEVICE;
+
+    for (int i = 1; i < n_args; ++i) {
+        const char* arg = args[i];
+        const int n_left = n_args - i - 1;
+        auto next_u32 = [&]() { return (uint32_t)strtoul(args[++i], nullptr, 10); };
+
+        if (strcmp(arg, "--threads") == 0 && n_left >= 1) n_threads = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--burst") == 0 && n_left >= 1) n_burst_lines = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--sustained") == 0 && n_left >= 1) n_sustained_lines = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--output") == 0 && n_left >= 1) output_path = args[++i];
+        else {
+            LOG(Error, "Unknown or incomplete argument \"%s\"", arg);
+            Log::flush();
+            return 1;
+        }
+    }
+
+    SyncLogger sync_logger;
+    sync_logger.file = fopen(output_path, "wb");
+    if (!sync_logger.file) {
+        LOG(Error, "Could not open \"%s\"", output_path);
+        Log::flush();
+        return 1;
+    }
+
+    // Something like what the loader threads log, a few numbers and a string
+    auto sync_log = [&](uint32_t thread, uint32_t i) {
+        sync_logger.write(Log::Level::Info, "Thread %u: uploaded \"%s\" (%u x %u, %.2f MiB) in %.3f ms", thread, "textures/sponza_albedo.dds", 2048u, 2048u, 5.33f, (double)i * 0.01);
+    };
+    auto sync_flush = [&]() {};
+    auto async_log = [](uint32_t thread, uint32_t i) {
+        LOG(Info, "Thread %u: uploaded \"%s\" (%u x %u, %.2f MiB) in %.3f ms", thread, "textures/sponza_albedo.dds", 2048u, 2048u, 5.33f, (double)i * 0.01);
+    };
+    auto async_flush = []() { Log::flush(600'000); };
+
+    printf("%u hardware threads, %u logging threads, writing to %s\n", std::thread::hardware_concurrency(), n_threads, output_path);
+    printf("  %-10s %-6s %10s %10s %10s %12s %12s %12s\n", "mode", "logger", "lines", "p50 us", "p99 us", "max us", "M calls/s", "M lines/s");
+    Log::set_output_file(output_path);
+    const uint32_t n_lines[] = { n_burst_lines, n_sustained_lines };
+    const char* mode_names[] = { "burst", "sustained" };
+    for (int mode = 0; mode < 2; ++mode) {
+        const RunResult sync_result = best_of(n_threads, n_lines[mode], sync_log, sync_flush);
+        const RunResult async_result = best_of(n_threads, n_lines[mode], async_log, async_flush);
+        print_result(mode_names[mode], "old", n_threads * n_lines[mode], sync_result);
+        print_result(mode_names[mode], "async", n_threads * n_lines[mode], async_result);
+    }
+    Log::set_output_file(nullptr);
+    fclose(sync_logger.file);
+
+    Log::flush();
+    return 0;
+}
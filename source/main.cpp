@@ -2,11 +2,17 @@
 #include "input.h"
 #include "scene.h"
 #include "renderer.h"
+#include "profiler.h"
 #include <glm/gtx/transform.hpp>
 #include <chrono>
 
 int main(int n_args, char** args) {
-    const auto renderer = std::make_unique<gfx::Renderer>(1280, 720, true, true);
+    // Decode the assets while the renderer compiles its shaders
+    const gfx::StartupAssets startup_assets = {
+        .scenes = { "assets/models/ABeautifulGame/ABeautifulGame.gltf", "assets/models/lights_test.glb" },
+        .environment_maps = { "assets/textures/hangar_interior_8k.hdr" },
+    };
+    const auto renderer = std::make_unique<gfx::Renderer>(1280, 720, true, true, startup_assets);
     auto scene = renderer->load_scene_gltf("assets/models/ABeautifulGame/ABeautifulGame.gltf");
     auto cubemap = renderer->load_environment_map("assets/textures/hangar_interior_8k.hdr", 2048, 256, 1.0f);
     auto lights = renderer->load_scene_gltf("assets/models/lights_test.glb");
@@ -48,6 +54,18 @@ int main(int n_args, char** args) {
         const float scroll = input::mouse_scroll().y;
         if (scroll > 0.0f) move_speed *= 1.1f;
         if (scroll < 0.0f) move_speed /= 1.1f;
+        if (input::key_pressed(input::Key::_3)) renderer->enable_dynamic_resolution({ .target_frame_time = 1.0f / 60.0f });
+        if (input::key_pressed(input::Key::_4)) renderer->disable_dynamic_resolution();
+        if (input::key_pressed(input::Key::_5)) {
+            // Open in chrome://tracing or ui.perfetto.dev
+            const uint64_t last_frame = gfx::profiler::current_frame();
+            gfx::profiler::export_chrome_trace("trace.json", (last_frame > 120) ? last_frame - 120 : 0, last_frame);
+            gfx::profiler::log_stats();
+        }
+        if (input::key_pressed(input::Key::_6)) {
+            renderer->memory_tracker().write_csv("memory.csv");
+            renderer->memory_tracker().log_report();
+        }
 
         renderer->begin_frame();
         
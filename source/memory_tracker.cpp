@@ -0,0 +1,176 @@
+#include "memory_tracker.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include "log.h"
+
+namespace gfx {
+    static thread_local std::string current_scene = MemoryTracker::NO_SCENE;
+
+    static const char* group_name(MemoryGroup group) {
+        switch (group) {
+        case MemoryGroup::type: return "type";
+        case MemoryGroup::scene: return "scene";
+        case MemoryGroup::category: return "category";
+        case MemoryGroup::total: return "total";
+        }
+        return "unknown";
+    }
+
+    MemoryScope::MemoryScope(const std::string& scene) {
+        m_previous_scene = std::move(current_scene);
+        current_scene = scene;
+    }
+
+    MemoryScope::~MemoryScope() {
+        current_scene = std::move(m_previous_scene);
+    }
+
+    uint32_t MemoryTracker::Group::index(const std::string& key) {
+        const auto existing = indices.find(key);
+        if (existing != indices.end()) return existing->second;
+        const uint32_t new_index = (uint32_t)keys.size();
+        indices[key] = new_index;
+        keys.push_back(key);
+        stats.emplace_back();
+        return new_index;
+    }
+
+    void MemoryTracker::add(MemoryStats& stats, const Allocation& allocation) {
+        stats.cpu_bytes += allocation.cpu_bytes;
+        stats.gpu_bytes += allocation.gpu_bytes;
+        stats.peak_cpu_bytes = std::max(stats.peak_cpu_bytes, stats.cpu_bytes);
+        stats.peak_gpu_bytes = std::max(stats.peak_gpu_bytes, stats.gpu_bytes);
+        stats.n_resources += 1;
+    }
+
+    void MemoryTracker::remove(MemoryStats& stats, const Allocation& allocation) {
+        assert(stats.cpu_bytes >= allocation.cpu_bytes && stats.gpu_bytes >= allocation.gpu_bytes && stats.n_resources > 0);
+        stats.cpu_bytes -= allocation.cpu_bytes;
+        stats.gpu_bytes -= allocation.gpu_bytes;
+        stats.n_resources -= 1;
+    }
+
+    uint64_t MemoryTracker::track(const std::string& name, const std::string& type, const std::string& default_category, uint64_t cpu_bytes, uint64_t gpu_bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const std::string* category = &default_category;
+        for (const auto& rule : m_category_rules) {
+            if (name.find(rule.pattern) != std::string::npos) {
+                category = &rule.category;
+                break;
+            }
+        }
+
+        const Allocation allocation = {
+            .type = m_groups[(size_t)MemoryGroup::type].index(type),
+            .scene = m_groups[(size_t)MemoryGroup::scene].index(current_scene),
+            .category = m_groups[(size_t)MemoryGroup::category].index(*category),
+            .cpu_bytes = cpu_bytes,
+            .gpu_bytes = gpu_bytes,
+        };
+        add(m_groups[(size_t)MemoryGroup::type].stats[allocation.type], allocation);
+        add(m_groups[(size_t)MemoryGroup::scene].stats[allocation.scene], allocation);
+        add(m_groups[(size_t)MemoryGroup::category].stats[allocation.category], allocation);
+        add(m_total, allocation);
+
+        const uint64_t id = m_next_id++;
+        m_allocations[id] = allocation;
+        return id;
+    }
+
+    void MemoryTracker::untrack(uint64_t id) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = m_allocations.find(id);
+        if (it == m_allocations.end()) {
+            LOG(Warning, "Memory tracker: allocation %llu was untracked twice", (unsigned long long)id);
+            return;
+        }
+        const Allocation& allocation = it->second;
+        remove(m_groups[(size_t)MemoryGroup::type].stats[allocation.type], allocation);
+        remove(m_groups[(size_t)MemoryGroup::scene].stats[allocation.scene], allocation);
+        remove(m_groups[(size_t)MemoryGroup::category].stats[allocation.category], allocation);
+        remove(m_total, allocation);
+        m_allocations.erase(it);
+    }
+
+    std::shared_ptr<void> make_memory_record(const std::shared_ptr<MemoryTracker>& tracker, uint64_t id) {
+        return std::shared_ptr<void>(tracker.get(), [tracker, id](void*) {
+            tracker->untrack(id);
+        });
+    }
+
+    void MemoryTracker::add_category_rule(const std::string& pattern, const std::string& category) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_category_rules.push_back({ pattern, category });
+    }
+
+    MemoryStats MemoryTracker::total() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_total;
+    }
+
+    MemoryStats MemoryTracker::stats(MemoryGroup group, const std::string& key) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (group == MemoryGroup::total) return m_total;
+        const Group& g = m_groups[(size_t)group];
+        const auto it = g.indices.find(key);
+        return (it != g.indices.end()) ? g.stats[it->second] : MemoryStats{};
+    }
+
+    std::vector<MemoryReportRow> MemoryTracker::report() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<MemoryReportRow> rows;
+        rows.push_back({ MemoryGroup::total, "", m_total });
+        for (const MemoryGroup group : { MemoryGroup::type, MemoryGroup::scene, MemoryGroup::category }) {
+            const Group& g = m_groups[(size_t)group];
+            const size_t first_row = rows.size();
+            for (size_t i = 0; i < g.keys.size(); ++i) {
+                rows.push_back({ group, g.keys[i], g.stats[i] });
+            }
+            std::sort(rows.begin() + first_row, rows.end(), [](const MemoryReportRow& a, const MemoryReportRow& b) { return a.key < b.key; });
+        }
+        return rows;
+    }
+
+    std::string MemoryTracker::csv() const {
+        std::string csv = "group,key,resources,cpu_bytes,gpu_bytes,peak_cpu_bytes,peak_gpu_bytes\n";
+        char line[128];
+        for (const auto& row : report()) {
+            // Keys are resource names and file paths, so quote them, and double the quotes inside them
+            std::string key = "\"";
+            for (const char c : row.key) {
+                if (c == '"') key += '"';
+                key += c;
+            }
+            key += '"';
+            snprintf(line, sizeof(line), ",%u,%llu,%llu,%llu,%llu\n", row.stats.n_resources,
+                (unsigned long long)row.stats.cpu_bytes, (unsigned long long)row.stats.gpu_bytes,
+                (unsigned long long)row.stats.peak_cpu_bytes, (unsigned long long)row.stats.peak_gpu_bytes);
+            csv += std::string(group_name(row.group)) + "," + key + line;
+        }
+        return csv;
+    }
+
+    bool MemoryTracker::write_csv(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            LOG(Error, "Memory tracker: could not open '%s' for writing", path.c_str());
+            return false;
+        }
+        file << csv();
+        LOG(Info, "Memory tracker: wrote report to '%s'", path.c_str());
+        return true;
+    }
+
+    void MemoryTracker::log_report() const {
+        auto mib = [](uint64_t bytes) { return (double)bytes / (1024.0 * 1024.0); };
+        LOG(Info, "----------------------------------------MEMORY----------------------------------------");
+        for (const auto& row : report()) {
+            LOG(Info, "%8s %48s: %5u resources, CPU %9.2f MiB (peak %9.2f), GPU %9.2f MiB (peak %9.2f)", group_name(row.group), row.key.c_str(),
+                row.stats.n_resources, mib(row.stats.cpu_bytes), mib(row.stats.peak_cpu_bytes), mib(row.stats.gpu_bytes), mib(row.stats.peak_gpu_bytes));
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gfx {
+    // GPU bytes live in video memory, CPU bytes in system memory (like upload and readback heaps)
+    struct MemoryStats {
+        uint64_t cpu_bytes = 0;
+        uint64_t gpu_bytes = 0;
+        uint64_t peak_cpu_bytes = 0; // High-water marks, these never go down
+        uint64_t peak_gpu_bytes = 0;
+        uint32_t n_resources = 0;
+    };
+
+    enum class MemoryGroup {
+        type, // Texture, buffer, acceleration structure, ...
+        scene, // Whatever `MemoryScope` was active on the thread that created it
+        category, // Render targets, upload buffers, BLAS scratch, ...
+        total, // Everything, `report()` has a single row for this
+    };
+
+    struct MemoryReportRow {
+        MemoryGroup group;
+        std::string key;
+        MemoryStats stats;
+    };
+
+    // Resources created while one of these is alive count towards `scene`. They nest, and only apply to the current thread
+    struct MemoryScope {
+        explicit MemoryScope(const std::string& scene);
+        ~MemoryScope();
+        MemoryScope(const MemoryScope&) = delete;
+        MemoryScope& operator=(const MemoryScope&) = delete;
+
+    private:
+        std::string m_previous_scene;
+    };
+
+    // Keeps track of how much memory every resource takes, grouped by resource type, by scene, and by category. The category is
+    // the first rule whose pattern shows up in the resource's name, or the default category the creator passed in otherwise.
+    // This only does the bookkeeping, the sizes come from whoever creates the resources, so it can be driven without a GPU
+    struct MemoryTracker {
+        static constexpr const char* NO_SCENE = "(none)";
+
+        // Returns an id to pass to `untrack()` once the memory is released
+        uint64_t track(const std::string& name, const std::string& type, const std::string& default_category, uint64_t cpu_bytes, uint64_t gpu_bytes);
+        void untrack(uint64_t id);
+        void add_category_rule(const std::string& pattern, const std::string& category); // Rules are checked in the order they were added
+
+        MemoryStats total() const;
+        MemoryStats stats(MemoryGroup group, const std::string& key) const; // All zeroes if nothing was ever tracked under `key`
+        std::vector<MemoryReportRow> report() const; // The total, followed by every group sorted by key
+        std::string csv() const; // One line per row of `report()`
+        bool write_csv(const std::string& path) const;
+        void log_report() const;
+
+    private:
+        struct Allocation {
+            uint32_t type;
+            uint32_t scene;
+            uint32_t category;
+            uint64_t cpu_bytes;
+            uint64_t gpu_bytes;
+        };
+        struct Group {
+            std::unordered_map<std::string, uint32_t> indices;
+            std::vector<std::string> keys;
+            std::vector<MemoryStats> stats;
+            uint32_t index(const std::string& key);
+        };
+        struct CategoryRule {
+            std::string pattern;
+            std::string category;
+        };
+
+        static void add(MemoryStats& stats, const Allocation& allocation);
+        static void remove(MemoryStats& stats, const Allocation& allocation);
+
+        mutable std::mutex m_mutex;
+        std::unordered_map<uint64_t, Allocation> m_allocations;
+        uint64_t m_next_id = 1;
+        std::vector<CategoryRule> m_category_rules;
+        Group m_groups[3]; // Indexed by `MemoryGroup`, except for the total
+        MemoryStats m_total;
+    };
+
+    // Untracks `id` once the last copy of the record is released. Holds on to the tracker, so that still works after its owner is gone
+    std::shared_ptr<void> make_memory_record(const std::shared_ptr<MemoryTracker>& tracker, uint64_t id);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include "thread_pool.h"
+
+namespace gfx {
+    // How a list of draws gets split up to be recorded on multiple threads: consecutive chunks, each into its own command buffer
+    struct RecordingChunks {
+        uint32_t n_chunks = 0;
+        uint32_t items_per_chunk = 0;
+    };
+
+    // At most one chunk per thread, and never less than `min_items_per_chunk` items in a chunk, unless there's only one
+    inline RecordingChunks split_recording(uint32_t n_items, uint32_t min_items_per_chunk, uint32_t max_chunks) {
+        if (n_items == 0) return {};
+        const uint32_t n_chunks = std::clamp(n_items / std::max(min_items_per_chunk, 1u), 1u, std::max(max_chunks, 1u));
+        const uint32_t items_per_chunk = (n_items + n_chunks - 1) / n_chunks;
+        return RecordingChunks{
+            .n_chunks = (n_items + items_per_chunk - 1) / items_per_chunk,
+            .items_per_chunk = items_per_chunk,
+        };
+    }
+
+    // Calls `func(chunk_index, begin, end)` once for every chunk, spread over the thread pool. A chunk always covers the same items no
+    // matter which thread picks it up, so submitting the command buffers in chunk order gives the same result as recording on one thread
+    template<typename Func>
+    void record_chunks(ThreadPool& thread_pool, uint32_t n_items, RecordingChunks chunks, Func&& func) {
+        if (chunks.n_chunks == 0) return;
+        thread_pool.parallel_for(n_items, chunks.items_per_chunk, [&](uint32_t begin, uint32_t end, uint32_t) {
+            func(begin / chunks.items_per_chunk, begin, end);
+        });
+    }
+}
@@ -15,6 +15,7 @@ namespace gfx {
     public:
         ComPtr<ID3D12PipelineState> pipeline_state;
         ComPtr<ID3D12RootSignature> root_signature;
+        ComPtr<ID3D12CommandSignature> indirect_draw_signature; // Only set after calling `Device::enable_indirect_draws()`
         std::string name;
 
     private:
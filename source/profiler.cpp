@@ -0,0 +1,358 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include "log.h"
+
+#define PROFILER_FRAME_HISTORY 256 // Frames that can be exported
+#define PROFILER_CPU_ZONE_CAPACITY (64 * 1024) // Zones kept for exporting, shared by all frames in the history
+#define PROFILER_GPU_PASS_CAPACITY (8 * 1024)
+#define PROFILER_THREAD_RING_SIZE 4096 // Zones a thread can record between two `begin_frame()` calls, has to be a power of 2
+#define PROFILER_STATS_SAMPLES 256 // The statistics are computed over this many of the most recent samples
+
+namespace gfx::profiler {
+    struct ZoneEvent {
+        const char* name;
+        int64_t begin_ns;
+        int64_t end_ns;
+    };
+
+    // Single producer, single consumer: the thread itself adds zones, `begin_frame()` takes them out
+    struct ThreadBuffer {
+        uint32_t thread_id = 0;
+        std::string name;
+        std::atomic<uint32_t> head = 0;
+        std::atomic<uint32_t> tail = 0;
+        std::atomic<uint32_t> n_dropped = 0;
+        ZoneEvent events[PROFILER_THREAD_RING_SIZE];
+    };
+
+    struct CpuZoneRecord {
+        const char* name;
+        int64_t begin_ns;
+        int64_t end_ns;
+        uint32_t thread_id;
+    };
+
+    struct GpuPassRecord {
+        uint32_t name; // Index into `gpu_names`
+        int64_t begin_ns;
+        int64_t end_ns;
+    };
+
+    // Zones and passes live in big ring buffers, a frame only knows which range is its own. When a ring wraps around, the oldest
+    // frames lose their zones, but that way nothing needs to be allocated once it's warmed up
+    struct FrameRecord {
+        uint64_t frame_index = ~0ull;
+        int64_t begin_ns = 0;
+        int64_t end_ns = 0; // 0 while the frame is still going
+        uint64_t cpu_zones_begin = 0; // Counts every zone ever written, so it can be compared against the ring's write position
+        uint64_t cpu_zones_end = 0;
+        uint64_t gpu_passes_begin = 0;
+        uint64_t gpu_passes_end = 0;
+    };
+
+    struct Samples {
+        std::array<float, PROFILER_STATS_SAMPLES> ms{};
+        uint32_t n_samples = 0;
+        uint32_t next = 0;
+
+        void add(float sample_ms) {
+            ms[next] = sample_ms;
+            next = (next + 1) % PROFILER_STATS_SAMPLES;
+            n_samples = std::min(n_samples + 1, (uint32_t)PROFILER_STATS_SAMPLES);
+        }
+    };
+
+    struct State {
+        std::mutex threads_mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> threads;
+
+        std::mutex mutex; // Everything below
+        std::vector<FrameRecord> frames = std::vector<FrameRecord>(PROFILER_FRAME_HISTORY);
+        std::vector<CpuZoneRecord> cpu_zones = std::vector<CpuZoneRecord>(PROFILER_CPU_ZONE_CAPACITY);
+        std::vector<GpuPassRecord> gpu_passes = std::vector<GpuPassRecord>(PROFILER_GPU_PASS_CAPACITY);
+        uint64_t n_cpu_zones_written = 0;
+        uint64_t n_gpu_passes_written = 0;
+        uint64_t current_frame = 0;
+        bool has_frame = false;
+
+        std::unordered_map<std::string_view, uint32_t> cpu_zone_indices; // Zone names are string literals, so the views stay valid
+        std::vector<const char*> cpu_zone_names;
+        std::vector<Samples> cpu_zone_samples;
+        std::unordered_map<std::string, uint32_t> gpu_name_indices;
+        std::vector<std::string> gpu_names;
+        std::vector<Samples> gpu_samples;
+    };
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+
+    static ThreadBuffer& thread_buffer() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            // Never freed, so zones from a thread that already exited can still be collected
+            State& s = state();
+            std::lock_guard lock(s.threads_mutex);
+            s.threads.push_back(std::make_unique<ThreadBuffer>());
+            buffer = s.threads.back().get();
+            buffer->thread_id = (uint32_t)s.threads.size();
+        }
+        return *buffer;
+    }
+
+    int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    Zone::~Zone() {
+        const int64_t end_ns = now_ns();
+        ThreadBuffer& buffer = thread_buffer();
+        const uint32_t head = buffer.head.load(std::memory_order_relaxed);
+        if (head - buffer.tail.load(std::memory_order_acquire) >= PROFILER_THREAD_RING_SIZE) {
+            buffer.n_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer.events[head & (PROFILER_THREAD_RING_SIZE - 1)] = ZoneEvent{ m_name, m_begin_ns, end_ns };
+        buffer.head.store(head + 1, std::memory_order_release);
+    }
+
+    void set_thread_name(const char* name) {
+        ThreadBuffer& buffer = thread_buffer();
+        std::lock_guard lock(state().threads_mutex);
+        buffer.name = name;
+    }
+
+    static uint32_t cpu_zone_index(State& s, const char* name) {
+        const auto existing = s.cpu_zone_indices.find(name);
+        if (existing != s.cpu_zone_indices.end()) return existing->second;
+        const uint32_t index = (uint32_t)s.cpu_zone_names.size();
+        s.cpu_zone_indices[name] = index;
+        s.cpu_zone_names.push_back(name);
+        s.cpu_zone_samples.emplace_back();
+        return index;
+    }
+
+    static void collect_thread_zones(State& s) {
+        std::lock_guard lock(s.threads_mutex);
+        for (auto& buffer : s.threads) {
+            const uint32_t head = buffer->head.load(std::memory_order_acquire);
+            uint32_t tail = buffer->tail.load(std::memory_order_relaxed);
+            for (; tail != head; ++tail) {
+                const ZoneEvent& event = buffer->events[tail & (PROFILER_THREAD_RING_SIZE - 1)];
+                s.cpu_zones[s.n_cpu_zones_written % PROFILER_CPU_ZONE_CAPACITY] = CpuZoneRecord{ event.name, event.begin_ns, event.end_ns, buffer->thread_id };
+                s.n_cpu_zones_written += 1;
+                s.cpu_zone_samples[cpu_zone_index(s, event.name)].add((float)(event.end_ns - event.begin_ns) / 1'000'000.0f);
+            }
+            buffer->tail.store(tail, std::memory_order_release);
+
+            const uint32_t n_dropped = buffer->n_dropped.exchange(0, std::memory_order_relaxed);
+            if (n_dropped > 0) LOG(Warning, "Profiler: thread %u recorded too many zones, dropped %u", buffer->thread_id, n_dropped);
+        }
+    }
+
+    void begin_frame(uint64_t frame_index) {
+        State& s = state();
+        std::lock_guard lock(s.mutex);
+        const int64_t time = now_ns();
+
+        // Everything that ended since the last call belongs to the frame that's ending now
+        if (s.has_frame) {
+            FrameRecord& ending = s.frames[s.current_frame % PROFILER_FRAME_HISTORY];
+            collect_thread_zones(s);
+            ending.end_ns = time;
+            ending.cpu_zones_end = s.n_cpu_zones_written;
+            s.cpu_zone_samples[cpu_zone_index(s, "Frame (CPU)")].add((float)(ending.end_ns - ending.begin_ns) / 1'000'000.0f);
+        }
+
+        FrameRecord& frame = s.frames[frame_index % PROFILER_FRAME_HISTORY];
+        frame = FrameRecord{
+            .frame_index = frame_index,
+            .begin_ns = time,
+            .cpu_zones_begin = s.n_cpu_zones_written,
+            .cpu_zones_end = s.n_cpu_zones_written,
+            .gpu_passes_begin = s.n_gpu_passes_written,
+            .gpu_passes_end = s.n_gpu_passes_written,
+        };
+        s.current_frame = frame_index;
+        s.has_frame = true;
+    }
+
+    uint64_t current_frame() {
+        State& s = state();
+        std::lock_guard lock(s.mutex);
+        return s.current_frame;
+    }
+
+    void add_gpu_pass(uint64_t frame_index, const std::string& name, int64_t begin_ns, int64_t end_ns) {
+        State& s = state();
+        std::lock_guard lock(s.mutex);
+
+        uint32_t name_index;
+        const auto existing = s.gpu_name_indices.find(name);
+        if (existing != s.gpu_name_indices.end()) {
+            name_index = existing->second;
+        }
+        else {
+            name_index = (uint32_t)s.gpu_names.size();
+            s.gpu_name_indices[name] = name_index;
+            s.gpu_names.push_back(name);
+            s.gpu_samples.emplace_back();
+        }
+        s.gpu_samples[name_index].add((float)(end_ns - begin_ns) / 1'000'000.0f);
+
+        FrameRecord& frame = s.frames[frame_index % PROFILER_FRAME_HISTORY];
+        if (frame.frame_index != frame_index) return;
+
+        // A frame's passes are reported together, so they're next to each other in the ring
+        if (frame.gpu_passes_end != s.n_gpu_passes_written) {
+            frame.gpu_passes_begin = s.n_gpu_passes_written;
+        }
+        s.gpu_passes[s.n_gpu_passes_written % PROFILER_GPU_PASS_CAPACITY] = GpuPassRecord{ name_index, begin_ns, end_ns };
+        s.n_gpu_passes_written += 1;
+        frame.gpu_passes_end = s.n_gpu_passes_written;
+    }
+
+    static ZoneStats compute_stats(const std::string& name, const Samples& samples) {
+        ZoneStats stats{ .name = name, .n_samples = samples.n_samples };
+        if (samples.n_samples == 0) return stats;
+
+        std::array<float, PROFILER_STATS_SAMPLES> sorted = samples.ms;
+        std::sort(sorted.begin(), sorted.begin() + samples.n_samples);
+        double total = 0.0;
+        for (uint32_t i = 0; i < samples.n_samples; ++i) total += sorted[i];
+        auto percentile = [&](double p) {
+            const uint32_t rank = (uint32_t)std::ceil(p * samples.n_samples);
+            return (double)sorted[std::clamp(rank, 1u, samples.n_samples) - 1];
+        };
+        stats.mean_ms = total / samples.n_samples;
+        stats.p95_ms = percentile(0.95);
+        stats.p99_ms = percentile(0.99);
+        stats.max_ms = sorted[samples.n_samples - 1];
+        return stats;
+    }
+
+    std::vector<ZoneStats> cpu_zone_stats() {
+        State& s = state();
+        std::lock_guard lock(s.mutex);
+        std::vector<ZoneStats> stats;
+        for (uint32_t i = 0; i < (uint32_t)s.cpu_zone_names.size(); ++i) {
+            stats.push_back(compute_stats(s.cpu_zone_names[i], s.cpu_zone_samples[i]));
+        }
+        return stats;
+    }
+
+    std::vector<ZoneStats> gpu_pass_stats() {
+        State& s = state();
+        std::lock_guard lock(s.mutex);
+        std::vector<ZoneStats> stats;
+        for (uint32_t i = 0; i < (uint32_t)s.gpu_names.size(); ++i) {
+            stats.push_back(compute_stats(s.gpu_names[i], s.gpu_samples[i]));
+        }
+        return stats;
+    }
+
+    void log_stats() {
+        auto log_table = [](const char* title, const std::vector<ZoneStats>& table) {
+            LOG(Info, "--------------------------------------%s--------------------------------------", title);
+            for (const auto& stats : table) {
+                LOG(Info, "%56s: mean %7.3f ms, p95 %7.3f ms, p99 %7.3f ms, max %7.3f ms (%u samples)", stats.name.c_str(),
+                    stats.mean_ms, stats.p95_ms, stats.p99_ms, stats.max_ms, stats.n_samples);
+            }
+        };
+        log_table("CPU ZONES", cpu_zone_stats());
+        log_table("GPU PASSES", gpu_pass_stats());
+    }
+
+    static void write_json_string(FILE* file, std::string_view string) {
+        fputc('"', file);
+        for (const char c : string) {
+            if (c == '"' || c == '\\') fputc('\\', file);
+            if ((unsigned char)c < 0x20) continue;
+            fputc(c, file);
+        }
+        fputc('"', file);
+    }
+
+    bool export_chrome_trace(const std::string& path, uint64_t first_frame, uint64_t last_frame) {
+        State& s = state();
+        std::lock_guard lock(s.mutex);
+
+        // Finished frames in the range that are still around, oldest first
+        std::vector<const FrameRecord*> frames;
+        for (const auto& frame : s.frames) {
+            if (frame.frame_index == ~0ull || frame.end_ns == 0) continue;
+            if (frame.frame_index < first_frame || frame.frame_index > last_frame) continue;
+            frames.push_back(&frame);
+        }
+        std::sort(frames.begin(), frames.end(), [](const FrameRecord* a, const FrameRecord* b) { return a->frame_index < b->frame_index; });
+        if (frames.empty()) {
+            LOG(Warning, "Profiler: no frames between %llu and %llu to export", (unsigned long long)first_frame, (unsigned long long)last_frame);
+            return false;
+        }
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) {
+            LOG(Error, "Profiler: could not open '%s' for writing", path.c_str());
+            return false;
+        }
+
+        // Chrome wants microseconds, relative to the start of the trace keeps the numbers readable
+        const int64_t start_ns = frames.front()->begin_ns;
+        auto write_event = [&](std::string_view name, uint32_t pid, uint32_t tid, int64_t begin_ns, int64_t end_ns) {
+            fprintf(file, ",\n{\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":", pid, tid,
+                (double)(begin_ns - start_ns) / 1000.0, (double)(end_ns - begin_ns) / 1000.0);
+            write_json_string(file, name);
+            fputc('}', file);
+        };
+
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"ph\":\"M\",\"pid\":0,\"name\":\"process_name\",\"args\":{\"name\":\"CPU\"}}");
+        fprintf(file, ",\n{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"GPU\"}}");
+        fprintf(file, ",\n{\"ph\":\"M\",\"pid\":0,\"tid\":0,\"name\":\"thread_name\",\"args\":{\"name\":\"Frames\"}}");
+        {
+            std::lock_guard threads_lock(s.threads_mutex);
+            for (const auto& buffer : s.threads) {
+                const std::string name = buffer->name.empty() ? "Thread " + std::to_string(buffer->thread_id) : buffer->name;
+                fprintf(file, ",\n{\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":", buffer->thread_id);
+                write_json_string(file, name);
+                fprintf(file, "}}");
+            }
+        }
+
+        uint32_t n_incomplete_frames = 0;
+        for (const FrameRecord* frame : frames) {
+            write_event("Frame " + std::to_string(frame->frame_index), 0, 0, frame->begin_ns, frame->end_ns);
+
+            // Skip zones and passes the rings already overwrote
+            if (frame->cpu_zones_begin + PROFILER_CPU_ZONE_CAPACITY < s.n_cpu_zones_written
+                || frame->gpu_passes_begin + PROFILER_GPU_PASS_CAPACITY < s.n_gpu_passes_written) {
+                n_incomplete_frames += 1;
+            }
+            for (uint64_t i = std::max(frame->cpu_zones_begin, s.n_cpu_zones_written - std::min(s.n_cpu_zones_written, (uint64_t)PROFILER_CPU_ZONE_CAPACITY)); i < frame->cpu_zones_end; ++i) {
+                const CpuZoneRecord& zone = s.cpu_zones[i % PROFILER_CPU_ZONE_CAPACITY];
+                write_event(zone.name, 0, zone.thread_id, zone.begin_ns, zone.end_ns);
+            }
+            for (uint64_t i = std::max(frame->gpu_passes_begin, s.n_gpu_passes_written - std::min(s.n_gpu_passes_written, (uint64_t)PROFILER_GPU_PASS_CAPACITY)); i < frame->gpu_passes_end; ++i) {
+                const GpuPassRecord& pass = s.gpu_passes[i % PROFILER_GPU_PASS_CAPACITY];
+                write_event(s.gpu_names[pass.name], 1, 0, pass.begin_ns, pass.end_ns);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+
+        if (n_incomplete_frames > 0) LOG(Warning, "Profiler: %u frames were missing zones, the history only holds so many", n_incomplete_frames);
+        LOG(Info, "Profiler: wrote frames %llu to %llu to '%s'", (unsigned long long)frames.front()->frame_index, (unsigned long long)frames.back()->frame_index, path.c_str());
+        return true;
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// When enabled, `PROFILE_ZONE()` records how long the rest of the scope takes. Disable it with the `ENABLE_PROFILER` CMake option,
+// which turns the zones into nothing. The frame and GPU pass bookkeeping still works either way
+#ifndef ENABLE_PROFILER
+#define ENABLE_PROFILER 1
+#endif
+
+namespace gfx::profiler {
+    struct ZoneStats {
+        std::string name;
+        uint32_t n_samples = 0; // Only the most recent samples are kept
+        double mean_ms = 0.0;
+        double p95_ms = 0.0;
+        double p99_ms = 0.0;
+        double max_ms = 0.0;
+    };
+
+    int64_t now_ns(); // The clock every CPU zone and GPU pass is placed on
+
+    // CPU zone, use `PROFILE_ZONE()` instead. The name isn't copied, so it has to be a string literal
+    struct Zone {
+        explicit Zone(const char* name) : m_name(name), m_begin_ns(now_ns()) {}
+        ~Zone();
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+    private:
+        const char* m_name;
+        int64_t m_begin_ns;
+    };
+
+    // Collects the zones that ended since the last call into the previous frame, and starts frame `frame_index`.
+    // Should be called from the main thread
+    void begin_frame(uint64_t frame_index);
+    uint64_t current_frame();
+    void set_thread_name(const char* name); // Shows up in the trace, instead of a thread number
+
+    // Timestamps should already be converted to `now_ns()` time. Frames that fell out of the history only update the statistics
+    void add_gpu_pass(uint64_t frame_index, const std::string& name, int64_t begin_ns, int64_t end_ns);
+
+    // Mean and percentiles over the last frames, for every CPU zone and every GPU pass
+    std::vector<ZoneStats> cpu_zone_stats();
+    std::vector<ZoneStats> gpu_pass_stats();
+    void log_stats();
+
+    // Writes the frames from `first_frame` up to and including `last_frame` as a Chrome trace (chrome://tracing or Perfetto).
+    // Only frames that are still in the history are written. Returns false if the file couldn't be written
+    bool export_chrome_trace(const std::string& path, uint64_t first_frame, uint64_t last_frame);
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#if ENABLE_PROFILER
+#define PROFILE_ZONE(name) const gfx::profiler::Zone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#endif
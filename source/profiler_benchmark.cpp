@@ -0,0 +1,140 @@
+// Measures what a `PROFILE_ZONE()` costs: recording it on the thread, and collecting it in `profiler::begin_frame()`. Zones are
+// recorded in frames, like the renderer does, and compared against the same loop without zones. Usage:
+//   profiler_benchmark [--zones n] [--zones-per-frame n] [--max-threads n]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "profiler.h"
+#include "log.h"
+
+#define N_REPEATS 5 // Best of
+#define THREAD_RING_SIZE 4096 // Same as `PROFILER_THREAD_RING_SIZE`, more zones than that per thread per frame get dropped
+
+static std::atomic<uint32_t> g_sink = 0; // So the loop bodies can't be optimized out
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The same tiny bit of work, without a zone, with one, and with two nested ones
+static void work(uint32_t i) {
+    g_sink.fetch_add(i, std::memory_order_relaxed);
+}
+
+static void zoned_work(uint32_t i) {
+    PROFILE_ZONE("Benchmark zone");
+    work(i);
+}
+
+static void nested_zoned_work(uint32_t i) {
+    PROFILE_ZONE("Benchmark outer zone");
+    {
+        PROFILE_ZONE("Benchmark inner zone");
+        work(i);
+    }
+}
+
+struct Timing {
+    double record_ns = INFINITY; // Per iteration, on the recording threads
+    double collect_ns = INFINITY; // Per zone, in `begin_frame()`
+};
+
+// Every thread runs `n_iterations` of `body`, split into frames of `iterations_per_frame`. After each frame the main thread waits
+// for the others and then collects the zones, so the rings never overflow. The threads stay around for every repeat, since the
+// profiler keeps every thread's ring forever, and each new one would make collecting a bit slower
+template<typename Body>
+static Timing run(uint32_t n_threads, uint32_t n_iterations, uint32_t iterations_per_frame, uint32_t zones_per_iteration, Body body) {
+    static uint64_t frame_index = 0;
+    const uint32_t n_frames = (n_iterations + iterations_per_frame - 1) / iterations_per_frame;
+    std::atomic<uint32_t> n_frames_started = 0; // Counted over every repeat
+    std::atomic<uint32_t> n_frames_recorded = 0; // Summed over the worker threads
+    std::vector<std::atomic<int64_t>> record_ns(N_REPEATS);
+
+    auto record_frame = [&](uint32_t repeat, uint32_t frame, uint32_t thread) {
+        const uint32_t begin = frame * iterations_per_frame;
+        const uint32_t end = std::min(begin + iterations_per_frame, n_iterations);
+        const auto start_time = std::chrono::steady_clock::now();
+        for (uint32_t i = begin; i < end; ++i) body(i ^ thread);
+        record_ns[repeat].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count());
+    };
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < n_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            for (uint32_t frame = 0; frame < N_REPEATS * n_frames; ++frame) {
+                while (n_frames_started.load(std::memory_order_acquire) <= frame) std::this_thread::yield();
+                record_frame(frame / n_frames, frame % n_frames, t);
+                n_frames_recorded.fetch_add(1, std::memory_order_release);
+            }
+        });
+    }
+
+    Timing best;
+    gfx::profiler::begin_frame(frame_index++);
+    for (uint32_t repeat = 0; repeat < N_REPEATS; ++repeat) {
+        double collect_seconds = 0.0;
+        for (uint32_t frame = 0; frame < n_frames; ++frame) {
+            const uint32_t n_started = repeat * n_frames + frame + 1;
+            n_frames_started.store(n_started, std::memory_order_release);
+            record_frame(repeat, frame, 0);
+            while (n_frames_recorded.load(std::memory_order_acquire) < n_started * (n_threads - 1)) std::this_thread::yield();
+
+            const auto collect_start = std::chrono::steady_clock::now();
+            gfx::profiler::begin_frame(frame_index++);
+            collect_seconds += seconds_since(collect_start);
+        }
+
+        const double n_zones = (double)n_threads * n_iterations * zones_per_iteration;
+        best.record_ns = std::min(best.record_ns, (double)record_ns[repeat].load() / ((double)n_threads * n_iterations));
+        if (zones_per_iteration > 0) best.collect_ns = std::min(best.collect_ns, collect_seconds * 1e9 / n_zones);
+    }
+    for (std::thread& thread : threads) thread.join();
+    return best;
+}
+
+int main(int n_args, char** args) {
+    uint32_t n_zones = 1'000'000;
+    uint32_t zones_per_frame = 1000;
+    uint32_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (int i = 1; i < n_args; ++i) {
+        const char* arg = args[i];
+        const int n_left = n_args - i - 1;
+        auto next_u32 = [&]() { return (uint32_t)strtoul(args[++i], nullptr, 10); };
+
+        if (strcmp(arg, "--zones") == 0 && n_left >= 1) n_zones = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--zones-per-frame") == 0 && n_left >= 1) zones_per_frame = std::clamp(next_u32(), 2u, (uint32_t)THREAD_RING_SIZE);
+        else if (strcmp(arg, "--max-threads") == 0 && n_left >= 1) max_threads = std::max(next_u32(), 1u);
+        else {
+            LOG(Error, "Unknown or incomplete argument \"%s\"", arg);
+            Log::flush();
+            return 1;
+        }
+    }
+
+#if !ENABLE_PROFILER
+    printf("Built with ENABLE_PROFILER=0, so the zones compile to nothing\n");
+#endif
+    printf("%u hardware threads, %u zones per thread, collected every %u zones\n", std::thread::hardware_concurrency(), n_zones, zones_per_frame);
+    printf("  %-8s %-8s %12s %12s %12s %12s\n", "threads", "zones", "loop ns", "record ns", "collect ns", "total ns");
+    for (uint32_t n_threads = 1; ; n_threads = std::min(n_threads * 2, max_threads)) {
+        // Nested zones do two per iteration, so half the iterations keep the number of zones the same
+        const Timing baseline = run(n_threads, n_zones, zones_per_frame, 0, [](uint32_t i) { work(i); });
+        const Timing single = run(n_threads, n_zones, zones_per_frame, 1, [](uint32_t i) { zoned_work(i); });
+        const Timing nested = run(n_threads, n_zones / 2, zones_per_frame / 2, 2, [](uint32_t i) { nested_zoned_work(i); });
+
+        // Per zone: what it added to the loop on the thread that recorded it, plus its share of collecting
+        const double single_record_ns = single.record_ns - baseline.record_ns;
+        const double nested_record_ns = (nested.record_ns - baseline.record_ns) / 2.0;
+        printf("  %-8u %-8s %12.1f %12.1f %12.1f %12.1f\n", n_threads, "single", baseline.record_ns, single_record_ns, single.collect_ns, single_record_ns + single.collect_ns);
+        printf("  %-8u %-8s %12.1f %12.1f %12.1f %12.1f\n", n_threads, "nested", baseline.record_ns, nested_record_ns, nested.collect_ns, nested_record_ns + nested.collect_ns);
+        if (n_threads == max_threads) break;
+    }
+
+    Log::flush();
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Records geometry pass draws the way `Renderer::record_raster_draws()` does, but into stub command lists that only write the
+// commands to memory, and measures how recording time scales with the number of threads. Every multithreaded recording gets
+// checked against recording on one thread. Usage:
+//   raster_recording_benchmark [--max-draws n] [--max-threads n] [--min-draws-per-thread n] [--work n]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include "parallel_recording.h"
+#include "thread_pool.h"
+#include "log.h"
+
+#define N_RECORD_REPEATS 5 // Best of
+#define MIN_DRAWS_PER_THREAD 16 // Same as the renderer
+
+// Stand-in for a D3D12 command list. `work` emulates the time the driver spends validating and encoding each command
+struct StubCommandList {
+    enum Opcode : uint32_t {
+        set_graphics_root_constants = 1,
+        draw_indirect = 2,
+    };
+
+    void set_root_constants(std::initializer_list<uint32_t> constants) {
+        commands.push_back(set_graphics_root_constants);
+        commands.push_back((uint32_t)constants.size());
+        for (uint32_t constant : constants) commands.push_back(encode(constant));
+    }
+
+    void draw(uint32_t commands_buffer, uint32_t offset, uint32_t n_draws) {
+        commands.push_back(draw_indirect);
+        commands.push_back(encode(commands_buffer));
+        commands.push_back(encode(offset));
+        commands.push_back(encode(n_draws));
+    }
+
+    uint32_t encode(uint32_t value) {
+        uint32_t hash = value;
+        for (uint32_t i = 0; i < work; ++i) hash = (hash ^ (hash >> 15)) * 0x2c1b3c6d + i;
+        checksum += hash; // So the work can't be optimized out
+        return value;
+    }
+
+    std::vector<uint32_t> commands;
+    uint32_t work = 0;
+    uint32_t checksum = 0;
+};
+
+// What the renderer records per draw, see `RasterDraw`
+struct StubDraw {
+    uint32_t instance_buffer;
+    uint32_t instance_offset;
+    uint32_t commands_buffer;
+    uint32_t commands_offset;
+    uint32_t n_draws;
+};
+
+static void record_draw(StubCommandList& command_list, const StubDraw& draw) {
+    command_list.set_root_constants({ 1, 0, 0, 0, 2, draw.instance_buffer, draw.instance_offset });
+    command_list.draw(draw.commands_buffer, draw.commands_offset, draw.n_draws);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int n_args, char** args) {
+    uint32_t max_draws = 100000;
+    uint32_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    uint32_t min_draws_per_thread = MIN_DRAWS_PER_THREAD;
+    uint32_t work = 32;
+
+    for (int i = 1; i < n_args; ++i) {
+        const char* arg = args[i];
+        const int n_left = n_args - i - 1;
+        auto next_u32 = [&]() { return (uint32_t)strtoul(args[++i], nullptr, 10); };
+
+        if (strcmp(arg, "--max-draws") == 0 && n_left >= 1) max_draws = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--max-threads") == 0 && n_left >= 1) max_threads = std::max(next_u32(), 1u);
+        else if (strcmp(arg, "--min-draws-per-thread") == 0 && n_left >= 1) min_draws_per_thread = next_u32();
+        else if (strcmp(arg, "--work") == 0 && n_left >= 1) work = next_u32();
+        else {
+            LOG(Error, "Unknown or incomplete argument \"%s\"", arg);
+            Log::flush();
+            return 1;
+        }
+    }
+
+    // 1, 2, 4, ... threads, and the maximum
+    std::vector<uint32_t> thread_counts;
+    for (uint32_t n_threads = 1; n_threads < max_threads; n_threads *= 2) thread_counts.push_back(n_threads);
+    thread_counts.push_back(max_threads);
+    std::vector<std::unique_ptr<gfx::ThreadPool>> thread_pools;
+    for (uint32_t n_threads : thread_counts) thread_pools.push_back(std::make_unique<gfx::ThreadPool>(std::max(n_threads, 2u) - 1));
+
+    printf("%u hardware threads, %u encoding steps per command\n", std::thread::hardware_concurrency(), work);
+    printf("  %-10s %-8s %8s %12s %10s %8s\n", "draws", "threads", "chunks", "record ms", "speedup", "match");
+    uint32_t n_mismatches = 0;
+    for (uint32_t n_draws = 1000; ; n_draws = (n_draws > max_draws / 10) ? max_draws : n_draws * 10) {
+        std::mt19937 rng(n_draws);
+        std::vector<StubDraw> draws(n_draws);
+        for (StubDraw& draw : draws) {
+            draw = StubDraw{ (uint32_t)rng() % 4096, (uint32_t)rng() % 65536, (uint32_t)rng() % 4096, (uint32_t)rng() % 65536, 1 + (uint32_t)rng() % 64 };
+        }
+
+        // Reference: everything into one command list, no thread pool involved
+        StubCommandList reference;
+        reference.work = work;
+        for (const StubDraw& draw : draws) record_draw(reference, draw);
+
+        double single_thread_seconds = 0.0;
+        for (size_t t = 0; t < thread_counts.size(); ++t) {
+            // With one thread there's only one chunk, so the calling thread records everything, but it's still the same code path
+            gfx::ThreadPool& thread_pool = *thread_pools[t];
+            const uint32_t n_threads = thread_counts[t];
+            const gfx::RecordingChunks chunks = gfx::split_recording(n_draws, min_draws_per_thread, n_threads);
+
+            // Command lists are reused between repeats, like the device's pooled command buffers
+            std::vector<StubCommandList> command_lists(chunks.n_chunks);
+            double best_seconds = INFINITY;
+            for (int i = 0; i < N_RECORD_REPEATS; ++i) {
+                for (StubCommandList& command_list : command_lists) {
+                    command_list.commands.clear();
+                    command_list.work = work;
+                }
+                const auto start_time = std::chrono::steady_clock::now();
+                gfx::record_chunks(thread_pool, n_draws, chunks, [&](uint32_t chunk_index, uint32_t begin, uint32_t end) {
+                    for (uint32_t i = begin; i < end; ++i) record_draw(command_lists[chunk_index], draws[i]);
+                });
+                best_seconds = std::min(best_seconds, seconds_since(start_time));
+            }
+            if (t == 0) single_thread_seconds = best_seconds;
+
+            // Submitting the command lists in order has to give exactly the single threaded stream
+            std::vector<uint32_t> submitted;
+            for (const StubCommandList& command_list : command_lists) submitted.insert(submitted.end(), command_list.commands.begin(), command_list.commands.end());
+            const bool match = (submitted == reference.commands);
+            n_mismatches += match ? 0 : 1;
+
+            printf("  %-10u %-8u %8u %12.3f %9.2fx %8s\n", n_draws, n_threads, chunks.n_chunks, best_seconds * 1000.0, single_thread_seconds / best_seconds, match ? "yes" : "NO");
+        }
+        if (n_draws == max_draws) break;
+    }
+
+    Log::flush();
+    if (n_mismatches > 0) {
+        printf("\n%u recordings didn't match recording on one thread\n", n_mismatches);
+        return 1;
+    }
+    return 0;
+}
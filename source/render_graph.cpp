@@ -0,0 +1,184 @@
+#include "render_graph.h"
+
+#include <cassert>
+#include "log.h"
+
+namespace gfx {
+    RenderGraphResource RenderGraph::add_resource(const std::string& name) {
+        m_resource_names.push_back(name);
+        m_resource_is_output.push_back(false);
+        return (RenderGraphResource)(m_resource_names.size() - 1);
+    }
+
+    void RenderGraph::mark_output(RenderGraphResource resource) {
+        m_resource_is_output[resource] = true;
+    }
+
+    uint32_t RenderGraph::add_pass(const std::string& name, std::initializer_list<RenderGraphAccess> accesses, std::function<void()> execute, bool has_side_effects) {
+        for ([[maybe_unused]] const RenderGraphAccess& access : accesses) {
+            assert(access.resource < m_resource_names.size() && "Render graph pass accesses a resource that wasn't added to the graph");
+        }
+        m_passes.push_back(RenderGraphPass{
+            .name = name,
+            .accesses = accesses,
+            .execute = std::move(execute),
+            .has_side_effects = has_side_effects,
+        });
+        return (uint32_t)(m_passes.size() - 1);
+    }
+
+    bool RenderGraph::is_write(ResourceUsage usage) {
+        return usage == ResourceUsage::compute_write || usage == ResourceUsage::render_target || usage == ResourceUsage::depth_target;
+    }
+
+    std::span<const RenderGraphBarrier> RenderGraph::barriers(uint32_t pass_index) const {
+        const uint32_t begin = m_pass_barrier_offsets[pass_index];
+        const uint32_t end = m_pass_barrier_offsets[pass_index + 1];
+        return { m_barriers.data() + begin, end - begin };
+    }
+
+    void RenderGraph::compile() {
+        std::vector<bool> keep;
+        cull_passes(keep);
+        sort_passes(keep);
+        place_barriers();
+        LOG(Debug, "Compiled render graph: %zu passes, %u culled, %zu barriers", m_passes.size(), n_culled_passes(), m_barriers.size());
+    }
+
+    void RenderGraph::cull_passes(std::vector<bool>& keep) const {
+        // Walk backwards from the outputs. A pass is needed if a needed pass or an output depends on something it writes
+        std::vector<bool> resource_needed = m_resource_is_output;
+        keep.assign(m_passes.size(), false);
+        for (uint32_t i = (uint32_t)m_passes.size(); i-- > 0;) {
+            const RenderGraphPass& pass = m_passes[i];
+            bool needed = pass.has_side_effects;
+            for (const RenderGraphAccess& access : pass.accesses) {
+                if (is_write(access.usage) && resource_needed[access.resource]) needed = true;
+            }
+            if (!needed) continue;
+
+            // Writes might only cover part of a resource, so earlier writers are still needed as well
+            keep[i] = true;
+            for (const RenderGraphAccess& access : pass.accesses) {
+                resource_needed[access.resource] = true;
+            }
+        }
+    }
+
+    uint32_t RenderGraph::count_barriers(uint32_t pass_index, const std::vector<ResourceUsage>& states) const {
+        uint32_t n_barriers = 0;
+        for (const RenderGraphAccess& access : m_passes[pass_index].accesses) {
+            if (states[access.resource] != access.usage || access.usage == ResourceUsage::compute_write) {
+                ++n_barriers;
+            }
+        }
+        return n_barriers;
+    }
+
+    void RenderGraph::sort_passes(const std::vector<bool>& keep) {
+        // Find dependencies between passes, based on the order they were added in: reads depend on the last write,
+        // and writes depend on the last write and every read since then
+        std::vector<std::vector<uint32_t>> successors(m_passes.size());
+        std::vector<uint32_t> n_predecessors(m_passes.size(), 0);
+        std::vector<uint32_t> last_writer(m_resource_names.size(), ~0u);
+        std::vector<std::vector<uint32_t>> readers_since_write(m_resource_names.size());
+        const auto add_dependency = [&](uint32_t from, uint32_t to) {
+            if (from == ~0u || from == to) return;
+            successors[from].push_back(to);
+            ++n_predecessors[to];
+        };
+
+        for (uint32_t i = 0; i < m_passes.size(); ++i) {
+            if (!keep[i]) continue;
+            for (const RenderGraphAccess& access : m_passes[i].accesses) {
+                add_dependency(last_writer[access.resource], i);
+                if (is_write(access.usage)) {
+                    for (uint32_t reader : readers_since_write[access.resource]) {
+                        add_dependency(reader, i);
+                    }
+                }
+            }
+            for (const RenderGraphAccess& access : m_passes[i].accesses) {
+                if (is_write(access.usage)) {
+                    last_writer[access.resource] = i;
+                    readers_since_write[access.resource].clear();
+                }
+                else {
+                    readers_since_write[access.resource].push_back(i);
+                }
+            }
+        }
+
+        // Out of all the passes that are ready to go, pick the one that needs the fewest barriers, so passes that use
+        // resources in the same state end up next to each other. Ties go to whichever pass was added first
+        std::vector<uint32_t> ready;
+        for (uint32_t i = 0; i < m_passes.size(); ++i) {
+            if (keep[i] && n_predecessors[i] == 0) ready.push_back(i);
+        }
+
+        std::vector<ResourceUsage> states(m_resource_names.size(), ResourceUsage::none);
+        m_pass_order.clear();
+        while (!ready.empty()) {
+            size_t best = 0;
+            uint32_t best_n_barriers = ~0u;
+            for (size_t i = 0; i < ready.size(); ++i) {
+                const uint32_t n_barriers = count_barriers(ready[i], states);
+                if (n_barriers < best_n_barriers || (n_barriers == best_n_barriers && ready[i] < ready[best])) {
+                    best = i;
+                    best_n_barriers = n_barriers;
+                }
+            }
+
+            const uint32_t pass_index = ready[best];
+            ready.erase(ready.begin() + best);
+            m_pass_order.push_back(pass_index);
+            for (const RenderGraphAccess& access : m_passes[pass_index].accesses) {
+                states[access.resource] = access.usage;
+            }
+            for (uint32_t successor : successors[pass_index]) {
+                if (--n_predecessors[successor] == 0) ready.push_back(successor);
+            }
+        }
+    }
+
+    void RenderGraph::place_barriers() {
+        // Resources start out in an unknown state, so the first pass to use a resource always gets a barrier for it.
+        // The device skips transitions to the state a resource is already in, so this costs nothing if it was already right
+        std::vector<std::vector<RenderGraphBarrier>> pass_barriers(m_passes.size());
+        std::vector<ResourceUsage> states(m_resource_names.size(), ResourceUsage::none);
+        std::vector<uint32_t> last_barrier_pass(m_resource_names.size(), ~0u);
+        for (uint32_t pass_index : m_pass_order) {
+            for (const RenderGraphAccess& access : m_passes[pass_index].accesses) {
+                // One barrier per resource per pass. If a pass uses a resource in two different ways, the first one wins
+                if (last_barrier_pass[access.resource] == pass_index) {
+                    if (states[access.resource] != access.usage) {
+                        LOG(Warning, "Render graph pass \"%s\" uses resource \"%s\" in two different states", m_passes[pass_index].name.c_str(), m_resource_names[access.resource].c_str());
+                    }
+                    continue;
+                }
+
+                const ResourceUsage prev_state = states[access.resource];
+                if (prev_state != access.usage || prev_state == ResourceUsage::none) {
+                    pass_barriers[pass_index].push_back({ access.resource, access.usage, false });
+                }
+                else if (access.usage == ResourceUsage::compute_write) {
+                    pass_barriers[pass_index].push_back({ access.resource, access.usage, true });
+                }
+                else {
+                    continue;
+                }
+                states[access.resource] = access.usage;
+                last_barrier_pass[access.resource] = pass_index;
+            }
+        }
+
+        // Store them all in one list, in the order the passes were added
+        m_barriers.clear();
+        m_pass_barrier_offsets.clear();
+        for (const auto& barriers : pass_barriers) {
+            m_pass_barrier_offsets.push_back((uint32_t)m_barriers.size());
+            m_barriers.insert(m_barriers.end(), barriers.begin(), barriers.end());
+        }
+        m_pass_barrier_offsets.push_back((uint32_t)m_barriers.size());
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <span>
+#include <string>
+#include <vector>
+#include "gpu_structs.h"
+
+namespace gfx {
+    using RenderGraphResource = uint32_t; // Index into the graph's resources, returned by `RenderGraph::add_resource()`
+
+    struct RenderGraphAccess {
+        RenderGraphResource resource;
+        ResourceUsage usage; // `compute_write`, `render_target` and `depth_target` count as writes, everything else as a read
+    };
+
+    struct RenderGraphBarrier {
+        RenderGraphResource resource;
+        ResourceUsage usage; // State the resource should be in
+        bool uav_only; // The resource stays in the unordered access state, but the previous pass' writes need to finish first
+    };
+
+    struct RenderGraphPass {
+        std::string name;
+        std::vector<RenderGraphAccess> accesses;
+        std::function<void()> execute; // Should begin and end its own pass on the device. The barriers are recorded when the pass begins
+        bool has_side_effects = false; // Never culled, like passes that render to the swapchain
+    };
+
+    // Passes declare which resources they read and write, and `compile()` works out the rest: which passes can be skipped because
+    // nothing uses their results, what order to run them in, and which barriers each of them needs. Compiling only looks at the
+    // declared accesses, so it doesn't touch the GPU, and the same graph can be executed every frame without compiling it again.
+    // Resources are only identified by index, binding them to actual GPU resources is up to whoever executes the graph.
+    struct RenderGraph {
+        RenderGraphResource add_resource(const std::string& name);
+        void mark_output(RenderGraphResource resource); // Passes that contribute to an output are never culled
+        uint32_t add_pass(const std::string& name, std::initializer_list<RenderGraphAccess> accesses, std::function<void()> execute, bool has_side_effects = false);
+        void compile();
+
+        // Only valid after `compile()`
+        std::span<const uint32_t> pass_order() const { return m_pass_order; } // Indices of the passes that survived culling, in execution order
+        std::span<const RenderGraphBarrier> barriers(uint32_t pass_index) const; // Barriers to record right before this pass
+        uint32_t n_barriers() const { return (uint32_t)m_barriers.size(); }
+        uint32_t n_culled_passes() const { return (uint32_t)(m_passes.size() - m_pass_order.size()); }
+
+        const RenderGraphPass& pass(uint32_t pass_index) const { return m_passes[pass_index]; }
+        const std::string& resource_name(RenderGraphResource resource) const { return m_resource_names[resource]; }
+        uint32_t n_resources() const { return (uint32_t)m_resource_names.size(); }
+
+        static bool is_write(ResourceUsage usage);
+
+    private:
+        void cull_passes(std::vector<bool>& keep) const;
+        void sort_passes(const std::vector<bool>& keep);
+        void place_barriers();
+        uint32_t count_barriers(uint32_t pass_index, const std::vector<ResourceUsage>& states) const;
+
+        std::vector<std::string> m_resource_names;
+        std::vector<bool> m_resource_is_output;
+        std::vector<RenderGraphPass> m_passes;
+        std::vector<uint32_t> m_pass_order;
+        std::vector<RenderGraphBarrier> m_barriers;
+        std::vector<uint32_t> m_pass_barrier_offsets; // Per pass, where its barriers start in `m_barriers`. Has an extra entry at the end
+    };
+}
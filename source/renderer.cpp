@@ -1,93 +1,191 @@
 #include "renderer.h"
 #include "scene.h"
 
-#define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 #include <glm/matrix.hpp>
 #include <glm/trigonometric.hpp>
 
 #include <algorithm>
 #include "input.h"
+#include "allocation_tracker.h"
+#include "shader.h"
+#include "pipeline.h"
+#include "task_graph.h"
+#include "startup_tasks.h"
+#include "parallel_recording.h"
+#include "profiler.h"
 
 namespace gfx {
     #define MAX_MATERIAL_COUNT 1024
-    #define DRAW_PACKET_BUFFER_SIZE 102400
+    #define DRAW_PACKET_PAGE_SIZE (64 * 1024)
     #define GPU_BUFFER_PREFERRED_ALIGNMENT 64
     #define MAX_LIGHTS_DIRECTIONAL 32
+    #define MAX_LIGHTS_POINT 16384
+    #define MAX_LIGHTS_SPOT 16384
+    #define MAX_LIGHT_CLUSTER_INDICES (1 << 19)
+    #define LIGHT_CLUSTER_NEAR 0.05f
+    #define LIGHT_CLUSTER_FAR 200.0f
+    #define LIGHT_INFLUENCE_CUTOFF 0.05f // Illuminance (lux) below which we consider a light with infinite range to have no influence
     #define MAX_CUBEMAP_SH 128
     #define FOV (glm::radians(70.f))
+    #define FRAME_ALLOCATION_WARMUP_FRAMES 16 // Containers are allowed to grow during the first few frames
+    #define SHADER_DIRECTORY "assets/shaders"
+    #define SHADER_HOT_RELOAD_INTERVAL_MS 250
+    #define MIN_RASTER_DRAWS_PER_THREAD 16 // Each draw is a whole scene's indirect draw. Below this, handing draws to another thread costs more than recording them
+
+    // Lights buffer layout, see `LightBufferHeader`
+    constexpr uint32_t lights_directional_offset = 64;
+    constexpr uint32_t lights_point_offset = lights_directional_offset + MAX_LIGHTS_DIRECTIONAL * sizeof(LightDirectional);
+    constexpr uint32_t lights_spot_offset = lights_point_offset + MAX_LIGHTS_POINT * sizeof(LightPoint);
+    constexpr uint32_t light_clusters_offset = lights_spot_offset + MAX_LIGHTS_SPOT * sizeof(LightSpot);
+    constexpr uint32_t light_cluster_indices_offset = light_clusters_offset + LightClusterGrid::n_clusters * sizeof(LightCluster);
+    constexpr uint32_t lights_buffer_size = light_cluster_indices_offset + MAX_LIGHT_CLUSTER_INDICES * sizeof(uint32_t);
+    static_assert(sizeof(LightBufferHeader) <= lights_directional_offset);
 
     // Initialisation and state
-    Renderer::Renderer(int width, int height, bool debug_layer_enabled, bool gpu_profiling_enabled) {
+    Renderer::Renderer(int width, int height, bool debug_layer_enabled, bool gpu_profiling_enabled, const StartupAssets& startup_assets) {
+        profiler::set_thread_name("Main thread");
         m_device = std::make_unique<Device>(width, height, debug_layer_enabled, gpu_profiling_enabled);
 
-        LOG(Debug, "Creating framebuffers");
-        m_position_target = m_device->create_render_target("Position framebuffer", width, height, PixelFormat::rgba32_float, glm::vec4(0.0f, 0.0f, 9999999.0f, 0.0f), ResourceUsage::compute_write);
-        m_color_target = m_device->create_render_target("Color framebuffer", width, height, PixelFormat::rgba16_float, glm::vec4(0.0f, 0.0f, 0.0f, -1.0f), ResourceUsage::compute_write);
-        m_normal_target = m_device->create_render_target("Normal framebuffer", width, height, PixelFormat::rgba16_float, {}, ResourceUsage::compute_write);
-        m_metallic_roughness_target = m_device->create_render_target("Metallic & roughness framebuffer", width, height, PixelFormat::rg8_unorm, {}, ResourceUsage::compute_write);
-        m_emissive_target = m_device->create_render_target("Emissive framebuffer", width, height, PixelFormat::rg11_b10_float, {}, ResourceUsage::compute_write);
-        m_shaded_target = m_device->load_texture("Shaded framebuffer", width, height, 1, nullptr, PixelFormat::rgba16_float, TextureType::tex_2d, ResourceUsage::compute_write);
-        m_ssao_target = m_device->load_texture("SSAO framebuffer", width, height, 1, nullptr, PixelFormat::r8_unorm, TextureType::tex_2d, ResourceUsage::compute_write);
-        m_accumulation_target = m_device->load_texture("Accumulation framebuffer", width, height, 1, nullptr, PixelFormat::rgba32_float, TextureType::tex_2d, ResourceUsage::compute_write);
-        m_depth_target = m_device->create_depth_target("Depth framebuffer", width, height, PixelFormat::depth32_float);
-        LOG(Debug, "Compiling shaders");
-        m_pipeline_scene = m_device->create_raster_pipeline("Geometry pass"  ,"assets/shaders/rasterized/geo_pass.vs.hlsl", "assets/shaders/rasterized/geo_pass.ps.hlsl", {
-            m_position_target,
-            m_color_target,
-            m_normal_target,
-            m_metallic_roughness_target,
-            m_emissive_target
-        }, m_depth_target);
-        m_pipeline_brdf = m_device->create_compute_pipeline("BRDF", "assets/shaders/rasterized/brdf.cs.hlsl");
-        m_pipeline_tonemapping = m_device->create_compute_pipeline("Tonemapping", "assets/shaders/post/tonemapping.cs.hlsl");
-        m_pipeline_final_blit = m_device->create_raster_pipeline("Final blit", "assets/shaders/fullscreen_tri.vs.hlsl", "assets/shaders/final_blit.ps.hlsl", {});
-        m_pipeline_hdri_to_cubemap = m_device->create_compute_pipeline("HRDI to cubemap conversion" ,"assets/shaders/pre/hdri_to_cubemap.cs.hlsl");
-        m_pipeline_cubemap_to_diffuse = m_device->create_compute_pipeline("Indirect diffuse spherical harmonics calculation" ,"assets/shaders/pre/cubemap_to_diffuse.cs.hlsl");
-        m_pipeline_accumulate_sh_coeffs = m_device->create_compute_pipeline("Accumulate spherical harmonics coefficients", "assets/shaders/pre/accumulate_sh_coeffs.cs.hlsl");
-        m_pipeline_compute_sh_matrices = m_device->create_compute_pipeline("Compute spherical harmonics matrices", "assets/shaders/pre/compute_sh_matrices.cs.hlsl");
-        m_pipeline_prefilter_cubemap = m_device->create_compute_pipeline("Prefilter specular IBL cubemap" ,"assets/shaders/pre/prefilter_cubemap.cs.hlsl");
-        m_pipeline_ibl_brdf_lut_gen = m_device->create_compute_pipeline("Generate IBL BRDF LUT", "assets/shaders/pre/ibl_brdf_lut_gen.cs.hlsl");
-        m_pipeline_downsample = m_device->create_compute_pipeline("Downsample texture" ,"assets/shaders/pre/downsample.cs.hlsl");
-        m_pipeline_ssao = m_device->create_compute_pipeline("SSAO" ,"assets/shaders/post/ssao.cs.hlsl");
-        m_pipeline_pathtrace = m_device->create_compute_pipeline("Pathtrace" ,"assets/shaders/pathtraced/pathtrace.cs.hlsl");
-        m_pipeline_reconstruct_normal_map = m_device->create_compute_pipeline("Reconstruct normal map Z component" ,"assets/shaders/pre/reconstruct_normal_map.cs.hlsl");
-        
-        LOG(Debug, "Creating buffers");
-        m_material_buffer = m_device->create_buffer("Material descriptions", MAX_MATERIAL_COUNT * sizeof(Material), nullptr, ResourceUsage::cpu_writable);
-        m_lights_buffer = m_device->create_buffer("Lights buffer", 3 * sizeof(uint32_t) + MAX_LIGHTS_DIRECTIONAL * sizeof(LightDirectional), nullptr, ResourceUsage::cpu_writable);
-        m_spherical_harmonics_buffer = m_device->create_buffer("Spherical harmonics coefficients buffer", MAX_CUBEMAP_SH * 3*sizeof(glm::mat4), nullptr, ResourceUsage::compute_write);
+        // Pipelines get rebuilt when their shaders change on disk
+        m_pipeline_hot_reload = std::make_unique<PipelineHotReload>(SHADER_DIRECTORY, backbuffer_count, ShaderCache::source_files);
+
+        // The dependencies between these are in `add_startup_tasks()`
+        StartupTasks startup_tasks;
 
-        // Create triple buffered draw packet buffer
-        for (int i = 0; i < backbuffer_count; ++i) {
-            m_draw_packets[i] = m_device->create_buffer("Draw Packets", DRAW_PACKET_BUFFER_SIZE, nullptr, ResourceUsage::cpu_writable);
+        stbi_set_flip_vertically_on_load(0);
+        for (const auto& path : startup_assets.environment_maps) {
+            DecodedImage& hdri = m_decoded_hdris[path];
+            startup_tasks.decode_environment_maps.push_back({ "Decode " + path, [&hdri, path]() {
+                hdri.pixels = std::shared_ptr<void>(stbi_loadf(path.c_str(), &hdri.width, &hdri.height, nullptr, 4), stbi_image_free);
+            }});
+        }
+        for (const auto& path : startup_assets.scenes) {
+            std::shared_ptr<tinygltf::Model>& model = m_decoded_scenes[path];
+            startup_tasks.decode_scenes.push_back({ "Decode " + path, [&model, path]() {
+                model = decode_gltf(path);
+            }});
         }
 
-        LOG(Debug, "Precalculating IBL BRDF LUT");
-        constexpr uint32_t ibl_brdf_resolution = 512;
-        m_env_brdf_lut = m_device->load_texture(
-            "IBL BRDF LUT", ibl_brdf_resolution, ibl_brdf_resolution, 1, nullptr, 
-            PixelFormat::rg16_float, TextureType::tex_2d, ResourceUsage::compute_write
-        );
-        m_device->begin_compute_pass(m_pipeline_ibl_brdf_lut_gen, true);
-        m_device->use_resource(m_env_brdf_lut, ResourceUsage::compute_write);
-        m_device->set_compute_root_constants({
-            m_env_brdf_lut.handle.as_u32_uav(),
-            ibl_brdf_resolution
+        startup_tasks.create_targets = { "Create framebuffers", [&]() {
+            m_position_target = m_device->create_render_target("Position framebuffer", width, height, PixelFormat::rgba32_float, glm::vec4(0.0f, 0.0f, 9999999.0f, 0.0f), ResourceUsage::compute_write);
+            m_color_target = m_device->create_render_target("Color framebuffer", width, height, PixelFormat::rgba16_float, glm::vec4(0.0f, 0.0f, 0.0f, -1.0f), ResourceUsage::compute_write);
+            m_normal_target = m_device->create_render_target("Normal framebuffer", width, height, PixelFormat::rgba16_float, {}, ResourceUsage::compute_write);
+            m_metallic_roughness_target = m_device->create_render_target("Metallic & roughness framebuffer", width, height, PixelFormat::rg8_unorm, {}, ResourceUsage::compute_write);
+            m_emissive_target = m_device->create_render_target("Emissive framebuffer", width, height, PixelFormat::rg11_b10_float, {}, ResourceUsage::compute_write);
+            m_shaded_target = m_device->load_texture("Shaded framebuffer", width, height, 1, nullptr, PixelFormat::rgba16_float, TextureType::tex_2d, ResourceUsage::compute_write);
+            m_ssao_target = m_device->load_texture("SSAO framebuffer", width, height, 1, nullptr, PixelFormat::r8_unorm, TextureType::tex_2d, ResourceUsage::compute_write);
+            m_accumulation_target = m_device->load_texture("Accumulation framebuffer", width, height, 1, nullptr, PixelFormat::rgba32_float, TextureType::tex_2d, ResourceUsage::compute_write);
+            m_depth_target = m_device->create_depth_target("Depth framebuffer", width, height, PixelFormat::depth32_float);
+        }};
+
+        // The same functions are used to rebuild pipelines when hot reloading, so they can't read any render targets, those might be
+        // resized in the meantime
+        auto add_pipeline = [&](std::shared_ptr<Pipeline>& pipeline, const std::string& name, const std::vector<std::string>& shader_paths, std::function<std::shared_ptr<Pipeline>()> create) {
+            m_pipeline_hot_reload->add_pipeline(pipeline, shader_paths, [create]() -> std::shared_ptr<Pipeline> {
+                auto rebuilt = create();
+                return rebuilt->pipeline_state ? rebuilt : nullptr; // Keep using the old one if it didn't compile
+            });
+            startup_tasks.create_pipelines.push_back({ "Pipeline: " + name, [&pipeline, create]() {
+                pipeline = create();
+            }});
+            return startup_tasks.create_pipelines.size() - 1;
+        };
+        auto add_compute_pipeline = [&](std::shared_ptr<Pipeline>& pipeline, const std::string& name, const std::string& path) {
+            return add_pipeline(pipeline, name, { path }, [this, name, path]() {
+                return m_device->create_compute_pipeline(name, path);
+            });
+        };
+        add_pipeline(m_pipeline_scene, "Geometry pass", { "assets/shaders/rasterized/geo_pass.vs.hlsl", "assets/shaders/rasterized/geo_pass.ps.hlsl" }, [this]() {
+            // Same formats as the position, color, normal, metallic & roughness, and emissive framebuffers
+            auto pipeline = m_device->create_raster_pipeline("Geometry pass"  ,"assets/shaders/rasterized/geo_pass.vs.hlsl", "assets/shaders/rasterized/geo_pass.ps.hlsl", {
+                PixelFormat::rgba32_float,
+                PixelFormat::rgba16_float,
+                PixelFormat::rgba16_float,
+                PixelFormat::rg8_unorm,
+                PixelFormat::rg11_b10_float,
+            }, PixelFormat::depth32_float);
+            if (pipeline->pipeline_state) m_device->enable_indirect_draws(pipeline, 2, 2); // Each mesh sets its own draw packet buffer and offset, see `IndirectDrawCommand`
+            return pipeline;
         });
-        m_device->dispatch_threadgroups(ibl_brdf_resolution / 8, ibl_brdf_resolution / 8, 1);
-        m_device->end_compute_pass();
+        add_pipeline(m_pipeline_final_blit, "Final blit", { "assets/shaders/fullscreen_tri.vs.hlsl", "assets/shaders/final_blit.ps.hlsl" }, [this]() {
+            return m_device->create_raster_pipeline("Final blit", "assets/shaders/fullscreen_tri.vs.hlsl", "assets/shaders/final_blit.ps.hlsl", std::vector<PixelFormat>{}, PixelFormat::none);
+        });
+        add_compute_pipeline(m_pipeline_pathtrace, "Pathtrace" ,"assets/shaders/pathtraced/pathtrace.cs.hlsl");
+        add_compute_pipeline(m_pipeline_brdf, "BRDF", "assets/shaders/rasterized/brdf.cs.hlsl");
+        add_compute_pipeline(m_pipeline_tonemapping, "Tonemapping", "assets/shaders/post/tonemapping.cs.hlsl");
+        add_compute_pipeline(m_pipeline_hdri_to_cubemap, "HRDI to cubemap conversion" ,"assets/shaders/pre/hdri_to_cubemap.cs.hlsl");
+        add_compute_pipeline(m_pipeline_cubemap_to_diffuse, "Indirect diffuse spherical harmonics calculation" ,"assets/shaders/pre/cubemap_to_diffuse.cs.hlsl");
+        add_compute_pipeline(m_pipeline_accumulate_sh_coeffs, "Accumulate spherical harmonics coefficients", "assets/shaders/pre/accumulate_sh_coeffs.cs.hlsl");
+        add_compute_pipeline(m_pipeline_compute_sh_matrices, "Compute spherical harmonics matrices", "assets/shaders/pre/compute_sh_matrices.cs.hlsl");
+        add_compute_pipeline(m_pipeline_prefilter_cubemap, "Prefilter specular IBL cubemap" ,"assets/shaders/pre/prefilter_cubemap.cs.hlsl");
+        startup_tasks.ibl_brdf_lut_pipeline = add_compute_pipeline(m_pipeline_ibl_brdf_lut_gen, "Generate IBL BRDF LUT", "assets/shaders/pre/ibl_brdf_lut_gen.cs.hlsl");
+        add_compute_pipeline(m_pipeline_downsample, "Downsample texture" ,"assets/shaders/pre/downsample.cs.hlsl");
+        add_compute_pipeline(m_pipeline_ssao, "SSAO" ,"assets/shaders/post/ssao.cs.hlsl");
+        add_compute_pipeline(m_pipeline_reconstruct_normal_map, "Reconstruct normal map Z component" ,"assets/shaders/pre/reconstruct_normal_map.cs.hlsl");
+
+        startup_tasks.create_buffers = { "Create buffers", [this]() {
+            m_material_buffer = m_device->create_buffer("Material descriptions", MAX_MATERIAL_COUNT * sizeof(Material), nullptr, ResourceUsage::cpu_writable);
+            m_spherical_harmonics_buffer = m_device->create_buffer("Spherical harmonics coefficients buffer", MAX_CUBEMAP_SH * 3*sizeof(glm::mat4), nullptr, ResourceUsage::compute_write);
+
+            // Create triple buffered light buffers
+            for (int i = 0; i < backbuffer_count; ++i) {
+                m_lights_buffers[i] = m_device->create_buffer("Lights buffer", lights_buffer_size, nullptr, ResourceUsage::cpu_writable);
+            }
 
+            // Draw packet pages get created on demand, and stay mapped until they're destroyed
+            m_draw_packet_allocator = LinearAllocator(DRAW_PACKET_PAGE_SIZE, GPU_BUFFER_PREFERRED_ALIGNMENT, [this](uint32_t page_index, uint32_t size) {
+                assert(page_index == m_draw_packet_pages.size());
+                auto page = m_device->create_buffer("Draw packet page " + std::to_string(page_index), size, nullptr, ResourceUsage::cpu_writable);
+                void* mapped_page = nullptr;
+                const D3D12_RANGE read_range = { 0, 0 };
+                validate(page.resource->handle->Map(0, &read_range, &mapped_page));
+                m_draw_packet_pages.push_back(page);
+                return mapped_page;
+            });
+        }};
+
+        startup_tasks.generate_ibl_brdf_lut = { "Precalculate IBL BRDF LUT", [this]() {
+            constexpr uint32_t ibl_brdf_resolution = 512;
+            m_env_brdf_lut = m_device->load_texture(
+                "IBL BRDF LUT", ibl_brdf_resolution, ibl_brdf_resolution, 1, nullptr, 
+                PixelFormat::rg16_float, TextureType::tex_2d, ResourceUsage::compute_write
+            );
+            m_device->begin_compute_pass(m_pipeline_ibl_brdf_lut_gen, true);
+            m_device->use_resource(m_env_brdf_lut, ResourceUsage::compute_write);
+            m_device->set_compute_root_constants({
+                m_env_brdf_lut.handle.as_u32_uav(),
+                ibl_brdf_resolution
+            });
+            m_device->dispatch_threadgroups(ibl_brdf_resolution / 8, ibl_brdf_resolution / 8, 1);
+            m_device->end_compute_pass();
+        }};
+
+        startup_tasks.build_render_graphs = { "Build render graphs", [this]() {
+            build_render_graphs();
+            place_transient_targets();
+        }};
+
+        TaskGraph startup;
+        add_startup_tasks(startup, std::move(startup_tasks));
+        startup.run(m_thread_pool);
+        startup.log_report("Renderer startup");
+        m_pipeline_hot_reload->start(std::chrono::milliseconds(SHADER_HOT_RELOAD_INTERVAL_MS));
+
+        const ShaderCacheStats shader_stats = shader_cache_stats();
+        LOG(Info, "Shader cache: %u hits, %u misses (%u failed), compiling took %.1f ms, loading took %.1f ms",
+            shader_stats.n_hits, shader_stats.n_misses, shader_stats.n_failed,
+            shader_stats.compile_seconds * 1000.0, shader_stats.load_seconds * 1000.0
+        );
         LOG(Info, "Renderer initialized (DirectX 12)");
     }
 
     Renderer::~Renderer() {
+        m_pipeline_hot_reload->stop();
+
         // Mark all resources for unloading
-        for (const auto [handle, resource] : m_resources) {
-            m_device->queue_unload_bindless_resource(ResourceHandlePair{
-                .handle = {.id = handle},
-                .resource = resource
-            });
+        for (const auto& [key, resource] : m_resources) {
+            m_device->queue_unload_bindless_resource(resource);
         }
     }
 
@@ -101,6 +199,9 @@ namespace gfx {
     }
 
     void Renderer::begin_frame() {
+        allocation_tracker::begin_scope();
+        PROFILE_ZONE("Renderer::begin_frame");
+
         // Fetch window content size
         int x = 0;
         int y = 0;
@@ -112,6 +213,19 @@ namespace gfx {
         m_resolution.x = (float)x;
         m_resolution.y = (float)y;        
 
+        // Textures that finished uploading can be sampled now, so flag them as loaded in the materials that use them
+        const auto newly_loaded = m_device->newly_loaded_resources();
+        if (!newly_loaded.empty()) {
+            for (Material& material : m_materials) {
+                for (ResourceHandle* texture : { &material.color_texture, &material.normal_texture, &material.metal_roughness_texture, &material.emissive_texture }) {
+                    if (texture->is_loaded || texture->type == (uint32_t)ResourceType::none) continue;
+                    if (std::find(newly_loaded.begin(), newly_loaded.end(), texture->id) == newly_loaded.end()) continue;
+                    texture->is_loaded = 1;
+                    m_should_update_material_buffer = true;
+                }
+            }
+        }
+
         // Update materials
         if (m_should_update_material_buffer) {
             m_should_update_material_buffer = false;
@@ -121,52 +235,62 @@ namespace gfx {
             memcpy(mapped_material_buffer, m_materials.data(), m_materials.size() * sizeof(Material));
             m_material_buffer.resource->handle->Unmap(0, &read_range);
         }
-        m_draw_packet_cursor = 0;
 
         // Begin frame handles swapchain resizes, which makes sure all the GPU operations finish first
         // This means we can be sure that resizing the render target textures is safe
         m_device->begin_frame();
+        m_frame_start_time = std::chrono::steady_clock::now();
+        profiler::begin_frame((uint64_t)m_device->frame_index());
 
-        render_queue_scenes.clear();
+        // Swap in the pipelines that were rebuilt because their shaders changed
+        if (m_pipeline_hot_reload->apply(m_device->frame_index(), m_device->completed_frame_index()) > 0) {
+            m_reset_accumulation = true; // The old samples were rendered with the old shaders
+        }
+        m_draw_packet_allocator.begin_frame(m_device->frame_index(), m_device->completed_frame_index());
+
+        // Keep the draw requests around so their transform lists don't need to be reallocated next frame
+        for (uint32_t i = 0; i < m_n_queued_scenes; ++i) {
+            render_queue_scenes[i].scene = {};
+            render_queue_scenes[i].transforms.clear();
+        }
+        m_n_queued_scenes = 0;
         m_lights_directional.clear();
+        m_lights_point.clear();
+        m_lights_spot.clear();
     }
 
     void Renderer::end_frame() {
-        // If the render resolution changes, update the render targets
-        const glm::vec2 prev_render_resolution = m_render_resolution;
-        m_render_resolution = m_resolution * resolution_scale;
-        if (m_render_resolution != prev_render_resolution) {
+        PROFILE_ZONE("Renderer::end_frame");
+        // The targets are allocated at the biggest size the render resolution can have at the current window size, so changing
+        // the resolution scale only changes how much of them gets rendered to. They only get reallocated when the window resizes
+        const glm::vec2 prev_target_resolution = m_target_resolution;
+        m_target_resolution = glm::ceil(m_resolution * glm::max(resolution_scale, glm::vec2(1.0f)) / 8.0f) * 8.0f;
+        if (m_target_resolution != prev_target_resolution) {
             m_view_data.viewport_size = {
                 tan(FOV * 0.5f) * (m_resolution.x / m_resolution.y), // viewport width
                 tan(FOV * 0.5f), // viewport height
             };
-            resize_texture(m_position_target, (uint32_t)m_render_resolution.x, (uint32_t)m_render_resolution.y);
-            resize_texture(m_color_target, (uint32_t)m_render_resolution.x, (uint32_t)m_render_resolution.y);
-            resize_texture(m_normal_target, (uint32_t)m_render_resolution.x, (uint32_t)m_render_resolution.y);
-            resize_texture(m_metallic_roughness_target, (uint32_t)m_render_resolution.x, (uint32_t)m_render_resolution.y);
-            resize_texture(m_emissive_target, (uint32_t)m_render_resolution.x, (uint32_t)m_render_resolution.y);
-            resize_texture(m_shaded_target, (uint32_t)m_render_resolution.x, (uint32_t)m_render_resolution.y);
-            resize_texture(m_depth_target, (uint32_t)m_render_resolution.x, (uint32_t)m_render_resolution.y);
-            resize_texture(m_ssao_target, (uint32_t)m_render_resolution.x, (uint32_t)m_render_resolution.y);
-            resize_texture(m_accumulation_target, (uint32_t)m_render_resolution.x, (uint32_t)m_render_resolution.y);
-        }
-        
-        // Upload light info to the GPU
-        const uint32_t light_count[3] = {
-            (uint32_t)m_lights_directional.size(),
-            0, // todo: point lights
-            0, // todo: spot lights
-        };
-        m_device->update_buffer(m_lights_buffer, 0, sizeof(light_count), &light_count);
-        if (m_lights_directional.empty() == false) {
-            m_device->update_buffer(
-                m_lights_buffer,
-                sizeof(light_count),
-                sizeof(m_lights_directional[0]) * (uint32_t)m_lights_directional.size(),
-                m_lights_directional.data()
-            );
+            resize_texture(m_position_target, (uint32_t)m_target_resolution.x, (uint32_t)m_target_resolution.y);
+            resize_texture(m_color_target, (uint32_t)m_target_resolution.x, (uint32_t)m_target_resolution.y);
+            resize_texture(m_normal_target, (uint32_t)m_target_resolution.x, (uint32_t)m_target_resolution.y);
+            resize_texture(m_metallic_roughness_target, (uint32_t)m_target_resolution.x, (uint32_t)m_target_resolution.y);
+            resize_texture(m_emissive_target, (uint32_t)m_target_resolution.x, (uint32_t)m_target_resolution.y);
+            resize_texture(m_shaded_target, (uint32_t)m_target_resolution.x, (uint32_t)m_target_resolution.y);
+            resize_texture(m_depth_target, (uint32_t)m_target_resolution.x, (uint32_t)m_target_resolution.y);
+            resize_texture(m_ssao_target, (uint32_t)m_target_resolution.x, (uint32_t)m_target_resolution.y);
+            resize_texture(m_accumulation_target, (uint32_t)m_target_resolution.x, (uint32_t)m_target_resolution.y);
+            place_transient_targets();
         }
 
+        // Rounded up to whole 8x8 threadgroups
+        const glm::vec2 prev_render_resolution = m_render_resolution;
+        m_render_resolution = glm::min(glm::ceil(m_resolution * resolution_scale / 8.0f) * 8.0f, m_target_resolution);
+        if (m_render_resolution != prev_render_resolution) {
+            m_reset_accumulation = true; // Pixels don't line up with the previous frames anymore
+        }
+        m_view_data.render_resolution = m_render_resolution;
+        m_view_data.uv_scale = m_render_resolution / m_target_resolution;
+        
         static int mode = 1;
         if (input::key_held(input::Key::_1)) mode = 0;
         if (input::key_held(input::Key::_2)) mode = 1;
@@ -175,33 +299,17 @@ namespace gfx {
         case 1: render_pathtraced(); break;
         }
 
-        // Tonemapping
-        m_device->begin_compute_pass(m_pipeline_tonemapping);
-        m_device->use_resource(m_shaded_target, ResourceUsage::compute_write);
-        m_device->set_compute_root_constants({
-            m_shaded_target.handle.as_u32_uav(),
-        });
-        m_device->dispatch_threadgroups( // threadgroup size is 8x8
-            (uint32_t)(m_render_resolution.x / 8.0f),
-            (uint32_t)(m_render_resolution.y / 8.0f),
-            1
-        );
-        m_device->end_compute_pass();
-
-        // Final blit
-        m_device->begin_raster_pass(m_pipeline_final_blit, RasterPassInfo{
-            .color_targets = {}, // render to swapchain
-            .clear_on_begin = false, // We're blitting to the entire buffer, no need to clear first
-        });
-        m_device->use_resource(m_shaded_target, ResourceUsage::pixel_shader_read);
-        m_device->set_graphics_root_constants({
-            m_shaded_target.handle.as_u32(), // Texture to blit to screen
-        });
-        m_device->draw_vertices(3); // Triangle covering entire screen
-        m_device->end_raster_pass();
-
         // API specific end frame
+        const float cpu_frame_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - m_frame_start_time).count();
         m_device->end_frame();
+        update_dynamic_resolution(cpu_frame_time);
+
+        // With a static scene, nothing in the frame should need the heap once everything has warmed up
+        const uint64_t n_frame_allocations = allocation_tracker::end_scope();
+        if (TRACK_FRAME_ALLOCATIONS && m_device->frame_index() > FRAME_ALLOCATION_WARMUP_FRAMES && n_frame_allocations > 0) {
+            LOG(Error, "Frame %i made %llu heap allocations", m_device->frame_index(), n_frame_allocations);
+            assert(n_frame_allocations == 0 && "Heap allocation during frame");
+        }
     }
 
     // todo: maybe make separate camera struct that holds the transform, fov, near and far plane, and also caches its matrices?
@@ -211,9 +319,10 @@ namespace gfx {
             .projection_matrix = glm::perspectiveFov(glm::radians(70.f), m_resolution.x, m_resolution.y, 0.0001f, 1000.0f),
         };
 
+        m_view_matrix = camera_matrices.view_matrix;
         m_view_data.rotation = transform.rotation;
         m_view_data.camera_world_position = transform.position;
-        m_camera_matrices_offset = create_draw_packet(&camera_matrices, sizeof(camera_matrices));
+        m_camera_matrices_packet = create_draw_packet(&camera_matrices, sizeof(camera_matrices));
     }
 
     void Renderer::set_skybox(Cubemap& sky) {
@@ -221,142 +330,402 @@ namespace gfx {
     }
 
     void Renderer::draw_scene(ResourceHandlePair scene_handle) {
-        render_queue_scenes.push_back(scene_handle);
+        const glm::mat4 identity(1.0f);
+        draw_scene(scene_handle, std::span<const glm::mat4>(&identity, 1));
+    }
+
+    void Renderer::draw_scene(ResourceHandlePair scene_handle, const glm::mat4& transform) {
+        draw_scene(scene_handle, std::span<const glm::mat4>(&transform, 1));
+    }
+
+    void Renderer::draw_scene(ResourceHandlePair scene_handle, std::span<const glm::mat4> transforms) {
+        if (transforms.empty()) return;
+
+        // If this scene was already queued this frame, add the instances to that batch, so it still ends up as one draw per mesh
+        for (auto& request : queued_scenes()) {
+            if (request.scene.handle.id == scene_handle.handle.id) {
+                request.transforms.insert(request.transforms.end(), transforms.begin(), transforms.end());
+                return;
+            }
+        }
+
+        // Reuse a request from an earlier frame if there is one
+        if (m_n_queued_scenes == render_queue_scenes.size()) {
+            render_queue_scenes.emplace_back();
+        }
+        SceneDrawRequest& request = render_queue_scenes[m_n_queued_scenes++];
+        request.scene = scene_handle;
+        request.transforms.assign(transforms.begin(), transforms.end());
     }
 
     void Renderer::set_resolution_scale(glm::vec2 scale) {
         resolution_scale = scale;
     }
 
+    void Renderer::enable_dynamic_resolution(const DynamicResolutionSettings& settings) {
+        m_dynamic_resolution = DynamicResolutionController(settings);
+        m_dynamic_resolution_enabled = true;
+        m_prev_frame_end_time = {};
+    }
+
+    void Renderer::disable_dynamic_resolution() {
+        m_dynamic_resolution_enabled = false;
+        resolution_scale = glm::vec2(m_dynamic_resolution.settings().max_scale);
+    }
+
+    void Renderer::update_dynamic_resolution(float cpu_frame_time) {
+        const auto now = std::chrono::steady_clock::now();
+        const float frame_interval = std::chrono::duration<float>(now - m_prev_frame_end_time).count();
+        const bool first_frame = (m_prev_frame_end_time == std::chrono::steady_clock::time_point{});
+        m_prev_frame_end_time = now;
+        if (!m_dynamic_resolution_enabled || first_frame) return;
+
+        // Without GPU timings, the time between frames is the next best thing. When the GPU is the bottleneck, that's how long it took
+        float gpu_frame_time = m_device->gpu_frame_time();
+        if (gpu_frame_time <= 0.0f) gpu_frame_time = frame_interval;
+        resolution_scale = glm::vec2(m_dynamic_resolution.update(gpu_frame_time, cpu_frame_time));
+    }
+
     bool Renderer::supports(RendererFeature feature) {
         return m_device->supports(feature);
     }
 
     void Renderer::render_rasterized() {
-        // Queue rendering scenes
-        m_device->begin_raster_pass(m_pipeline_scene, RasterPassInfo{
-            .color_targets = {
-                m_position_target,
-                m_color_target,
-                m_normal_target,
-                m_metallic_roughness_target,
-                m_emissive_target,
-            },
-            .depth_target = m_depth_target,
-            .clear_on_begin = true,
-        });
-        for (auto& scene : render_queue_scenes) {
-            render_scene_raster(scene.handle);
+        PROFILE_ZONE("Renderer::render_rasterized");
+        // Prepare the scenes' draw lists on this thread first, since that also allocates draw packets and queues lights
+        m_raster_draws.clear();
+        for (const auto& request : queued_scenes()) {
+            gather_scene_raster(request);
         }
-        m_device->end_raster_pass();
+        upload_lights();
+        m_view_data_packet = create_draw_packet(&m_view_data, sizeof(m_view_data));
 
-        // SSAO
-        m_device->begin_compute_pass(m_pipeline_ssao);
-        m_device->use_resources({
-            { m_position_target, ResourceUsage::non_pixel_shader_read },
-            { m_normal_target, ResourceUsage::non_pixel_shader_read },
-            { m_ssao_target, ResourceUsage::compute_write },
-            { m_draw_packets[m_device->frame_index() % backbuffer_count], ResourceUsage::non_pixel_shader_read },
+        bind_frame_graph_resources({});
+        execute_render_graph(m_raster_graph);
+    }
+
+    void Renderer::render_pathtraced() {
+        PROFILE_ZONE("Renderer::render_pathtraced");
+        m_view_data_packet = create_draw_packet(&m_view_data, sizeof(m_view_data));
+
+        bind_frame_graph_resources(get_frame_tlas());
+        execute_render_graph(m_pathtrace_graph);
+    }
+
+    FrameGraphResources Renderer::add_frame_graph_resources(RenderGraph& graph) {
+        FrameGraphResources resources = {
+            .position_target = graph.add_resource("Position target"),
+            .color_target = graph.add_resource("Color target"),
+            .normal_target = graph.add_resource("Normal target"),
+            .metallic_roughness_target = graph.add_resource("Metallic roughness target"),
+            .emissive_target = graph.add_resource("Emissive target"),
+            .depth_target = graph.add_resource("Depth target"),
+            .ssao_target = graph.add_resource("SSAO target"),
+            .shaded_target = graph.add_resource("Shaded target"),
+            .accumulation_target = graph.add_resource("Accumulation target"),
+            .material_buffer = graph.add_resource("Material buffer"),
+            .lights_buffer = graph.add_resource("Lights buffer"),
+            .spherical_harmonics_buffer = graph.add_resource("Spherical harmonics buffer"),
+            .sky = graph.add_resource("Sky"),
+            .ibl = graph.add_resource("IBL"),
+            .env_brdf_lut = graph.add_resource("IBL BRDF LUT"),
+            .frame_tlas = graph.add_resource("Frame TLAS"),
+            .swapchain = graph.add_resource("Swapchain"),
+        };
+        graph.mark_output(resources.swapchain);
+        return resources;
+    }
+
+    void Renderer::build_render_graphs() {
+        // Rasterized
+        m_frame_graph_resources = add_frame_graph_resources(m_raster_graph);
+        const FrameGraphResources& res = m_frame_graph_resources;
+        m_raster_graph.add_pass("Geometry pass", {
+            { res.position_target, ResourceUsage::render_target },
+            { res.color_target, ResourceUsage::render_target },
+            { res.normal_target, ResourceUsage::render_target },
+            { res.metallic_roughness_target, ResourceUsage::render_target },
+            { res.emissive_target, ResourceUsage::render_target },
+            { res.depth_target, ResourceUsage::depth_target },
+            { res.material_buffer, ResourceUsage::non_pixel_shader_read }, // Draw packet pages live in an upload heap, which has to stay in the generic read state, so they're not in here
+        }, [this]() {
+            m_device->begin_raster_pass(m_pipeline_scene, RasterPassInfo{
+                .color_targets = {
+                    m_position_target,
+                    m_color_target,
+                    m_normal_target,
+                    m_metallic_roughness_target,
+                    m_emissive_target,
+                },
+                .depth_target = m_depth_target,
+                .clear_on_begin = true,
+                .viewport_size = glm::uvec2(m_render_resolution),
+            });
+            record_raster_draws();
+            m_device->end_raster_pass();
         });
-        m_device->set_compute_root_constants({
-            64, // n_samples
-            to_fixed_16_16(0.0065f), // radius
-            to_fixed_16_16(0.003f), // bias
-            to_fixed_16_16(1.0f), // strength
-            (uint32_t)m_device->frame_index(),
-            m_position_target.handle.as_u32(),
-            m_normal_target.handle.as_u32(),
-            m_ssao_target.handle.as_u32_uav(),
-            m_draw_packets[m_device->frame_index() % backbuffer_count].handle.as_u32(),
-            m_camera_matrices_offset,
+        m_raster_graph.add_pass("SSAO", {
+            { res.position_target, ResourceUsage::non_pixel_shader_read },
+            { res.normal_target, ResourceUsage::non_pixel_shader_read },
+            { res.ssao_target, ResourceUsage::compute_write },
+        }, [this]() {
+            m_device->begin_compute_pass(m_pipeline_ssao);
+            m_device->set_compute_root_constants({
+                64, // n_samples
+                to_fixed_16_16(0.0065f), // radius
+                to_fixed_16_16(0.003f), // bias
+                to_fixed_16_16(1.0f), // strength
+                (uint32_t)m_device->frame_index(),
+                m_position_target.handle.as_u32(),
+                m_normal_target.handle.as_u32(),
+                m_ssao_target.handle.as_u32_uav(),
+                draw_packet_buffer(m_camera_matrices_packet).handle.as_u32(),
+                m_camera_matrices_packet.offset,
+                to_fixed_16_16(m_view_data.uv_scale.x),
+                to_fixed_16_16(m_view_data.uv_scale.y),
+            });
+            m_device->dispatch_threadgroups( // threadgroup size is 8x8
+                (uint32_t)(m_render_resolution.x / 8.0f),
+                (uint32_t)(m_render_resolution.y / 8.0f),
+                1
+            );
+            m_device->end_compute_pass();
         });
-        m_device->dispatch_threadgroups( // threadgroup size is 8x8
-            (uint32_t)(m_render_resolution.x / 8.0f),
-            (uint32_t)(m_render_resolution.y / 8.0f),
-            1
-        );
-        m_device->end_compute_pass();
-
-        // BRDF
-        const uint32_t view_data_offset = create_draw_packet(&m_view_data, sizeof(m_view_data));
-        m_device->begin_compute_pass(m_pipeline_brdf);
-        m_device->use_resources({
-            { m_shaded_target, ResourceUsage::compute_write },
-            { m_position_target, ResourceUsage::non_pixel_shader_read },
-            { m_color_target, ResourceUsage::non_pixel_shader_read },
-            { m_normal_target, ResourceUsage::non_pixel_shader_read },
-            { m_metallic_roughness_target, ResourceUsage::non_pixel_shader_read },
-            { m_emissive_target, ResourceUsage::non_pixel_shader_read },
-            { m_ssao_target, ResourceUsage::non_pixel_shader_read },
-            { m_lights_buffer, ResourceUsage::non_pixel_shader_read },
-            { m_spherical_harmonics_buffer, ResourceUsage::non_pixel_shader_read },
-            { m_curr_sky_cube.sky, ResourceUsage::non_pixel_shader_read },
-            { m_curr_sky_cube.ibl, ResourceUsage::non_pixel_shader_read },
-            { m_env_brdf_lut, ResourceUsage::non_pixel_shader_read },
-            { m_draw_packets[m_device->frame_index() % backbuffer_count], ResourceUsage::non_pixel_shader_read }
+        m_raster_graph.add_pass("BRDF", {
+            { res.shaded_target, ResourceUsage::compute_write },
+            { res.position_target, ResourceUsage::non_pixel_shader_read },
+            { res.color_target, ResourceUsage::non_pixel_shader_read },
+            { res.normal_target, ResourceUsage::non_pixel_shader_read },
+            { res.metallic_roughness_target, ResourceUsage::non_pixel_shader_read },
+            { res.emissive_target, ResourceUsage::non_pixel_shader_read },
+            { res.ssao_target, ResourceUsage::non_pixel_shader_read },
+            { res.lights_buffer, ResourceUsage::non_pixel_shader_read },
+            { res.spherical_harmonics_buffer, ResourceUsage::non_pixel_shader_read },
+            { res.sky, ResourceUsage::non_pixel_shader_read },
+            { res.ibl, ResourceUsage::non_pixel_shader_read },
+            { res.env_brdf_lut, ResourceUsage::non_pixel_shader_read },
+        }, [this]() {
+            m_device->begin_compute_pass(m_pipeline_brdf);
+            m_device->set_compute_root_constants({
+                m_shaded_target.handle.as_u32_uav(),
+                m_position_target.handle.as_u32(),
+                m_color_target.handle.as_u32(),
+                m_normal_target.handle.as_u32(),
+                m_metallic_roughness_target.handle.as_u32(),
+                m_emissive_target.handle.as_u32(),
+                m_ssao_target.handle.as_u32(),
+                m_lights_buffers[m_device->frame_index() % backbuffer_count].handle.as_u32(),
+                m_spherical_harmonics_buffer.handle.as_u32(),
+                m_curr_sky_cube.sky.handle.as_u32(),
+                m_curr_sky_cube.ibl.handle.as_u32(),
+                m_curr_sky_cube.offset_diffuse_sh,
+                (uint32_t)(m_curr_sky_cube.ibl.resource != nullptr ? m_curr_sky_cube.ibl.resource->subresource_handles.size() : 0),
+                draw_packet_buffer(m_view_data_packet).handle.as_u32(),
+                m_view_data_packet.offset,
+                m_env_brdf_lut.handle.as_u32()
+            });
+            m_device->dispatch_threadgroups( // threadgroup size is 8x8
+                (uint32_t)(m_render_resolution.x / 8.0f),
+                (uint32_t)(m_render_resolution.y / 8.0f),
+                1
+            );
+            m_device->end_compute_pass();
         });
-        m_device->set_compute_root_constants({
-            m_shaded_target.handle.as_u32_uav(),
-            m_position_target.handle.as_u32(),
-            m_color_target.handle.as_u32(),
-            m_normal_target.handle.as_u32(),
-            m_metallic_roughness_target.handle.as_u32(),
-            m_emissive_target.handle.as_u32(),
-            m_ssao_target.handle.as_u32(),
-            m_lights_buffer.handle.as_u32(),
-            m_spherical_harmonics_buffer.handle.as_u32(),
-            m_curr_sky_cube.sky.handle.as_u32(),
-            m_curr_sky_cube.ibl.handle.as_u32(),
-            m_curr_sky_cube.offset_diffuse_sh,
-            (uint32_t)(m_curr_sky_cube.ibl.resource != nullptr ? m_curr_sky_cube.ibl.resource->subresource_handles.size() : 0),
-            m_draw_packets[m_device->frame_index() % backbuffer_count].handle.as_u32(),
-            view_data_offset,
-            m_env_brdf_lut.handle.as_u32()
+        add_post_processing_passes(m_raster_graph);
+        m_raster_graph.compile();
+
+        // Path traced
+        add_frame_graph_resources(m_pathtrace_graph);
+        m_pathtrace_graph.add_pass("Path tracing", {
+            { res.frame_tlas, ResourceUsage::acceleration_structure },
+            { res.material_buffer, ResourceUsage::non_pixel_shader_read },
+            { res.accumulation_target, ResourceUsage::compute_write },
+            { res.shaded_target, ResourceUsage::compute_write },
+            { res.sky, ResourceUsage::non_pixel_shader_read },
+        }, [this]() {
+            const ResourceHandlePair& tlas = m_frame_graph_handles[m_frame_graph_resources.frame_tlas];
+            if (!tlas.resource) return;
+
+            m_device->begin_compute_pass(m_pipeline_pathtrace);
+            m_device->set_compute_root_constants({
+                (uint32_t)(input::mouse_button(input::MouseButton::right) || m_reset_accumulation), // reset accumulation buffer
+                1, // enable anti aliasing
+                4, // rays per pixel
+                4, // bounces per ray
+                tlas.handle.as_u32(),
+                m_accumulation_target.handle.as_u32_uav(),
+                m_shaded_target.handle.as_u32_uav(),
+                m_curr_sky_cube.sky.handle.as_u32(),
+                m_material_buffer.handle.as_u32(),
+                draw_packet_buffer(m_view_data_packet).handle.as_u32(),
+                m_view_data_packet.offset,
+                (uint32_t)m_device->frame_index(),
+            });
+            m_device->dispatch_threadgroups( // threadgroup size is 8x8
+                (uint32_t)(m_render_resolution.x / 8.0f),
+                (uint32_t)(m_render_resolution.y / 8.0f),
+                1
+            );
+            m_device->end_compute_pass();
+            m_reset_accumulation = false;
         });
-        m_device->dispatch_threadgroups( // threadgroup size is 8x8
-            (uint32_t)(m_render_resolution.x / 8.0f),
-            (uint32_t)(m_render_resolution.y / 8.0f),
-            1
-        );
-        m_device->end_compute_pass();
+        add_post_processing_passes(m_pathtrace_graph);
+        m_pathtrace_graph.compile();
+
+        m_frame_graph_handles.resize(m_raster_graph.n_resources());
+
+        // Full resolution targets live in one heap, shared where their lifetimes allow it
+        m_transient_targets = {
+            { &m_position_target, res.position_target, false },
+            { &m_color_target, res.color_target, false },
+            { &m_normal_target, res.normal_target, false },
+            { &m_metallic_roughness_target, res.metallic_roughness_target, false },
+            { &m_emissive_target, res.emissive_target, false },
+            { &m_depth_target, res.depth_target, false },
+            { &m_ssao_target, res.ssao_target, false },
+            { &m_shaded_target, res.shaded_target, false },
+            { &m_accumulation_target, res.accumulation_target, true },
+        };
+        m_transient_target_indices.assign(m_raster_graph.n_resources(), ~0u);
+        for (uint32_t i = 0; i < m_transient_targets.size(); ++i) {
+            m_transient_target_indices[m_transient_targets[i].graph_resource] = i;
+        }
+        m_transient_target_active.assign(m_transient_targets.size(), true);
     }
 
-    void Renderer::render_pathtraced() {
-        const uint32_t view_data_offset = create_draw_packet(&m_view_data, sizeof(m_view_data));
-        
-        // todo: unhardcode
-        const auto& scene_handle = render_queue_scenes.begin();
-        SceneNode* scene = render_queue_scenes.begin()->resource->expect_scene().root;
-
-        m_device->begin_compute_pass(m_pipeline_pathtrace);
-        m_device->use_resources({
-            { scene->expect_root().tlas, ResourceUsage::acceleration_structure },
-            { m_material_buffer, ResourceUsage::non_pixel_shader_read },
-            { m_accumulation_target, ResourceUsage::compute_write },
-            { m_shaded_target, ResourceUsage::compute_write },
-            { m_curr_sky_cube.sky, ResourceUsage::non_pixel_shader_read },
-            { m_draw_packets[m_device->frame_index() % backbuffer_count], ResourceUsage::non_pixel_shader_read }
+    void Renderer::add_post_processing_passes(RenderGraph& graph) {
+        const FrameGraphResources& res = m_frame_graph_resources;
+        graph.add_pass("Tonemapping", {
+            { res.shaded_target, ResourceUsage::compute_write },
+        }, [this]() {
+            m_device->begin_compute_pass(m_pipeline_tonemapping);
+            m_device->set_compute_root_constants({
+                m_shaded_target.handle.as_u32_uav(),
+            });
+            m_device->dispatch_threadgroups( // threadgroup size is 8x8
+                (uint32_t)(m_render_resolution.x / 8.0f),
+                (uint32_t)(m_render_resolution.y / 8.0f),
+                1
+            );
+            m_device->end_compute_pass();
         });
-        m_device->set_compute_root_constants({
-            (uint32_t)input::mouse_button(input::MouseButton::right), // reset accumulation buffer
-            1, // enable anti aliasing
-            4, // rays per pixel
-            4, // bounces per ray
-            scene->expect_root().tlas.handle.as_u32(),
-            m_accumulation_target.handle.as_u32_uav(),
-            m_shaded_target.handle.as_u32_uav(),
-            m_curr_sky_cube.sky.handle.as_u32(),
-            m_material_buffer.handle.as_u32(),
-            m_draw_packets[m_device->frame_index() % backbuffer_count].handle.as_u32(),
-            view_data_offset,
-            (uint32_t)m_device->frame_index(),
+        graph.add_pass("Final blit", {
+            { res.shaded_target, ResourceUsage::pixel_shader_read },
+            { res.swapchain, ResourceUsage::render_target },
+        }, [this]() {
+            m_device->begin_raster_pass(m_pipeline_final_blit, RasterPassInfo{
+                .color_targets = {}, // render to swapchain
+                .clear_on_begin = false, // We're blitting to the entire buffer, no need to clear first
+            });
+            m_device->set_graphics_root_constants({
+                m_shaded_target.handle.as_u32(), // Texture to blit to screen
+                to_fixed_16_16(m_view_data.uv_scale.x),
+                to_fixed_16_16(m_view_data.uv_scale.y),
+            });
+            m_device->draw_vertices(3); // Triangle covering entire screen
+            m_device->end_raster_pass();
         });
-        m_device->dispatch_threadgroups( // threadgroup size is 8x8
-            (uint32_t)(m_render_resolution.x / 8.0f),
-            (uint32_t)(m_render_resolution.y / 8.0f),
-            1
+    }
+
+    void Renderer::bind_frame_graph_resources(const ResourceHandlePair& frame_tlas) {
+        const FrameGraphResources& res = m_frame_graph_resources;
+        m_frame_graph_handles[res.position_target] = m_position_target;
+        m_frame_graph_handles[res.color_target] = m_color_target;
+        m_frame_graph_handles[res.normal_target] = m_normal_target;
+        m_frame_graph_handles[res.metallic_roughness_target] = m_metallic_roughness_target;
+        m_frame_graph_handles[res.emissive_target] = m_emissive_target;
+        m_frame_graph_handles[res.depth_target] = m_depth_target;
+        m_frame_graph_handles[res.ssao_target] = m_ssao_target;
+        m_frame_graph_handles[res.shaded_target] = m_shaded_target;
+        m_frame_graph_handles[res.accumulation_target] = m_accumulation_target;
+        m_frame_graph_handles[res.material_buffer] = m_material_buffer;
+        m_frame_graph_handles[res.lights_buffer] = m_lights_buffers[m_device->frame_index() % backbuffer_count];
+        m_frame_graph_handles[res.spherical_harmonics_buffer] = m_spherical_harmonics_buffer;
+        m_frame_graph_handles[res.sky] = m_curr_sky_cube.sky;
+        m_frame_graph_handles[res.ibl] = m_curr_sky_cube.ibl;
+        m_frame_graph_handles[res.env_brdf_lut] = m_env_brdf_lut;
+        m_frame_graph_handles[res.frame_tlas] = frame_tlas;
+        m_frame_graph_handles[res.swapchain] = {}; // `begin_raster_pass()` takes care of the swapchain
+    }
+
+    void Renderer::execute_render_graph(const RenderGraph& graph) {
+        PROFILE_ZONE("Execute render graph");
+        for (uint32_t pass_index : graph.pass_order()) {
+            // Targets that share memory need an aliasing barrier before the transition, whenever another one used that memory in between
+            for (const RenderGraphAccess& access : graph.pass(pass_index).accesses) {
+                const uint32_t target_index = m_transient_target_indices[access.resource];
+                if (target_index != ~0u && !m_transient_target_active[target_index]) activate_transient_target(target_index);
+            }
+
+            // Queue the barriers, so they get recorded as one batch when the pass begins
+            for (const RenderGraphBarrier& barrier : graph.barriers(pass_index)) {
+                const ResourceHandlePair& resource = m_frame_graph_handles[barrier.resource];
+                if (barrier.uav_only) m_device->queue_uav_barrier(resource);
+                else m_device->queue_resource_transition(resource, barrier.usage);
+            }
+            graph.pass(pass_index).execute();
+        }
+    }
+
+    void Renderer::place_transient_targets() {
+        if (!m_device->supports(RendererFeature::mixed_resource_heaps)) {
+            LOG(Warning, "Resource heap tier 2 isn't supported, render targets won't share memory");
+            return;
+        }
+
+        // Lay the graphs out one after the other on a timeline. Only one of them runs each frame, so targets that only the rasterizer
+        // uses can share memory with the ones only the path tracer uses
+        std::vector<TransientLifetime> lifetimes(m_raster_graph.n_resources());
+        const uint32_t pathtrace_begin = extend_transient_lifetimes(m_raster_graph, 0, lifetimes);
+        const uint32_t pathtrace_end = extend_transient_lifetimes(m_pathtrace_graph, pathtrace_begin, lifetimes);
+
+        std::vector<TransientResource> resources(m_transient_targets.size());
+        for (size_t i = 0; i < m_transient_targets.size(); ++i) {
+            const TransientTarget& target = m_transient_targets[i];
+            TransientResource& resource = resources[i];
+            m_device->get_allocation_info(*target.texture, resource.size, resource.alignment);
+            resource.lifetime = lifetimes[target.graph_resource];
+
+            // Persistent targets take up their graphs from start to end, so nothing in the same graph can overwrite them between frames
+            if (target.persistent) {
+                const TransientLifetime raster_graph = { 0, pathtrace_begin - 1 };
+                const TransientLifetime pathtrace_graph = { pathtrace_begin, pathtrace_end - 1 };
+                if (resource.lifetime.overlaps(raster_graph)) {
+                    resource.lifetime.extend(raster_graph.first_pass);
+                    resource.lifetime.extend(raster_graph.last_pass);
+                }
+                if (resource.lifetime.overlaps(pathtrace_graph)) {
+                    resource.lifetime.extend(pathtrace_graph.first_pass);
+                    resource.lifetime.extend(pathtrace_graph.last_pass);
+                }
+            }
+        }
+
+        // The old placed targets are replaced one by one, so the old heap can go once they're all moved
+        m_transient_layout = pack_transient_resources(resources);
+        ComPtr<ID3D12Heap> heap = m_device->create_heap("Transient render targets", m_transient_layout.heap_size);
+        for (size_t i = 0; i < m_transient_targets.size(); ++i) {
+            m_device->place_texture(*m_transient_targets[i].texture, heap.Get(), m_transient_layout.offsets[i]);
+            m_transient_target_active[i] = m_transient_layout.aliases[i].empty();
+        }
+        m_transient_heap = heap;
+        m_transient_heap_memory_record = m_device->track_heap_memory("Transient render targets", m_transient_layout.heap_size, "Render targets");
+        m_reset_accumulation = true; // Placed memory starts out with garbage in it
+
+        LOG(Info, "Render targets: %.2f MiB in a shared heap, would be %.2f MiB without aliasing",
+            (double)m_transient_layout.heap_size / (1024.0 * 1024.0),
+            (double)m_transient_layout.unaliased_size / (1024.0 * 1024.0)
         );
-        m_device->end_compute_pass();    
+    }
+
+    void Renderer::activate_transient_target(uint32_t target_index) {
+        const TransientTarget& target = m_transient_targets[target_index];
+        m_device->queue_aliasing_barrier(*target.texture);
+        m_transient_target_active[target_index] = true;
+        for (uint32_t alias : m_transient_layout.aliases[target_index]) {
+            m_transient_target_active[alias] = false;
+        }
+        if (target.texture == &m_accumulation_target) m_reset_accumulation = true;
     }
 
     void Renderer::unload_resource(ResourceHandlePair& resource) {
@@ -364,11 +733,11 @@ namespace gfx {
         m_device->queue_unload_bindless_resource(resource);
         
         // Since the device now owns the resource, we can get rid of it here
-        m_resources.erase(resource.handle.id);
+        m_resources.erase(resource.handle.key());
     }
 
     ResourceHandlePair Renderer::load_texture(const std::string& path, bool free_after_upload) {
-        stbi__vertically_flip_on_load = 0;
+        stbi_set_flip_vertically_on_load(0);
         int width, height, channels;
         uint8_t* data = stbi_load(path.c_str(), &width, &height, &channels, 4);
         auto texture = load_texture(path, width, height, 1, data, PixelFormat::rgba8_unorm, TextureType::tex_2d, ResourceUsage::compute_write, true); // todo: implement mipmapping and set this to true
@@ -378,25 +747,25 @@ namespace gfx {
 
     ResourceHandlePair Renderer::load_texture(const std::string& name, uint32_t width, uint32_t height, uint32_t depth, void* data, PixelFormat pixel_format, TextureType type, ResourceUsage usage, bool allocate_mips) {
         ResourceHandlePair texture = m_device->load_texture(name, width, height, depth, data, pixel_format, type, usage, allocate_mips ? 999 : 1);
-        m_resources[texture.handle.id] = texture.resource;
+        m_resources[texture.handle.key()] = texture;
         return texture;
     }
 
     ResourceHandlePair Renderer::create_buffer(const std::string& name, size_t size, void* data, ResourceUsage usage) {
         ResourceHandlePair buffer = m_device->create_buffer(name, size, data, usage);
-        m_resources[buffer.handle.id] = buffer.resource;
+        m_resources[buffer.handle.key()] = buffer;
         return buffer;
     }
 
     ResourceHandlePair Renderer::create_blas(const std::string& name, const ResourceHandlePair& position_buffer, const ResourceHandlePair& index_buffer, const uint32_t vertex_count, const uint32_t index_count) {
         ResourceHandlePair blas = m_device->create_blas(name, position_buffer, index_buffer, vertex_count, index_count);
-        m_resources[blas.handle.id] = blas.resource;
+        m_resources[blas.handle.key()] = blas;
         return blas;
     }
 
     ResourceHandlePair Renderer::create_tlas(const std::string& name, const std::vector<RaytracingInstance>& instances) {
         ResourceHandlePair tlas = m_device->create_tlas(name, instances);
-        m_resources[tlas.handle.id] = tlas.resource;
+        m_resources[tlas.handle.key()] = tlas;
         return tlas;
     }
 
@@ -409,7 +778,7 @@ namespace gfx {
     }
 
     void Renderer::generate_mipmaps(ResourceHandlePair& texture) {
-            if (!texture.handle.is_loaded) return;
+            if (texture.resource == nullptr) return;
 
             // Downsample base texture to mip 1
             uint32_t target_width = texture.resource->expect_texture().width / 2;
@@ -497,12 +866,13 @@ namespace gfx {
 
     ResourceHandle Renderer::allocate_non_gpu_resource_handle(ResourceType type) {
         ResourceHandle handle {
-            .id = m_non_gpu_resource_handle_cursor | (1 << 26),
+            .id = m_non_gpu_resource_handle_cursor,
+            .is_cpu_only = 1,
             .type = (uint32_t)type
         };
 
         if (!m_non_gpu_resource_handles_to_reuse.empty()) {
-            handle.id = m_non_gpu_resource_handles_to_reuse.back() | (1 << 26);
+            handle.id = m_non_gpu_resource_handles_to_reuse.back();
             m_non_gpu_resource_handles_to_reuse.pop_back();
         }
         else {
@@ -513,11 +883,22 @@ namespace gfx {
     }
 
     ResourceHandlePair Renderer::load_scene_gltf(const std::string& path) {
+        // If it was decoded during startup, only the upload is left
+        std::shared_ptr<tinygltf::Model> model;
+        if (const auto decoded = m_decoded_scenes.find(path); decoded != m_decoded_scenes.end()) {
+            model = std::move(decoded->second);
+            m_decoded_scenes.erase(decoded);
+        }
+        else {
+            model = decode_gltf(path);
+        }
+
         const auto resource = std::make_shared<Resource>(ResourceType::scene);
-        resource->expect_scene().root = gfx::create_scene_graph_from_gltf(*this, path);
+        const MemoryScope memory_scope(path);
+        resource->expect_scene().root = model ? gfx::create_scene_graph_from_gltf(*this, path, *model) : nullptr;
 
         ResourceHandle handle = allocate_non_gpu_resource_handle(ResourceType::scene);
-        m_resources[handle.id] = resource;
+        m_resources[handle.key()] = ResourceHandlePair{ handle, resource };
 
         return ResourceHandlePair{ handle, resource };
     }
@@ -531,11 +912,21 @@ namespace gfx {
         if (sky_res < ibl_res / 2) {
             LOG(Warning, "Sky resolution (%ix%ix6) is less than half of the IBL resolution (%ix%ix6), resulting in poorer specular quality", sky_res, sky_res, ibl_res, ibl_res);
         }
+        const MemoryScope memory_scope(path);
 
-        // Load HDRI from file
-        stbi__vertically_flip_on_load = 0;
-        int width, height, channels;
-        glm::vec4* data = (glm::vec4*)stbi_loadf(path.c_str(), &width, &height, &channels, 4);
+        // Load HDRI from file, unless it was decoded during startup
+        DecodedImage decoded_hdri;
+        if (const auto decoded = m_decoded_hdris.find(path); decoded != m_decoded_hdris.end()) {
+            decoded_hdri = std::move(decoded->second);
+            m_decoded_hdris.erase(decoded);
+        }
+        else {
+            stbi_set_flip_vertically_on_load(0);
+            decoded_hdri.pixels = std::shared_ptr<void>(stbi_loadf(path.c_str(), &decoded_hdri.width, &decoded_hdri.height, nullptr, 4), stbi_image_free);
+        }
+        const int width = decoded_hdri.width;
+        const int height = decoded_hdri.height;
+        glm::vec4* data = (glm::vec4*)decoded_hdri.pixels.get();
 
         if (!data) {
             LOG(Error, "Failed to load environment map \"%s\" - does the file exist?", path.c_str());
@@ -790,9 +1181,6 @@ namespace gfx {
         }
         m_device->end_compute_pass();
 
-        // We won't need the original image data anymore
-        stbi_image_free(data);
-        
         // Now upload this texture as a cubemap
         return {
             .sky = sky,
@@ -801,63 +1189,230 @@ namespace gfx {
         };
     }
 
-    uint32_t Renderer::create_draw_packet(const void* data, uint32_t size_bytes) {
-        auto reason = m_device->device->GetDeviceRemovedReason();
-        // Allocate data in the draw packets buffer
-        assert(((m_draw_packet_cursor + size_bytes) < DRAW_PACKET_BUFFER_SIZE) && "Failed to allocate draw packet: buffer overflow!");
+    DrawPacket Renderer::create_draw_packet(const void* data, uint32_t size_bytes) {
+        // The pages are persistently mapped, so this is just a copy
+        const LinearAllocation allocation = m_draw_packet_allocator.allocate(size_bytes);
+        memcpy(allocation.cpu_address, data, size_bytes);
+        return DrawPacket{
+            .page = allocation.page,
+            .offset = allocation.offset,
+        };
+    }
 
-        const uint32_t start = m_draw_packet_cursor;
-        m_device->update_buffer(
-            m_draw_packets[m_device->frame_index() % backbuffer_count], 
-            m_draw_packet_cursor,
-            size_bytes,
-            data
-        );
+    static float light_range(const SceneNodeLight& light) {
+        if (light.range > 0.0f) return light.range;
 
-        // Return the byte offset of that draw packet, and update the cursor to the next entry, wrapping at the end
-        add_and_align(m_draw_packet_cursor, size_bytes, (uint32_t)GPU_BUFFER_PREFERRED_ALIGNMENT);
-        return start;
+        // A range of 0 means infinite in glTF, but we need some cutoff to be able to cull lights, so use the distance where it gets too dim to matter
+        const float brightest_channel = std::max({ light.color.r, light.color.g, light.color.b });
+        return sqrtf(light.intensity * brightest_channel / LIGHT_INFLUENCE_CUTOFF);
     }
 
-    void Renderer::traverse_scene_raster(SceneNode* node) {
-        if (!node) return;
-
-        if (node->type == SceneNodeType::mesh) {
-            auto draw_packet = PacketDrawMesh{
-                .model_transform = node->cached_global_transform,
-                .position_offset = glm::vec4(node->position_offset, 0.0f),
-                .position_scale = glm::vec4(node->position_scale, 0.0f),
-                .vertex_buffer = node->expect_mesh().vertex_buffer,
-            };
-            auto n_vertices = m_resources[draw_packet.vertex_buffer.id]->expect_buffer().size / sizeof(VertexCompressed);
-            auto draw_packet_offset = create_draw_packet(&draw_packet, sizeof(draw_packet));
-            m_device->use_resources({
-                { m_draw_packets[m_device->frame_index() % backbuffer_count], ResourceUsage::non_pixel_shader_read, },
-                { m_material_buffer, ResourceUsage::non_pixel_shader_read },
+    void Renderer::queue_light(const SceneNodeLight& light, const glm::mat4& transform) {
+        switch (light.type) {
+        case LightType::Directional:
+            m_lights_directional.push_back(LightDirectional{
+                .color = light.color,
+                .intensity = light.intensity,
+                .direction = glm::normalize(glm::vec3(transform * glm::vec4(0.0, 0.0, -1.0, 0.0)) * m_view_data.rotation),
             });
-            m_device->set_graphics_root_constants({
-                m_draw_packets[m_device->frame_index() % backbuffer_count].handle.as_u32(),
-                (uint32_t)m_camera_matrices_offset,
-                (uint32_t)draw_packet_offset,
-                m_material_buffer.handle.as_u32()
+            break;
+        case LightType::Point:
+            m_lights_point.push_back(LightPoint{
+                .color = light.color,
+                .intensity = light.intensity,
+                .position = glm::vec3(m_view_matrix * transform * glm::vec4(0.0, 0.0, 0.0, 1.0)),
+                .range = light_range(light),
+            });
+            break;
+        case LightType::Spot:
+            m_lights_spot.push_back(LightSpot{
+                .color = light.color,
+                .intensity = light.intensity,
+                .position = glm::vec3(m_view_matrix * transform * glm::vec4(0.0, 0.0, 0.0, 1.0)),
+                .range = light_range(light),
+                .direction = glm::normalize(glm::vec3(m_view_matrix * transform * glm::vec4(0.0, 0.0, -1.0, 0.0))),
+                .inner_cone_angle = light.inner_cone_angle,
+                .outer_cone_angle = light.outer_cone_angle,
+            });
+            break;
+        }
+    }
+
+    void Renderer::gather_scene_raster(const SceneDrawRequest& request) {
+        SceneNode* scene = request.scene.resource->expect_scene().root;
+        if (!scene) return;
+        auto& root = scene->expect_root();
+
+        // Lights are queued in view space, so they're transformed every frame, but there are a lot fewer of them than meshes
+        for (SceneNode* light_node : root.draw_list.light_nodes()) {
+            for (const glm::mat4& instance_transform : request.transforms) {
+                queue_light(light_node->expect_light(), instance_transform * light_node->cached_global_transform);
+            }
+        }
+
+        if (root.draw_list.n_draws() == 0) return;
+
+        // Every mesh in the scene is drawn with the same set of instance transforms, so they only need to be uploaded once
+        const DrawPacket instance_transforms = create_draw_packet(request.transforms.data(), (uint32_t)(request.transforms.size() * sizeof(glm::mat4)));
+        root.draw_list.set_instance_count((uint32_t)request.transforms.size());
+        const uint32_t commands_offset = upload_draw_list(root);
+        m_raster_draws.push_back(RasterDraw{
+            .commands = root.draw_list_buffer,
+            .commands_offset = commands_offset,
+            .n_draws = root.draw_list.n_draws(),
+            .instance_transforms = instance_transforms,
+        });
+    }
+
+    uint32_t Renderer::upload_draw_list(SceneNodeRoot& root) {
+        const SceneDrawList& draw_list = root.draw_list;
+
+        // The buffer holds one copy per frame in flight, so a copy can be rewritten while the GPU is still reading the others
+        if (root.draw_list_buffer_capacity < draw_list.n_draws()) {
+            if (root.draw_list_buffer.resource) unload_resource(root.draw_list_buffer);
+            root.draw_list_buffer_capacity = draw_list.n_draws();
+            const size_t buffer_size = SceneDrawList::gpu_data_size(root.draw_list_buffer_capacity) * backbuffer_count;
+            root.draw_list_buffer = create_buffer("Scene draw list", buffer_size, nullptr, ResourceUsage::cpu_writable);
+            const D3D12_RANGE read_range = { 0, 0 };
+            validate(root.draw_list_buffer.resource->handle->Map(0, &read_range, (void**)&root.draw_list_buffer_mapped));
+            std::fill(std::begin(root.draw_list_buffer_versions), std::end(root.draw_list_buffer_versions), 0);
+        }
+
+        // Only write this frame's copy if the draw list changed since it was last written, so static scenes cost nothing here
+        const uint32_t copy_index = m_device->frame_index() % backbuffer_count;
+        const uint32_t copy_offset = (uint32_t)(copy_index * SceneDrawList::gpu_data_size(root.draw_list_buffer_capacity));
+        if (root.draw_list_buffer_versions[copy_index] != draw_list.version()) {
+            draw_list.write_gpu_data(root.draw_list_buffer_mapped + copy_offset, root.draw_list_buffer.handle.as_u32(), copy_offset);
+            root.draw_list_buffer_versions[copy_index] = draw_list.version();
+        }
+        return copy_offset;
+    }
+
+    void Renderer::record_raster_draws() {
+        if (m_raster_draws.empty()) return;
+
+        // One chunk of consecutive scenes per thread, each recorded into its own command buffer. They're submitted in order, so the result is the same as recording on one thread
+        const uint32_t n_draws = (uint32_t)m_raster_draws.size();
+        const RecordingChunks chunks = split_recording(n_draws, MIN_RASTER_DRAWS_PER_THREAD, m_thread_pool.n_threads());
+        const std::span<RasterPassRecorder> recorders = m_device->fork_raster_pass(chunks.n_chunks);
+        if (recorders.empty()) return;
+
+        const uint32_t camera_buffer = draw_packet_buffer(m_camera_matrices_packet).handle.as_u32();
+        const uint32_t material_buffer = m_material_buffer.handle.as_u32();
+        record_chunks(m_thread_pool, n_draws, chunks, [&](uint32_t chunk_index, uint32_t begin, uint32_t end) {
+            PROFILE_ZONE("Record raster draws");
+            RasterPassRecorder& recorder = recorders[chunk_index];
+            for (uint32_t i = begin; i < end; ++i) {
+                const RasterDraw& draw = m_raster_draws[i];
+                recorder.set_graphics_root_constants({
+                    camera_buffer,
+                    m_camera_matrices_packet.offset,
+                    0, 0, // Set per mesh by the indirect draw commands
+                    material_buffer,
+                    draw_packet_buffer(draw.instance_transforms).handle.as_u32(),
+                    draw.instance_transforms.offset,
                 });
-            m_device->draw_vertices((uint32_t)n_vertices);
+                recorder.draw_indirect(draw.commands, draw.commands_offset, draw.n_draws);
+            }
+        });
+    }
+
+    void Renderer::upload_lights() {
+        if (m_lights_directional.size() > MAX_LIGHTS_DIRECTIONAL) m_lights_directional.resize(MAX_LIGHTS_DIRECTIONAL);
+        if (m_lights_point.size() > MAX_LIGHTS_POINT) m_lights_point.resize(MAX_LIGHTS_POINT);
+        if (m_lights_spot.size() > MAX_LIGHTS_SPOT) m_lights_spot.resize(MAX_LIGHTS_SPOT);
+
+        // Bin point and spot lights into clusters. Their index in this list is also the index the shader gets from the cluster
+        m_cluster_light_bounds.clear();
+        for (const LightPoint& light : m_lights_point) {
+            m_cluster_light_bounds.push_back({ light.position, light.range });
         }
-        else if (node->type == SceneNodeType::light) {
-            m_lights_directional.push_back(LightDirectional{
-                .color = node->expect_light().color,
-                .intensity = node->expect_light().intensity,
-                .direction = glm::normalize(glm::vec3(node->cached_global_transform * glm::vec4(0.0, 0.0, -1.0, 0.0)) * m_view_data.rotation),
-            });
+        for (const LightSpot& light : m_lights_spot) {
+            m_cluster_light_bounds.push_back({ light.position, light.range });
+        }
+        PROFILE_ZONE("Build light clusters");
+        m_light_clusters.build(m_thread_pool, m_cluster_light_bounds, m_view_data.viewport_size, LIGHT_CLUSTER_NEAR, LIGHT_CLUSTER_FAR, MAX_LIGHT_CLUSTER_INDICES);
+        if (m_light_clusters.n_dropped_light_indices > 0) {
+            LOG(Warning, "Light cluster index list is full, %u light indices were dropped", m_light_clusters.n_dropped_light_indices);
         }
-        for (auto& node : node->children) {
-            traverse_scene_raster(node.get());
+
+        const LightBufferHeader header = {
+            .n_directional_lights = (uint32_t)m_lights_directional.size(),
+            .n_point_lights = (uint32_t)m_lights_point.size(),
+            .n_spot_lights = (uint32_t)m_lights_spot.size(),
+            .directional_lights_offset = lights_directional_offset,
+            .point_lights_offset = lights_point_offset,
+            .spot_lights_offset = lights_spot_offset,
+            .clusters_offset = light_clusters_offset,
+            .cluster_light_indices_offset = light_cluster_indices_offset,
+            .cluster_grid_size = { LightClusterGrid::size_x, LightClusterGrid::size_y, LightClusterGrid::size_z },
+            .cluster_near = LIGHT_CLUSTER_NEAR,
+            .cluster_far = LIGHT_CLUSTER_FAR,
+        };
+
+        const auto& lights_buffer = m_lights_buffers[m_device->frame_index() % backbuffer_count];
+        m_device->update_buffer(lights_buffer, 0, sizeof(header), &header);
+        if (!m_lights_directional.empty()) m_device->update_buffer(lights_buffer, lights_directional_offset, (uint32_t)(m_lights_directional.size() * sizeof(LightDirectional)), m_lights_directional.data());
+        if (!m_lights_point.empty()) m_device->update_buffer(lights_buffer, lights_point_offset, (uint32_t)(m_lights_point.size() * sizeof(LightPoint)), m_lights_point.data());
+        if (!m_lights_spot.empty()) m_device->update_buffer(lights_buffer, lights_spot_offset, (uint32_t)(m_lights_spot.size() * sizeof(LightSpot)), m_lights_spot.data());
+        m_device->update_buffer(lights_buffer, light_clusters_offset, (uint32_t)(m_light_clusters.clusters.size() * sizeof(LightCluster)), m_light_clusters.clusters.data());
+        if (!m_light_clusters.light_indices.empty()) m_device->update_buffer(lights_buffer, light_cluster_indices_offset, (uint32_t)(m_light_clusters.light_indices.size() * sizeof(uint32_t)), m_light_clusters.light_indices.data());
+    }
+
+    static bool rt_instances_equal(const std::vector<RaytracingInstance>& a, const std::vector<RaytracingInstance>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i].transform != b[i].transform) return false;
+            if (a[i].instance_id != b[i].instance_id) return false;
+            if (a[i].blas.handle.id != b[i].blas.handle.id) return false;
         }
+        return true;
     }
 
-    void Renderer::render_scene_raster(ResourceHandle scene_handle) {
-        std::shared_ptr<Resource> resource = m_resources[scene_handle.id];
-        SceneNode* scene = m_resources[scene_handle.id]->expect_scene().root;
-        traverse_scene_raster(scene);
+    ResourceHandlePair Renderer::get_frame_tlas() {
+        // A single scene drawn once at its authored transform can just use the TLAS that was built when it was loaded, as long as
+        // nothing in it was moved since
+        if (m_n_queued_scenes == 1 && render_queue_scenes[0].transforms.size() == 1 && render_queue_scenes[0].transforms[0] == glm::mat4(1.0f)) {
+            SceneNode* scene = render_queue_scenes[0].scene.resource->expect_scene().root;
+            if (!scene) return ResourceHandlePair{};
+            if (!scene->expect_root().transforms_changed) return scene->expect_root().tlas;
+        }
+
+        // Otherwise, place a copy of each scene's instances for every instance transform. They all point to the BLASes that already exist
+        auto& instances = m_frame_tlas_scratch_instances;
+        auto& scene_instances = m_frame_tlas_scratch_scene_instances;
+        instances.clear();
+        for (const auto& request : queued_scenes()) {
+            SceneNode* scene = request.scene.resource->expect_scene().root;
+            if (!scene) continue;
+
+            scene_instances.clear();
+            get_rt_instances_from_scene_nodes(scene, scene_instances);
+            for (const glm::mat4& instance_transform : request.transforms) {
+                for (RaytracingInstance instance : scene_instances) {
+                    instance.transform = glm::mat4x3(instance_transform * glm::mat4(instance.transform));
+                    instances.push_back(instance);
+                }
+            }
+        }
+
+        // Most of the time the instances don't move between frames, so only rebuild when something changed
+        if (m_frame_tlas.resource && rt_instances_equal(instances, m_frame_tlas_instances)) {
+            return m_frame_tlas;
+        }
+
+        if (m_frame_tlas.resource) {
+            unload_resource(m_frame_tlas);
+            m_frame_tlas = {};
+        }
+        m_frame_tlas_instances = instances;
+        if (instances.empty()) {
+            return {};
+        }
+
+        // The TLAS is built on the upload queue, so make sure the graphics queue waits for it before tracing rays
+        m_frame_tlas = create_tlas("Instanced scene TLAS", instances);
+        m_device->flush_upload_queue();
+        return m_frame_tlas;
     }
 }
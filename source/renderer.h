@@ -1,19 +1,97 @@
 #pragma once
 #include <memory>
+#include <chrono>
+#include <span>
 #include "device.h"
+#include "dynamic_resolution.h"
+#include "hot_reload.h"
+#include "light_clusters.h"
+#include "linear_allocator.h"
+#include "render_graph.h"
+#include "thread_pool.h"
+#include "transient_resources.h"
 #include <glm/gtx/quaternion.hpp>
 
+namespace tinygltf {
+    class Model;
+}
+
 namespace gfx {
+    struct SceneNodeRoot;
+    struct SceneNodeLight;
+
     struct ViewData {
         glm::quat rotation{};
         glm::vec2 viewport_size{};
         glm::vec3 camera_world_position{};
+        glm::vec2 render_resolution{}; // Part of the render targets that's actually rendered to, in pixels
+        glm::vec2 uv_scale{}; // `render_resolution` divided by the size of the render targets
+    };
+
+    // Location of a draw packet, see `Renderer::create_draw_packet()`
+    struct DrawPacket {
+        uint32_t page = 0; // Index into the renderer's draw packet pages
+        uint32_t offset = 0; // Byte offset into that page
+    };
+
+    // Indirect draw for all meshes in one scene, gathered on the main thread, so the draws themselves can be recorded on multiple threads
+    struct RasterDraw {
+        ResourceHandlePair commands; // Indirect argument buffer, see `SceneDrawList::write_gpu_data()`
+        uint32_t commands_offset;
+        uint32_t n_draws;
+        DrawPacket instance_transforms;
+    };
+
+    // Every GPU resource the frame's render graphs use. Both graphs add them in the same order, so the IDs work for either one
+    struct FrameGraphResources {
+        RenderGraphResource position_target;
+        RenderGraphResource color_target;
+        RenderGraphResource normal_target;
+        RenderGraphResource metallic_roughness_target;
+        RenderGraphResource emissive_target;
+        RenderGraphResource depth_target;
+        RenderGraphResource ssao_target;
+        RenderGraphResource shaded_target;
+        RenderGraphResource accumulation_target;
+        RenderGraphResource material_buffer;
+        RenderGraphResource lights_buffer;
+        RenderGraphResource spherical_harmonics_buffer;
+        RenderGraphResource sky;
+        RenderGraphResource ibl;
+        RenderGraphResource env_brdf_lut;
+        RenderGraphResource frame_tlas;
+        RenderGraphResource swapchain;
+    };
+
+    // Full resolution target that gets placed in the shared transient heap
+    struct TransientTarget {
+        ResourceHandlePair* texture;
+        RenderGraphResource graph_resource;
+        bool persistent; // Keeps its contents between frames, so it can't share memory with anything else used by the same graph
+    };
+
+    struct SceneDrawRequest {
+        ResourceHandlePair scene;
+        std::vector<glm::mat4> transforms; // One entry per instance, applied on top of the scene's authored transforms
+    };
+
+    // Files to decode while the renderer starts up, in parallel with compiling the shaders. Loading them afterwards with
+    // `load_scene_gltf()` or `load_environment_map()` then only has to upload them
+    struct StartupAssets {
+        std::vector<std::string> scenes;
+        std::vector<std::string> environment_maps;
+    };
+
+    struct DecodedImage {
+        int width = 0;
+        int height = 0;
+        std::shared_ptr<void> pixels;
     };
 
     class Renderer {
     public:
         // Initialisation and state
-        Renderer(int width, int height, bool debug_layer_enabled, bool gpu_profiling_enabled);
+        Renderer(int width, int height, bool debug_layer_enabled, bool gpu_profiling_enabled, const StartupAssets& startup_assets = {});
         ~Renderer();
         Renderer(const Renderer&) = delete;
         Renderer& operator=(const Renderer&) = delete;
@@ -25,8 +103,12 @@ namespace gfx {
         void end_frame();
         void set_camera(Transform& transform);
         void set_skybox(Cubemap& sky);
-        void draw_scene(ResourceHandlePair scene_handle);
+        void draw_scene(ResourceHandlePair scene_handle); // Draws the scene once, at its authored transform
+        void draw_scene(ResourceHandlePair scene_handle, const glm::mat4& transform);
+        void draw_scene(ResourceHandlePair scene_handle, std::span<const glm::mat4> transforms); // Draws the scene once per transform, reusing the same buffers and BLASes for every instance
         void set_resolution_scale(glm::vec2 scale);
+        void enable_dynamic_resolution(const DynamicResolutionSettings& settings); // Picks the resolution scale every frame to stay within `settings.target_frame_time`, overriding `set_resolution_scale()`
+        void disable_dynamic_resolution();
 
         // Different rendering types
         bool supports(RendererFeature feature);
@@ -45,18 +127,32 @@ namespace gfx {
         void resize_texture(ResourceHandlePair& texture, const uint32_t width, const uint32_t height);
         void generate_mipmaps(ResourceHandlePair& texture);
         void reconstruct_normal_map(ResourceHandlePair& texture);
+        const MemoryTracker& memory_tracker() const { return m_device->memory_tracker(); } // Memory used by every resource that's alive, per type, scene and category
 
-        friend SceneNode* create_scene_graph_from_gltf(Renderer& renderer, const std::string& path);
+        friend SceneNode* create_scene_graph_from_gltf(Renderer& renderer, const std::string& path, tinygltf::Model& model);
 
     private:
-        void traverse_scene_raster(SceneNode* node);
-        void render_scene_raster(ResourceHandle scene_handle);
+        void build_render_graphs();
+        FrameGraphResources add_frame_graph_resources(RenderGraph& graph);
+        void add_post_processing_passes(RenderGraph& graph); // Tonemapping and the final blit to the swapchain
+        void bind_frame_graph_resources(const ResourceHandlePair& frame_tlas); // Points the graph resources to this frame's GPU resources
+        void execute_render_graph(const RenderGraph& graph);
+        void place_transient_targets(); // Works out which full resolution targets can share memory, and moves them into one heap
+        void activate_transient_target(uint32_t target_index); // Records an aliasing barrier if other targets used its memory since it was last used
+        void update_dynamic_resolution(); // Feeds this frame's timings to the resolution controller
+        void gather_scene_raster(const SceneDrawRequest& request); // Adds the scene to `m_raster_draws`, and queues its lights
+        uint32_t upload_draw_list(SceneNodeRoot& root); // Makes sure this frame's GPU copy of the scene's draw list is up to date, and returns its offset in `root.draw_list_buffer`
+        void queue_light(const SceneNodeLight& light, const glm::mat4& transform);
+        void record_raster_draws(); // Records `m_raster_draws` into the current raster pass, split over the thread pool
+        void upload_lights(); // Bins the queued point and spot lights into clusters, and uploads everything to this frame's lights buffer
+        ResourceHandlePair get_frame_tlas(); // Returns a TLAS containing every queued scene instance, rebuilding it only when the instances change
         std::pair<int, Material*> allocate_material_slot();
         ResourceHandle allocate_non_gpu_resource_handle(ResourceType type);
-        uint32_t create_draw_packet(const void* data, uint32_t size_bytes); // Returns the byte offset into the `m_draw_packets` buffer where this new draw packet was allocated
+        DrawPacket create_draw_packet(const void* data, uint32_t size_bytes); // Copies the data into this frame's draw packet memory. It stays valid until the end of the frame
+        const ResourceHandlePair& draw_packet_buffer(DrawPacket packet) const { return m_draw_packet_pages[packet.page]; }
 
         std::unique_ptr<Device> m_device;
-        std::unordered_map<uint32_t, std::shared_ptr<Resource>> m_resources; // Maps linking resource IDs and actual resource data
+        std::unordered_map<uint32_t, ResourceHandlePair> m_resources; // Maps linking resource keys (see `ResourceHandle::key()`) and actual resource data
         std::vector<uint32_t> m_non_gpu_resource_handles_to_reuse; // Non-GPU resources are resources that are useful on the CPU side, but don't directly correspond to a single GPU descriptor
         uint32_t m_non_gpu_resource_handle_cursor = 0;
         ResourceHandlePair m_position_target = { ResourceHandle::none(), nullptr };
@@ -74,8 +170,20 @@ namespace gfx {
         uint32_t m_spherical_harmonics_buffer_cursor = 0;
         glm::vec2 m_resolution = { 0.0f, 0.0f };
         glm::vec2 m_render_resolution = { 0.0f, 0.0f };
+        glm::vec2 m_target_resolution = { 0.0f, 0.0f }; // Size the full resolution targets are allocated at, the largest `m_render_resolution` can get without reallocating
         glm::vec2 resolution_scale = { 1.0f, 1.0f };
-        std::vector<ResourceHandlePair> render_queue_scenes;
+        DynamicResolutionController m_dynamic_resolution;
+        bool m_dynamic_resolution_enabled = false;
+        std::chrono::steady_clock::time_point m_frame_start_time{};
+        std::chrono::steady_clock::time_point m_prev_frame_end_time{};
+        std::span<SceneDrawRequest> queued_scenes() { return { render_queue_scenes.data(), m_n_queued_scenes }; }
+        std::vector<SceneDrawRequest> render_queue_scenes; // Only the first `m_n_queued_scenes` are queued this frame, the rest are kept for reuse
+        uint32_t m_n_queued_scenes = 0;
+        std::vector<RasterDraw> m_raster_draws; // Scene draws for the geometry pass this frame
+        std::vector<RaytracingInstance> m_frame_tlas_instances; // Instances the current `m_frame_tlas` was built from
+        std::vector<RaytracingInstance> m_frame_tlas_scratch_instances;
+        std::vector<RaytracingInstance> m_frame_tlas_scratch_scene_instances;
+        ResourceHandlePair m_frame_tlas{}; // TLAS built from all queued scene instances, if they can't use the scene's own TLAS
         std::shared_ptr<Pipeline> m_pipeline_scene = nullptr;
         std::shared_ptr<Pipeline> m_pipeline_brdf = nullptr;
         std::shared_ptr<Pipeline> m_pipeline_tonemapping = nullptr;
@@ -90,15 +198,36 @@ namespace gfx {
         std::shared_ptr<Pipeline> m_pipeline_ssao = nullptr;
         std::shared_ptr<Pipeline> m_pipeline_pathtrace = nullptr;
         std::shared_ptr<Pipeline> m_pipeline_reconstruct_normal_map = nullptr;
+        std::unique_ptr<PipelineHotReload> m_pipeline_hot_reload; // Swaps the pipelines above when their shaders change
         std::vector<int> m_material_indices_to_reuse;
         std::vector<Material> m_materials; // Should be uploaded to the GPU after modifying
         ResourceHandlePair m_material_buffer{}; // Buffer that contains all currently loaded materials
         bool m_should_update_material_buffer = false;
         std::vector<LightDirectional> m_lights_directional; // All currently queued directional lights
-        ResourceHandlePair m_lights_buffer{}; // Buffer that contains all queued lights for this frame
-        ResourceHandlePair m_draw_packets[backbuffer_count]; // Scratch buffer that is used to send draw info to the shader pipelines
-        uint32_t m_draw_packet_cursor = 0; // Current allocation offset into the draw packet buffer
-        uint32_t m_camera_matrices_offset = 0; // Where the camera matrices for this frame are stored
+        std::vector<LightPoint> m_lights_point; // All currently queued point lights, in view space
+        std::vector<LightSpot> m_lights_spot; // All currently queued spot lights, in view space
+        std::vector<ClusterLightBounds> m_cluster_light_bounds; // Point lights followed by spot lights, used for binning them into clusters
+        LightClusterGrid m_light_clusters;
+        ResourceHandlePair m_lights_buffers[backbuffer_count]; // Buffer that contains all queued lights for this frame, and the light clusters
+        LinearAllocator m_draw_packet_allocator; // Hands out scratch memory that is used to send draw info to the shader pipelines
+        std::vector<ResourceHandlePair> m_draw_packet_pages; // Persistently mapped upload buffers backing `m_draw_packet_allocator`
+        DrawPacket m_camera_matrices_packet{}; // Where the camera matrices for this frame are stored
+        RenderGraph m_raster_graph;
+        RenderGraph m_pathtrace_graph;
+        FrameGraphResources m_frame_graph_resources{};
+        std::vector<ResourceHandlePair> m_frame_graph_handles; // GPU resource for each render graph resource, bound every frame
+        std::vector<TransientTarget> m_transient_targets;
+        std::vector<uint32_t> m_transient_target_indices; // Per render graph resource, index into `m_transient_targets`, or `~0u`
+        std::vector<bool> m_transient_target_active; // Whether the target's memory still holds its own data, rather than another target's
+        TransientHeapLayout m_transient_layout;
+        ComPtr<ID3D12Heap> m_transient_heap = nullptr;
+        std::shared_ptr<void> m_transient_heap_memory_record = nullptr; // The targets placed in it aren't tracked on their own
+        bool m_reset_accumulation = false; // Set when the accumulation target's contents were lost
+        DrawPacket m_view_data_packet{}; // This frame's `m_view_data`
         ViewData m_view_data{};
+        glm::mat4 m_view_matrix{ 1.0f };
+        ThreadPool m_thread_pool;
+        std::unordered_map<std::string, std::shared_ptr<tinygltf::Model>> m_decoded_scenes; // Decoded during startup, but not loaded yet
+        std::unordered_map<std::string, DecodedImage> m_decoded_hdris;
     };
 }
@@ -1,11 +1,13 @@
 #pragma once
 #include "common.h"
+#include "gpu_structs.h"
 #include <d3d12.h>
 
 #include <glm/vec4.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
 #include <glm/matrix.hpp>
+#include <memory>
 #include <optional>
 #include <variant>
 
@@ -33,61 +35,12 @@ namespace gfx {
         tex_cube
     };
 
-    // General
-    enum class ResourceType {
-        none = 0,
-        texture,
-        buffer,
-        scene,
-        acceleration_structure
-    };
-    inline const char* _resource_type_names[] = { "None", "Texture", "Buffer"};
-
-    enum class ResourceUsage : uint8_t {
-        none = 0,
-        read,
-        render_target,
-        depth_target,
-        compute_write,
-        pixel_shader_read,
-        non_pixel_shader_read,
-        cpu_writable,
-        cpu_read_write,
-        acceleration_structure
-    };
-
-    struct ResourceHandle {
-        uint32_t id : 27;
-        uint32_t is_loaded : 1;
-        uint32_t type : 4;
-        bool operator==(const ResourceHandle& rhs) {
-            // We only really need to check if the IDs are identical, but we should sanity check the rest too
-            assert(type == rhs.type);
-            assert(is_loaded == rhs.is_loaded);
-            return id == rhs.id;
-        }
-        static ResourceHandle none() {
-            return ResourceHandle{
-                .id = 0,
-                .is_loaded = 0,
-                .type = (uint32_t)ResourceType::none,
-            };
-        }
-        uint32_t as_u32() const {
-            return id | is_loaded << 27 | type << 28;
-        }
-        uint32_t as_u32_uav() const {
-            return (id+1) | is_loaded << 27 | type << 28;
-        }
-    };
-
     struct ResourceHandlePair {
         ResourceHandle handle = ResourceHandle::none();
         std::shared_ptr<Resource> resource = nullptr;
     };
 
     struct TextureResource {
-        void* data;
         uint32_t width, height, depth;
         PixelFormat pixel_format;
         // Extra optional handles for render targets
@@ -96,10 +49,10 @@ namespace gfx {
         glm::vec4 clear_color;
         ResourceHandle rtv_handle;
         ResourceHandle dsv_handle;
+        bool needs_discard = false; // Placed render targets that just took over aliased memory have to be cleared or discarded before use
     };
 
     struct BufferResource {
-        void* data;
         uint64_t size;
     };
 
@@ -178,6 +131,8 @@ namespace gfx {
 
         ResourceType type = ResourceType::none;
         ResourceUsage usage = ResourceUsage::none;
+        std::shared_ptr<void> placement; // If the resource is placed in one of the device's heaps, this gives that memory back once it's released
+        std::shared_ptr<void> memory_record; // Takes the resource out of the device's memory tracker once it's released
         ComPtr<ID3D12Resource> handle;
         D3D12_RESOURCE_STATES current_state = D3D12_RESOURCE_STATE_COMMON;
         std::string name;
@@ -189,34 +144,6 @@ namespace gfx {
         std::variant<TextureResource, BufferResource, SceneResource, AccelerationStructureResource> resource;
     }; 
 
-    struct Vertex {
-        glm::vec3 position;
-        glm::vec3 normal;
-        glm::vec4 tangent;
-        glm::vec4 color;
-        glm::vec2 texcoord0;
-        uint32_t material_id;
-    };
-
-    struct VertexFlags1 {
-        uint8_t tangent_sign : 1; // Tangent vector's sign. 1 = positive, 0 = negative
-        uint8_t _reserved : 7;
-    };
-    struct VertexFlags2 {
-        uint8_t _reserved : 8;
-    };
-
-    struct VertexCompressed {
-        glm::u16vec3 position; // 1.14 fixed point positions that need to be dequantized by the mesh's corresponding scaling vectors
-        uint16_t material_id; // Index into the material array. 0xFFFF means no material -> use default material
-        glm::u8vec3 normal; // Normal vector, where 0 = -1.0, 127 = 0.0, 254 = +1.0, kinda like a normal map texture
-        VertexFlags1 flags1;
-        glm::u8vec3 tangent; // Tangent vector, where 0 = -1.0, 127 = 0.0, 254 = +1.0, just like the normal vector
-        VertexFlags2 flags2;
-        glm::u16vec4 color; // Linear RGB 0-1023 for SDR, with brighter HDR colors above that. Alpha is in range 0 - 1023, and values above that should be clamped to 1023 (1.0)
-        glm::vec2 texcoord0;
-    };
-
     struct Triangle {
         Vertex verts[3];
     };
@@ -276,19 +203,6 @@ namespace gfx {
         glm::mat4 projection_matrix;
     };
 
-    struct Material {
-        glm::vec4 color_multiplier = { 1.0f, 1.0f, 1.0f, 1.0f }; // Color to multiply the color texture with.
-        glm::vec3 emissive_multiplier = { 1.0f, 1.0f, 1.0f }; // Color to multiply the emissive texture with.
-        ResourceHandle color_texture = ResourceHandle::none(); // If set to none, a default value of { 1, 1, 1, 1 } will be used.
-        ResourceHandle normal_texture = ResourceHandle::none(); // If set to none, a default value of { 0.5, 0.5, 1.0 } will be used.
-        ResourceHandle metal_roughness_texture = ResourceHandle::none(); // If set to none, a default value of { 0.0, 1.0 } will be used.
-        ResourceHandle emissive_texture = ResourceHandle::none(); // If set to none, a default value of { 0, 0, 0 } will be used.
-        float normal_intensity = 1.0f; // Used to interpolate between { 0.5, 0.5, 1.0 } and the sampled normal map value. Can go beyond 1.0 to make the normal map more intense
-        float roughness_multiplier = 1.0f; // Will be multipled with the sampled roughness texture value
-        float metallic_multiplier = 1.0f; // Will be multiplied with the sample metallic texture value
-        uint64_t reserved = 0; // This makes the struct size 64 bytes, perfect for cache lines
-    };
-
     enum class LightType {
         Directional,
         Point,
@@ -305,17 +219,34 @@ namespace gfx {
         glm::vec3 color; // linear 0.0 - 1.0
         float intensity; // in candela (lm/sr)
         glm::vec3 position;
+        float range; // distance at which the light's influence fades out completely
     };
 
     struct LightSpot {
         glm::vec3 color; // linear 0.0 - 1.0
         float intensity; // in candela (lm/sr)
         glm::vec3 position;
+        float range; // distance at which the light's influence fades out completely
         glm::vec3 direction;
         float inner_cone_angle; // radians
         float outer_cone_angle; // radians
     };
 
+    // Layout of the start of the lights buffer. All offsets are in bytes, from the start of the buffer
+    struct LightBufferHeader {
+        uint32_t n_directional_lights;
+        uint32_t n_point_lights;
+        uint32_t n_spot_lights;
+        uint32_t directional_lights_offset;
+        uint32_t point_lights_offset;
+        uint32_t spot_lights_offset;
+        uint32_t clusters_offset; // Array of { offset, count } pairs into the cluster light index list
+        uint32_t cluster_light_indices_offset; // Indices below `n_point_lights` are point lights, the rest are spot lights
+        glm::uvec3 cluster_grid_size;
+        float cluster_near; // Depth where the first exponential slice starts. Everything closer is in slice 0
+        float cluster_far; // Depth where the last slice ends
+    };
+
     struct Cubemap {
         ResourceHandlePair sky{};
         ResourceHandlePair ibl{};
@@ -6,6 +6,9 @@
 #include <vector>
 #include "resource.h"
 #include "renderer.h"
+#include "light_tree.h"
+#include "draw_list.h"
+#include "gltf_loader.h"
 
 namespace gfx {
     struct Transform {
@@ -31,14 +34,27 @@ namespace gfx {
         ResourceHandle position_buffer;
         ResourceHandle vertex_buffer;
         ResourceHandlePair blas;
+        uint32_t n_vertices = 0;
+        uint32_t draw_index = ~0u; // Index in the scene's `SceneDrawList`
     };
     struct SceneNodeLight {
         LightType type;
         glm::vec3 color;
         float intensity;
+        float range; // 0.0 means infinite
+        float inner_cone_angle; // Only used for spot lights
+        float outer_cone_angle; // Only used for spot lights
     };
     struct SceneNodeRoot {
-        ResourceHandlePair tlas;
+        ResourceHandlePair tlas; // Built at load time, so it's out of date once `transforms_changed` is set
+        bool transforms_changed = false; // Set by `set_node_transform()`
+        LightTree light_tree; // All point lights, spot lights and emissive triangles in the scene, in scene space
+        ResourceHandlePair light_tree_buffer; // `light_tree` uploaded to the GPU, see `LightTree::to_gpu_buffer()`
+        SceneDrawList draw_list; // All meshes and lights in the scene, so drawing it doesn't require walking the scene graph
+        ResourceHandlePair draw_list_buffer; // `backbuffer_count` copies of the draw list's GPU data, see `Renderer::upload_draw_list()`
+        uint8_t* draw_list_buffer_mapped = nullptr;
+        uint32_t draw_list_buffer_capacity = 0; // Number of draws each copy has room for
+        uint64_t draw_list_buffer_versions[backbuffer_count] = {}; // Draw list version each copy was last written with
     };
 
     struct SceneNode {
@@ -77,5 +93,7 @@ namespace gfx {
         std::variant<SceneNodeMesh, SceneNodeLight, SceneNodeRoot> data;
     };
 
-    SceneNode* create_scene_graph_from_gltf(Renderer& renderer, const std::string& path);
+    SceneNode* create_scene_graph_from_gltf(Renderer& renderer, const std::string& path, tinygltf::Model& model);
+    void get_rt_instances_from_scene_nodes(SceneNode* node, std::vector<RaytracingInstance>& instances);
+    void set_node_transform(SceneNode* root, SceneNode* node, const glm::mat4& global_transform); // Moves `node` and everything under it, and patches the meshes in `root`'s draw list. Ray tracing stops using the TLAS from load time and builds one with the new transforms. The light tree isn't rebuilt, so moved lights only affect raster lighting
 }
@@ -1,11 +1,19 @@
 #include "shader.h"
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <d3dcompiler.h>
+
+#define SHADER_CACHE_DIRECTORY "./shader_cache"
 
 namespace gfx {
-    ComPtr<IDxcCompiler3> _dxc_compiler = nullptr;
-    ComPtr<IDxcUtils> _dxc_utils = nullptr;
-    ComPtr<IDxcIncludeHandler> _dxc_include_handler = nullptr;
+    // DXC objects aren't meant to be shared between threads, so every thread that compiles shaders gets its own
+    thread_local ComPtr<IDxcCompiler3> _dxc_compiler = nullptr;
+    thread_local ComPtr<IDxcUtils> _dxc_utils = nullptr;
+    thread_local ComPtr<IDxcIncludeHandler> _dxc_include_handler = nullptr;
+    std::unique_ptr<ShaderCache> _shader_cache = nullptr;
+    std::once_flag _shader_cache_created;
 
     std::string profile_from_shader_type(const ShaderType type) {
         switch (type) {
@@ -36,45 +44,64 @@ namespace gfx {
         return temp;
     }
 
-    Shader::Shader(const std::string& path, const std::string& entry_point, const ShaderType type) {
-        // Init dxc
+    void init_dxc() {
         if (_dxc_compiler.Get() == nullptr) {
             DxcCreateInstance(CLSID_DxcCompiler, IID_PPV_ARGS(&_dxc_compiler));
             DxcCreateInstance(CLSID_DxcUtils, IID_PPV_ARGS(&_dxc_utils));
             _dxc_utils->CreateDefaultIncludeHandler(&_dxc_include_handler);
         }
+    }
+
+    std::string dxc_version_string() {
+        // Part of the cache key, so updating dxc recompiles everything
+        std::string version = "dxc";
+        ComPtr<IDxcVersionInfo> version_info;
+        if (SUCCEEDED(_dxc_compiler.As(&version_info))) {
+            UINT32 major = 0, minor = 0;
+            version_info->GetVersion(&major, &minor);
+            version += " " + std::to_string(major) + "." + std::to_string(minor);
+        }
+        ComPtr<IDxcVersionInfo2> version_info2;
+        if (SUCCEEDED(_dxc_compiler.As(&version_info2))) {
+            UINT32 commit_count = 0;
+            char* commit_hash = nullptr;
+            if (SUCCEEDED(version_info2->GetCommitInfo(&commit_count, &commit_hash)) && commit_hash) {
+                version += " (" + std::to_string(commit_count) + ", " + commit_hash + ")";
+                CoTaskMemFree(commit_hash);
+            }
+        }
+        return version;
+    }
+
+    bool compile_with_dxc(const ShaderCompileRequest& request, std::vector<uint8_t>& bytecode) {
+        init_dxc();
 
         // Load shader file
-        const auto wpath = to_wstring(path);
-        const auto wentry_point = to_wstring(entry_point);
-        const auto wtype = to_wstring(profile_from_shader_type(type));
+        const auto wpath = to_wstring(request.path);
+        const auto wentry_point = to_wstring(request.entry_point);
+        const auto wtype = to_wstring(request.profile);
         ComPtr<IDxcBlobEncoding> source_blob;
-        _dxc_utils->LoadFile(to_wstring(path).c_str(), nullptr, &source_blob);
+        _dxc_utils->LoadFile(wpath.c_str(), nullptr, &source_blob);
 
         if (source_blob.Get() == nullptr) {
-            LOG(Error, "Could not load file '%s'! Does the file exist?", path.c_str());
-            return;
+            LOG(Error, "Could not load file '%s'! Does the file exist?", request.path.c_str());
+            return false;
         }
 
         // Set up compilation arguments
+        std::vector<std::wstring> wargs;
+        for (const auto& argument : request.arguments) {
+            wargs.push_back(to_wstring(argument));
+        }
         std::vector<LPCWSTR> args;
-
-        // TODO: add more args for optimization, debug, stripping reflect/debug
         args.emplace_back(wpath.c_str());
         args.emplace_back(L"-T");
         args.emplace_back(wtype.c_str());
         args.emplace_back(L"-E");
         args.emplace_back(wentry_point.c_str());
-        args.emplace_back(L"-Qstrip_debug");
-        args.emplace_back(L"-Qstrip_reflect");
-        args.emplace_back(L"-HV 2021");
-        args.emplace_back(L"-res-may-alias");
-        args.emplace_back(DXC_ARG_WARNINGS_ARE_ERRORS); //-WX
-#ifdef _DEBUG
-        args.emplace_back(DXC_ARG_DEBUG); //-Zi
-#else
-        args.emplace_back(DXC_ARG_OPTIMIZATION_LEVEL3);
-#endif
+        for (const auto& argument : wargs) {
+            args.emplace_back(argument.c_str());
+        }
 
         // Compile it
         const DxcBuffer buffer {
@@ -97,9 +124,13 @@ namespace gfx {
         validate(result->GetOutput(DXC_OUT_ERRORS, IID_PPV_ARGS(&errors), nullptr));
          
         if (errors != nullptr && errors->GetStringLength() > 0) {
-            LOG(Error, "Error compiling shader '%s':\n\t%s", path.c_str(), errors->GetStringPointer());
+            LOG(Error, "Error compiling shader '%s':\n\t%s", request.path.c_str(), errors->GetStringPointer());
         }
 
+        HRESULT status = S_OK;
+        result->GetStatus(&status);
+        if (FAILED(status)) return false;
+
         // Get PDB file
 #ifdef _DEBUG
         ComPtr<IDxcBlob> pdb_data;
@@ -114,7 +145,49 @@ namespace gfx {
         // Get shader blob
         ComPtr<IDxcBlob> dxc_shader_blob = nullptr;
         validate(result->GetOutput(DXC_OUT_OBJECT, IID_PPV_ARGS(&dxc_shader_blob), nullptr)); 
+        if (dxc_shader_blob == nullptr || dxc_shader_blob->GetBufferSize() == 0) return false;
+
+        const uint8_t* data = (const uint8_t*)dxc_shader_blob->GetBufferPointer();
+        bytecode.assign(data, data + dxc_shader_blob->GetBufferSize());
+        return true;
+    }
+
+    Shader::Shader(const std::string& path, const std::string& entry_point, const ShaderType type) {
+        // Init dxc
+        init_dxc();
+        std::call_once(_shader_cache_created, []() {
+            _shader_cache = std::make_unique<ShaderCache>(SHADER_CACHE_DIRECTORY, dxc_version_string(), compile_with_dxc);
+        });
+
+        // TODO: add more args for optimization, debug, stripping reflect/debug
+        ShaderCompileRequest request = {
+            .path = path,
+            .entry_point = entry_point,
+            .profile = profile_from_shader_type(type),
+            .arguments = {
+                "-Qstrip_debug",
+                "-Qstrip_reflect",
+                "-HV 2021",
+                "-res-may-alias",
+                "-WX",
+#ifdef _DEBUG
+                "-Zi",
+#else
+                "-O3",
+#endif
+            },
+        };
+
+        // Only goes to dxc if this exact shader isn't in the cache yet
+        std::vector<uint8_t> bytecode;
+        if (!_shader_cache->get(request, bytecode)) return;
+
+        validate(D3DCreateBlob(bytecode.size(), &shader_blob));
+        memcpy(shader_blob->GetBufferPointer(), bytecode.data(), bytecode.size());
+    }
 
-        shader_blob = reinterpret_cast<ID3DBlob*>(dxc_shader_blob.Detach());
+    ShaderCacheStats shader_cache_stats() {
+        if (!_shader_cache) return ShaderCacheStats{};
+        return _shader_cache->stats();
     }
 }
@@ -4,6 +4,7 @@
 
 #include "common.h"
 #include "dxc/dxcapi.h"
+#include "shader_cache.h"
 
 namespace gfx {
     struct Device;
@@ -15,6 +16,7 @@ namespace gfx {
     };
 
     std::string profile_from_shader_type(ShaderType type);
+    ShaderCacheStats shader_cache_stats(); // Hits and misses of every shader loaded so far
 
     struct Shader {
         explicit Shader(const std::string& path, const std::string& entry_point, ShaderType type);
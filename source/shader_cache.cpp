@@ -0,0 +1,202 @@
+#include "shader_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "log.h"
+
+#define SHADER_CACHE_MAGIC 0x43444853 // "SHDC"
+#define SHADER_CACHE_VERSION 1
+#define MAX_INCLUDE_DEPTH 32
+
+namespace gfx {
+    struct ShaderCacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint64_t size;
+    };
+
+    // 64-bit FNV-1a, chained so several strings can go into the same hash
+    static uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    static uint64_t fnv1a(const std::string& string, uint64_t hash) {
+        // Hash the terminator too, so "ab" + "c" and "a" + "bc" don't end up the same
+        return fnv1a(string.c_str(), string.size() + 1, hash);
+    }
+
+    static bool read_file(const std::string& path, std::string& contents) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        std::stringstream stream;
+        stream << file.rdbuf();
+        contents = stream.str();
+        return true;
+    }
+
+    ShaderCache::ShaderCache(const std::string& directory, const std::string& compiler_version, CompileFunc compile) {
+        m_directory = directory;
+        m_compiler_version = compiler_version;
+        m_compile = std::move(compile);
+    }
+
+    bool ShaderCache::hash_source(const std::string& path, uint64_t& hash, std::vector<std::string>& visited, int depth) {
+        if (depth > MAX_INCLUDE_DEPTH) {
+            LOG(Error, "Shader cache: includes in '%s' nest too deep, is there a cycle?", path.c_str());
+            return false;
+        }
+
+        std::string source;
+        if (!read_file(path, source)) return false;
+        hash = fnv1a(path, hash);
+        hash = fnv1a(source, hash);
+        visited.push_back(path);
+
+        // Follow every `#include "file"`, even the ones that are #ifdef'd out, that only means a few more misses
+        size_t line_start = 0;
+        while (line_start < source.size()) {
+            size_t line_end = source.find('\n', line_start);
+            if (line_end == std::string::npos) line_end = source.size();
+            const std::string_view line(source.data() + line_start, line_end - line_start);
+            line_start = line_end + 1;
+
+            const size_t first_char = line.find_first_not_of(" \t");
+            if (first_char == std::string::npos || line.substr(first_char, 8) != "#include") continue;
+            const size_t name_start = line.find('"', first_char + 8);
+            const size_t name_end = (name_start == std::string::npos) ? std::string::npos : line.find('"', name_start + 1);
+            if (name_end == std::string::npos) continue;
+            const std::string include_name(line.substr(name_start + 1, name_end - name_start - 1));
+
+            // Includes are relative to the file that includes them, or to the working directory. Normalized, so "../" can't hide a cycle
+            std::string include_path = (std::filesystem::path(path).parent_path() / include_name).lexically_normal().generic_string();
+            if (!std::filesystem::exists(include_path)) include_path = include_name;
+            if (std::find(visited.begin(), visited.end(), include_path) != visited.end()) continue;
+            if (!hash_source(include_path, hash, visited, depth + 1)) {
+                // Let the compiler complain about missing includes, but make sure it's not a hit
+                hash = fnv1a(include_path, hash);
+                hash = fnv1a(std::string("(missing)"), hash); // As a string, a bare literal would pick the (data, size) overload
+            }
+        }
+        return true;
+    }
+
+    uint64_t ShaderCache::cache_key(const ShaderCompileRequest& request) const {
+        uint64_t hash = fnv1a(m_compiler_version, 0xcbf29ce484222325ull);
+        hash = fnv1a(request.entry_point, hash);
+        hash = fnv1a(request.profile, hash);
+        for (const auto& argument : request.arguments) {
+            hash = fnv1a(argument, hash);
+        }
+
+        std::vector<std::string> visited;
+        if (!hash_source(request.path, hash, visited, 0)) return 0;
+        return (hash == 0) ? 1 : hash;
+    }
+
+    std::vector<std::string> ShaderCache::source_files(const std::string& path) {
+        uint64_t hash = 0;
+        std::vector<std::string> visited;
+        hash_source(path, hash, visited, 0);
+        return visited;
+    }
+
+    std::string ShaderCache::entry_path(const ShaderCompileRequest& request, uint64_t key) const {
+        // Start with the file name, so it's easy to tell which shader an entry belongs to
+        char key_hex[17];
+        snprintf(key_hex, sizeof(key_hex), "%016llx", (unsigned long long)key);
+        const std::string name = std::filesystem::path(request.path).filename().string();
+        return (std::filesystem::path(m_directory) / (name + "." + request.entry_point + "." + key_hex + ".bin")).string();
+    }
+
+    bool ShaderCache::read_entry(const std::string& path, uint64_t key, std::vector<uint8_t>& bytecode) const {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+
+        ShaderCacheHeader header{};
+        if (!file.read((char*)&header, sizeof(header))) return false;
+        if (header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.key != key) {
+            LOG(Warning, "Shader cache: ignoring invalid entry '%s'", path.c_str());
+            return false;
+        }
+        bytecode.resize(header.size);
+        if (!file.read((char*)bytecode.data(), (std::streamsize)header.size)) {
+            LOG(Warning, "Shader cache: entry '%s' is truncated", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void ShaderCache::write_entry(const std::string& path, uint64_t key, const std::vector<uint8_t>& bytecode) const {
+        std::error_code error;
+        std::filesystem::create_directories(m_directory, error);
+
+        // Write to a temporary file first, so a crash halfway through doesn't leave a broken entry behind
+        const std::string temp_path = path + ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                LOG(Warning, "Shader cache: could not write '%s'", temp_path.c_str());
+                return;
+            }
+            const ShaderCacheHeader header = {
+                .magic = SHADER_CACHE_MAGIC,
+                .version = SHADER_CACHE_VERSION,
+                .key = key,
+                .size = bytecode.size(),
+            };
+            file.write((const char*)&header, sizeof(header));
+            file.write((const char*)bytecode.data(), (std::streamsize)bytecode.size());
+        }
+        std::filesystem::rename(temp_path, path, error);
+        if (error) LOG(Warning, "Shader cache: could not write '%s'", path.c_str());
+    }
+
+    bool ShaderCache::get(const ShaderCompileRequest& request, std::vector<uint8_t>& bytecode) {
+        const auto load_start = std::chrono::high_resolution_clock::now();
+        const uint64_t key = cache_key(request);
+        if (key == 0) {
+            LOG(Error, "Could not load file '%s'! Does the file exist?", request.path.c_str());
+            return false;
+        }
+
+        const std::string path = entry_path(request, key);
+        const bool hit = read_entry(path, key, bytecode);
+        const auto load_end = std::chrono::high_resolution_clock::now();
+        if (hit) {
+            std::lock_guard<std::mutex> lock(m_stats_mutex);
+            m_stats.n_hits += 1;
+            m_stats.load_seconds += std::chrono::duration<double>(load_end - load_start).count();
+            return true;
+        }
+
+        bytecode.clear();
+        const bool compiled = m_compile && m_compile(request, bytecode);
+        const auto compile_end = std::chrono::high_resolution_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(m_stats_mutex);
+            m_stats.n_misses += 1;
+            m_stats.n_failed += compiled ? 0 : 1;
+            m_stats.load_seconds += std::chrono::duration<double>(load_end - load_start).count();
+            m_stats.compile_seconds += std::chrono::duration<double>(compile_end - load_end).count();
+        }
+
+        // Failed compiles aren't stored, so fixing the shader doesn't need a cache flush
+        if (!compiled) return false;
+        write_entry(path, key, bytecode);
+        return true;
+    }
+
+    ShaderCacheStats ShaderCache::stats() const {
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        return m_stats;
+    }
+}
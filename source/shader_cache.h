@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gfx {
+    struct ShaderCompileRequest {
+        std::string path;
+        std::string entry_point;
+        std::string profile;
+        std::vector<std::string> arguments; // Everything else that's passed to the compiler
+    };
+
+    struct ShaderCacheStats {
+        uint32_t n_hits = 0;
+        uint32_t n_misses = 0;
+        uint32_t n_failed = 0; // Misses that didn't compile either
+        double compile_seconds = 0.0; // Time spent compiling the misses
+        double load_seconds = 0.0; // Time spent hashing sources and reading the hits from disk
+    };
+
+    // Stores compiled shaders on disk, so they only get compiled again when something changed. The key is a hash of the source, every
+    // file it includes (found by following `#include "..."` lines), the entry point, the profile, the arguments, and the compiler
+    // version, so changing any of those is a miss. Old entries aren't cleaned up, deleting the cache directory is always safe.
+    // The compiler is a callback, so the cache can be used without DXC.
+    struct ShaderCache {
+        // Should compile the shader, and put the bytecode in `bytecode`. Returns false if it didn't compile
+        using CompileFunc = std::function<bool(const ShaderCompileRequest& request, std::vector<uint8_t>& bytecode)>;
+
+        ShaderCache() = default;
+        ShaderCache(const std::string& directory, const std::string& compiler_version, CompileFunc compile);
+
+        bool get(const ShaderCompileRequest& request, std::vector<uint8_t>& bytecode); // Returns false if the shader can't be loaded or compiled
+        uint64_t cache_key(const ShaderCompileRequest& request) const; // Returns 0 if the source file can't be read
+        ShaderCacheStats stats() const;
+        static std::vector<std::string> source_files(const std::string& path); // The shader itself, followed by every file it includes
+
+    private:
+        static bool hash_source(const std::string& path, uint64_t& hash, std::vector<std::string>& visited, int depth);
+        std::string entry_path(const ShaderCompileRequest& request, uint64_t key) const;
+        bool read_entry(const std::string& path, uint64_t key, std::vector<uint8_t>& bytecode) const;
+        void write_entry(const std::string& path, uint64_t key, const std::vector<uint8_t>& bytecode) const;
+
+        std::string m_directory;
+        std::string m_compiler_version;
+        CompileFunc m_compile;
+        mutable std::mutex m_stats_mutex;
+        ShaderCacheStats m_stats;
+    };
+}
@@ -0,0 +1,80 @@
+#include "staging_ring.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+
+namespace gfx {
+    StagingRing::StagingRing(uint64_t capacity) {
+        m_capacity = capacity;
+    }
+
+    bool StagingRing::allocate(uint64_t size, uint64_t alignment, uint64_t& offset) {
+        assert(alignment != 0 && (alignment & (alignment - 1)) == 0 && "Alignment should be a power of 2");
+        assert(size <= m_capacity && "Allocation can never fit in the staging ring, split it up first");
+
+        // If nothing's in use, start over at the beginning of the ring, so nothing gets wasted on padding
+        if (m_head == m_tail && m_head % m_capacity != 0) {
+            m_head = m_tail = m_retired_head = (m_head / m_capacity + 1) * m_capacity;
+        }
+
+        // Align the start, and if it would run past the end, skip to the start of the ring instead, so allocations never wrap around
+        const uint64_t head_offset = m_head % m_capacity;
+        uint64_t start = (head_offset + alignment - 1) & ~(alignment - 1);
+        if (start + size > m_capacity) start = m_capacity;
+        const uint64_t padding = start - head_offset;
+        const uint64_t space_needed = padding + size;
+
+        if (bytes_in_use() + space_needed > m_capacity) {
+            m_stats.n_full += 1;
+            return false;
+        }
+
+        m_head += space_needed;
+        offset = start % m_capacity;
+
+        m_stats.n_allocations += 1;
+        m_stats.bytes_allocated += size;
+        m_stats.bytes_padding += padding;
+        m_stats.peak_bytes_in_use = std::max(m_stats.peak_bytes_in_use, bytes_in_use());
+        return true;
+    }
+
+    void StagingRing::retire(uint64_t fence_value) {
+        if (!has_unretired_allocations()) return;
+        assert((m_retired_regions.empty() || m_retired_regions.back().fence_value <= fence_value) && "Upload fence values should only go up");
+
+        // Merge with the previous region if it finishes at the same time anyway
+        if (!m_retired_regions.empty() && m_retired_regions.back().fence_value == fence_value) {
+            m_retired_regions.back().end = m_head;
+        }
+        else {
+            m_retired_regions.push_back({ m_head, fence_value });
+        }
+        m_retired_head = m_head;
+    }
+
+    void StagingRing::update(uint64_t completed_fence_value) {
+        size_t n_freed = 0;
+        while (n_freed < m_retired_regions.size() && m_retired_regions[n_freed].fence_value <= completed_fence_value) {
+            m_tail = m_retired_regions[n_freed].end;
+            ++n_freed;
+        }
+        // Only a handful are in flight at any time, so shifting the rest down is cheap
+        m_retired_regions.erase(m_retired_regions.begin(), m_retired_regions.begin() + n_freed);
+    }
+
+    StagingRowLayout staging_row_layout(uint64_t row_size, uint64_t pitch_alignment, uint64_t max_chunk_size) {
+        assert(pitch_alignment != 0 && (pitch_alignment & (pitch_alignment - 1)) == 0 && "Alignment should be a power of 2");
+        StagingRowLayout layout;
+        layout.row_size = row_size;
+        layout.row_pitch = (row_size + pitch_alignment - 1) & ~(pitch_alignment - 1);
+        layout.max_rows_per_copy = (uint32_t)std::max((uint64_t)1, max_chunk_size / std::max(layout.row_pitch, (uint64_t)1));
+        return layout;
+    }
+
+    uint64_t StagingRing::oldest_fence_value() const {
+        if (m_retired_regions.empty()) return 0;
+        return m_retired_regions.front().fence_value;
+    }
+}
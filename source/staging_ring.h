@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace gfx {
+    struct StagingRingStats {
+        uint64_t n_allocations = 0;
+        uint64_t bytes_allocated = 0; // Total bytes handed out since the ring was made, not counting padding
+        uint64_t bytes_padding = 0; // Bytes skipped for alignment, or at the end of the ring when an allocation didn't fit there
+        uint64_t n_full = 0; // Times an allocation didn't fit, and the caller had to wait for the GPU
+        uint64_t peak_bytes_in_use = 0;
+    };
+
+    // How the rows of a texture are laid out in the staging ring. Texture copies need every row to start at a multiple of the pitch
+    // alignment, and big textures are copied a few rows at a time so they can stream through the ring
+    struct StagingRowLayout {
+        uint64_t row_size = 0; // Bytes of pixel data per row
+        uint64_t row_pitch = 0; // Distance between the starts of two rows in the ring
+        uint32_t max_rows_per_copy = 1; // Always at least 1, even if a single row is bigger than a chunk
+    };
+    StagingRowLayout staging_row_layout(uint64_t row_size, uint64_t pitch_alignment, uint64_t max_chunk_size);
+
+    // Sub-allocates upload memory from one big ring. Allocations are made at the head, and the tail moves up once the GPU is done with
+    // the oldest ones. Allocations don't get freed one by one: `retire()` closes everything allocated since the last call, and all of
+    // that is freed at once when the upload fence reaches the given value. When the ring is full, `allocate()` fails, and the caller
+    // is expected to submit its uploads and wait for `oldest_fence_value()` before trying again.
+    // This only works with offsets, so it can be driven by a fake fence without a GPU.
+    struct StagingRing {
+        StagingRing() = default;
+        explicit StagingRing(uint64_t capacity);
+
+        // Returns false if there's no room right now. `alignment` has to be a power of 2
+        bool allocate(uint64_t size, uint64_t alignment, uint64_t& offset);
+        void retire(uint64_t fence_value); // Everything allocated since the last call can be reused once the fence reaches this value
+        void update(uint64_t completed_fence_value); // Frees the memory of everything retired with this fence value or lower
+
+        uint64_t oldest_fence_value() const; // Fence value to wait for to free up some memory, or 0 if nothing was retired
+        bool has_unretired_allocations() const { return m_head != m_retired_head; }
+        uint64_t capacity() const { return m_capacity; }
+        uint64_t bytes_in_use() const { return m_head - m_tail; }
+        const StagingRingStats& stats() const { return m_stats; }
+
+    private:
+        struct RetiredRegion {
+            uint64_t end; // Head position when it was retired
+            uint64_t fence_value;
+        };
+
+        // Positions only go up, the offset into the ring is the position modulo the capacity
+        uint64_t m_capacity = 0;
+        uint64_t m_head = 0;
+        uint64_t m_tail = 0;
+        uint64_t m_retired_head = 0;
+        std::vector<RetiredRegion> m_retired_regions; // Oldest first
+        StagingRingStats m_stats;
+    };
+}
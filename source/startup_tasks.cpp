@@ -0,0 +1,38 @@
+#include "startup_tasks.h"
+
+#include <cassert>
+#include <utility>
+
+namespace gfx {
+    StartupTaskIds add_startup_tasks(TaskGraph& graph, StartupTasks tasks) {
+        assert(tasks.ibl_brdf_lut_pipeline < tasks.create_pipelines.size());
+        StartupTaskIds ids;
+
+        // These take the longest, so get them going first
+        for (StartupTask& task : tasks.decode_environment_maps) {
+            ids.decode_environment_maps.push_back(graph.add_task(task.name, std::move(task.func)));
+        }
+        for (StartupTask& task : tasks.decode_scenes) {
+            ids.decode_scenes.push_back(graph.add_task(task.name, std::move(task.func)));
+        }
+
+        ids.create_targets = graph.add_task(tasks.create_targets.name, std::move(tasks.create_targets.func));
+
+        // Pipeline creation only talks to the D3D12 device, which is fine to do from any thread
+        for (StartupTask& task : tasks.create_pipelines) {
+            ids.create_pipelines.push_back(graph.add_task(task.name, std::move(task.func)));
+        }
+
+        ids.create_buffers = graph.add_task(tasks.create_buffers.name, std::move(tasks.create_buffers.func), { ids.create_targets });
+        ids.generate_ibl_brdf_lut = graph.add_task(tasks.generate_ibl_brdf_lut.name, std::move(tasks.generate_ibl_brdf_lut.func), {
+            ids.create_buffers,
+            ids.create_pipelines[tasks.ibl_brdf_lut_pipeline],
+        });
+
+        ids.build_render_graphs = graph.add_task(tasks.build_render_graphs.name, std::move(tasks.build_render_graphs.func), { ids.generate_ibl_brdf_lut });
+        for (const TaskId create_pipeline : ids.create_pipelines) {
+            graph.add_dependency(ids.build_render_graphs, create_pipeline);
+        }
+        return ids;
+    }
+}
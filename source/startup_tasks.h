@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include "task_graph.h"
+
+namespace gfx {
+    struct StartupTask {
+        std::string name;
+        std::function<void()> func;
+    };
+
+    // Everything the renderer does at startup. The renderer fills these in with the real work, tests can use stubs instead
+    struct StartupTasks {
+        std::vector<StartupTask> decode_environment_maps;
+        std::vector<StartupTask> decode_scenes;
+        StartupTask create_targets;
+        std::vector<StartupTask> create_pipelines; // Each one compiles its shaders and creates the pipeline
+        size_t ibl_brdf_lut_pipeline = 0; // Index into `create_pipelines` of the pipeline `generate_ibl_brdf_lut` uses
+        StartupTask create_buffers;
+        StartupTask generate_ibl_brdf_lut;
+        StartupTask build_render_graphs; // Needs all pipelines
+    };
+
+    struct StartupTaskIds {
+        std::vector<TaskId> decode_environment_maps;
+        std::vector<TaskId> decode_scenes;
+        TaskId create_targets = 0;
+        std::vector<TaskId> create_pipelines;
+        TaskId create_buffers = 0;
+        TaskId generate_ibl_brdf_lut = 0;
+        TaskId build_render_graphs = 0;
+    };
+
+    // Adds the startup tasks to `graph` with the dependencies between them. Shader compiles and asset decoding don't depend on each
+    // other, so they all run in parallel. Everything that creates GPU resources goes through the device's upload command list, which
+    // isn't thread safe, so those tasks are chained instead
+    StartupTaskIds add_startup_tasks(TaskGraph& graph, StartupTasks tasks);
+}
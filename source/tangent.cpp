@@ -1,5 +1,5 @@
 #include "tangent.h"
-#include "scene.h"
+#include "gpu_structs.h"
 
 namespace gfx {
 	TangentCalculator::TangentCalculator() {
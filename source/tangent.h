@@ -1,3 +1,4 @@
+#include <cstddef>
 #include <mikktspace/mikktspace.h>
 
 namespace gfx {
@@ -0,0 +1,145 @@
+#include "task_graph.h"
+
+#include <algorithm>
+#include <cassert>
+#include "log.h"
+
+namespace gfx {
+    TaskId TaskGraph::add_task(const std::string& name, std::function<void()> func, std::initializer_list<TaskId> dependencies) {
+        const TaskId id = (TaskId)m_tasks.size();
+        m_tasks.push_back(Task{
+            .name = name,
+            .func = std::move(func),
+        });
+        for (const TaskId dependency : dependencies) {
+            add_dependency(id, dependency);
+        }
+        return id;
+    }
+
+    void TaskGraph::add_dependency(TaskId task, TaskId dependency) {
+        assert(dependency < task && "Tasks can only depend on tasks that were added before them");
+        m_tasks[task].dependencies.push_back(dependency);
+        m_tasks[task].n_unfinished_dependencies += 1;
+        m_tasks[dependency].dependents.push_back(task);
+    }
+
+    void TaskGraph::run(ThreadPool& thread_pool) {
+        m_start_time = std::chrono::high_resolution_clock::now();
+        m_n_finished = 0;
+        m_exception = nullptr;
+        m_failed = false;
+        m_ready_tasks.clear();
+        for (TaskId i = 0; i < (TaskId)m_tasks.size(); ++i) {
+            if (m_tasks[i].n_unfinished_dependencies == 0) m_ready_tasks.push_back(i);
+        }
+
+        // Every thread keeps picking up ready tasks until the whole graph is done
+        const uint32_t n_threads = std::min(thread_pool.n_threads(), std::max(n_tasks(), 1u));
+        thread_pool.parallel_for(n_threads, 1, [this](uint32_t, uint32_t, uint32_t thread_index) {
+            worker_loop(thread_index);
+        });
+
+        m_wall_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - m_start_time).count();
+
+        // Every thread is out of `worker_loop()` by now, so it's safe to throw
+        if (m_exception) {
+            LOG(Error, "Task \"%s\" failed, skipped everything that hadn't started yet", m_tasks[m_failed_task].name.c_str());
+            std::rethrow_exception(m_exception);
+        }
+    }
+
+    void TaskGraph::worker_loop(uint32_t thread_index) {
+        std::unique_lock lock(m_mutex);
+        while (true) {
+            m_task_ready.wait(lock, [&]() { return !m_ready_tasks.empty() || m_n_finished == m_tasks.size(); });
+            if (m_ready_tasks.empty()) return;
+
+            // Oldest first, that's roughly the order they were added in
+            const TaskId id = m_ready_tasks.front();
+            m_ready_tasks.erase(m_ready_tasks.begin());
+            lock.unlock();
+
+            // Once something failed, the rest only gets marked as done without running, so every thread still gets to the end.
+            // The task still has to count as done when it throws, otherwise the other threads wait for it forever
+            Task& task = m_tasks[id];
+            task.timing.thread_index = thread_index;
+            task.timing.start_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - m_start_time).count();
+            std::exception_ptr exception = nullptr;
+            if (task.func && !m_failed.load(std::memory_order_relaxed)) {
+                try {
+                    task.func();
+                }
+                catch (...) {
+                    exception = std::current_exception();
+                }
+            }
+            task.timing.end_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - m_start_time).count();
+
+            lock.lock();
+            if (exception && !m_exception) {
+                m_exception = exception;
+                m_failed_task = id;
+                m_failed.store(true, std::memory_order_relaxed);
+            }
+            for (const TaskId dependent : task.dependents) {
+                if (--m_tasks[dependent].n_unfinished_dependencies == 0) m_ready_tasks.push_back(dependent);
+            }
+            m_n_finished += 1;
+            m_task_ready.notify_all();
+        }
+    }
+
+    std::vector<TaskId> TaskGraph::critical_path() const {
+        if (m_tasks.empty()) return {};
+
+        // Dependencies always come first, so one pass in order is enough to find the longest chain ending at each task
+        std::vector<double> chain_length(m_tasks.size(), 0.0);
+        std::vector<TaskId> chain_previous(m_tasks.size(), ~0u);
+        TaskId last = 0;
+        for (TaskId i = 0; i < (TaskId)m_tasks.size(); ++i) {
+            for (const TaskId dependency : m_tasks[i].dependencies) {
+                if (chain_previous[i] == ~0u || chain_length[dependency] > chain_length[chain_previous[i]]) {
+                    chain_previous[i] = dependency;
+                }
+            }
+            const double previous_length = (chain_previous[i] != ~0u) ? chain_length[chain_previous[i]] : 0.0;
+            chain_length[i] = previous_length + m_tasks[i].timing.duration();
+            if (chain_length[i] > chain_length[last]) last = i;
+        }
+
+        std::vector<TaskId> path;
+        for (TaskId i = last; i != ~0u; i = chain_previous[i]) {
+            path.push_back(i);
+        }
+        std::reverse(path.begin(), path.end());
+        return path;
+    }
+
+    void TaskGraph::log_report(const char* title) const {
+        double total_seconds = 0.0;
+        for (const auto& task : m_tasks) {
+            total_seconds += task.timing.duration();
+        }
+        LOG(Info, "%s: %.1f ms, %u tasks with %.1f ms of work combined", title, m_wall_seconds * 1000.0, n_tasks(), total_seconds * 1000.0);
+
+        // Timeline, in the order the tasks started
+        std::vector<TaskId> order(m_tasks.size());
+        for (TaskId i = 0; i < (TaskId)order.size(); ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](TaskId a, TaskId b) { return m_tasks[a].timing.start_seconds < m_tasks[b].timing.start_seconds; });
+        for (const TaskId i : order) {
+            const TaskTiming& timing = m_tasks[i].timing;
+            LOG(Debug, "%56s: thread %2u, %8.1f ms -> %8.1f ms (%.1f ms)", m_tasks[i].name.c_str(), timing.thread_index,
+                timing.start_seconds * 1000.0, timing.end_seconds * 1000.0, timing.duration() * 1000.0);
+        }
+
+        double critical_seconds = 0.0;
+        std::string critical_names;
+        for (const TaskId i : critical_path()) {
+            critical_seconds += m_tasks[i].timing.duration();
+            if (!critical_names.empty()) critical_names += " -> ";
+            critical_names += m_tasks[i].name;
+        }
+        LOG(Info, "%s critical path (%.1f ms): %s", title, critical_seconds * 1000.0, critical_names.c_str());
+    }
+}
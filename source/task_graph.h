@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "thread_pool.h"
+
+namespace gfx {
+    using TaskId = uint32_t;
+
+    struct TaskTiming {
+        double start_seconds = 0.0; // Relative to the start of `TaskGraph::run()`
+        double end_seconds = 0.0;
+        uint32_t thread_index = 0;
+        double duration() const { return end_seconds - start_seconds; }
+    };
+
+    // One-off set of tasks with dependencies between them, used to spread startup work over the thread pool. A task starts as soon
+    // as everything it depends on is done, on whichever thread is free. Start and end times are recorded, so afterwards it can
+    // report the timeline and the critical path, which is the chain of dependent tasks that decided how long the whole thing took.
+    // Tasks that aren't safe to run at the same time should depend on each other.
+    struct TaskGraph {
+        // Dependencies have to be added before the tasks that depend on them, so there can't be any cycles
+        TaskId add_task(const std::string& name, std::function<void()> func, std::initializer_list<TaskId> dependencies = {});
+        void add_dependency(TaskId task, TaskId dependency);
+
+        // Blocks until every task is done. Tasks can't use `thread_pool` themselves. If a task throws, the tasks that haven't started
+        // yet are skipped, and the first exception is rethrown here
+        void run(ThreadPool& thread_pool);
+        void log_report(const char* title) const; // Timeline and critical path, only makes sense after `run()`
+
+        std::vector<TaskId> critical_path() const; // First task first
+        const TaskTiming& timing(TaskId task) const { return m_tasks[task].timing; }
+        const std::string& name(TaskId task) const { return m_tasks[task].name; }
+        uint32_t n_tasks() const { return (uint32_t)m_tasks.size(); }
+        double wall_seconds() const { return m_wall_seconds; }
+
+    private:
+        struct Task {
+            std::string name;
+            std::function<void()> func;
+            std::vector<TaskId> dependencies;
+            std::vector<TaskId> dependents;
+            uint32_t n_unfinished_dependencies = 0;
+            TaskTiming timing;
+        };
+
+        void worker_loop(uint32_t thread_index);
+
+        std::vector<Task> m_tasks;
+        std::mutex m_mutex;
+        std::condition_variable m_task_ready;
+        std::vector<TaskId> m_ready_tasks;
+        uint32_t m_n_finished = 0;
+        std::exception_ptr m_exception = nullptr; // First task that threw
+        TaskId m_failed_task = 0;
+        std::atomic<bool> m_failed = false; // Same as `m_exception != nullptr`, but can be read without the lock
+        double m_wall_seconds = 0.0;
+        std::chrono::high_resolution_clock::time_point m_start_time;
+    };
+}
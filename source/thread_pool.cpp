@@ -0,0 +1,96 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <string>
+#include "profiler.h"
+
+namespace gfx {
+    ThreadPool::ThreadPool(uint32_t n_workers) {
+        if (n_workers == AUTO_WORKERS) {
+            const uint32_t n_hardware_threads = std::thread::hardware_concurrency();
+            n_workers = (n_hardware_threads > 1) ? (n_hardware_threads - 1) : 0;
+        }
+
+        m_workers.reserve(n_workers);
+        for (uint32_t i = 0; i < n_workers; ++i) {
+            m_workers.emplace_back(&ThreadPool::worker_main, this, i + 1);
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_shutting_down = true;
+        }
+        m_wake_workers.notify_all();
+        for (auto& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    void ThreadPool::run(uint32_t n_items, uint32_t batch_size, JobFunc func, void* context) {
+        if (n_items == 0) return;
+        if (batch_size == 0) batch_size = 1;
+
+        // Not worth waking anyone up for
+        if (m_workers.empty() || n_items <= batch_size) {
+            func(context, 0, n_items, 0);
+            return;
+        }
+
+        std::lock_guard submit_lock(m_submit_mutex);
+        {
+            // A worker that woke up late for the previous job might still be reading its parameters
+            std::unique_lock lock(m_mutex);
+            m_job_done.wait(lock, [&]() { return m_n_active_workers == 0; });
+            m_func = func;
+            m_context = context;
+            m_n_items = n_items;
+            m_batch_size = batch_size;
+            m_items_done = 0;
+            m_next_item = 0;
+            ++m_generation;
+        }
+        m_wake_workers.notify_all();
+
+        // Help out instead of just waiting
+        execute_batches(0);
+
+        std::unique_lock lock(m_mutex);
+        m_job_done.wait(lock, [&]() { return m_items_done.load() == m_n_items && m_n_active_workers == 0; });
+    }
+
+    void ThreadPool::worker_main(uint32_t thread_index) {
+        profiler::set_thread_name(("Worker " + std::to_string(thread_index)).c_str());
+        uint64_t last_generation = 0;
+        while (true) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_wake_workers.wait(lock, [&]() { return m_shutting_down || m_generation != last_generation; });
+                if (m_shutting_down) return;
+                last_generation = m_generation;
+                m_n_active_workers++;
+            }
+            execute_batches(thread_index);
+            {
+                std::lock_guard lock(m_mutex);
+                if (--m_n_active_workers == 0) m_job_done.notify_all();
+            }
+        }
+    }
+
+    void ThreadPool::execute_batches(uint32_t thread_index) {
+        while (true) {
+            const uint32_t begin = m_next_item.fetch_add(m_batch_size);
+            if (begin >= m_n_items) return;
+            const uint32_t end = std::min(begin + m_batch_size, m_n_items);
+            m_func(m_context, begin, end, thread_index);
+
+            // The last batch to finish wakes up the thread that submitted the job
+            if (m_items_done.fetch_add(end - begin) + (end - begin) == m_n_items) {
+                std::lock_guard lock(m_mutex);
+                m_job_done.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace gfx {
+    // Fixed set of worker threads that CPU work within a frame can be split up over
+    struct ThreadPool {
+        static constexpr uint32_t AUTO_WORKERS = ~0u; // One worker per hardware thread, minus one for the calling thread
+
+        explicit ThreadPool(uint32_t n_workers = AUTO_WORKERS); // With 0 workers the calling thread does everything
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Calls `func(begin, end, thread_index)` for consecutive ranges of at most `batch_size` items, and blocks until all of them are done.
+        // The calling thread helps out as `thread_index` 0, so `thread_index` is always less than `n_threads()`. This never allocates.
+        // Calling this from inside one of the jobs is not supported.
+        template<typename Func>
+        void parallel_for(uint32_t n_items, uint32_t batch_size, Func&& func) {
+            run(n_items, batch_size, [](void* context, uint32_t begin, uint32_t end, uint32_t thread_index) {
+                (*(std::remove_reference_t<Func>*)context)(begin, end, thread_index);
+            }, (void*)&func);
+        }
+
+        uint32_t n_threads() const { return (uint32_t)m_workers.size() + 1; }
+
+    private:
+        using JobFunc = void(*)(void* context, uint32_t begin, uint32_t end, uint32_t thread_index);
+        void run(uint32_t n_items, uint32_t batch_size, JobFunc func, void* context);
+        void worker_main(uint32_t thread_index);
+        void execute_batches(uint32_t thread_index);
+
+        std::vector<std::thread> m_workers;
+        std::mutex m_submit_mutex; // Only one `parallel_for()` can be in flight at a time
+        std::mutex m_mutex;
+        std::condition_variable m_wake_workers;
+        std::condition_variable m_job_done;
+        JobFunc m_func = nullptr;
+        void* m_context = nullptr;
+        uint32_t m_n_items = 0;
+        uint32_t m_batch_size = 1;
+        std::atomic<uint32_t> m_next_item = 0;
+        std::atomic<uint32_t> m_items_done = 0;
+        uint64_t m_generation = 0; // Incremented for every job, so sleeping workers know there's something new to do
+        uint32_t m_n_active_workers = 0; // Workers inside `execute_batches()`, the job's parameters can't change until this is 0
+        bool m_shutting_down = false;
+    };
+}
@@ -0,0 +1,76 @@
+#include "transient_resources.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace gfx {
+    uint32_t extend_transient_lifetimes(const RenderGraph& graph, uint32_t first_pass, std::span<TransientLifetime> lifetimes) {
+        assert(lifetimes.size() >= graph.n_resources());
+        uint32_t timeline_pass = first_pass;
+        for (uint32_t pass_index : graph.pass_order()) {
+            for (const RenderGraphAccess& access : graph.pass(pass_index).accesses) {
+                lifetimes[access.resource].extend(timeline_pass);
+            }
+            ++timeline_pass;
+        }
+        return timeline_pass;
+    }
+
+    TransientHeapLayout pack_transient_resources(std::span<const TransientResource> resources) {
+        TransientHeapLayout layout;
+        layout.offsets.assign(resources.size(), 0);
+        layout.aliases.resize(resources.size());
+
+        // Biggest first, ties go to whichever came first so the layout doesn't change between runs
+        std::vector<uint32_t> order(resources.size());
+        for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return resources[a].size > resources[b].size;
+        });
+
+        std::vector<uint32_t> placed;
+        std::vector<uint32_t> conflicts;
+        for (uint32_t index : order) {
+            const TransientResource& resource = resources[index];
+            assert(resource.alignment != 0 && (resource.alignment & (resource.alignment - 1)) == 0 && "Alignment must be a power of 2");
+            layout.unaliased_size += resource.size;
+
+            // Anything alive at the same time is in the way. Unused resources conflict with everything, so they never share memory
+            conflicts.clear();
+            for (uint32_t other : placed) {
+                if (!resource.lifetime.is_used() || !resources[other].lifetime.is_used() || resource.lifetime.overlaps(resources[other].lifetime)) {
+                    conflicts.push_back(other);
+                }
+            }
+            std::sort(conflicts.begin(), conflicts.end(), [&](uint32_t a, uint32_t b) {
+                return layout.offsets[a] < layout.offsets[b];
+            });
+
+            // Walk through the conflicts from low to high, and take the first gap that fits
+            uint64_t offset = 0;
+            for (uint32_t other : conflicts) {
+                const uint64_t other_begin = layout.offsets[other];
+                const uint64_t other_end = other_begin + resources[other].size;
+                if (offset + resource.size <= other_begin) break;
+                if (other_end > offset) {
+                    offset = (other_end + resource.alignment - 1) & ~(resource.alignment - 1);
+                }
+            }
+
+            layout.offsets[index] = offset;
+            layout.heap_size = std::max(layout.heap_size, offset + resource.size);
+            placed.push_back(index);
+        }
+
+        // Find out which resources ended up sharing memory, those need aliasing barriers when switching between them
+        for (uint32_t a = 0; a < resources.size(); ++a) {
+            for (uint32_t b = a + 1; b < resources.size(); ++b) {
+                const bool memory_overlaps = layout.offsets[a] < layout.offsets[b] + resources[b].size && layout.offsets[b] < layout.offsets[a] + resources[a].size;
+                if (!memory_overlaps || resources[a].size == 0 || resources[b].size == 0) continue;
+                layout.aliases[a].push_back(b);
+                layout.aliases[b].push_back(a);
+            }
+        }
+        return layout;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "render_graph.h"
+
+namespace gfx {
+    // Range of passes a resource is used in, inclusive. Pass indices are positions on a timeline, not indices into one graph,
+    // so the lifetimes of multiple graphs can be laid out one after the other
+    struct TransientLifetime {
+        uint32_t first_pass = ~0u;
+        uint32_t last_pass = 0;
+
+        bool is_used() const { return first_pass <= last_pass; }
+        void extend(uint32_t pass) {
+            if (pass < first_pass) first_pass = pass;
+            if (pass > last_pass) last_pass = pass;
+        }
+        bool overlaps(const TransientLifetime& other) const {
+            return is_used() && other.is_used() && first_pass <= other.last_pass && other.first_pass <= last_pass;
+        }
+    };
+
+    struct TransientResource {
+        uint64_t size = 0;
+        uint64_t alignment = 1; // Has to be a power of 2
+        TransientLifetime lifetime;
+    };
+
+    struct TransientHeapLayout {
+        std::vector<uint64_t> offsets; // Per resource, byte offset into the heap
+        std::vector<std::vector<uint32_t>> aliases; // Per resource, the other resources that share some of its memory
+        uint64_t heap_size = 0;
+        uint64_t unaliased_size = 0; // How big the heap would be if nothing shared memory
+    };
+
+    // Extends `lifetimes` (indexed by graph resource) with every pass in the graph's execution order, starting at `first_pass` on the timeline.
+    // The graph has to be compiled. Returns the timeline index right after the graph's last pass
+    uint32_t extend_transient_lifetimes(const RenderGraph& graph, uint32_t first_pass, std::span<TransientLifetime> lifetimes);
+
+    // Places resources in a single heap, letting resources share memory if their lifetimes don't overlap. Biggest resources go first,
+    // each one at the lowest offset that doesn't collide with anything it's alive at the same time as. Doesn't touch the GPU,
+    // so it can be fed made up pass lists. Resources that are never used still get memory, but they conflict with everything, so it's never shared
+    TransientHeapLayout pack_transient_resources(std::span<const TransientResource> resources);
+}
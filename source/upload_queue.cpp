@@ -0,0 +1,66 @@
+#include "upload_queue.h"
+
+#include <cassert>
+#include <utility>
+
+#include "log.h"
+
+namespace gfx {
+    UploadQueue::UploadQueue(UploadQueueFuncs funcs, uint64_t staging_ring_size) {
+        m_funcs = std::move(funcs);
+        m_staging_ring = StagingRing(staging_ring_size);
+    }
+
+    std::shared_ptr<CommandBuffer> UploadQueue::copy_command_buffer() {
+        if (m_copy_cmd == nullptr) {
+            m_copy_cmd = m_funcs.create_command_buffer(nullptr, ++m_fence_value);
+        }
+        return m_copy_cmd;
+    }
+
+    std::shared_ptr<CommandBuffer> UploadQueue::create_command_buffer(const Pipeline* pipeline) {
+        return m_funcs.create_command_buffer(pipeline, ++m_fence_value);
+    }
+
+    uint64_t UploadQueue::allocate_staging(uint64_t size, uint64_t alignment) {
+        uint64_t offset = 0;
+        while (!m_staging_ring.allocate(size, alignment, offset)) {
+            // The ring is full, so submit what's in it, and wait for the oldest uploads to finish
+            if (m_staging_ring.has_unretired_allocations()) flush();
+            const uint64_t fence_value = m_staging_ring.oldest_fence_value();
+            assert(fence_value != 0 && "Staging ring is full, but nothing is in flight");
+            LOG(Debug, "Staging ring is full, waiting for upload fence value %llu", (unsigned long long)fence_value);
+            m_funcs.cpu_wait(fence_value);
+            m_staging_ring.update(m_funcs.completed_fence_value());
+        }
+        return offset;
+    }
+
+    void UploadQueue::keep_alive(std::shared_ptr<void> resource) {
+        m_keep_alive.push_back(KeepAlive{ m_fence_value, std::move(resource) });
+    }
+
+    void UploadQueue::track_load(uint32_t resource_id) {
+        m_tracker.track_load(resource_id, m_fence_value);
+    }
+
+    void UploadQueue::flush() {
+        m_funcs.submit(m_fence_value);
+        m_staging_ring.retire(m_fence_value);
+        m_copy_cmd = nullptr;
+    }
+
+    void UploadQueue::wait_idle() {
+        flush();
+        m_funcs.cpu_wait(m_fence_value);
+    }
+
+    void UploadQueue::update(std::vector<uint32_t>& loaded_resource_ids) {
+        const uint64_t completed_fence_value = m_funcs.completed_fence_value();
+        while (!m_keep_alive.empty() && m_keep_alive.front().fence_value <= completed_fence_value) {
+            m_keep_alive.pop_front();
+        }
+        m_staging_ring.update(completed_fence_value);
+        m_tracker.update(completed_fence_value, loaded_resource_ids);
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "staging_ring.h"
+#include "upload_tracker.h"
+
+namespace gfx {
+    struct CommandBuffer;
+    struct Pipeline;
+
+    // What the upload queue needs from the GPU. The device does these with the D3D12 upload queue and its fence
+    struct UploadQueueFuncs {
+        std::function<std::shared_ptr<CommandBuffer>(const Pipeline* pipeline, uint64_t fence_value)> create_command_buffer; // Has to run after every command buffer created before it
+        std::function<void(uint64_t fence_value)> submit; // Executes the command buffers created so far, then signals the upload fence with this value, and makes the graphics queue wait for it on the GPU
+        std::function<uint64_t()> completed_fence_value;
+        std::function<void(uint64_t fence_value)> cpu_wait;
+    };
+
+    // Batches uploads on the async upload queue, and keeps what they use alive until the GPU is done with them.
+    // Copies all go into one command buffer until the next `flush()`. Work that needs its own command buffer, like acceleration structure
+    // builds and async compute, gets one with the next fence value. Command buffers run in the order they were made, so that work starts
+    // after the copies recorded before it, and copies recorded after it can still end up in the earlier copy batch.
+    // Fence values are only signaled by `flush()`, with the highest one handed out so far, so everything in between finishes together.
+    // Only talks to the GPU through the callbacks, so it can be driven by a fake queue and fence without a GPU.
+    struct UploadQueue {
+        UploadQueue() = default;
+        UploadQueue(UploadQueueFuncs funcs, uint64_t staging_ring_size);
+
+        std::shared_ptr<CommandBuffer> copy_command_buffer(); // The command buffer all copies go into until the next flush
+        std::shared_ptr<CommandBuffer> create_command_buffer(const Pipeline* pipeline = nullptr); // A command buffer of its own, that runs after everything recorded so far
+        uint64_t allocate_staging(uint64_t size, uint64_t alignment); // Returns an offset into the staging ring. If the ring is full, flushes and waits on the CPU until there's room
+        void keep_alive(std::shared_ptr<void> resource); // Released by `update()` once everything recorded so far is done
+        void track_load(uint32_t resource_id); // Reported by `update()` once everything recorded so far is done
+        void flush(); // Submits everything recorded so far. The graphics queue waits for it on the GPU, the CPU doesn't
+        void wait_idle(); // Flushes, and waits for it on the CPU
+
+        // Releases what the GPU is done with, and appends the resources that finished loading to `loaded_resource_ids`
+        void update(std::vector<uint32_t>& loaded_resource_ids);
+
+        uint64_t fence_value() const { return m_fence_value; } // The value the next flush signals
+        bool has_kept_alive_resources() const { return !m_keep_alive.empty(); }
+        const StagingRingStats& staging_ring_stats() const { return m_staging_ring.stats(); }
+        const UploadTrackerStats& tracker_stats() const { return m_tracker.stats(); }
+
+    private:
+        struct KeepAlive {
+            uint64_t fence_value;
+            std::shared_ptr<void> resource;
+        };
+
+        UploadQueueFuncs m_funcs;
+        uint64_t m_fence_value = 0; // Highest fence value handed out so far
+        std::shared_ptr<CommandBuffer> m_copy_cmd = nullptr; // Null if nothing was copied since the last flush
+        StagingRing m_staging_ring;
+        UploadTracker m_tracker;
+        std::deque<KeepAlive> m_keep_alive; // Sorted by fence value, since they only go up
+    };
+}
@@ -0,0 +1,22 @@
+#include "upload_tracker.h"
+
+#include <cassert>
+#include <cstddef>
+
+namespace gfx {
+    void UploadTracker::track_load(uint32_t resource_id, uint64_t fence_value) {
+        assert((m_pending_loads.empty() || m_pending_loads.back().fence_value <= fence_value) && "Upload fence values should only go up");
+        m_pending_loads.push_back({ resource_id, fence_value });
+        m_stats.n_pending_loads = (uint32_t)m_pending_loads.size();
+    }
+
+    void UploadTracker::update(uint64_t completed_fence_value, std::vector<uint32_t>& loaded_resource_ids) {
+        size_t n_loaded = 0;
+        while (n_loaded < m_pending_loads.size() && m_pending_loads[n_loaded].fence_value <= completed_fence_value) {
+            loaded_resource_ids.push_back(m_pending_loads[n_loaded].resource_id);
+            ++n_loaded;
+        }
+        m_pending_loads.erase(m_pending_loads.begin(), m_pending_loads.begin() + n_loaded);
+        m_stats.n_pending_loads = (uint32_t)m_pending_loads.size();
+    }
+}
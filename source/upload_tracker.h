@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace gfx {
+    struct UploadTrackerStats {
+        uint32_t n_pending_loads = 0;
+    };
+
+    // Keeps track of resources on the upload queue that shouldn't be marked as loaded before the upload fence reaches a certain value.
+    // Upload fence values only go up, and nothing here waits for them, it just gets told which value the fence has completed so far,
+    // so it can be driven by a fake fence without a GPU.
+    struct UploadTracker {
+        void track_load(uint32_t resource_id, uint64_t fence_value); // The resource counts as loaded once the fence reaches this value
+
+        // Appends every resource that finished loading to `loaded_resource_ids`, in the order they were tracked
+        void update(uint64_t completed_fence_value, std::vector<uint32_t>& loaded_resource_ids);
+
+        const UploadTrackerStats& stats() const { return m_stats; }
+
+    private:
+        struct PendingLoad {
+            uint32_t resource_id;
+            uint64_t fence_value;
+        };
+
+        std::vector<PendingLoad> m_pending_loads; // Sorted by fence value, since they only go up
+        UploadTrackerStats m_stats;
+    };
+}
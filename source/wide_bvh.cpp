@@ -0,0 +1,290 @@
+#include "wide_bvh.h"
+
+#include <cmath>
+#include "wide_bvh_kernels.h"
+#include "bvh_packet_kernels.h"
+#include "profiler.h"
+#include "log.h"
+
+#if WIDE_BVH_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace gfx {
+    namespace {
+        // Emulates a SIMD register with a plain array, so the scalar kernel runs the exact same traversal code as the others
+        template<int Width>
+        struct SimdScalar {
+            static constexpr int width = Width;
+            struct Float {
+                float lanes[Width];
+            };
+            using Mask = uint32_t;
+
+            template<typename Op>
+            static Float map(Op op) {
+                Float result;
+                for (int i = 0; i < Width; ++i) result.lanes[i] = op(i);
+                return result;
+            }
+            template<typename Op>
+            static Mask compare(Op op) {
+                Mask result = 0;
+                for (int i = 0; i < Width; ++i) result |= op(i) ? (1u << i) : 0;
+                return result;
+            }
+
+            static Float load(const float* src) { return map([&](int i) { return src[i]; }); }
+            static void store(float* dst, const Float& a) { for (int i = 0; i < Width; ++i) dst[i] = a.lanes[i]; }
+            static Float set1(float value) { return map([&](int) { return value; }); }
+            static Float add(const Float& a, const Float& b) { return map([&](int i) { return a.lanes[i] + b.lanes[i]; }); }
+            static Float sub(const Float& a, const Float& b) { return map([&](int i) { return a.lanes[i] - b.lanes[i]; }); }
+            static Float mul(const Float& a, const Float& b) { return map([&](int i) { return a.lanes[i] * b.lanes[i]; }); }
+            static Float div(const Float& a, const Float& b) { return map([&](int i) { return a.lanes[i] / b.lanes[i]; }); }
+            // Same NaN behavior as minps/maxps: the second operand wins
+            static Float min(const Float& a, const Float& b) { return map([&](int i) { return (a.lanes[i] < b.lanes[i]) ? a.lanes[i] : b.lanes[i]; }); }
+            static Float max(const Float& a, const Float& b) { return map([&](int i) { return (a.lanes[i] > b.lanes[i]) ? a.lanes[i] : b.lanes[i]; }); }
+            static Float abs(const Float& a) { return map([&](int i) { return fabsf(a.lanes[i]); }); }
+            static Mask cmp_ge(const Float& a, const Float& b) { return compare([&](int i) { return a.lanes[i] >= b.lanes[i]; }); }
+            static Mask cmp_le(const Float& a, const Float& b) { return compare([&](int i) { return a.lanes[i] <= b.lanes[i]; }); }
+            static Mask cmp_lt(const Float& a, const Float& b) { return compare([&](int i) { return a.lanes[i] < b.lanes[i]; }); }
+            static Mask and_mask(Mask a, Mask b) { return a & b; }
+            static uint32_t to_bits(Mask a) { return a; }
+        };
+    }
+
+    bool wide_bvh_intersect_scalar4(const WideBvhNode<4>* nodes, const TrianglePacket<4>* packets, const WideRay& ray, BvhHit* hit) {
+        return hit ? traverse<SimdScalar<4>, false>(nodes, packets, ray, hit) : traverse<SimdScalar<4>, true>(nodes, packets, ray, nullptr);
+    }
+
+    bool wide_bvh_intersect_scalar8(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const WideRay& ray, BvhHit* hit) {
+        return hit ? traverse<SimdScalar<8>, false>(nodes, packets, ray, hit) : traverse<SimdScalar<8>, true>(nodes, packets, ray, nullptr);
+    }
+
+    void bvh_intersect_packet_scalar(const BvhNode* nodes, const BvhTriangle* triangles, const uint32_t* triangle_indices, RayPacket& packet, bool any_hit) {
+        if (any_hit) traverse_packet<SimdScalar<8>, true>(nodes, triangles, triangle_indices, packet);
+        else traverse_packet<SimdScalar<8>, false>(nodes, triangles, triangle_indices, packet);
+    }
+
+    static SimdIsa detect_simd_isa_uncached() {
+#if WIDE_BVH_X86
+        auto cpuid = [](uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+            __cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+            __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        };
+        // Which register states the OS saves on context switches, the CPU supporting AVX isn't enough
+        auto xgetbv = []() -> uint64_t {
+#if defined(_MSC_VER)
+            return _xgetbv(0);
+#else
+            uint32_t eax, edx;
+            __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            return ((uint64_t)edx << 32) | eax;
+#endif
+        };
+
+        uint32_t regs[4];
+        cpuid(0, 0, regs);
+        const uint32_t max_leaf = regs[0];
+        cpuid(1, 0, regs);
+        const bool has_sse4 = (regs[2] >> 19) & 1;
+        const bool has_os_xsave = (regs[2] >> 27) & 1;
+        const bool has_avx = (regs[2] >> 28) & 1;
+        const uint64_t xcr0 = has_os_xsave ? xgetbv() : 0;
+        const bool os_saves_ymm = (xcr0 & 0x06) == 0x06;
+        const bool os_saves_zmm = (xcr0 & 0xE6) == 0xE6;
+
+        bool has_avx2 = false, has_avx512 = false;
+        if (max_leaf >= 7) {
+            cpuid(7, 0, regs);
+            has_avx2 = (regs[1] >> 5) & 1;
+            has_avx512 = ((regs[1] >> 16) & 1) && ((regs[1] >> 31) & 1); // F and VL
+        }
+
+        if (has_avx512 && has_avx2 && os_saves_zmm) return SimdIsa::avx512;
+        if (has_avx2 && has_avx && os_saves_ymm) return SimdIsa::avx2;
+        if (has_sse4) return SimdIsa::sse4;
+#endif
+        return SimdIsa::scalar;
+    }
+
+    SimdIsa detect_simd_isa() {
+        static const SimdIsa isa = detect_simd_isa_uncached();
+        return isa;
+    }
+
+    bool is_simd_isa_supported(SimdIsa isa) {
+        return (uint32_t)isa <= (uint32_t)detect_simd_isa();
+    }
+
+    uint32_t simd_isa_width(SimdIsa isa) {
+        return (isa == SimdIsa::avx2 || isa == SimdIsa::avx512) ? 8 : 4;
+    }
+
+    // Greedily pulls up the grandchildren with the biggest surface area until the node is full. Subtrees that fit in one
+    // packet become a single leaf, which also merges the binary BVH's small leaves
+    template<int Width>
+    static void collapse_bvh(const Bvh& bvh, const glm::vec3* positions, std::vector<WideBvhNode<Width>>& wide_nodes, std::vector<TrianglePacket<Width>>& packets) {
+        const std::vector<BvhNode>& nodes = bvh.nodes();
+        const std::vector<uint32_t>& triangle_indices = bvh.triangle_indices();
+        wide_nodes.clear();
+        packets.clear();
+        if (bvh.n_triangles() == 0) return;
+
+        // Every subtree covers a contiguous range of triangles in leaf order. Children always come after their parent
+        std::vector<uint32_t> first(nodes.size()), count(nodes.size());
+        for (size_t i = nodes.size(); i-- > 0;) {
+            if (nodes[i].count > 0) {
+                first[i] = nodes[i].left_first;
+                count[i] = nodes[i].count;
+            }
+            else {
+                first[i] = first[nodes[i].left_first];
+                count[i] = count[nodes[i].left_first] + count[nodes[i].left_first + 1];
+            }
+        }
+        auto is_leaf = [&](uint32_t node_index) { return nodes[node_index].count > 0 || count[node_index] <= (uint32_t)Width; };
+        auto area = [&](uint32_t node_index) {
+            const glm::vec3 extent = nodes[node_index].max - nodes[node_index].min;
+            return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+        };
+
+        struct Task {
+            uint32_t node_index;
+            uint32_t wide_node_index;
+        };
+        std::vector<Task> tasks = { { 0, 0 } };
+        wide_nodes.emplace_back();
+        while (!tasks.empty()) {
+            const Task task = tasks.back();
+            tasks.pop_back();
+
+            uint32_t children[Width];
+            int n_children = 0;
+            if (is_leaf(task.node_index)) {
+                children[n_children++] = task.node_index; // Only happens for the root of a tiny scene
+            }
+            else {
+                children[n_children++] = nodes[task.node_index].left_first;
+                children[n_children++] = nodes[task.node_index].left_first + 1;
+            }
+            while (n_children < Width) {
+                int best_child = -1;
+                float best_area = -1.0f;
+                for (int i = 0; i < n_children; ++i) {
+                    if (!is_leaf(children[i]) && area(children[i]) > best_area) {
+                        best_child = i;
+                        best_area = area(children[i]);
+                    }
+                }
+                if (best_child == -1) break;
+                const uint32_t left = nodes[children[best_child]].left_first;
+                children[best_child] = left;
+                children[n_children++] = left + 1;
+            }
+
+            WideBvhNode<Width> wide_node;
+            for (int i = 0; i < Width; ++i) {
+                for (int axis = 0; axis < 3; ++axis) {
+                    wide_node.bounds[axis][i] = (i < n_children) ? nodes[children[i]].min[axis] : +INFINITY;
+                    wide_node.bounds[axis + 3][i] = (i < n_children) ? nodes[children[i]].max[axis] : -INFINITY;
+                }
+                wide_node.children[i] = WIDE_BVH_EMPTY;
+                wide_node.n_packets[i] = 0;
+                if (i >= n_children) continue;
+
+                if (!is_leaf(children[i])) {
+                    wide_node.children[i] = (uint32_t)wide_nodes.size();
+                    wide_nodes.emplace_back();
+                    tasks.push_back({ children[i], wide_node.children[i] });
+                    continue;
+                }
+
+                wide_node.children[i] = (uint32_t)packets.size();
+                wide_node.n_packets[i] = (count[children[i]] + Width - 1) / Width;
+                for (uint32_t p = 0; p < wide_node.n_packets[i]; ++p) {
+                    TrianglePacket<Width> packet;
+                    for (int lane = 0; lane < Width; ++lane) {
+                        const uint32_t index = p * Width + lane;
+                        const bool is_padding = index >= count[children[i]];
+                        const uint32_t triangle_index = is_padding ? 0 : triangle_indices[first[children[i]] + index];
+                        const glm::vec3* triangle = &positions[triangle_index * 3];
+                        for (int axis = 0; axis < 3; ++axis) {
+                            packet.v0[axis][lane] = is_padding ? 0.0f : triangle[0][axis];
+                            packet.edge1[axis][lane] = is_padding ? 0.0f : triangle[1][axis] - triangle[0][axis];
+                            packet.edge2[axis][lane] = is_padding ? 0.0f : triangle[2][axis] - triangle[0][axis];
+                        }
+                        packet.triangle_indices[lane] = is_padding ? WIDE_BVH_EMPTY : triangle_index;
+                    }
+                    packets.push_back(packet);
+                }
+            }
+            wide_nodes[task.wide_node_index] = wide_node;
+        }
+    }
+
+    void WideBvh::build(const Bvh& bvh, const glm::vec3* positions, SimdIsa isa, uint32_t width) {
+        PROFILE_ZONE("WideBvh::build");
+        if (!is_simd_isa_supported(isa)) {
+            LOG(Warning, "WideBvh: %s is not supported on this machine, falling back to %s", simd_isa_names[(int)isa], simd_isa_names[(int)detect_simd_isa()]);
+            isa = detect_simd_isa();
+        }
+        if (width == 0) width = simd_isa_width(isa);
+        if (width != 4 && width != 8) {
+            LOG(Warning, "WideBvh: width %u is not supported, using 8", width);
+            width = 8;
+        }
+
+        // The SIMD kernels only exist for their own width
+        m_isa = (width == simd_isa_width(isa)) ? isa : SimdIsa::scalar;
+        m_width = width;
+        m_nodes4.clear();
+        m_packets4.clear();
+        m_nodes8.clear();
+        m_packets8.clear();
+        if (width == 4) collapse_bvh(bvh, positions, m_nodes4, m_packets4);
+        else collapse_bvh(bvh, positions, m_nodes8, m_packets8);
+    }
+
+    bool WideBvh::intersect(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, BvhHit* hit) const {
+        if (n_packets() == 0) return false;
+        const WideRay ray = {
+            { origin.x, origin.y, origin.z },
+            { direction.x, direction.y, direction.z },
+            t_min,
+            t_max,
+        };
+
+        if (m_width == 4) {
+#if WIDE_BVH_X86
+            if (m_isa == SimdIsa::sse4) return wide_bvh_intersect_sse4(m_nodes4.data(), m_packets4.data(), ray, hit);
+#endif
+            return wide_bvh_intersect_scalar4(m_nodes4.data(), m_packets4.data(), ray, hit);
+        }
+#if WIDE_BVH_X86
+        if (m_isa == SimdIsa::avx512) return wide_bvh_intersect_avx512(m_nodes8.data(), m_packets8.data(), ray, hit);
+        if (m_isa == SimdIsa::avx2) return wide_bvh_intersect_avx2(m_nodes8.data(), m_packets8.data(), ray, hit);
+#endif
+        return wide_bvh_intersect_scalar8(m_nodes8.data(), m_packets8.data(), ray, hit);
+    }
+
+    bool WideBvh::intersect_closest(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, BvhHit& hit) const {
+        return intersect(origin, direction, t_min, t_max, &hit);
+    }
+
+    bool WideBvh::intersect_any(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) const {
+        return intersect(origin, direction, t_min, t_max, nullptr);
+    }
+
+    size_t WideBvh::size_in_bytes() const {
+        return m_nodes4.size() * sizeof(m_nodes4[0]) + m_packets4.size() * sizeof(m_packets4[0])
+            + m_nodes8.size() * sizeof(m_nodes8[0]) + m_packets8.size() * sizeof(m_packets8[0]);
+    }
+}
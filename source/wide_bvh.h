@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+
+namespace gfx {
+    enum class SimdIsa {
+        scalar, // Plain C++, the same traversal code as the SIMD kernels, for validating them
+        sse4,
+        avx2,
+        avx512,
+        count,
+    };
+
+    inline const char* simd_isa_names[] = {
+        "scalar",
+        "sse4",
+        "avx2",
+        "avx512",
+    };
+
+    SimdIsa detect_simd_isa(); // Widest instruction set both this build and the CPU support
+    bool is_simd_isa_supported(SimdIsa isa);
+    uint32_t simd_isa_width(SimdIsa isa); // Node width the ISA's kernel traverses, 4 for scalar
+
+    // Bounds of all children in SoA layout, so one ray can be tested against all of them at once. Unused slots have
+    // inverted bounds, so they never get hit
+    template<int Width>
+    struct alignas(Width * 4) WideBvhNode {
+        float bounds[6][Width]; // min x, y, z, max x, y, z
+        uint32_t children[Width]; // Node index for inner children, first triangle packet for leaves
+        uint32_t n_packets[Width]; // 0 for inner children
+    };
+
+    // A leaf's triangles in SoA layout, padded with degenerate triangles that never get hit
+    template<int Width>
+    struct alignas(Width * 4) TrianglePacket {
+        float v0[3][Width];
+        float edge1[3][Width];
+        float edge2[3][Width];
+        uint32_t triangle_indices[Width];
+    };
+
+    // 4- or 8-wide BVH, collapsed from a binary one. A ray is tested against all children of a node, or all triangles of a
+    // leaf packet, with one SIMD instruction per plane. Hits are the same as the binary BVH's, up to floating point rounding
+    struct WideBvh {
+        // `positions` has to be the buffer `bvh` was built from. A `width` of 0 picks the one `isa` traverses
+        void build(const Bvh& bvh, const glm::vec3* positions, SimdIsa isa = detect_simd_isa(), uint32_t width = 0);
+
+        bool intersect_closest(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, BvhHit& hit) const;
+        bool intersect_any(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max) const;
+
+        SimdIsa isa() const { return m_isa; }
+        uint32_t width() const { return m_width; }
+        size_t n_nodes() const { return (m_width == 4) ? m_nodes4.size() : m_nodes8.size(); }
+        size_t n_packets() const { return (m_width == 4) ? m_packets4.size() : m_packets8.size(); }
+        size_t size_in_bytes() const;
+
+    private:
+        bool intersect(glm::vec3 origin, glm::vec3 direction, float t_min, float t_max, BvhHit* hit) const;
+
+        SimdIsa m_isa = SimdIsa::scalar;
+        uint32_t m_width = 4;
+        std::vector<WideBvhNode<4>> m_nodes4;
+        std::vector<TrianglePacket<4>> m_packets4;
+        std::vector<WideBvhNode<8>> m_nodes8;
+        std::vector<TrianglePacket<8>> m_packets8;
+    };
+}
@@ -0,0 +1,43 @@
+#include "wide_bvh_kernels.h"
+#include "bvh_packet_kernels.h"
+
+#if WIDE_BVH_X86
+#include <immintrin.h>
+
+namespace gfx {
+    namespace {
+        // Same node width as AVX2, the gain is comparing straight into mask registers, which saves the and + movemask
+        // chain in the triangle test. 16-wide nodes would need a BVH16, and those end up mostly empty
+        struct SimdAvx512 {
+            static constexpr int width = 8;
+            using Float = __m256;
+            using Mask = __mmask8;
+
+            static Float load(const float* src) { return _mm256_load_ps(src); }
+            static void store(float* dst, Float a) { _mm256_store_ps(dst, a); }
+            static Float set1(float value) { return _mm256_set1_ps(value); }
+            static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+            static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+            static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+            static Float div(Float a, Float b) { return _mm256_div_ps(a, b); }
+            static Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+            static Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+            static Float abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+            static Mask cmp_ge(Float a, Float b) { return _mm256_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+            static Mask cmp_le(Float a, Float b) { return _mm256_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+            static Mask cmp_lt(Float a, Float b) { return _mm256_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+            static Mask and_mask(Mask a, Mask b) { return (Mask)(a & b); }
+            static uint32_t to_bits(Mask a) { return (uint32_t)a; }
+        };
+    }
+
+    bool wide_bvh_intersect_avx512(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const WideRay& ray, BvhHit* hit) {
+        return hit ? traverse<SimdAvx512, false>(nodes, packets, ray, hit) : traverse<SimdAvx512, true>(nodes, packets, ray, nullptr);
+    }
+
+    void bvh_intersect_packet_avx512(const BvhNode* nodes, const BvhTriangle* triangles, const uint32_t* triangle_indices, RayPacket& packet, bool any_hit) {
+        if (any_hit) traverse_packet<SimdAvx512, true>(nodes, triangles, triangle_indices, packet);
+        else traverse_packet<SimdAvx512, false>(nodes, triangles, triangle_indices, packet);
+    }
+}
+#endif
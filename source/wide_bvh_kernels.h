@@ -0,0 +1,187 @@
+#pragma once
+// Traversal shared by every instruction set. Each wide_bvh_<isa>.cpp includes this with its own `Simd` type and gets
+// compiled for that instruction set, so everything here is in an anonymous namespace: otherwise the linker could pick an
+// AVX-512 copy of some inline function for the SSE4 kernel
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "wide_bvh.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define WIDE_BVH_X86 1 // The SIMD kernels are only compiled on x86, everything else gets the scalar one
+#else
+#define WIDE_BVH_X86 0
+#endif
+
+#define WIDE_BVH_EMPTY 0xFFFFFFFF
+#define WIDE_BVH_STACK_SIZE (64 * 8) // Every level pushes at most `Width` - 1 more entries than it pops
+
+namespace gfx {
+    struct WideRay {
+        float origin[3];
+        float direction[3];
+        float t_min;
+        float t_max;
+    };
+
+    // Defined in the wide_bvh_<isa>.cpp files. Closest hit if `hit` isn't null, any hit otherwise
+    bool wide_bvh_intersect_scalar4(const WideBvhNode<4>* nodes, const TrianglePacket<4>* packets, const WideRay& ray, BvhHit* hit);
+    bool wide_bvh_intersect_scalar8(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const WideRay& ray, BvhHit* hit);
+    bool wide_bvh_intersect_sse4(const WideBvhNode<4>* nodes, const TrianglePacket<4>* packets, const WideRay& ray, BvhHit* hit);
+    bool wide_bvh_intersect_avx2(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const WideRay& ray, BvhHit* hit);
+    bool wide_bvh_intersect_avx512(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const WideRay& ray, BvhHit* hit);
+
+    namespace {
+        inline int count_trailing_zeros(uint32_t bits) {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, bits);
+            return (int)index;
+#else
+            return __builtin_ctz(bits);
+#endif
+        }
+
+        // Tests one ray against every triangle in the packet, same math as the binary BVH's Möller-Trumbore
+        template<typename Simd>
+        uint32_t intersect_packet(const TrianglePacket<Simd::width>& packet, const typename Simd::Float (&origin)[3], const typename Simd::Float (&direction)[3],
+                                  float t_min, float t_max, float* out_t, float* out_u, float* out_v) {
+            using Float = typename Simd::Float;
+            const Float e1_x = Simd::load(packet.edge1[0]), e1_y = Simd::load(packet.edge1[1]), e1_z = Simd::load(packet.edge1[2]);
+            const Float e2_x = Simd::load(packet.edge2[0]), e2_y = Simd::load(packet.edge2[1]), e2_z = Simd::load(packet.edge2[2]);
+
+            // Same operations in the same order as the binary BVH, without FMA, so every instruction set rounds the same way and
+            // finds exactly the same hits. Otherwise rays right on the edge between two triangles can slip through both
+            auto dot = [](const Float& a_x, const Float& a_y, const Float& a_z, const Float& b_x, const Float& b_y, const Float& b_z) {
+                return Simd::add(Simd::add(Simd::mul(a_x, b_x), Simd::mul(a_y, b_y)), Simd::mul(a_z, b_z));
+            };
+
+            // p = cross(direction, edge2)
+            const Float p_x = Simd::sub(Simd::mul(direction[1], e2_z), Simd::mul(e2_y, direction[2]));
+            const Float p_y = Simd::sub(Simd::mul(direction[2], e2_x), Simd::mul(e2_z, direction[0]));
+            const Float p_z = Simd::sub(Simd::mul(direction[0], e2_y), Simd::mul(e2_x, direction[1]));
+            const Float det = dot(e1_x, e1_y, e1_z, p_x, p_y, p_z);
+            const Float inv_det = Simd::div(Simd::set1(1.0f), det);
+
+            const Float s_x = Simd::sub(origin[0], Simd::load(packet.v0[0]));
+            const Float s_y = Simd::sub(origin[1], Simd::load(packet.v0[1]));
+            const Float s_z = Simd::sub(origin[2], Simd::load(packet.v0[2]));
+            const Float u = Simd::mul(dot(s_x, s_y, s_z, p_x, p_y, p_z), inv_det);
+
+            // q = cross(s, edge1)
+            const Float q_x = Simd::sub(Simd::mul(s_y, e1_z), Simd::mul(e1_y, s_z));
+            const Float q_y = Simd::sub(Simd::mul(s_z, e1_x), Simd::mul(e1_z, s_x));
+            const Float q_z = Simd::sub(Simd::mul(s_x, e1_y), Simd::mul(e1_x, s_y));
+            const Float v = Simd::mul(dot(direction[0], direction[1], direction[2], q_x, q_y, q_z), inv_det);
+            const Float t = Simd::mul(dot(e2_x, e2_y, e2_z, q_x, q_y, q_z), inv_det);
+
+            // Written so NaNs from the padding triangles fail every test
+            const Float zero = Simd::set1(0.0f);
+            const Float one = Simd::set1(1.0f);
+            typename Simd::Mask mask = Simd::cmp_ge(Simd::abs(det), Simd::set1(1e-12f));
+            mask = Simd::and_mask(mask, Simd::and_mask(Simd::cmp_ge(u, zero), Simd::cmp_le(u, one)));
+            mask = Simd::and_mask(mask, Simd::and_mask(Simd::cmp_ge(v, zero), Simd::cmp_le(Simd::add(u, v), one)));
+            mask = Simd::and_mask(mask, Simd::and_mask(Simd::cmp_ge(t, Simd::set1(t_min)), Simd::cmp_lt(t, Simd::set1(t_max))));
+            const uint32_t bits = Simd::to_bits(mask);
+            if (bits != 0 && out_t) {
+                Simd::store(out_t, t);
+                Simd::store(out_u, u);
+                Simd::store(out_v, v);
+            }
+            return bits;
+        }
+
+        template<typename Simd, bool AnyHit>
+        bool traverse(const WideBvhNode<Simd::width>* nodes, const TrianglePacket<Simd::width>* packets, const WideRay& ray, BvhHit* hit) {
+            constexpr int Width = Simd::width;
+            using Float = typename Simd::Float;
+
+            // Pick the near and far plane per axis up front, instead of sorting them for every box
+            float inv_direction[3];
+            int near_planes[3], far_planes[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                inv_direction[axis] = 1.0f / ray.direction[axis];
+                near_planes[axis] = (inv_direction[axis] >= 0.0f) ? axis : axis + 3;
+                far_planes[axis] = (inv_direction[axis] >= 0.0f) ? axis + 3 : axis;
+            }
+            const Float origin[3] = { Simd::set1(ray.origin[0]), Simd::set1(ray.origin[1]), Simd::set1(ray.origin[2]) };
+            const Float direction[3] = { Simd::set1(ray.direction[0]), Simd::set1(ray.direction[1]), Simd::set1(ray.direction[2]) };
+            const Float inv_dir[3] = { Simd::set1(inv_direction[0]), Simd::set1(inv_direction[1]), Simd::set1(inv_direction[2]) };
+            const Float t_min = Simd::set1(ray.t_min);
+
+            struct StackEntry {
+                uint32_t child;
+                uint32_t n_packets;
+                float t;
+            };
+            StackEntry stack[WIDE_BVH_STACK_SIZE];
+            uint32_t stack_size = 0;
+            stack[stack_size++] = { 0, 0, ray.t_min };
+
+            float closest_t = ray.t_max;
+            bool found_hit = false;
+            while (stack_size > 0) {
+                const StackEntry entry = stack[--stack_size];
+                if (entry.t > closest_t) continue; // Something closer got hit after this was pushed
+
+                if (entry.n_packets > 0) {
+                    for (uint32_t i = entry.child; i < entry.child + entry.n_packets; ++i) {
+                        alignas(64) float t[Width], u[Width], v[Width];
+                        uint32_t bits = intersect_packet<Simd>(packets[i], origin, direction, ray.t_min, closest_t, AnyHit ? nullptr : t, u, v);
+                        if constexpr (AnyHit) {
+                            if (bits != 0) return true;
+                        }
+                        while (bits != 0) {
+                            const int lane = count_trailing_zeros(bits);
+                            bits &= bits - 1;
+                            if (t[lane] < closest_t) {
+                                closest_t = t[lane];
+                                hit->t = t[lane];
+                                hit->barycentrics.x = u[lane];
+                                hit->barycentrics.y = v[lane];
+                                hit->triangle_index = packets[i].triangle_indices[lane];
+                                found_hit = true;
+                            }
+                        }
+                    }
+                    continue;
+                }
+
+                // Slab test against all children at once. (plane - origin) * inv_dir rounds exactly like the binary BVH does, so
+                // flat boxes around axis aligned triangles get hit by the same rays
+                const WideBvhNode<Width>& node = nodes[entry.child];
+                Float t_near = t_min;
+                Float t_far = Simd::set1(closest_t);
+                for (int axis = 0; axis < 3; ++axis) {
+                    const Float near_plane = Simd::mul(Simd::sub(Simd::load(node.bounds[near_planes[axis]]), origin[axis]), inv_dir[axis]);
+                    const Float far_plane = Simd::mul(Simd::sub(Simd::load(node.bounds[far_planes[axis]]), origin[axis]), inv_dir[axis]);
+                    t_near = Simd::max(t_near, near_plane);
+                    t_far = Simd::min(t_far, far_plane);
+                }
+                uint32_t bits = Simd::to_bits(Simd::cmp_le(t_near, t_far));
+                if (bits == 0) continue;
+
+                alignas(64) float t_enter[Width];
+                Simd::store(t_enter, t_near);
+
+                // Push the farthest child first, so the nearest one gets popped next
+                const uint32_t first_pushed = stack_size;
+                while (bits != 0) {
+                    const int lane = count_trailing_zeros(bits);
+                    bits &= bits - 1;
+                    if (node.children[lane] == WIDE_BVH_EMPTY) continue;
+                    StackEntry new_entry = { node.children[lane], node.n_packets[lane], t_enter[lane] };
+                    uint32_t i = stack_size++;
+                    if constexpr (!AnyHit) {
+                        for (; i > first_pushed && stack[i - 1].t < new_entry.t; --i) {
+                            stack[i] = stack[i - 1];
+                        }
+                    }
+                    stack[i] = new_entry;
+                }
+            }
+            return found_hit;
+        }
+    }
+}
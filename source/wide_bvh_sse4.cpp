@@ -0,0 +1,41 @@
+#include "wide_bvh_kernels.h"
+#include "bvh_packet_kernels.h"
+
+#if WIDE_BVH_X86
+#include <immintrin.h>
+
+namespace gfx {
+    namespace {
+        struct SimdSse4 {
+            static constexpr int width = 4;
+            using Float = __m128;
+            using Mask = __m128;
+
+            static Float load(const float* src) { return _mm_load_ps(src); }
+            static void store(float* dst, Float a) { _mm_store_ps(dst, a); }
+            static Float set1(float value) { return _mm_set1_ps(value); }
+            static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+            static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+            static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+            static Float div(Float a, Float b) { return _mm_div_ps(a, b); }
+            static Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+            static Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+            static Float abs(Float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+            static Mask cmp_ge(Float a, Float b) { return _mm_cmpge_ps(a, b); }
+            static Mask cmp_le(Float a, Float b) { return _mm_cmple_ps(a, b); }
+            static Mask cmp_lt(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+            static Mask and_mask(Mask a, Mask b) { return _mm_and_ps(a, b); }
+            static uint32_t to_bits(Mask a) { return (uint32_t)_mm_movemask_ps(a); }
+        };
+    }
+
+    bool wide_bvh_intersect_sse4(const WideBvhNode<4>* nodes, const TrianglePacket<4>* packets, const WideRay& ray, BvhHit* hit) {
+        return hit ? traverse<SimdSse4, false>(nodes, packets, ray, hit) : traverse<SimdSse4, true>(nodes, packets, ray, nullptr);
+    }
+
+    void bvh_intersect_packet_sse4(const BvhNode* nodes, const BvhTriangle* triangles, const uint32_t* triangle_indices, RayPacket& packet, bool any_hit) {
+        if (any_hit) traverse_packet<SimdSse4, true>(nodes, triangles, triangle_indices, packet);
+        else traverse_packet<SimdSse4, false>(nodes, triangles, triangle_indices, packet);
+    }
+}
+#endif
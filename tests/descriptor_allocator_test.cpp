@@ -0,0 +1,176 @@
+// Hands out and frees descriptor slots with a fake frame fence, from one thread and from several at once
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include "descriptor_allocator.h"
+#include "log.h"
+#include "test.h"
+
+#define N_THREADS 8
+#define N_STEPS_PER_THREAD 20000
+
+static void test_frees_wait_for_their_frame() {
+    gfx::DescriptorAllocator allocator(16, 1);
+    uint32_t index = 0;
+    uint32_t generation = 0;
+    CHECK(allocator.allocate(index, generation));
+    const uint32_t first = index;
+    allocator.free(first, 0);
+    CHECK(allocator.stats().n_pending_free == 1);
+
+    // The fence starts at 0, so a completed value of 0 doesn't mean frame 0 is done yet
+    allocator.recycle(0);
+    CHECK(allocator.stats().n_pending_free == 1);
+    allocator.recycle(1);
+    CHECK(allocator.stats().n_pending_free == 0);
+
+    // Freed during frame 5, only comes back once the GPU is past frame 5
+    CHECK(allocator.allocate(index, generation));
+    allocator.free(index, 5);
+    allocator.recycle(5);
+    CHECK(allocator.stats().n_pending_free == 1);
+    allocator.recycle(6);
+    CHECK(allocator.stats().n_pending_free == 0);
+}
+
+static void test_generations() {
+    gfx::DescriptorAllocator allocator(4, 1);
+    uint32_t index = 0;
+    uint32_t generation = 0;
+    CHECK(allocator.allocate(index, generation));
+    CHECK(allocator.is_current(index, generation));
+
+    // A stale handle gets caught as soon as it's freed, not only once the slot is reused
+    allocator.free(index, 0);
+    CHECK(!allocator.is_current(index, generation));
+    CHECK(allocator.generation(index) == generation + 1);
+    CHECK(!allocator.is_current(4, 0)); // Out of range
+
+    // Generations wrap around. The slot that was freed last is the first one to be reused
+    const uint32_t slot = index;
+    for (uint32_t i = 0; i < gfx::DescriptorAllocator::GENERATION_MASK; ++i) {
+        allocator.recycle(1);
+        CHECK(allocator.allocate(index, generation) && index == slot);
+        CHECK(generation == i + 1);
+        allocator.free(index, 0);
+    }
+    CHECK(allocator.generation(slot) == 0);
+}
+
+static void test_stride_and_capacity() {
+    // Like the bindless heap, where every resource gets an SRV and a UAV next to each other
+    gfx::DescriptorAllocator allocator(200, 2);
+    std::vector<uint32_t> indices;
+    uint32_t index = 0;
+    uint32_t generation = 0;
+    while (allocator.allocate(index, generation)) indices.push_back(index);
+    CHECK(indices.size() == 100);
+    std::sort(indices.begin(), indices.end());
+    for (uint32_t i = 0; i < indices.size(); ++i) CHECK(indices[i] == i * 2);
+    CHECK(allocator.stats().n_allocated == 100);
+    CHECK(allocator.stats().peak_allocated == 100);
+
+    // Full until something gets recycled
+    allocator.free(indices[10], 3);
+    CHECK(!allocator.allocate(index, generation));
+    allocator.recycle(4);
+    CHECK(allocator.allocate(index, generation) && index == indices[10]);
+    CHECK(allocator.stats().peak_allocated == 100);
+}
+
+static void test_slots_from_other_threads() {
+    // One thread takes every fresh slot, so another thread has to get them from its shard once they're freed
+    gfx::DescriptorAllocator allocator(128, 1);
+    std::vector<uint32_t> indices;
+    std::thread([&]() {
+        uint32_t index = 0;
+        uint32_t generation = 0;
+        while (allocator.allocate(index, generation)) indices.push_back(index);
+        for (uint32_t index : indices) allocator.free(index, 0);
+    }).join();
+    CHECK(indices.size() == 128);
+    allocator.recycle(1);
+
+    uint32_t n_allocated = 0;
+    uint32_t index = 0;
+    uint32_t generation = 0;
+    while (allocator.allocate(index, generation)) ++n_allocated;
+    CHECK(n_allocated == 128);
+}
+
+static void test_contention() {
+    // Every thread allocates and frees at random, while the main thread keeps recycling frames. A slot handed out to two
+    // threads at once shows up as an owner that isn't zero when it's taken
+    constexpr uint32_t capacity = 4096;
+    gfx::DescriptorAllocator allocator(capacity, 1);
+    std::vector<std::atomic<uint32_t>> owners(capacity);
+    std::atomic<uint64_t> frame_index = 0;
+    std::atomic<uint32_t> n_threads_done = 0;
+    std::atomic<uint32_t> n_double_allocations = 0;
+    std::atomic<uint32_t> n_stale_generations = 0;
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < N_THREADS; ++t) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            std::vector<std::pair<uint32_t, uint32_t>> held; // Index and generation
+            for (int step = 0; step < N_STEPS_PER_THREAD; ++step) {
+                if (rng() % 2 == 0 && held.size() < capacity / N_THREADS) {
+                    uint32_t index = 0;
+                    uint32_t generation = 0;
+                    if (!allocator.allocate(index, generation)) continue;
+                    uint32_t expected = 0;
+                    if (!owners[index].compare_exchange_strong(expected, t + 1)) n_double_allocations++;
+                    held.push_back({ index, generation });
+                }
+                else if (!held.empty()) {
+                    const size_t i = rng() % held.size();
+                    const auto [index, generation] = held[i];
+                    if (!allocator.is_current(index, generation)) n_stale_generations++;
+                    owners[index].store(0);
+                    allocator.free(index, frame_index.load());
+                    held[i] = held.back();
+                    held.pop_back();
+                }
+            }
+            for (const auto& [index, generation] : held) {
+                owners[index].store(0);
+                allocator.free(index, frame_index.load());
+            }
+            n_threads_done++;
+        });
+    }
+    while (n_threads_done.load() < N_THREADS) {
+        // The GPU lags two frames behind
+        const uint64_t frame = ++frame_index;
+        allocator.recycle(frame >= 2 ? frame - 2 : 0);
+        std::this_thread::yield();
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    CHECK(n_double_allocations.load() == 0);
+    CHECK(n_stale_generations.load() == 0);
+    CHECK(allocator.stats().n_allocated == 0);
+    CHECK(allocator.stats().peak_allocated <= capacity);
+
+    // Once every frame is done, every slot is back
+    allocator.recycle(frame_index.load() + 1);
+    CHECK(allocator.stats().n_pending_free == 0);
+    uint32_t n_allocated = 0;
+    uint32_t index = 0;
+    uint32_t generation = 0;
+    while (allocator.allocate(index, generation)) ++n_allocated;
+    CHECK(n_allocated == capacity);
+}
+
+int main() {
+    test_frees_wait_for_their_frame();
+    test_generations();
+    test_stride_and_capacity();
+    test_slots_from_other_threads();
+    test_contention();
+    Log::flush();
+    return test_result();
+}
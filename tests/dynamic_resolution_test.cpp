@@ -0,0 +1,144 @@
+// Feeds frame time traces to the dynamic resolution controller, with a made up GPU whose frame time scales with the pixel count
+// and shows up a couple of frames late, like real timestamp queries do
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "dynamic_resolution.h"
+#include "log.h"
+#include "test.h"
+
+#define GPU_TIMING_LATENCY 2 // Frames between rendering at a scale and the controller seeing how long it took
+#define MS (1.0f / 1000.0f)
+
+struct FrameTimes {
+    float gpu_full_resolution; // What the frame would cost at scale 1
+    float cpu;
+};
+
+struct TraceResult {
+    std::vector<float> scales; // Scale each frame was rendered at
+    std::vector<float> gpu_times; // What each frame actually cost
+    uint32_t n_changes_after(uint32_t frame) const {
+        uint32_t n_changes = 0;
+        for (size_t i = std::max(frame, 1u); i < scales.size(); ++i) n_changes += (scales[i] != scales[i - 1]) ? 1 : 0;
+        return n_changes;
+    }
+};
+
+static TraceResult run_trace(gfx::DynamicResolutionController& controller, const std::vector<FrameTimes>& trace) {
+    TraceResult result;
+    for (size_t frame = 0; frame < trace.size(); ++frame) {
+        const float scale = controller.scale();
+        result.scales.push_back(scale);
+        result.gpu_times.push_back(trace[frame].gpu_full_resolution * scale * scale);
+
+        if (frame >= GPU_TIMING_LATENCY) {
+            const size_t measured = frame - GPU_TIMING_LATENCY;
+            controller.update(result.gpu_times[measured], trace[measured].cpu);
+        }
+    }
+    return result;
+}
+
+// A scene that costs `gpu` at full resolution, with some frame to frame noise
+static std::vector<FrameTimes> make_trace(uint32_t n_frames, float gpu, float cpu, float noise, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> noise_dist(1.0f - noise, 1.0f + noise);
+    std::vector<FrameTimes> trace(n_frames);
+    for (FrameTimes& frame : trace) frame = FrameTimes{ gpu * noise_dist(rng), cpu * noise_dist(rng) };
+    return trace;
+}
+
+static void test_light_scene_stays_at_full_resolution() {
+    gfx::DynamicResolutionController controller(gfx::DynamicResolutionSettings{});
+    const TraceResult result = run_trace(controller, make_trace(300, 8.0f * MS, 4.0f * MS, 0.1f, 1));
+    CHECK(result.n_changes_after(0) == 0);
+    CHECK(controller.scale() == 1.0f);
+}
+
+static void test_heavy_scene_settles_within_budget() {
+    const gfx::DynamicResolutionSettings settings{};
+    gfx::DynamicResolutionController controller(settings);
+    const TraceResult result = run_trace(controller, make_trace(600, 25.0f * MS, 4.0f * MS, 0.05f, 2));
+
+    // Gets under budget within a second or so, and then leaves the resolution alone
+    CHECK(controller.scale() < 1.0f);
+    CHECK(result.n_changes_after(60) == 0);
+    float average_gpu_time = 0.0f;
+    for (size_t i = 60; i < result.gpu_times.size(); ++i) average_gpu_time += result.gpu_times[i];
+    average_gpu_time /= (float)(result.gpu_times.size() - 60);
+    CHECK(average_gpu_time <= settings.target_frame_time * settings.upper_threshold);
+    CHECK(average_gpu_time >= settings.target_frame_time * settings.lower_threshold * 0.9f);
+}
+
+static void test_single_spike_is_ignored() {
+    std::vector<FrameTimes> trace = make_trace(200, 12.0f * MS, 4.0f * MS, 0.0f, 3);
+    trace[100].gpu_full_resolution = 30.0f * MS;
+    gfx::DynamicResolutionController controller(gfx::DynamicResolutionSettings{});
+    const TraceResult result = run_trace(controller, trace);
+    CHECK(result.n_changes_after(0) == 0);
+}
+
+static void test_cpu_bound_doesnt_scale_down_for_nothing() {
+    // The CPU takes 20ms no matter what, so the GPU only has to get down to that, going lower wouldn't make frames faster
+    gfx::DynamicResolutionController controller(gfx::DynamicResolutionSettings{});
+    run_trace(controller, make_trace(600, 25.0f * MS, 20.0f * MS, 0.02f, 4));
+    const float scale = controller.scale();
+    CHECK(scale < 1.0f);
+    CHECK(25.0f * MS * scale * scale >= 20.0f * MS * 0.9f);
+}
+
+static void test_clamped_to_min_scale() {
+    const gfx::DynamicResolutionSettings settings{};
+    gfx::DynamicResolutionController controller(settings);
+    const TraceResult result = run_trace(controller, make_trace(300, 200.0f * MS, 4.0f * MS, 0.05f, 5));
+    CHECK(controller.scale() == settings.min_scale);
+    for (float scale : result.scales) CHECK(scale >= settings.min_scale && scale <= settings.max_scale);
+
+    // Steps down are limited, so it doesn't jump straight to the minimum
+    for (size_t i = 1; i < result.scales.size(); ++i) CHECK(result.scales[i - 1] - result.scales[i] <= settings.max_step_down + 1e-5f);
+}
+
+static void test_recovers_when_the_scene_gets_lighter() {
+    // Heavy for a while, then light again. Should come back to full resolution, only ever moving up on the way
+    const gfx::DynamicResolutionSettings settings{};
+    std::vector<FrameTimes> trace = make_trace(400, 30.0f * MS, 4.0f * MS, 0.05f, 6);
+    const std::vector<FrameTimes> light = make_trace(400, 9.0f * MS, 4.0f * MS, 0.05f, 7);
+    trace.insert(trace.end(), light.begin(), light.end());
+
+    gfx::DynamicResolutionController controller(settings);
+    const TraceResult result = run_trace(controller, trace);
+    CHECK(result.scales[399] < 0.8f);
+    CHECK(controller.scale() == settings.max_scale);
+    for (size_t i = 401 + GPU_TIMING_LATENCY; i < result.scales.size(); ++i) {
+        CHECK(result.scales[i] >= result.scales[i - 1]);
+        CHECK(result.scales[i] - result.scales[i - 1] <= settings.max_step_up + 1e-5f);
+    }
+}
+
+static void test_scales_are_quantized() {
+    const gfx::DynamicResolutionSettings settings{};
+    gfx::DynamicResolutionController controller(settings);
+    const TraceResult result = run_trace(controller, make_trace(600, 21.0f * MS, 4.0f * MS, 0.1f, 8));
+    for (float scale : result.scales) {
+        const float steps = scale / settings.scale_granularity;
+        CHECK(std::abs(steps - std::round(steps)) < 1e-3f);
+    }
+
+    controller.reset(0.7f);
+    CHECK(std::abs(controller.scale() / settings.scale_granularity - std::round(controller.scale() / settings.scale_granularity)) < 1e-3f);
+    CHECK(controller.scale() <= 0.7f);
+}
+
+int main() {
+    test_light_scene_stays_at_full_resolution();
+    test_heavy_scene_settles_within_budget();
+    test_single_spike_is_ignored();
+    test_cpu_bound_doesnt_scale_down_for_nothing();
+    test_clamped_to_min_scale();
+    test_recovers_when_the_scene_gets_lighter();
+    test_scales_are_quantized();
+    Log::flush();
+    return test_result();
+}
@@ -0,0 +1,186 @@
+// Allocates and frees at random with a fake heap callback, and checks that allocations never overlap, stay aligned and inside their
+// heap, and that the heaps merge back into one free block each once everything is freed
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "heap_allocator.h"
+#include "log.h"
+#include "test.h"
+
+#define KB (1024ull)
+#define HEAP_SIZE (4 * 1024 * KB)
+#define GRANULARITY (4 * KB)
+
+// Stand-in for the device: remembers the heaps it was asked for, and can be told to fail
+struct FakeHeaps {
+    std::vector<uint64_t> sizes;
+    bool fail = false;
+
+    gfx::HeapAllocator::CreateHeapFunc func() {
+        return [this](uint32_t heap_index, uint64_t size) {
+            if (fail) return false;
+            CHECK(heap_index == sizes.size());
+            sizes.push_back(size);
+            return true;
+        };
+    }
+};
+
+struct LiveAllocation {
+    gfx::HeapAllocation allocation;
+    uint64_t requested_size;
+    uint64_t alignment;
+};
+
+static void check_allocations(const gfx::HeapAllocator& allocator, const FakeHeaps& heaps, std::vector<LiveAllocation> live) {
+    uint64_t bytes_allocated = 0;
+    for (const LiveAllocation& a : live) {
+        CHECK(a.allocation.is_valid());
+        CHECK(a.allocation.heap < heaps.sizes.size());
+        CHECK(a.allocation.offset % a.alignment == 0);
+        CHECK(a.allocation.size >= a.requested_size);
+        CHECK(a.allocation.offset + a.allocation.size <= HEAP_SIZE);
+        bytes_allocated += a.allocation.size;
+    }
+    CHECK(allocator.stats().n_allocations == live.size());
+    CHECK(allocator.stats().bytes_allocated == bytes_allocated);
+    CHECK(allocator.stats().n_heaps == heaps.sizes.size());
+    CHECK(allocator.stats().total_heap_bytes == heaps.sizes.size() * HEAP_SIZE);
+
+    std::sort(live.begin(), live.end(), [](const LiveAllocation& a, const LiveAllocation& b) {
+        return (a.allocation.heap != b.allocation.heap) ? (a.allocation.heap < b.allocation.heap) : (a.allocation.offset < b.allocation.offset);
+    });
+    for (size_t i = 1; i < live.size(); ++i) {
+        const gfx::HeapAllocation& prev = live[i - 1].allocation;
+        const gfx::HeapAllocation& curr = live[i].allocation;
+        if (prev.heap == curr.heap) CHECK(prev.offset + prev.size <= curr.offset);
+    }
+}
+
+// Once everything is freed, every heap should be a single free block again, so a whole-heap allocation fits in each without a new heap
+static void check_heaps_merged(gfx::HeapAllocator& allocator, const FakeHeaps& heaps) {
+    CHECK(allocator.stats().n_allocations == 0);
+    CHECK(allocator.stats().bytes_allocated == 0);
+    CHECK(allocator.largest_free_block() == (heaps.sizes.empty() ? 0 : HEAP_SIZE));
+
+    const size_t n_heaps = heaps.sizes.size();
+    std::vector<gfx::HeapAllocation> whole_heaps;
+    for (size_t i = 0; i < n_heaps; ++i) {
+        whole_heaps.push_back(allocator.allocate(HEAP_SIZE, 64 * KB));
+        CHECK(whole_heaps.back().is_valid() && whole_heaps.back().offset == 0);
+    }
+    CHECK(heaps.sizes.size() == n_heaps);
+    for (gfx::HeapAllocation& allocation : whole_heaps) allocator.free(allocation);
+}
+
+static void test_random_alloc_free(uint32_t seed) {
+    std::mt19937 rng(seed);
+    FakeHeaps heaps;
+    gfx::HeapAllocator allocator(HEAP_SIZE, GRANULARITY, heaps.func());
+    std::vector<LiveAllocation> live;
+
+    for (int batch = 0; batch < 200; ++batch) {
+        // Mostly small buffers and textures, with the odd big one, like a scene's resources
+        const int n_allocs = rng() % 32;
+        for (int i = 0; i < n_allocs; ++i) {
+            const uint64_t size = (rng() % 8 == 0) ? (64 * KB + rng() % (1024 * KB)) : (1 + rng() % (64 * KB));
+            const uint64_t alignment = (rng() % 2 == 0) ? 4 * KB : 64 * KB;
+            const gfx::HeapAllocation allocation = allocator.allocate(size, alignment);
+            CHECK(allocation.is_valid());
+            if (allocation.is_valid()) live.push_back({ allocation, size, alignment });
+        }
+        const int n_frees = std::min((int)live.size(), (int)(rng() % 32));
+        for (int i = 0; i < n_frees; ++i) {
+            const size_t index = rng() % live.size();
+            allocator.free(live[index].allocation);
+            CHECK(!live[index].allocation.is_valid());
+            live[index] = live.back();
+            live.pop_back();
+        }
+        check_allocations(allocator, heaps, live);
+    }
+    CHECK(heaps.sizes.size() > 1); // Otherwise it never had to make a new heap
+    CHECK(allocator.stats().n_failed_allocations == 0);
+
+    std::shuffle(live.begin(), live.end(), rng);
+    for (LiveAllocation& a : live) allocator.free(a.allocation);
+    check_heaps_merged(allocator, heaps);
+}
+
+static void test_budget() {
+    FakeHeaps heaps;
+    gfx::HeapAllocator allocator(HEAP_SIZE, GRANULARITY, heaps.func());
+    allocator.set_budget(2 * HEAP_SIZE);
+
+    gfx::HeapAllocation a = allocator.allocate(HEAP_SIZE, 4 * KB);
+    gfx::HeapAllocation b = allocator.allocate(HEAP_SIZE / 2, 4 * KB);
+    gfx::HeapAllocation c = allocator.allocate(HEAP_SIZE / 2, 4 * KB);
+    CHECK(a.is_valid() && b.is_valid() && c.is_valid());
+    CHECK(heaps.sizes.size() == 2);
+
+    // A third heap would go over the budget
+    gfx::HeapAllocation d = allocator.allocate(4 * KB, 4 * KB);
+    CHECK(!d.is_valid());
+    CHECK(heaps.sizes.size() == 2);
+    CHECK(allocator.stats().n_failed_allocations == 1);
+    CHECK(allocator.stats().total_heap_bytes <= allocator.budget());
+
+    // Bigger than a heap never fits, budget or not
+    CHECK(!allocator.allocate(HEAP_SIZE + 1, 4 * KB).is_valid());
+
+    // Room in the existing heaps is still fine
+    allocator.free(b);
+    d = allocator.allocate(4 * KB, 4 * KB);
+    CHECK(d.is_valid() && d.heap == 1);
+
+    // Raising the budget allows another heap, but if the callback fails, the allocation fails too
+    allocator.set_budget(3 * HEAP_SIZE);
+    heaps.fail = true;
+    gfx::HeapAllocation e = allocator.allocate(HEAP_SIZE, 4 * KB);
+    CHECK(!e.is_valid());
+    CHECK(allocator.stats().n_heaps == 2);
+    heaps.fail = false;
+    e = allocator.allocate(HEAP_SIZE, 4 * KB);
+    CHECK(e.is_valid() && e.heap == 2);
+
+    allocator.free(a);
+    allocator.free(c);
+    allocator.free(d);
+    allocator.free(e);
+    check_heaps_merged(allocator, heaps);
+}
+
+static void test_alignment_padding_is_reused() {
+    FakeHeaps heaps;
+    gfx::HeapAllocator allocator(HEAP_SIZE, GRANULARITY, heaps.func());
+
+    // The 64 KB aligned texture skips over 60 KB, which small buffers should fill up before anything goes after the texture
+    gfx::HeapAllocation small = allocator.allocate(4 * KB, 4 * KB);
+    gfx::HeapAllocation texture = allocator.allocate(64 * KB, 64 * KB);
+    CHECK(small.offset == 0);
+    CHECK(texture.offset == 64 * KB);
+
+    std::vector<gfx::HeapAllocation> fillers;
+    for (int i = 0; i < 15; ++i) {
+        fillers.push_back(allocator.allocate(4 * KB, 4 * KB));
+        CHECK(fillers.back().heap == 0);
+        CHECK(fillers.back().offset >= 4 * KB && fillers.back().offset < 64 * KB);
+    }
+    gfx::HeapAllocation after = allocator.allocate(4 * KB, 4 * KB);
+    CHECK(after.offset == 128 * KB);
+    CHECK(heaps.sizes.size() == 1);
+
+    allocator.free(small);
+    allocator.free(texture);
+    allocator.free(after);
+    for (gfx::HeapAllocation& filler : fillers) allocator.free(filler);
+    check_heaps_merged(allocator, heaps);
+}
+
+int main() {
+    for (uint32_t seed = 1; seed <= 3; ++seed) test_random_alloc_free(seed);
+    test_budget();
+    test_alignment_padding_is_reused();
+    Log::flush();
+    return test_result();
+}
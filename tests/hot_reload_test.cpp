@@ -0,0 +1,251 @@
+// Edits files in a temporary directory and checks what the file watcher and the pipeline hot reloading make of it. Write times are
+// set by hand, so the tests don't depend on how precise the file system's timestamps are
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "hot_reload.h"
+#include "log.h"
+#include "test.h"
+
+#define FRAMES_IN_FLIGHT 2
+
+// The real one wraps D3D12 objects, hot reloading only ever passes it around as a pointer
+namespace gfx {
+    struct Pipeline {
+        std::string name;
+        uint32_t version;
+    };
+}
+
+struct TempDirectory {
+    std::filesystem::path path;
+    TempDirectory(const char* name) {
+        path = std::filesystem::temp_directory_path() / (std::string(name) + "_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+        std::filesystem::create_directories(path);
+    }
+    ~TempDirectory() {
+        std::error_code error;
+        std::filesystem::remove_all(path, error);
+    }
+    std::string file(const std::string& name) const { return (path / name).generic_string(); }
+};
+
+// Writes the file and gives it a write time a whole second after the last one, so every write is seen as a change
+static void write_file(const std::string& path, const std::string& contents) {
+    static auto write_time = std::filesystem::file_time_type::clock::now();
+    write_time += std::chrono::seconds(1);
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << contents;
+    }
+    std::filesystem::last_write_time(path, write_time);
+}
+
+static void test_watcher_reports_stable_changes() {
+    TempDirectory temp("hot_reload_test");
+    write_file(temp.file("existing.hlsl"), "a");
+    gfx::FileWatcher watcher(temp.path.string());
+    CHECK(watcher.poll().empty()); // Files that were there from the start aren't changes
+
+    // A new file shows up one poll later, once its write time stopped changing, and only once
+    write_file(temp.file("sub/dir/new.hlsl"), "b");
+    CHECK(watcher.poll().empty());
+    CHECK(watcher.poll() == std::vector<std::string>({ temp.file("sub/dir/new.hlsl") }));
+    CHECK(watcher.poll().empty());
+
+    // A file that keeps getting written isn't reported until it's done
+    write_file(temp.file("existing.hlsl"), "c");
+    CHECK(watcher.poll().empty());
+    write_file(temp.file("existing.hlsl"), "cd");
+    CHECK(watcher.poll().empty());
+    CHECK(watcher.poll() == std::vector<std::string>({ temp.file("existing.hlsl") }));
+
+    // Several at once come back sorted
+    write_file(temp.file("z.hlsl"), "z");
+    write_file(temp.file("a.hlsl"), "a");
+    write_file(temp.file("existing.hlsl"), "e");
+    watcher.poll();
+    CHECK(watcher.poll() == std::vector<std::string>({ temp.file("a.hlsl"), temp.file("existing.hlsl"), temp.file("z.hlsl") }));
+
+    // Deleting isn't a change, and doesn't break anything
+    std::filesystem::remove(temp.file("a.hlsl"));
+    CHECK(watcher.poll().empty());
+    CHECK(watcher.poll().empty());
+}
+
+static void test_watcher_missing_directory() {
+    TempDirectory temp("hot_reload_test");
+    gfx::FileWatcher watcher(temp.file("not_there_yet"));
+    CHECK(watcher.poll().empty());
+
+    // Created later, so everything in it is new
+    write_file(temp.file("not_there_yet/a.hlsl"), "a");
+    watcher.poll();
+    CHECK(watcher.poll().size() == 1);
+}
+
+struct FakePipelines {
+    std::map<std::string, std::vector<std::string>> includes; // Per shader, what `ShaderCache::source_files()` would find
+    std::map<std::string, uint32_t> n_builds;
+    bool fail = false;
+
+    gfx::PipelineHotReload::SourceFilesFunc source_files_func() {
+        return [this](const std::string& shader_path) {
+            std::vector<std::string> files = { shader_path };
+            for (const std::string& include : includes[shader_path]) files.push_back(include);
+            return files;
+        };
+    }
+
+    gfx::PipelineHotReload::BuildFunc build_func(const std::string& name) {
+        return [this, name]() -> std::shared_ptr<gfx::Pipeline> {
+            if (fail) return nullptr;
+            return std::make_shared<gfx::Pipeline>(gfx::Pipeline{ name, ++n_builds[name] });
+        };
+    }
+};
+
+static void test_rebuild_affected_pipelines() {
+    TempDirectory temp("hot_reload_test");
+    const std::string common = temp.file("common.hlsl");
+    const std::string lighting = temp.file("lighting.hlsl");
+    const std::string sky = temp.file("sky.hlsl");
+    write_file(common, "common");
+    write_file(lighting, "#include \"common.hlsl\"");
+    write_file(sky, "sky");
+
+    FakePipelines fake;
+    fake.includes[lighting] = { common };
+    gfx::PipelineHotReload hot_reload(temp.path.string(), FRAMES_IN_FLIGHT, fake.source_files_func());
+    std::shared_ptr<gfx::Pipeline> lighting_pipeline = fake.build_func("lighting")();
+    std::shared_ptr<gfx::Pipeline> sky_pipeline = fake.build_func("sky")();
+    hot_reload.add_pipeline(lighting_pipeline, { lighting }, fake.build_func("lighting"));
+    hot_reload.add_pipeline(sky_pipeline, { sky }, fake.build_func("sky"));
+    CHECK(hot_reload.rebuild_changed() == 0);
+
+    // Editing an include only rebuilds the pipeline that uses it
+    write_file(common, "common v2");
+    CHECK(hot_reload.rebuild_changed() == 0);
+    CHECK(hot_reload.rebuild_changed() == 1);
+    CHECK(fake.n_builds["lighting"] == 2 && fake.n_builds["sky"] == 1);
+
+    // Nothing changes until `apply()`
+    CHECK(lighting_pipeline->version == 1);
+    CHECK(hot_reload.apply(10, 9) == 1);
+    CHECK(lighting_pipeline->version == 2);
+    CHECK(hot_reload.apply(11, 10) == 0);
+
+    // The include list gets refreshed on a rebuild, so a new include counts from then on
+    const std::string shadows = temp.file("shadows.hlsl");
+    write_file(shadows, "shadows");
+    fake.includes[lighting].push_back(shadows);
+    write_file(lighting, "#include \"common.hlsl\"\n#include \"shadows.hlsl\"");
+    hot_reload.rebuild_changed();
+    CHECK(hot_reload.rebuild_changed() == 1);
+    write_file(shadows, "shadows v2");
+    hot_reload.rebuild_changed();
+    CHECK(hot_reload.rebuild_changed() == 1);
+    CHECK(fake.n_builds["lighting"] == 4);
+
+    // Rebuilt twice before `apply()`, only the newest one gets swapped in
+    CHECK(hot_reload.apply(12, 11) == 1);
+    CHECK(lighting_pipeline->version == 4);
+}
+
+static void test_failed_rebuild_keeps_old_pipeline() {
+    TempDirectory temp("hot_reload_test");
+    const std::string sky = temp.file("sky.hlsl");
+    write_file(sky, "sky");
+    FakePipelines fake;
+    gfx::PipelineHotReload hot_reload(temp.path.string(), FRAMES_IN_FLIGHT, fake.source_files_func());
+    std::shared_ptr<gfx::Pipeline> sky_pipeline = fake.build_func("sky")();
+    hot_reload.add_pipeline(sky_pipeline, { sky }, fake.build_func("sky"));
+
+    fake.fail = true;
+    write_file(sky, "syntax error");
+    hot_reload.rebuild_changed();
+    CHECK(hot_reload.rebuild_changed() == 0);
+    CHECK(hot_reload.apply(1, 0) == 0);
+    CHECK(sky_pipeline->version == 1);
+
+    // Fixing it works again
+    fake.fail = false;
+    write_file(sky, "fixed");
+    hot_reload.rebuild_changed();
+    CHECK(hot_reload.rebuild_changed() == 1);
+    CHECK(hot_reload.apply(2, 1) == 1);
+    CHECK(sky_pipeline->version == 2);
+}
+
+static void test_old_pipelines_wait_for_the_gpu() {
+    TempDirectory temp("hot_reload_test");
+    const std::string sky = temp.file("sky.hlsl");
+    write_file(sky, "sky");
+    FakePipelines fake;
+    gfx::PipelineHotReload hot_reload(temp.path.string(), FRAMES_IN_FLIGHT, fake.source_files_func());
+    std::shared_ptr<gfx::Pipeline> sky_pipeline = fake.build_func("sky")();
+    const std::weak_ptr<gfx::Pipeline> old_pipeline = sky_pipeline;
+    hot_reload.add_pipeline(sky_pipeline, { sky }, fake.build_func("sky"));
+
+    write_file(sky, "sky v2");
+    hot_reload.rebuild_changed();
+    hot_reload.rebuild_changed();
+
+    // Swapped in during frame 5, so frames up to 5 + FRAMES_IN_FLIGHT might still use the old one
+    const uint64_t frame_index = 5;
+    CHECK(hot_reload.apply(frame_index, 4) == 1);
+    CHECK(hot_reload.n_retired() == 1);
+    CHECK(!old_pipeline.expired());
+    for (uint64_t completed = 5; completed <= frame_index + FRAMES_IN_FLIGHT; ++completed) {
+        hot_reload.apply(completed + 1, completed);
+        CHECK(!old_pipeline.expired());
+    }
+
+    // The fence has to get past that frame, reaching it isn't enough
+    hot_reload.apply(frame_index + FRAMES_IN_FLIGHT + 2, frame_index + FRAMES_IN_FLIGHT + 1);
+    CHECK(old_pipeline.expired());
+    CHECK(hot_reload.n_retired() == 0);
+}
+
+static void test_background_thread() {
+    TempDirectory temp("hot_reload_test");
+    const std::string sky = temp.file("sky.hlsl");
+    write_file(sky, "sky");
+    FakePipelines fake;
+    gfx::PipelineHotReload hot_reload(temp.path.string(), FRAMES_IN_FLIGHT, fake.source_files_func());
+    std::shared_ptr<gfx::Pipeline> sky_pipeline = fake.build_func("sky")();
+    hot_reload.add_pipeline(sky_pipeline, { sky }, fake.build_func("sky"));
+    hot_reload.start(std::chrono::milliseconds(2));
+
+    // Pretend to render frames until the rebuild shows up
+    write_file(sky, "sky v2");
+    uint64_t frame_index = 0;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (hot_reload.apply(frame_index, frame_index) == 0 && std::chrono::steady_clock::now() < deadline) {
+        ++frame_index;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    hot_reload.stop();
+    CHECK(sky_pipeline->version == 2);
+
+    // Stopping twice, and starting again, is fine
+    hot_reload.stop();
+    hot_reload.start(std::chrono::milliseconds(2));
+    hot_reload.stop();
+}
+
+int main() {
+    test_watcher_reports_stable_changes();
+    test_watcher_missing_directory();
+    test_rebuild_affected_pipelines();
+    test_failed_rebuild_keeps_old_pipeline();
+    test_old_pipelines_wait_for_the_gpu();
+    test_background_thread();
+    Log::flush();
+    return test_result();
+}
@@ -0,0 +1,245 @@
+// Builds light trees over random mixes of point lights, spot lights and emissive triangles, and checks that sampling them is
+// consistent with `pdf()`, unbiased, and less noisy than picking a light uniformly
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+#include "light_tree.h"
+#include "log.h"
+#include "test.h"
+
+#define N_SHADING_POINTS 64
+#define N_SAMPLES 16384 // Per shading point, stratified
+
+static float luminance(const glm::vec3 color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Unshadowed contribution of an emitter to a shading point, triangles treated as a point at their centroid. Like the tree, the
+// surface is lit from both sides, and a zero normal means a point in a volume, lit from every direction
+static float contribution(const gfx::LightTreeEmitter& emitter, glm::vec3 position, glm::vec3 normal) {
+    const glm::vec3 light_position = (emitter.type == gfx::LightTreeEmitterType::triangle)
+        ? (emitter.positions[0] + emitter.positions[1] + emitter.positions[2]) / 3.0f
+        : emitter.positions[0];
+    const glm::vec3 to_light = light_position - position;
+    const float distance_squared = glm::dot(to_light, to_light);
+    const glm::vec3 light_dir = to_light / sqrtf(distance_squared);
+    const float cos_surface = (normal != glm::vec3(0.0f)) ? fabsf(glm::dot(normal, light_dir)) : 1.0f;
+    float result = luminance(emitter.radiance) * cos_surface / distance_squared;
+
+    switch (emitter.type) {
+    case gfx::LightTreeEmitterType::point:
+        break;
+    case gfx::LightTreeEmitterType::spot:
+        result *= glm::smoothstep(emitter.cos_outer_cone_angle, emitter.cos_inner_cone_angle, glm::dot(glm::normalize(emitter.direction), -light_dir));
+        break;
+    case gfx::LightTreeEmitterType::triangle: {
+        const glm::vec3 cross = glm::cross(emitter.positions[1] - emitter.positions[0], emitter.positions[2] - emitter.positions[0]);
+        const float cos_emitter = glm::dot(glm::normalize(cross), -light_dir);
+        result *= glm::length(cross) * 0.5f * (emitter.double_sided ? fabsf(cos_emitter) : std::max(cos_emitter, 0.0f));
+        break;
+    }
+    }
+    return result;
+}
+
+// Lamps and spot lights over a 40 x 40 meter floor, and a few emissive panels made of triangles, with very different brightnesses
+static std::vector<gfx::LightTreeEmitter> random_emitters(std::mt19937& rng) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    auto random_position = [&](float min_height, float max_height) {
+        return glm::vec3(unit(rng) * 40.0f - 20.0f, min_height + unit(rng) * (max_height - min_height), unit(rng) * 40.0f - 20.0f);
+    };
+    auto random_radiance = [&]() {
+        return glm::vec3(0.5f + unit(rng), 0.5f + unit(rng), 0.5f + unit(rng)) * powf(10.0f, unit(rng) * 3.0f);
+    };
+
+    std::vector<gfx::LightTreeEmitter> emitters;
+    for (int i = 0; i < 200; ++i) {
+        gfx::LightTreeEmitter emitter{ .type = gfx::LightTreeEmitterType::point, .radiance = random_radiance() };
+        emitter.positions[0] = random_position(0.5f, 6.0f);
+        emitters.push_back(emitter);
+    }
+    for (int i = 0; i < 100; ++i) {
+        gfx::LightTreeEmitter emitter{ .type = gfx::LightTreeEmitterType::spot, .radiance = random_radiance() };
+        emitter.positions[0] = random_position(3.0f, 8.0f);
+        emitter.direction = glm::normalize(glm::vec3(unit(rng) - 0.5f, -1.0f, unit(rng) - 0.5f));
+        emitter.cos_outer_cone_angle = cosf(0.2f + unit(rng) * 0.6f);
+        emitter.cos_inner_cone_angle = std::min(emitter.cos_outer_cone_angle + 0.05f, 1.0f);
+        emitters.push_back(emitter);
+    }
+    for (int panel = 0; panel < 20; ++panel) {
+        // Ceiling panels facing down, some of them double sided, each split into a fan of triangles
+        const glm::vec3 center = random_position(4.0f, 8.0f);
+        const glm::vec3 radiance = random_radiance() * 0.1f;
+        const bool double_sided = (panel % 4) == 0;
+        for (int i = 0; i < 12; ++i) {
+            const float angle_a = (float)i / 12.0f * 6.2831853f;
+            const float angle_b = (float)(i + 1) / 12.0f * 6.2831853f;
+            gfx::LightTreeEmitter emitter{ .type = gfx::LightTreeEmitterType::triangle, .radiance = radiance, .double_sided = double_sided };
+            emitter.positions[0] = center;
+            emitter.positions[1] = center + glm::vec3(cosf(angle_b), 0.0f, sinf(angle_b));
+            emitter.positions[2] = center + glm::vec3(cosf(angle_a), 0.0f, sinf(angle_a)); // Counter clockwise seen from below, so it faces down
+            emitters.push_back(emitter);
+        }
+    }
+    return emitters;
+}
+
+struct Estimate {
+    double exact = 0.0; // Sum of every emitter's contribution
+    double mean = 0.0; // Average of contribution / pdf over the samples
+    double tree_variance = 0.0; // Of one sample, computed from `pdf()`
+    double uniform_variance = 0.0; // Same, for picking an emitter uniformly
+    double nothing_probability = 0.0; // Of `sample()` not returning an emitter
+};
+
+static Estimate check_shading_point(const gfx::LightTree& tree, glm::vec3 position, glm::vec3 normal) {
+    const size_t n_emitters = tree.emitters.size();
+    std::vector<double> contributions(n_emitters);
+    std::vector<double> pdfs(n_emitters);
+    double max_contribution = 0.0;
+    double pdf_sum = 0.0;
+    for (uint32_t i = 0; i < n_emitters; ++i) {
+        contributions[i] = contribution(tree.emitters[i], position, normal);
+        pdfs[i] = tree.pdf(position, normal, i);
+        max_contribution = std::max(max_contribution, contributions[i]);
+        pdf_sum += pdfs[i];
+    }
+
+    // Anything that actually lights the point has to be possible to pick, or the estimate is missing it
+    Estimate estimate;
+    for (uint32_t i = 0; i < n_emitters; ++i) {
+        const double f = contributions[i];
+        estimate.exact += f;
+        estimate.uniform_variance += f * f * (double)n_emitters;
+        if (f > max_contribution * 1e-6) CHECK(pdfs[i] > 0.0);
+        if (pdfs[i] > 0.0) estimate.tree_variance += f * f / pdfs[i];
+    }
+    estimate.uniform_variance -= estimate.exact * estimate.exact;
+    estimate.tree_variance -= estimate.exact * estimate.exact;
+
+    // Stratified samples, so each emitter gets picked about `pdf * N_SAMPLES` times
+    std::vector<uint32_t> n_picked(n_emitters, 0);
+    uint32_t n_mismatched_pdfs = 0;
+    uint32_t n_nothing = 0;
+    for (uint32_t i = 0; i < N_SAMPLES; ++i) {
+        const gfx::LightTreeSample sample = tree.sample(position, normal, ((float)i + 0.5f) / (float)N_SAMPLES);
+        CHECK(sample.emitter_index < n_emitters);
+        if (sample.emitter_index >= n_emitters || sample.pdf <= 0.0f) {
+            n_nothing++;
+            continue;
+        }
+        if (fabs(sample.pdf - pdfs[sample.emitter_index]) > 1e-3 * pdfs[sample.emitter_index]) n_mismatched_pdfs++; // Float products in a different order
+        n_picked[sample.emitter_index]++;
+        estimate.mean += contributions[sample.emitter_index] / sample.pdf;
+    }
+    estimate.mean /= N_SAMPLES;
+    CHECK(n_mismatched_pdfs == 0);
+
+    // A walk can end up in a node where neither child can light the point, even though the node itself looked like it could,
+    // and then there's no sample. Together with that, the pdfs add up to 1
+    estimate.nothing_probability = (double)n_nothing / N_SAMPLES;
+    CHECK(fabs(pdf_sum + estimate.nothing_probability - 1.0) < 1e-3);
+
+    uint32_t n_bad_frequencies = 0;
+    for (uint32_t i = 0; i < n_emitters; ++i) {
+        if (fabs((double)n_picked[i] / N_SAMPLES - pdfs[i]) > 2.0 / N_SAMPLES + pdfs[i] * 1e-3) n_bad_frequencies++;
+    }
+    CHECK(n_bad_frequencies == 0);
+    return estimate;
+}
+
+static void test_sampling(uint32_t seed) {
+    std::mt19937 rng(seed);
+    gfx::LightTree tree;
+    tree.build(random_emitters(rng));
+    CHECK(tree.nodes.size() == tree.emitters.size() * 2 - 1);
+
+    // Points on the floor, and a few floating in the air without a normal, like in fog
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    double total_tree_variance = 0.0;
+    double total_uniform_variance = 0.0;
+    uint32_t n_biased = 0;
+    double max_nothing_probability = 0.0;
+    for (int i = 0; i < N_SHADING_POINTS; ++i) {
+        const bool in_volume = (i % 8) == 0;
+        const glm::vec3 position = glm::vec3(unit(rng) * 36.0f - 18.0f, in_volume ? 2.0f : 0.0f, unit(rng) * 36.0f - 18.0f);
+        const glm::vec3 normal = in_volume ? glm::vec3(0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        const Estimate estimate = check_shading_point(tree, position, normal);
+        if (fabs(estimate.mean - estimate.exact) > 0.01 * estimate.exact) {
+            printf("  seed %u, point %i: mean %f, expected %f\n", seed, i, estimate.mean, estimate.exact);
+            n_biased++;
+        }
+
+        max_nothing_probability = std::max(max_nothing_probability, estimate.nothing_probability);
+
+        // Relative to the squared mean, so the brightest points don't dominate the totals
+        const double squared_mean = estimate.exact * estimate.exact;
+        total_tree_variance += estimate.tree_variance / squared_mean;
+        total_uniform_variance += estimate.uniform_variance / squared_mean;
+    }
+    CHECK(n_biased == 0);
+    CHECK(max_nothing_probability < 0.05); // Those samples are wasted, there shouldn't be many
+
+    // The whole point of the tree: a lot less noise than picking any light at random
+    printf("  seed %u: relative variance %.3f with the tree, %.3f uniform\n", seed, total_tree_variance / N_SHADING_POINTS, total_uniform_variance / N_SHADING_POINTS);
+    CHECK(total_tree_variance < total_uniform_variance * 0.5);
+}
+
+static void test_edge_cases() {
+    gfx::LightTree tree;
+    tree.build({});
+    CHECK(tree.nodes.empty());
+    CHECK(tree.sample(glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 0.5f).pdf == 0.0f);
+    CHECK(tree.pdf(glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 0) == 0.0f);
+
+    // One spot light, which only lights what's in its cone
+    gfx::LightTreeEmitter spot{ .type = gfx::LightTreeEmitterType::spot, .radiance = glm::vec3(10.0f) };
+    spot.positions[0] = glm::vec3(0.0f, 5.0f, 0.0f);
+    spot.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    spot.cos_outer_cone_angle = cosf(0.3f);
+    spot.cos_inner_cone_angle = cosf(0.2f);
+    tree.build({ spot });
+    const glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+    const gfx::LightTreeSample below = tree.sample(glm::vec3(0.0f), up, 0.5f);
+    CHECK(below.emitter_index == 0 && below.pdf == 1.0f);
+    CHECK(tree.pdf(glm::vec3(0.0f), up, 0) == 1.0f);
+    CHECK(tree.sample(glm::vec3(0.0f, 10.0f, 0.0f), up, 0.5f).pdf == 0.0f); // Behind it
+    CHECK(tree.pdf(glm::vec3(0.0f, 10.0f, 0.0f), up, 0) == 0.0f);
+
+    // Emitters at the exact same spot still build, and split evenly
+    std::vector<gfx::LightTreeEmitter> stacked(5, gfx::LightTreeEmitter{ .type = gfx::LightTreeEmitterType::point, .radiance = glm::vec3(1.0f) });
+    tree.build(stacked);
+    CHECK(tree.nodes.size() == 9);
+    for (uint32_t i = 0; i < 5; ++i) CHECK(fabsf(tree.pdf(glm::vec3(0.0f, -2.0f, 0.0f), up, i) - 0.2f) < 1e-4f);
+}
+
+static void test_pdfs_add_up_to_one() {
+    // Point lights seen from a point without a normal can't be ruled out by any node, so every sample finds an emitter
+    std::mt19937 rng(4);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<gfx::LightTreeEmitter> emitters;
+    for (int i = 0; i < 500; ++i) {
+        gfx::LightTreeEmitter emitter{ .type = gfx::LightTreeEmitterType::point, .radiance = glm::vec3(unit(rng) * 100.0f) };
+        emitter.positions[0] = glm::vec3(unit(rng), unit(rng), unit(rng)) * 50.0f;
+        emitters.push_back(emitter);
+    }
+    gfx::LightTree tree;
+    tree.build(emitters);
+    for (int i = 0; i < 8; ++i) {
+        const glm::vec3 position = glm::vec3(unit(rng), unit(rng), unit(rng)) * 50.0f;
+        double pdf_sum = 0.0;
+        for (uint32_t emitter = 0; emitter < tree.emitters.size(); ++emitter) pdf_sum += tree.pdf(position, glm::vec3(0.0f), emitter);
+        CHECK(fabs(pdf_sum - 1.0) < 1e-4);
+        CHECK(check_shading_point(tree, position, glm::vec3(0.0f)).nothing_probability == 0.0);
+    }
+}
+
+int main() {
+    test_edge_cases();
+    test_pdfs_add_up_to_one();
+    for (uint32_t seed : { 1u, 2u, 3u }) test_sampling(seed);
+    Log::flush();
+    return test_result();
+}
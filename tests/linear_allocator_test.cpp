@@ -0,0 +1,116 @@
+// Drives the linear allocator with plain heap memory as pages and a made up GPU that lags behind the CPU
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "linear_allocator.h"
+#include "log.h"
+#include "test.h"
+
+#define PAGE_SIZE 1024
+#define ALIGNMENT 256
+
+struct Pages {
+    std::vector<std::unique_ptr<uint8_t[]>> memory;
+    std::vector<uint32_t> sizes;
+
+    gfx::LinearAllocator::CreatePageFunc create_func() {
+        return [this](uint32_t page_index, uint32_t size) {
+            CHECK(page_index == memory.size());
+            memory.emplace_back(new uint8_t[size]);
+            sizes.push_back(size);
+            return (void*)memory.back().get();
+        };
+    }
+};
+
+static void test_bump_and_alignment() {
+    Pages pages;
+    gfx::LinearAllocator allocator(PAGE_SIZE, ALIGNMENT, pages.create_func());
+    allocator.begin_frame(0, 0);
+
+    const gfx::LinearAllocation a = allocator.allocate(100);
+    const gfx::LinearAllocation b = allocator.allocate(300);
+    const gfx::LinearAllocation c = allocator.allocate(256);
+    CHECK(a.page == 0 && a.offset == 0);
+    CHECK(b.page == 0 && b.offset == 256);
+    CHECK(c.page == 0 && c.offset == 768);
+    CHECK(c.cpu_address == pages.memory[0].get() + 768);
+
+    // Doesn't fit in what's left of page 0
+    const gfx::LinearAllocation d = allocator.allocate(16);
+    CHECK(d.page == 1 && d.offset == 0);
+
+    // Too big for any page, gets its own, rounded up to whole pages
+    const gfx::LinearAllocation e = allocator.allocate(PAGE_SIZE * 2 + 1);
+    CHECK(e.page == 2 && e.offset == 0);
+    CHECK(pages.sizes[2] == PAGE_SIZE * 3);
+
+    CHECK(allocator.stats().n_allocations_this_frame == 5);
+    CHECK(allocator.stats().bytes_allocated_this_frame == 100 + 300 + 256 + 16 + PAGE_SIZE * 2 + 1);
+    CHECK(allocator.stats().n_pages == 3);
+    CHECK(allocator.stats().total_page_bytes == PAGE_SIZE * 5);
+}
+
+static void test_frame_zero_not_recycled_early() {
+    Pages pages;
+    gfx::LinearAllocator allocator(PAGE_SIZE, ALIGNMENT, pages.create_func());
+
+    // Before the GPU finished anything the fence still reads 0, that can't count as frame 0 being done
+    allocator.begin_frame(0, 0);
+    const gfx::LinearAllocation frame_0 = allocator.allocate(PAGE_SIZE);
+    allocator.begin_frame(1, 0);
+    const gfx::LinearAllocation frame_1 = allocator.allocate(PAGE_SIZE);
+    CHECK(frame_1.page != frame_0.page);
+
+    // Now frame 0 is done, so its page is free again
+    allocator.begin_frame(2, 1);
+    const gfx::LinearAllocation frame_2 = allocator.allocate(PAGE_SIZE);
+    CHECK(frame_2.page == frame_0.page);
+    CHECK(allocator.stats().n_pages == 2);
+}
+
+static void test_steady_state() {
+    Pages pages;
+    gfx::LinearAllocator allocator(PAGE_SIZE, ALIGNMENT, pages.create_func());
+
+    // GPU runs 2 frames behind, every frame uses 3 pages. Should settle on 3 frames worth of pages and never make more
+    constexpr uint64_t frames_in_flight = 2;
+    for (uint64_t frame = 0; frame < 100; ++frame) {
+        allocator.begin_frame(frame, (frame > frames_in_flight) ? frame - frames_in_flight : 0);
+        std::vector<uint32_t> pages_this_frame;
+        for (int i = 0; i < 3; ++i) pages_this_frame.push_back(allocator.allocate(PAGE_SIZE).page);
+
+        // A page used by a frame that's still in flight can't be handed out again
+        for (int i = 0; i < 3; ++i) {
+            for (int j = i + 1; j < 3; ++j) CHECK(pages_this_frame[i] != pages_this_frame[j]);
+        }
+    }
+    CHECK(allocator.stats().n_pages == 3 * (frames_in_flight + 1));
+    CHECK(allocator.stats().bytes_allocated_last_frame == PAGE_SIZE * 3);
+    CHECK(allocator.stats().peak_bytes_per_frame == PAGE_SIZE * 3);
+}
+
+static void test_small_free_page_skipped() {
+    Pages pages;
+    gfx::LinearAllocator allocator(PAGE_SIZE, ALIGNMENT, pages.create_func());
+    allocator.begin_frame(0, 0);
+    allocator.allocate(PAGE_SIZE);
+    allocator.begin_frame(1, 0);
+    allocator.begin_frame(2, 1);
+
+    // Page 0 is free but too small, so this needs a new page
+    const gfx::LinearAllocation big = allocator.allocate(PAGE_SIZE * 2);
+    CHECK(big.page == 1);
+    const gfx::LinearAllocation small = allocator.allocate(PAGE_SIZE);
+    CHECK(small.page == 0);
+}
+
+int main() {
+    test_bump_and_alignment();
+    test_frame_zero_not_recycled_early();
+    test_steady_state();
+    test_small_free_page_skipped();
+    Log::flush();
+    return test_result();
+}
@@ -0,0 +1,123 @@
+// Logs to a temporary file and checks the messages against what `snprintf()` makes of the same format, plus the things only the
+// logger does: copying strings, and converting wide strings
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "log.h"
+#include "test.h"
+
+// Everything logged in between ends up in `lines`, without the time and level in front
+struct CapturedLog {
+    std::filesystem::path path;
+    std::vector<std::string> lines;
+
+    CapturedLog() {
+        path = std::filesystem::temp_directory_path() / ("log_test_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".txt");
+        Log::set_output_file(path.string().c_str());
+    }
+
+    void finish() {
+        CHECK(Log::flush());
+        Log::set_output_file(nullptr);
+        std::ifstream file(path, std::ios::binary);
+        std::string line;
+        while (std::getline(file, line)) lines.push_back(line.substr(std::min(line.size(), strlen("[12:34:56] [INFO]  "))));
+        file.close();
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+};
+
+template<typename... Args>
+static std::string expected(const char* format, Args... args) {
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), format, args...);
+    return buffer;
+}
+
+static void test_matches_snprintf() {
+    std::vector<std::string> expected_lines;
+    CapturedLog log;
+#define CHECK_FORMAT(...) do { LOG(Info, __VA_ARGS__); expected_lines.push_back(expected(__VA_ARGS__)); } while (0)
+    CHECK_FORMAT("No arguments, 100%% done");
+    CHECK_FORMAT("%d %i %5d %-5d| %05d %+d", 1, -2, 3, 4, -5, 6);
+    CHECK_FORMAT("%u %x %X %#x %o", 4000000000u, 0xBEEFu, 0xBEEFu, 255u, 8u);
+    CHECK_FORMAT("%hhd %hd %hu", (signed char)-1, (short)-300, (unsigned short)60000);
+    CHECK_FORMAT("%lld %llu %zu %llx", -5000000000ll, 18000000000000000000ull, (size_t)123456, 0xFFFFFFFFFFull);
+    CHECK_FORMAT("%f %.2f %10.3f %-10.1f| %e %g %G", 3.14159, 2.5f, -1.0, 0.25, 12345.678, 0.0001, 1e20);
+    CHECK_FORMAT("%c%c%c", 'a', 'b', 'c');
+    CHECK_FORMAT("\"%s\" \"%10s\" \"%-10s\" \"%.3s\"", "text", "right", "left", "truncated");
+    CHECK_FORMAT("%*d|%-*d|%.*f", 6, 42, 6, 42, 3, 1.0 / 3.0);
+#undef CHECK_FORMAT
+    log.finish();
+
+    CHECK(log.lines == expected_lines);
+    for (size_t i = 0; i < log.lines.size() && i < expected_lines.size(); ++i) {
+        if (log.lines[i] != expected_lines[i]) printf("  got \"%s\", expected \"%s\"\n", log.lines[i].c_str(), expected_lines[i].c_str());
+    }
+}
+
+static void test_strings_are_copied() {
+    CapturedLog log;
+    {
+        std::string name = "first";
+        LOG(Info, "Loaded %s", name.c_str());
+        name = "overwritten before the log thread got to it";
+        char buffer[16];
+        strcpy(buffer, "second");
+        LOG(Info, "Loaded %s", buffer);
+        strcpy(buffer, "gone");
+    }
+    const char* null_string = nullptr;
+    LOG(Info, "Loaded %s", null_string);
+
+    // Cut off when the strings don't fit, instead of overflowing into the next one
+    const std::string long_string(2000, 'x');
+    LOG(Info, "%s|%s", long_string.c_str(), "after");
+    log.finish();
+
+    CHECK(log.lines.size() == 4);
+    if (log.lines.size() != 4) return;
+    CHECK(log.lines[0] == "Loaded first");
+    CHECK(log.lines[1] == "Loaded second");
+    CHECK(log.lines[2] == "Loaded (null)");
+    CHECK(log.lines[3].size() < long_string.size());
+    CHECK(log.lines[3].find_first_not_of('x') == log.lines[3].find('|'));
+}
+
+static void test_wide_strings() {
+    CapturedLog log;
+    {
+        // Like the adapter names the device logs, which live in a struct that's gone by the time the message is written
+        wchar_t description[64];
+        wcscpy(description, L"Fake GPU \u00E9\u4E2D");
+        LOG(Info, "Using device \"%ws\"", description);
+        wcscpy(description, L"overwritten");
+    }
+    const wchar_t* emoji = L"\U0001F600!";
+    LOG(Info, "%ls|%10ls|%-4ls|", L"wide", L"right", L"x");
+    LOG(Info, "%ls", emoji);
+    const wchar_t* null_string = nullptr;
+    LOG(Info, "%ws and %s", null_string, "narrow");
+    log.finish();
+
+    CHECK(log.lines.size() == 4);
+    if (log.lines.size() != 4) return;
+    CHECK(log.lines[0] == "Using device \"Fake GPU \xC3\xA9\xE4\xB8\xAD\"");
+    CHECK(log.lines[1] == "wide|     right|x   |");
+    CHECK(log.lines[2] == "\xF0\x9F\x98\x80!");
+    CHECK(log.lines[3] == "(null) and narrow");
+}
+
+int main() {
+    test_matches_snprintf();
+    test_strings_are_copied();
+    test_wide_strings();
+    Log::flush();
+    return test_result();
+}
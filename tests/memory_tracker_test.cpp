@@ -0,0 +1,157 @@
+// Tracks made up resources the way the device does, and checks the totals, the groups, and the report
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "memory_tracker.h"
+#include "log.h"
+#include "test.h"
+
+#define MIB (1024ull * 1024ull)
+
+static void test_totals_and_peaks() {
+    gfx::MemoryTracker tracker;
+    const uint64_t texture = tracker.track("Albedo", "Texture", "Textures", 0, 4 * MIB);
+    const uint64_t upload = tracker.track("Upload", "Buffer", "Upload buffers", 2 * MIB, 0);
+    CHECK(tracker.total().gpu_bytes == 4 * MIB);
+    CHECK(tracker.total().cpu_bytes == 2 * MIB);
+    CHECK(tracker.total().n_resources == 2);
+
+    tracker.untrack(texture);
+    CHECK(tracker.total().gpu_bytes == 0);
+    CHECK(tracker.total().peak_gpu_bytes == 4 * MIB); // Peaks never go down
+    CHECK(tracker.total().n_resources == 1);
+    CHECK(tracker.stats(gfx::MemoryGroup::type, "Texture").n_resources == 0);
+    CHECK(tracker.stats(gfx::MemoryGroup::type, "Texture").peak_gpu_bytes == 4 * MIB);
+
+    // Untracking twice only warns
+    tracker.untrack(texture);
+    CHECK(tracker.total().n_resources == 1);
+    tracker.untrack(upload);
+    CHECK(tracker.total().cpu_bytes == 0 && tracker.total().n_resources == 0);
+}
+
+static void test_category_rules() {
+    gfx::MemoryTracker tracker;
+    tracker.add_category_rule("Staging ring", "Staging ring");
+    tracker.add_category_rule("(blas scratch buffer)", "BLAS scratch");
+    tracker.add_category_rule("scratch", "Other scratch"); // Only gets what the rule above doesn't
+
+    tracker.track("Staging ring buffer", "Buffer", "Upload buffers", MIB, 0);
+    tracker.track("Sponza (blas scratch buffer)", "Buffer", "Buffers", 0, 3 * MIB);
+    tracker.track("TLAS scratch", "Buffer", "Buffers", 0, 5 * MIB);
+    tracker.track("Vertices", "Buffer", "Buffers", 0, 7 * MIB);
+    CHECK(tracker.stats(gfx::MemoryGroup::category, "Staging ring").cpu_bytes == MIB);
+    CHECK(tracker.stats(gfx::MemoryGroup::category, "Upload buffers").n_resources == 0);
+    CHECK(tracker.stats(gfx::MemoryGroup::category, "BLAS scratch").gpu_bytes == 3 * MIB);
+    CHECK(tracker.stats(gfx::MemoryGroup::category, "Other scratch").gpu_bytes == 5 * MIB);
+    CHECK(tracker.stats(gfx::MemoryGroup::category, "Buffers").gpu_bytes == 7 * MIB);
+    CHECK(tracker.stats(gfx::MemoryGroup::type, "Buffer").gpu_bytes == 15 * MIB);
+    CHECK(tracker.stats(gfx::MemoryGroup::category, "Never used").n_resources == 0);
+}
+
+static void test_scopes() {
+    gfx::MemoryTracker tracker;
+    tracker.track("Before", "Texture", "Textures", 0, 1);
+    {
+        gfx::MemoryScope sponza("Sponza");
+        tracker.track("Sponza albedo", "Texture", "Textures", 0, 2);
+        {
+            gfx::MemoryScope sky("Sky");
+            tracker.track("Sky", "Texture", "Textures", 0, 4);
+        }
+        tracker.track("Sponza normals", "Texture", "Textures", 0, 8);
+
+        // Scopes only apply to the thread that made them
+        std::thread([&]() { tracker.track("Loader thread", "Texture", "Textures", 0, 16); }).join();
+    }
+    tracker.track("After", "Texture", "Textures", 0, 32);
+
+    CHECK(tracker.stats(gfx::MemoryGroup::scene, "Sponza").gpu_bytes == 10);
+    CHECK(tracker.stats(gfx::MemoryGroup::scene, "Sky").gpu_bytes == 4);
+    CHECK(tracker.stats(gfx::MemoryGroup::scene, gfx::MemoryTracker::NO_SCENE).gpu_bytes == 49);
+}
+
+static void test_report() {
+    gfx::MemoryTracker tracker;
+    tracker.track("B", "Texture", "Textures", 0, 1);
+    tracker.track("A", "Buffer", "Buffers", 2, 0);
+    const std::vector<gfx::MemoryReportRow> rows = tracker.report();
+
+    // The total, then each group sorted by key
+    CHECK(rows.size() == 6);
+    if (rows.size() != 6) return;
+    CHECK(rows[0].group == gfx::MemoryGroup::total && rows[0].stats.n_resources == 2);
+    CHECK(rows[1].group == gfx::MemoryGroup::type && rows[1].key == "Buffer");
+    CHECK(rows[2].group == gfx::MemoryGroup::type && rows[2].key == "Texture");
+    CHECK(rows[3].group == gfx::MemoryGroup::scene && rows[3].key == gfx::MemoryTracker::NO_SCENE);
+    CHECK(rows[4].group == gfx::MemoryGroup::category && rows[4].key == "Buffers");
+    CHECK(rows[5].group == gfx::MemoryGroup::category && rows[5].key == "Textures");
+
+    // Keys can be file paths with quotes and commas in them
+    gfx::MemoryTracker quoted;
+    {
+        gfx::MemoryScope scope("assets/\"odd\", name.gltf");
+        quoted.track("Mesh", "Buffer", "Buffers", 0, 64);
+    }
+    const std::string csv = quoted.csv();
+    CHECK(csv.rfind("group,key,resources,cpu_bytes,gpu_bytes,peak_cpu_bytes,peak_gpu_bytes\n", 0) == 0);
+    CHECK(csv.find("total,\"\",1,0,64,0,64\n") != std::string::npos);
+    CHECK(csv.find("scene,\"assets/\"\"odd\"\", name.gltf\",1,0,64,0,64\n") != std::string::npos);
+}
+
+static void test_records_outlive_the_owner() {
+    // Resources can be released after the device is gone, so the record keeps the tracker alive
+    auto tracker = std::make_shared<gfx::MemoryTracker>();
+    const std::weak_ptr<gfx::MemoryTracker> weak_tracker = tracker;
+    std::shared_ptr<void> record = gfx::make_memory_record(tracker, tracker->track("Texture", "Texture", "Textures", 0, 100));
+    std::shared_ptr<void> copy = record;
+    CHECK(tracker->total().gpu_bytes == 100);
+
+    record = nullptr;
+    CHECK(tracker->total().gpu_bytes == 100); // Still a copy around
+    const gfx::MemoryTracker* raw_tracker = tracker.get();
+    tracker = nullptr;
+    CHECK(!weak_tracker.expired());
+    CHECK(raw_tracker->total().gpu_bytes == 100);
+    copy = nullptr;
+    CHECK(weak_tracker.expired());
+}
+
+static void test_transient_heap() {
+    // What the device and renderer do with the transient render targets: they start out tracked on their own, then get placed
+    // in one heap that's tracked once, with whatever size the packing came up with. Placing drops the per target records
+    auto tracker = std::make_shared<gfx::MemoryTracker>();
+    std::vector<std::shared_ptr<void>> target_records;
+    for (int i = 0; i < 5; ++i) {
+        target_records.push_back(gfx::make_memory_record(tracker, tracker->track("Target " + std::to_string(i), "Texture", "Render targets", 0, 16 * MIB)));
+    }
+    const uint64_t other_textures = 7 * MIB;
+    std::shared_ptr<void> other = gfx::make_memory_record(tracker, tracker->track("Albedo", "Texture", "Textures", 0, other_textures));
+    CHECK(tracker->total().gpu_bytes == 5 * 16 * MIB + other_textures);
+
+    const uint64_t heap_size = 40 * MIB; // Aliasing got it down from 80
+    std::shared_ptr<void> heap_record = gfx::make_memory_record(tracker, tracker->track("Transient render targets", "Heap", "Render targets", 0, heap_size));
+    for (auto& record : target_records) record = nullptr;
+    CHECK(tracker->total().gpu_bytes == heap_size + other_textures);
+    CHECK(tracker->stats(gfx::MemoryGroup::category, "Render targets").gpu_bytes == heap_size);
+    CHECK(tracker->stats(gfx::MemoryGroup::category, "Render targets").n_resources == 1);
+    CHECK(tracker->stats(gfx::MemoryGroup::type, "Texture").gpu_bytes == other_textures);
+
+    // Resizing makes a new heap, replacing the record lets go of the old one
+    const uint64_t resized_heap_size = 60 * MIB;
+    heap_record = gfx::make_memory_record(tracker, tracker->track("Transient render targets", "Heap", "Render targets", 0, resized_heap_size));
+    CHECK(tracker->total().gpu_bytes == resized_heap_size + other_textures);
+    CHECK(tracker->stats(gfx::MemoryGroup::type, "Heap").n_resources == 1);
+}
+
+int main() {
+    test_totals_and_peaks();
+    test_category_rules();
+    test_scopes();
+    test_report();
+    test_records_outlive_the_owner();
+    test_transient_heap();
+    Log::flush();
+    return test_result();
+}
@@ -0,0 +1,185 @@
+// Compiles render graphs and runs them against a mock backend that only tracks resource states, to check the pass order,
+// culling and barriers without a GPU
+#include <algorithm>
+#include <vector>
+#include "render_graph.h"
+#include "log.h"
+#include "test.h"
+
+using gfx::ResourceUsage;
+
+// Executes the graph like the renderer does, recording barriers into a state table. Every pass has to find its resources in
+// the state it declared, and every barrier has to actually change something
+struct MockBackend {
+    std::vector<ResourceUsage> states;
+    std::vector<uint32_t> executed_passes;
+    uint32_t n_transitions = 0;
+    uint32_t n_uav_barriers = 0;
+
+    void execute(const gfx::RenderGraph& graph) {
+        states.assign(graph.n_resources(), ResourceUsage::none);
+        for (uint32_t pass_index : graph.pass_order()) {
+            for (const gfx::RenderGraphBarrier& barrier : graph.barriers(pass_index)) {
+                if (barrier.uav_only) {
+                    CHECK(states[barrier.resource] == ResourceUsage::compute_write);
+                    CHECK(barrier.usage == ResourceUsage::compute_write);
+                    n_uav_barriers++;
+                }
+                else {
+                    CHECK(states[barrier.resource] != barrier.usage || states[barrier.resource] == ResourceUsage::none);
+                    n_transitions++;
+                }
+                states[barrier.resource] = barrier.usage;
+            }
+            for (const gfx::RenderGraphAccess& access : graph.pass(pass_index).accesses) {
+                CHECK(states[access.resource] == access.usage);
+            }
+            graph.pass(pass_index).execute();
+        }
+    }
+};
+
+static uint32_t position_in_order(const gfx::RenderGraph& graph, uint32_t pass_index) {
+    const auto order = graph.pass_order();
+    return (uint32_t)(std::find(order.begin(), order.end(), pass_index) - order.begin());
+}
+
+// Roughly the raster frame: a G-buffer, light culling that doesn't depend on it, shading, and a tonemap pass into the swapchain
+static void test_raster_frame() {
+    gfx::RenderGraph graph;
+    std::vector<uint32_t> executed;
+    const auto gbuffer = graph.add_resource("G-buffer");
+    const auto depth = graph.add_resource("Depth");
+    const auto lights = graph.add_resource("Light clusters");
+    const auto shaded = graph.add_resource("Shaded");
+    const auto debug = graph.add_resource("Debug view");
+
+    const uint32_t geometry = graph.add_pass("Geometry", { { gbuffer, ResourceUsage::render_target }, { depth, ResourceUsage::depth_target } }, [&]() { executed.push_back(0); });
+    const uint32_t light_culling = graph.add_pass("Light culling", { { lights, ResourceUsage::compute_write } }, [&]() { executed.push_back(1); });
+    const uint32_t debug_view = graph.add_pass("Debug view", { { gbuffer, ResourceUsage::non_pixel_shader_read }, { debug, ResourceUsage::compute_write } }, [&]() { executed.push_back(2); });
+    const uint32_t shading = graph.add_pass("Shading", {
+        { gbuffer, ResourceUsage::non_pixel_shader_read },
+        { depth, ResourceUsage::non_pixel_shader_read },
+        { lights, ResourceUsage::non_pixel_shader_read },
+        { shaded, ResourceUsage::compute_write },
+    }, [&]() { executed.push_back(3); });
+    const uint32_t tonemap = graph.add_pass("Tonemap", { { shaded, ResourceUsage::pixel_shader_read } }, [&]() { executed.push_back(4); }, true);
+    graph.compile();
+
+    // Nothing reads the debug view, so that pass goes
+    CHECK(graph.n_culled_passes() == 1);
+    CHECK(position_in_order(graph, debug_view) == graph.pass_order().size());
+
+    // Light culling only needs one barrier, the geometry pass two, so light culling goes first
+    const std::vector<uint32_t> expected_order = { light_culling, geometry, shading, tonemap };
+    CHECK(std::equal(graph.pass_order().begin(), graph.pass_order().end(), expected_order.begin(), expected_order.end()));
+
+    CHECK(graph.barriers(light_culling).size() == 1);
+    CHECK(graph.barriers(geometry).size() == 2);
+    CHECK(graph.barriers(shading).size() == 4);
+    CHECK(graph.barriers(tonemap).size() == 1);
+    CHECK(graph.barriers(debug_view).empty());
+    CHECK(graph.n_barriers() == 8);
+
+    MockBackend backend;
+    backend.execute(graph);
+    CHECK(executed == std::vector<uint32_t>({ 1, 0, 3, 4 }));
+    CHECK(backend.n_transitions == 8);
+    CHECK(backend.n_uav_barriers == 0);
+}
+
+static void test_outputs_keep_passes() {
+    gfx::RenderGraph graph;
+    const auto a = graph.add_resource("A");
+    const auto b = graph.add_resource("B");
+    const uint32_t write_a = graph.add_pass("Write A", { { a, ResourceUsage::compute_write } }, []() {});
+    const uint32_t a_to_b = graph.add_pass("A to B", { { a, ResourceUsage::non_pixel_shader_read }, { b, ResourceUsage::compute_write } }, []() {});
+    graph.add_pass("Overwrite A", { { a, ResourceUsage::compute_write } }, []() {});
+
+    // Without outputs or side effects, everything is culled
+    graph.compile();
+    CHECK(graph.pass_order().empty());
+    CHECK(graph.n_culled_passes() == 3);
+
+    // B is needed, which needs A. The last write to A isn't read by anything
+    graph.mark_output(b);
+    graph.compile();
+    CHECK(graph.pass_order().size() == 2);
+    CHECK(position_in_order(graph, write_a) < position_in_order(graph, a_to_b));
+}
+
+static void test_write_after_read() {
+    // The second write can't move before the reader, even though it'd need fewer barriers there
+    gfx::RenderGraph graph;
+    const auto a = graph.add_resource("A");
+    const auto b = graph.add_resource("B");
+    const auto c = graph.add_resource("C");
+    graph.mark_output(a);
+    graph.mark_output(b);
+    graph.mark_output(c);
+    const uint32_t first_write = graph.add_pass("First write", { { a, ResourceUsage::compute_write } }, []() {});
+    const uint32_t reader = graph.add_pass("Reader", { { a, ResourceUsage::non_pixel_shader_read }, { b, ResourceUsage::compute_write }, { c, ResourceUsage::compute_write } }, []() {});
+    const uint32_t second_write = graph.add_pass("Second write", { { a, ResourceUsage::compute_write } }, []() {});
+    graph.compile();
+
+    CHECK(graph.pass_order().size() == 3);
+    CHECK(position_in_order(graph, first_write) < position_in_order(graph, reader));
+    CHECK(position_in_order(graph, reader) < position_in_order(graph, second_write));
+
+    MockBackend backend;
+    backend.execute(graph);
+    CHECK(backend.n_transitions == 5);
+}
+
+static void test_uav_and_read_barriers() {
+    gfx::RenderGraph graph;
+    const auto a = graph.add_resource("A");
+    graph.mark_output(a);
+    const uint32_t write_0 = graph.add_pass("Write 0", { { a, ResourceUsage::compute_write } }, []() {});
+    const uint32_t write_1 = graph.add_pass("Write 1", { { a, ResourceUsage::compute_write } }, []() {});
+    const uint32_t read_0 = graph.add_pass("Read 0", { { a, ResourceUsage::pixel_shader_read } }, []() {}, true);
+    const uint32_t read_1 = graph.add_pass("Read 1", { { a, ResourceUsage::pixel_shader_read } }, []() {}, true);
+    graph.compile();
+
+    // Back to back writes stay in the same state, but still need a UAV barrier. Back to back reads need nothing
+    CHECK(graph.barriers(write_0).size() == 1 && !graph.barriers(write_0)[0].uav_only);
+    CHECK(graph.barriers(write_1).size() == 1 && graph.barriers(write_1)[0].uav_only);
+    CHECK(graph.barriers(read_0).size() == 1 && graph.barriers(read_0)[0].usage == ResourceUsage::pixel_shader_read);
+    CHECK(graph.barriers(read_1).empty());
+
+    MockBackend backend;
+    backend.execute(graph);
+    CHECK(backend.n_transitions == 2);
+    CHECK(backend.n_uav_barriers == 1);
+}
+
+static void test_batches_same_state_readers() {
+    // Two readers of A and two of B, added interleaved. Grouping them by state saves barriers compared to the order they were added in
+    gfx::RenderGraph graph;
+    const auto a = graph.add_resource("A");
+    std::vector<uint32_t> readers;
+    graph.add_pass("Write A", { { a, ResourceUsage::compute_write } }, []() {});
+    readers.push_back(graph.add_pass("Pixel read 0", { { a, ResourceUsage::pixel_shader_read } }, []() {}, true));
+    readers.push_back(graph.add_pass("Compute read 0", { { a, ResourceUsage::non_pixel_shader_read } }, []() {}, true));
+    readers.push_back(graph.add_pass("Pixel read 1", { { a, ResourceUsage::pixel_shader_read } }, []() {}, true));
+    readers.push_back(graph.add_pass("Compute read 1", { { a, ResourceUsage::non_pixel_shader_read } }, []() {}, true));
+    graph.compile();
+
+    CHECK(graph.pass_order().size() == 5);
+    CHECK(position_in_order(graph, readers[2]) == position_in_order(graph, readers[0]) + 1);
+    CHECK(graph.n_barriers() == 3);
+
+    MockBackend backend;
+    backend.execute(graph);
+    CHECK(backend.n_transitions == 3);
+}
+
+int main() {
+    test_raster_frame();
+    test_outputs_keep_passes();
+    test_write_after_read();
+    test_uav_and_read_barriers();
+    test_batches_same_state_readers();
+    Log::flush();
+    return test_result();
+}
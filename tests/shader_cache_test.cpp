@@ -0,0 +1,218 @@
+// Runs the shader cache against a fake compiler that counts its calls, with made up shader sources in a temporary directory
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "shader_cache.h"
+#include "log.h"
+#include "test.h"
+
+// Stand-in for DXC: the "bytecode" is the entry point, the profile and the source, so a stale hit can be told apart.
+// Sources containing "error" don't compile
+struct FakeCompiler {
+    uint32_t n_calls = 0;
+
+    gfx::ShaderCache::CompileFunc func() {
+        return [this](const gfx::ShaderCompileRequest& request, std::vector<uint8_t>& bytecode) {
+            ++n_calls;
+            std::ifstream file(request.path, std::ios::binary);
+            const std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (!file.good() && !file.eof()) return false;
+            if (source.find("error") != std::string::npos) return false;
+            const std::string output = request.entry_point + "|" + request.profile + "|" + source;
+            bytecode.assign(output.begin(), output.end());
+            return true;
+        };
+    }
+};
+
+struct TempDirectory {
+    std::filesystem::path path;
+    TempDirectory(const char* name) {
+        path = std::filesystem::temp_directory_path() / (std::string(name) + "_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+        std::filesystem::create_directories(path);
+    }
+    ~TempDirectory() {
+        std::error_code error;
+        std::filesystem::remove_all(path, error);
+    }
+    std::string file(const std::string& name) const { return (path / name).generic_string(); }
+};
+
+static void write_file(const std::string& path, const std::string& contents) {
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << contents;
+}
+
+static std::string as_string(const std::vector<uint8_t>& bytecode) {
+    return std::string(bytecode.begin(), bytecode.end());
+}
+
+static void test_miss_then_hit() {
+    TempDirectory temp("shader_cache_test");
+    write_file(temp.file("shaders/a.hlsl"), "float4 main() { return 0; }");
+    FakeCompiler compiler;
+    gfx::ShaderCache cache(temp.file("cache"), "fake 1.0", compiler.func());
+    const gfx::ShaderCompileRequest request{ temp.file("shaders/a.hlsl"), "main", "ps_6_6", { "-O3" } };
+
+    std::vector<uint8_t> bytecode;
+    CHECK(cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 1);
+    CHECK(as_string(bytecode) == "main|ps_6_6|float4 main() { return 0; }");
+
+    bytecode.clear();
+    CHECK(cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 1);
+    CHECK(as_string(bytecode) == "main|ps_6_6|float4 main() { return 0; }");
+    CHECK(cache.stats().n_hits == 1 && cache.stats().n_misses == 1 && cache.stats().n_failed == 0);
+
+    // A new cache on the same directory, like the next run of the program, still hits
+    FakeCompiler next_compiler;
+    gfx::ShaderCache next_cache(temp.file("cache"), "fake 1.0", next_compiler.func());
+    CHECK(next_cache.get(request, bytecode));
+    CHECK(next_compiler.n_calls == 0);
+}
+
+static void test_key_changes() {
+    TempDirectory temp("shader_cache_test");
+    write_file(temp.file("a.hlsl"), "source");
+    FakeCompiler compiler;
+    gfx::ShaderCache cache(temp.file("cache"), "fake 1.0", compiler.func());
+    gfx::ShaderCache other_version(temp.file("cache"), "fake 1.1", compiler.func());
+    const gfx::ShaderCompileRequest request{ temp.file("a.hlsl"), "main", "ps_6_6", { "-O3" } };
+
+    // Every part of the request goes into the key
+    gfx::ShaderCompileRequest other_entry = request;
+    other_entry.entry_point = "other";
+    gfx::ShaderCompileRequest other_profile = request;
+    other_profile.profile = "vs_6_6";
+    gfx::ShaderCompileRequest other_arguments = request;
+    other_arguments.arguments = { "-O0" };
+    gfx::ShaderCompileRequest split_arguments = request;
+    split_arguments.arguments = { "-O", "3" };
+
+    const uint64_t key = cache.cache_key(request);
+    CHECK(key != 0);
+    CHECK(key == cache.cache_key(request));
+    CHECK(key != cache.cache_key(other_entry));
+    CHECK(key != cache.cache_key(other_profile));
+    CHECK(key != cache.cache_key(other_arguments));
+    CHECK(key != cache.cache_key(split_arguments));
+    CHECK(key != other_version.cache_key(request));
+
+    std::vector<uint8_t> bytecode;
+    CHECK(cache.get(request, bytecode));
+    CHECK(other_version.get(request, bytecode));
+    CHECK(compiler.n_calls == 2);
+
+    // Editing the source is a miss, and the new bytecode comes back
+    write_file(temp.file("a.hlsl"), "edited source");
+    CHECK(cache.cache_key(request) != key);
+    CHECK(cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 3);
+    CHECK(as_string(bytecode) == "main|ps_6_6|edited source");
+
+    // Going back to the old source hits the old entry again
+    write_file(temp.file("a.hlsl"), "source");
+    CHECK(cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 3);
+    CHECK(as_string(bytecode) == "main|ps_6_6|source");
+}
+
+static void test_includes() {
+    TempDirectory temp("shader_cache_test");
+    write_file(temp.file("shaders/main.hlsl"), "#include \"common.hlsl\"\n  #include \"lib/lighting.hlsl\"\n// #include not a file\nmain");
+    write_file(temp.file("shaders/common.hlsl"), "#include \"lib/lighting.hlsl\"\ncommon");
+    write_file(temp.file("shaders/lib/lighting.hlsl"), "#include \"../common.hlsl\"\nlighting"); // Cycle back to common
+    FakeCompiler compiler;
+    gfx::ShaderCache cache(temp.file("cache"), "fake 1.0", compiler.func());
+    const gfx::ShaderCompileRequest request{ temp.file("shaders/main.hlsl"), "main", "cs_6_6", {} };
+
+    const std::vector<std::string> files = gfx::ShaderCache::source_files(request.path);
+    CHECK(files.size() == 3);
+    CHECK(files.size() >= 1 && files[0] == request.path);
+
+    std::vector<uint8_t> bytecode;
+    CHECK(cache.get(request, bytecode));
+    CHECK(cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 1);
+
+    // Editing a file that's only included is a miss too
+    write_file(temp.file("shaders/lib/lighting.hlsl"), "#include \"../common.hlsl\"\nlighting v2");
+    CHECK(cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 2);
+
+    // A missing include still gets compiled, so the compiler can report it, but doesn't hit the entry from when it was there
+    const uint64_t key_with_include = cache.cache_key(request);
+    std::filesystem::remove(temp.file("shaders/common.hlsl"));
+    CHECK(cache.cache_key(request) != 0);
+    CHECK(cache.cache_key(request) != key_with_include);
+}
+
+static void test_failures() {
+    TempDirectory temp("shader_cache_test");
+    FakeCompiler compiler;
+    gfx::ShaderCache cache(temp.file("cache"), "fake 1.0", compiler.func());
+    std::vector<uint8_t> bytecode;
+
+    // A shader that doesn't exist doesn't even get to the compiler
+    const gfx::ShaderCompileRequest missing{ temp.file("missing.hlsl"), "main", "ps_6_6", {} };
+    CHECK(cache.cache_key(missing) == 0);
+    CHECK(!cache.get(missing, bytecode));
+    CHECK(compiler.n_calls == 0);
+
+    // Failed compiles aren't stored, so once the shader's fixed it compiles again
+    const gfx::ShaderCompileRequest request{ temp.file("a.hlsl"), "main", "ps_6_6", {} };
+    write_file(request.path, "syntax error");
+    CHECK(!cache.get(request, bytecode));
+    CHECK(!cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 2);
+    CHECK(cache.stats().n_failed == 2);
+    write_file(request.path, "fixed");
+    CHECK(cache.get(request, bytecode));
+    CHECK(as_string(bytecode) == "main|ps_6_6|fixed");
+
+    // Without a compiler every miss fails
+    gfx::ShaderCache no_compiler(temp.file("other_cache"), "fake 1.0", nullptr);
+    CHECK(!no_compiler.get(request, bytecode));
+}
+
+static void test_broken_entries() {
+    TempDirectory temp("shader_cache_test");
+    write_file(temp.file("a.hlsl"), "source");
+    FakeCompiler compiler;
+    gfx::ShaderCache cache(temp.file("cache"), "fake 1.0", compiler.func());
+    const gfx::ShaderCompileRequest request{ temp.file("a.hlsl"), "main", "ps_6_6", {} };
+    std::vector<uint8_t> bytecode;
+    CHECK(cache.get(request, bytecode));
+
+    std::vector<std::filesystem::path> entries;
+    for (const auto& entry : std::filesystem::directory_iterator(temp.file("cache"))) entries.push_back(entry.path());
+    CHECK(entries.size() == 1); // No temporary file left behind
+    if (entries.size() != 1) return;
+
+    // Truncated, like a crash halfway through writing without the rename. Gets compiled and written again
+    std::filesystem::resize_file(entries[0], std::filesystem::file_size(entries[0]) - 3);
+    CHECK(cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 2);
+    CHECK(as_string(bytecode) == "main|ps_6_6|source");
+
+    // Garbage
+    write_file(entries[0].string(), "not a shader cache entry at all");
+    CHECK(cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 3);
+    CHECK(cache.get(request, bytecode));
+    CHECK(compiler.n_calls == 3);
+}
+
+int main() {
+    test_miss_then_hit();
+    test_key_changes();
+    test_includes();
+    test_failures();
+    test_broken_entries();
+    Log::flush();
+    return test_result();
+}
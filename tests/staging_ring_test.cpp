@@ -0,0 +1,179 @@
+// Pushes uploads through a small staging ring with a fake upload fence, including texture uploads that get split into row chunks
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "staging_ring.h"
+#include "log.h"
+#include "test.h"
+
+#define PITCH_ALIGNMENT 256 // D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+#define PLACEMENT_ALIGNMENT 512 // D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+
+static void test_alignment_and_padding() {
+    gfx::StagingRing ring(4096);
+    uint64_t offset = ~0ull;
+    CHECK(ring.allocate(100, 16, offset) && offset == 0);
+    CHECK(ring.allocate(100, 256, offset) && offset == 256);
+    CHECK(ring.allocate(1, 1, offset) && offset == 356);
+    CHECK(ring.bytes_in_use() == 357);
+    CHECK(ring.stats().bytes_allocated == 201);
+    CHECK(ring.stats().bytes_padding == 156);
+}
+
+static void test_wraparound() {
+    gfx::StagingRing ring(1024);
+    uint64_t offset = 0;
+    uint64_t fence_value = 0;
+
+    // Fill up most of the ring over two batches
+    CHECK(ring.allocate(400, 16, offset) && offset == 0);
+    ring.retire(++fence_value);
+    CHECK(ring.allocate(400, 16, offset) && offset == 400);
+    ring.retire(++fence_value);
+
+    // Doesn't fit at the end, and the start is still in use
+    CHECK(!ring.allocate(300, 16, offset));
+    CHECK(ring.stats().n_full == 1);
+    CHECK(ring.oldest_fence_value() == 1);
+
+    // Once the first batch is done, the allocation goes to the start of the ring, and the end of the ring counts as padding
+    ring.update(1);
+    CHECK(ring.oldest_fence_value() == 2);
+    CHECK(ring.allocate(300, 16, offset) && offset == 0);
+    CHECK(ring.bytes_in_use() == 400 + 224 + 300);
+    CHECK(ring.stats().bytes_padding == 224);
+
+    // The head can't pass the tail: 100 bytes are free before the second batch starts, the padding for alignment counts too
+    CHECK(ring.allocate(90, 16, offset) && offset == 304);
+    CHECK(!ring.allocate(16, 16, offset));
+    ring.retire(++fence_value);
+    ring.update(fence_value);
+    CHECK(ring.bytes_in_use() == 0);
+    CHECK(ring.oldest_fence_value() == 0);
+
+    // Once everything's done, the ring starts over at the beginning, so even a full-size allocation fits
+    CHECK(ring.allocate(1024, 16, offset) && offset == 0);
+}
+
+static void test_retire_merging() {
+    gfx::StagingRing ring(1024);
+    uint64_t offset = 0;
+    CHECK(!ring.has_unretired_allocations());
+    ring.retire(1); // Nothing to retire, doesn't add a region
+    CHECK(ring.oldest_fence_value() == 0);
+
+    ring.allocate(100, 1, offset);
+    ring.retire(5);
+    ring.allocate(100, 1, offset);
+    ring.retire(5);
+    CHECK(!ring.has_unretired_allocations());
+    ring.update(4);
+    CHECK(ring.bytes_in_use() == 200);
+    ring.update(5);
+    CHECK(ring.bytes_in_use() == 0);
+}
+
+static void test_row_layout() {
+    for (uint64_t row_size : { 1ull, 4ull, 255ull, 256ull, 257ull, 1000ull, 4096ull, 12345ull }) {
+        const gfx::StagingRowLayout layout = gfx::staging_row_layout(row_size, PITCH_ALIGNMENT, 64 * 1024);
+        CHECK(layout.row_size == row_size);
+        CHECK(layout.row_pitch % PITCH_ALIGNMENT == 0);
+        CHECK(layout.row_pitch >= row_size && layout.row_pitch < row_size + PITCH_ALIGNMENT);
+        CHECK(layout.max_rows_per_copy * layout.row_pitch <= 64 * 1024);
+        CHECK((layout.max_rows_per_copy + 1) * layout.row_pitch > 64 * 1024);
+    }
+
+    // A row bigger than a whole chunk still gets copied, one row at a time
+    const gfx::StagingRowLayout huge = gfx::staging_row_layout(100000, PITCH_ALIGNMENT, 64 * 1024);
+    CHECK(huge.max_rows_per_copy == 1);
+}
+
+// Uploads textures the way `Device::load_texture()` does, into a fake ring buffer. The fake GPU only copies them out of the ring once
+// their batch's fence value completes, so if the ring handed out memory that's still in flight, the data gets overwritten before
+// it's copied. The ring is small, so the uploads have to wrap around and wait for the fence
+static void test_texture_upload_through_ring() {
+    constexpr uint64_t ring_size = 64 * 1024;
+    constexpr uint64_t max_chunk_size = 16 * 1024;
+    constexpr uint32_t height = 77;
+    constexpr uint32_t bytes_per_pixel = 4;
+    const std::vector<uint32_t> widths = { 1, 33, 64, 100, 1000, 3000 };
+
+    struct PendingCopy {
+        uint64_t fence_value; // 0 until its batch gets submitted
+        uint64_t offset;
+        uint32_t texture;
+        uint32_t first_row;
+        uint32_t n_rows;
+        gfx::StagingRowLayout rows;
+    };
+    gfx::StagingRing ring(ring_size);
+    std::vector<uint8_t> ring_memory(ring_size);
+    std::vector<std::vector<uint8_t>> sources;
+    std::vector<std::vector<uint8_t>> destinations;
+    std::vector<PendingCopy> pending_copies;
+    uint64_t fence_value = 0;
+
+    auto submit = [&]() {
+        ring.retire(++fence_value);
+        for (PendingCopy& copy : pending_copies) {
+            if (copy.fence_value == 0) copy.fence_value = fence_value;
+        }
+    };
+    auto complete = [&](uint64_t completed_fence_value) {
+        std::erase_if(pending_copies, [&](const PendingCopy& copy) {
+            if (copy.fence_value == 0 || copy.fence_value > completed_fence_value) return false;
+            for (uint32_t row = 0; row < copy.n_rows; ++row) {
+                memcpy(destinations[copy.texture].data() + (uint64_t)(copy.first_row + row) * copy.rows.row_size, ring_memory.data() + copy.offset + row * copy.rows.row_pitch, copy.rows.row_size);
+            }
+            return true;
+        });
+        ring.update(completed_fence_value);
+    };
+
+    for (uint32_t texture = 0; texture < widths.size(); ++texture) {
+        const uint32_t width = widths[texture];
+        sources.emplace_back((size_t)width * height * bytes_per_pixel);
+        destinations.emplace_back(sources.back().size(), 0);
+        std::mt19937 rng(width);
+        for (uint8_t& byte : sources.back()) byte = (uint8_t)rng();
+
+        const gfx::StagingRowLayout rows = gfx::staging_row_layout((uint64_t)width * bytes_per_pixel, PITCH_ALIGNMENT, max_chunk_size);
+        for (uint32_t y = 0; y < height; y += rows.max_rows_per_copy) {
+            const uint32_t n_rows = std::min(rows.max_rows_per_copy, height - y);
+            uint64_t offset = 0;
+            while (!ring.allocate(n_rows * rows.row_pitch, PLACEMENT_ALIGNMENT, offset)) {
+                // Same as `Device::allocate_staging()`: submit what's there, and wait for the oldest batch
+                if (ring.has_unretired_allocations()) submit();
+                CHECK(ring.oldest_fence_value() != 0);
+                complete(ring.oldest_fence_value());
+            }
+            CHECK(offset % PLACEMENT_ALIGNMENT == 0);
+            CHECK(offset + n_rows * rows.row_pitch <= ring_size);
+            for (uint32_t row = 0; row < n_rows; ++row) {
+                memcpy(ring_memory.data() + offset + row * rows.row_pitch, sources[texture].data() + (uint64_t)(y + row) * rows.row_size, rows.row_size);
+            }
+            pending_copies.push_back({ 0, offset, texture, y, n_rows, rows });
+
+            // Submit every now and then, so several batches are in flight at once
+            if (pending_copies.size() % 2 == 0) submit();
+        }
+    }
+    submit();
+    complete(fence_value);
+
+    CHECK(pending_copies.empty());
+    for (uint32_t texture = 0; texture < widths.size(); ++texture) CHECK(destinations[texture] == sources[texture]);
+    CHECK(ring.stats().n_full > 0); // The ring had to wrap around
+    CHECK(ring.bytes_in_use() == 0);
+}
+
+int main() {
+    test_alignment_and_padding();
+    test_wraparound();
+    test_retire_merging();
+    test_row_layout();
+    test_texture_upload_through_ring();
+    Log::flush();
+    return test_result();
+}
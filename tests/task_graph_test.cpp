@@ -0,0 +1,189 @@
+// Runs task graphs with made up tasks on real thread pools, checking the order they ran in, the critical path, and what happens
+// when a task throws. Also runs the renderer's startup graph with stubs instead of GPU calls
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "task_graph.h"
+#include "startup_tasks.h"
+#include "log.h"
+#include "test.h"
+
+#define N_RANDOM_TASKS 200
+
+static void sleep_ms(int ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static void test_empty_graph() {
+    gfx::ThreadPool thread_pool(3);
+    gfx::TaskGraph graph;
+    graph.run(thread_pool);
+    CHECK(graph.critical_path().empty());
+}
+
+static void test_random_dependencies() {
+    // Every task checks that everything it depends on has finished before it started, on pools of different sizes
+    for (uint32_t n_workers : { 0u, 1u, 3u, 7u }) {
+        gfx::ThreadPool thread_pool(n_workers);
+        gfx::TaskGraph graph;
+        std::mt19937 rng(n_workers);
+        std::vector<std::atomic<uint32_t>> n_runs(N_RANDOM_TASKS);
+        std::vector<std::vector<gfx::TaskId>> dependencies(N_RANDOM_TASKS);
+        std::atomic<uint32_t> n_early_starts = 0;
+
+        for (gfx::TaskId id = 0; id < N_RANDOM_TASKS; ++id) {
+            if (id > 0) {
+                for (uint32_t i = 0, n = rng() % 4; i < n; ++i) dependencies[id].push_back(rng() % id);
+            }
+            const uint32_t work = rng() % 2000;
+            graph.add_task("Task " + std::to_string(id), [&, id, work]() {
+                for (const gfx::TaskId dependency : dependencies[id]) {
+                    if (n_runs[dependency].load() != 1) n_early_starts++;
+                }
+                volatile uint32_t sum = 0;
+                for (uint32_t i = 0; i < work; ++i) sum = sum + i;
+                n_runs[id]++;
+            });
+            for (const gfx::TaskId dependency : dependencies[id]) graph.add_dependency(id, dependency);
+        }
+        graph.run(thread_pool);
+
+        CHECK(n_early_starts.load() == 0);
+        for (gfx::TaskId id = 0; id < N_RANDOM_TASKS; ++id) {
+            CHECK(n_runs[id].load() == 1);
+            CHECK(graph.timing(id).thread_index < thread_pool.n_threads());
+            for (const gfx::TaskId dependency : dependencies[id]) CHECK(graph.timing(dependency).end_seconds <= graph.timing(id).start_seconds);
+        }
+    }
+}
+
+static void test_independent_tasks_overlap() {
+    // Sleeping doesn't need a core, so this works even on a single core machine
+    gfx::ThreadPool thread_pool(3);
+    gfx::TaskGraph graph;
+    for (int i = 0; i < 4; ++i) graph.add_task("Sleep", []() { sleep_ms(20); });
+    graph.run(thread_pool);
+
+    bool overlapped = false;
+    for (gfx::TaskId a = 0; a < graph.n_tasks(); ++a) {
+        for (gfx::TaskId b = a + 1; b < graph.n_tasks(); ++b) {
+            overlapped |= graph.timing(a).start_seconds < graph.timing(b).end_seconds && graph.timing(b).start_seconds < graph.timing(a).end_seconds;
+        }
+    }
+    CHECK(overlapped);
+    CHECK(graph.wall_seconds() < 0.07);
+}
+
+static void test_critical_path() {
+    gfx::ThreadPool thread_pool(3);
+    gfx::TaskGraph graph;
+    const gfx::TaskId decode = graph.add_task("Decode", []() { sleep_ms(30); });
+    const gfx::TaskId shaders = graph.add_task("Shaders", []() { sleep_ms(5); });
+    const gfx::TaskId upload = graph.add_task("Upload", []() { sleep_ms(30); }, { decode });
+    const gfx::TaskId finish = graph.add_task("Finish", []() {}, { shaders, upload });
+    graph.run(thread_pool);
+
+    CHECK(graph.critical_path() == std::vector<gfx::TaskId>({ decode, upload, finish }));
+    CHECK(graph.wall_seconds() >= 0.06);
+    graph.log_report("Critical path test");
+}
+
+static void test_throwing_task() {
+    // The throwing task's dependents never run, and `run()` rethrows instead of hanging
+    for (uint32_t n_workers : { 0u, 1u, 3u }) {
+        gfx::ThreadPool thread_pool(n_workers);
+        gfx::TaskGraph graph;
+        std::atomic<uint32_t> n_dependents_run = 0;
+        std::atomic<uint32_t> n_independent_run = 0;
+
+        const gfx::TaskId load = graph.add_task("Load", []() {
+            sleep_ms(5);
+            throw std::runtime_error("Could not load");
+        });
+        for (int i = 0; i < 8; ++i) {
+            const gfx::TaskId dependent = graph.add_task("Dependent", [&]() { n_dependents_run++; }, { load });
+            graph.add_task("Dependent of dependent", [&]() { n_dependents_run++; }, { dependent });
+        }
+        graph.add_task("Independent", [&]() { n_independent_run++; });
+
+        bool caught = false;
+        try {
+            graph.run(thread_pool);
+        }
+        catch (const std::runtime_error& error) {
+            caught = std::string(error.what()) == "Could not load";
+        }
+        CHECK(caught);
+        CHECK(n_dependents_run.load() == 0);
+        CHECK(n_independent_run.load() <= 1);
+    }
+
+    // Several tasks throwing at once, only one exception comes out
+    gfx::ThreadPool thread_pool(3);
+    gfx::TaskGraph graph;
+    for (int i = 0; i < 16; ++i) graph.add_task("Throw", [i]() { throw i; });
+    uint32_t n_caught = 0;
+    try {
+        graph.run(thread_pool);
+    }
+    catch (int) {
+        n_caught++;
+    }
+    CHECK(n_caught == 1);
+}
+
+static bool overlap(const gfx::TaskGraph& graph, gfx::TaskId a, gfx::TaskId b) {
+    return graph.timing(a).start_seconds < graph.timing(b).end_seconds && graph.timing(b).start_seconds < graph.timing(a).end_seconds;
+}
+
+static void test_renderer_startup() {
+    // Sleeps instead of the real work: compiling shaders takes the longest, decoding takes a while but nothing at startup waits for
+    // it, and the tasks that go through the device are quick
+    auto stub = [](const std::string& name, int ms) { return gfx::StartupTask{ name, [ms]() { sleep_ms(ms); } }; };
+    gfx::StartupTasks tasks;
+    tasks.decode_environment_maps = { stub("Decode sky.hdr", 20), stub("Decode studio.hdr", 20) };
+    tasks.decode_scenes = { stub("Decode sponza.gltf", 20), stub("Decode bistro.gltf", 20) };
+    tasks.create_targets = stub("Create framebuffers", 1);
+    for (int i = 0; i < 6; ++i) tasks.create_pipelines.push_back(stub("Pipeline " + std::to_string(i), (i == 3) ? 40 : 10));
+    tasks.ibl_brdf_lut_pipeline = 1;
+    tasks.create_buffers = stub("Create buffers", 1);
+    tasks.generate_ibl_brdf_lut = stub("Precalculate IBL BRDF LUT", 2);
+    tasks.build_render_graphs = stub("Build render graphs", 2);
+
+    gfx::TaskGraph graph;
+    const gfx::StartupTaskIds ids = gfx::add_startup_tasks(graph, std::move(tasks));
+    gfx::ThreadPool thread_pool(15); // Enough for everything that's ready at the start
+    graph.run(thread_pool);
+    graph.log_report("Renderer startup (stubbed)");
+
+    // The slowest shader compile decides how long startup takes, the decodes are hidden behind it
+    CHECK(graph.critical_path() == std::vector<gfx::TaskId>({ ids.create_pipelines[3], ids.build_render_graphs }));
+    for (const gfx::TaskId decode_scene : ids.decode_scenes) {
+        for (const gfx::TaskId decode_hdri : ids.decode_environment_maps) CHECK(overlap(graph, decode_scene, decode_hdri));
+        CHECK(overlap(graph, decode_scene, ids.create_pipelines[3]));
+    }
+    CHECK(graph.wall_seconds() < 0.1);
+
+    // The device tasks are chained, and the render graphs wait for every pipeline
+    auto ran_before = [&](gfx::TaskId a, gfx::TaskId b) { return graph.timing(a).end_seconds <= graph.timing(b).start_seconds; };
+    CHECK(ran_before(ids.create_targets, ids.create_buffers));
+    CHECK(ran_before(ids.create_buffers, ids.generate_ibl_brdf_lut));
+    CHECK(ran_before(ids.create_pipelines[1], ids.generate_ibl_brdf_lut));
+    CHECK(ran_before(ids.generate_ibl_brdf_lut, ids.build_render_graphs));
+    for (const gfx::TaskId create_pipeline : ids.create_pipelines) CHECK(ran_before(create_pipeline, ids.build_render_graphs));
+}
+
+int main() {
+    test_empty_graph();
+    test_random_dependencies();
+    test_independent_tasks_overlap();
+    test_critical_path();
+    test_throwing_task();
+    test_renderer_startup();
+    Log::flush();
+    return test_result();
+}
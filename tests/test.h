@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdio>
+
+// Bare minimum for the headless tests: a failing CHECK prints where it was and keeps going, so one run shows every failure.
+// Tests end with `return test_result();`, which ctest sees as a failure if any check failed.
+inline int g_n_failed_checks = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            printf("%s:%i: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            g_n_failed_checks++; \
+        } \
+    } while (0)
+
+inline int test_result() {
+    if (g_n_failed_checks > 0) {
+        printf("%i checks failed\n", g_n_failed_checks);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
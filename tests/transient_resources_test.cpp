@@ -0,0 +1,149 @@
+// Packs made up resources with made up lifetimes, and checks that nothing alive at the same time shares memory
+#include <random>
+#include <vector>
+#include "transient_resources.h"
+#include "log.h"
+#include "test.h"
+
+static gfx::TransientResource resource(uint64_t size, uint64_t alignment, uint32_t first_pass, uint32_t last_pass) {
+    return gfx::TransientResource{
+        .size = size,
+        .alignment = alignment,
+        .lifetime = { .first_pass = first_pass, .last_pass = last_pass },
+    };
+}
+
+static gfx::TransientResource unused_resource(uint64_t size) {
+    return gfx::TransientResource{ .size = size, .alignment = 1 };
+}
+
+static bool memory_overlaps(const gfx::TransientHeapLayout& layout, const std::vector<gfx::TransientResource>& resources, uint32_t a, uint32_t b) {
+    return layout.offsets[a] < layout.offsets[b] + resources[b].size && layout.offsets[b] < layout.offsets[a] + resources[a].size;
+}
+
+static bool is_alias(const gfx::TransientHeapLayout& layout, uint32_t a, uint32_t b) {
+    for (uint32_t alias : layout.aliases[a]) {
+        if (alias == b) return true;
+    }
+    return false;
+}
+
+static void test_disjoint_lifetimes_share() {
+    const std::vector<gfx::TransientResource> resources = {
+        resource(100, 1, 0, 1),
+        resource(100, 1, 2, 3),
+    };
+    const gfx::TransientHeapLayout layout = gfx::pack_transient_resources(resources);
+    CHECK(layout.offsets[0] == 0 && layout.offsets[1] == 0);
+    CHECK(layout.heap_size == 100);
+    CHECK(layout.unaliased_size == 200);
+    CHECK(is_alias(layout, 0, 1) && is_alias(layout, 1, 0));
+}
+
+static void test_overlapping_lifetimes_stack() {
+    const std::vector<gfx::TransientResource> resources = {
+        resource(100, 256, 0, 2),
+        resource(50, 256, 2, 3), // Overlaps in pass 2 only
+    };
+    const gfx::TransientHeapLayout layout = gfx::pack_transient_resources(resources);
+    CHECK(layout.offsets[0] == 0);
+    CHECK(layout.offsets[1] == 256);
+    CHECK(layout.heap_size == 306);
+    CHECK(layout.aliases[0].empty() && layout.aliases[1].empty());
+}
+
+static void test_unused_never_shares() {
+    const std::vector<gfx::TransientResource> resources = {
+        unused_resource(64),
+        resource(64, 1, 0, 0),
+        resource(64, 1, 1, 1),
+    };
+    const gfx::TransientHeapLayout layout = gfx::pack_transient_resources(resources);
+
+    // The two used ones share, the unused one gets memory of its own
+    CHECK(layout.offsets[1] == layout.offsets[2]);
+    CHECK(layout.offsets[0] != layout.offsets[1]);
+    CHECK(layout.heap_size == 128);
+    CHECK(layout.aliases[0].empty());
+}
+
+static void test_small_resources_fill_gaps() {
+    // The big one goes first, then both small ones fit in its memory since it's dead by then, one after the other
+    const std::vector<gfx::TransientResource> resources = {
+        resource(100, 1, 1, 1),
+        resource(200, 1, 0, 0),
+        resource(100, 1, 1, 1),
+    };
+    const gfx::TransientHeapLayout layout = gfx::pack_transient_resources(resources);
+    CHECK(layout.offsets[1] == 0);
+    CHECK(layout.offsets[0] == 0);
+    CHECK(layout.offsets[2] == 100);
+    CHECK(layout.heap_size == 200);
+    CHECK(layout.aliases[1].size() == 2);
+    CHECK(!is_alias(layout, 0, 2));
+}
+
+static void test_random_layouts() {
+    std::mt19937 rng(1234);
+    for (int iteration = 0; iteration < 200; ++iteration) {
+        std::vector<gfx::TransientResource> resources(1 + rng() % 24);
+        for (gfx::TransientResource& resource : resources) {
+            const uint32_t first_pass = rng() % 16;
+            resource = (rng() % 8 == 0) ? unused_resource(1 + rng() % 4096) : ::resource(1 + rng() % 65536, 1ull << (rng() % 17), first_pass, first_pass + rng() % 8);
+        }
+        const gfx::TransientHeapLayout layout = gfx::pack_transient_resources(resources);
+
+        uint64_t unaliased_size = 0;
+        for (uint32_t a = 0; a < resources.size(); ++a) {
+            unaliased_size += resources[a].size;
+            CHECK(layout.offsets[a] % resources[a].alignment == 0);
+            CHECK(layout.offsets[a] + resources[a].size <= layout.heap_size);
+            for (uint32_t b = a + 1; b < resources.size(); ++b) {
+                const bool conflict = !resources[a].lifetime.is_used() || !resources[b].lifetime.is_used() || resources[a].lifetime.overlaps(resources[b].lifetime);
+                const bool overlaps = memory_overlaps(layout, resources, a, b);
+                CHECK(!(conflict && overlaps));
+                CHECK(is_alias(layout, a, b) == overlaps);
+                CHECK(is_alias(layout, b, a) == overlaps);
+            }
+        }
+        CHECK(layout.unaliased_size == unaliased_size);
+        CHECK(layout.heap_size <= unaliased_size + resources.size() * 65536); // Worst case is every resource stacked, plus alignment padding
+    }
+}
+
+static void test_lifetimes_from_graphs() {
+    // Two graphs back to back on one timeline, like the path traced and raster halves of a frame
+    gfx::RenderGraph first;
+    const auto a = first.add_resource("A");
+    const auto b = first.add_resource("B");
+    first.mark_output(b);
+    first.add_pass("Write A", { { a, gfx::ResourceUsage::compute_write } }, []() {});
+    first.add_pass("A to B", { { a, gfx::ResourceUsage::non_pixel_shader_read }, { b, gfx::ResourceUsage::compute_write } }, []() {});
+    first.compile();
+
+    gfx::RenderGraph second;
+    second.add_resource("A");
+    second.add_resource("B");
+    second.add_pass("Read B", { { b, gfx::ResourceUsage::pixel_shader_read } }, []() {}, true);
+    second.compile();
+
+    std::vector<gfx::TransientLifetime> lifetimes(2);
+    const uint32_t second_start = gfx::extend_transient_lifetimes(first, 0, lifetimes);
+    const uint32_t end = gfx::extend_transient_lifetimes(second, second_start, lifetimes);
+    CHECK(second_start == 2);
+    CHECK(end == 3);
+    CHECK(lifetimes[a].first_pass == 0 && lifetimes[a].last_pass == 1);
+    CHECK(lifetimes[b].first_pass == 1 && lifetimes[b].last_pass == 2);
+    CHECK(lifetimes[a].overlaps(lifetimes[b]));
+}
+
+int main() {
+    test_disjoint_lifetimes_share();
+    test_overlapping_lifetimes_stack();
+    test_unused_never_shares();
+    test_small_resources_fill_gaps();
+    test_random_layouts();
+    test_lifetimes_from_graphs();
+    Log::flush();
+    return test_result();
+}
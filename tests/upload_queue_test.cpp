@@ -0,0 +1,267 @@
+// Drives the upload queue with a fake command queue and fence, that record what would have been sent to the GPU, and only finish
+// work when the test says so
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+#include "upload_queue.h"
+#include "log.h"
+#include "test.h"
+
+// The real one wraps a D3D12 command list, the upload queue only ever passes it around as a pointer
+namespace gfx {
+    struct CommandBuffer {
+        uint64_t fence_value;
+        uint32_t creation_index;
+    };
+}
+
+// Executes command buffers in the order they were created, like the real queue
+struct FakeGpu {
+    std::vector<std::shared_ptr<gfx::CommandBuffer>> created;
+    std::vector<std::shared_ptr<gfx::CommandBuffer>> executed;
+    size_t n_executed = 0;
+    std::vector<uint64_t> signaled_values; // Upload fence signals, one per submit
+    std::vector<uint64_t> graphics_waits; // Values the graphics queue was told to wait for
+    std::vector<uint64_t> cpu_waits;
+    uint64_t completed_value = 0;
+
+    gfx::UploadQueueFuncs funcs() {
+        return gfx::UploadQueueFuncs{
+            .create_command_buffer = [this](const gfx::Pipeline*, uint64_t fence_value) {
+                created.push_back(std::make_shared<gfx::CommandBuffer>(gfx::CommandBuffer{ fence_value, (uint32_t)created.size() }));
+                return created.back();
+            },
+            .submit = [this](uint64_t fence_value) {
+                for (; n_executed < created.size(); ++n_executed) executed.push_back(created[n_executed]);
+                signaled_values.push_back(fence_value);
+                graphics_waits.push_back(fence_value);
+            },
+            .completed_fence_value = [this]() { return completed_value; },
+            .cpu_wait = [this](uint64_t fence_value) {
+                cpu_waits.push_back(fence_value);
+                complete_up_to(fence_value);
+            },
+        };
+    }
+
+    // The GPU can only get as far as the last signal that was submitted
+    void complete_up_to(uint64_t value) {
+        uint64_t submitted = 0;
+        for (uint64_t signaled : signaled_values) if (signaled <= value) submitted = std::max(submitted, signaled);
+        completed_value = std::max(completed_value, submitted);
+    }
+    void complete_all() { if (!signaled_values.empty()) complete_up_to(signaled_values.back()); }
+};
+
+static void test_flush_signals_and_waits_on_the_gpu() {
+    FakeGpu gpu;
+    gfx::UploadQueue queue(gpu.funcs(), 1024);
+    std::vector<uint32_t> loaded;
+
+    queue.allocate_staging(256, 16);
+    auto cmd = queue.copy_command_buffer();
+    queue.track_load(7);
+    CHECK(queue.copy_command_buffer() == cmd); // Copies share one command buffer until the flush
+    CHECK(gpu.executed.empty());
+
+    queue.flush();
+    CHECK(gpu.executed.size() == 1 && gpu.executed[0] == cmd);
+    CHECK(gpu.signaled_values == std::vector<uint64_t>({ cmd->fence_value }));
+    CHECK(gpu.graphics_waits == std::vector<uint64_t>({ cmd->fence_value }));
+    CHECK(gpu.cpu_waits.empty()); // Only the graphics queue waits
+
+    // Not done on the GPU yet, so the load isn't reported, and the staging memory is still in use
+    queue.update(loaded);
+    CHECK(loaded.empty());
+    CHECK(queue.tracker_stats().n_pending_loads == 1);
+
+    gpu.complete_all();
+    queue.update(loaded);
+    CHECK(loaded == std::vector<uint32_t>({ 7 }));
+
+    // A new batch after the flush
+    auto next_cmd = queue.copy_command_buffer();
+    CHECK(next_cmd != cmd);
+    CHECK(next_cmd->fence_value > cmd->fence_value);
+}
+
+static void test_own_command_buffers_run_after_earlier_copies() {
+    // Like loading two meshes: copy the vertices, build the BLAS on its own command buffer, copy the next mesh, build its BLAS
+    FakeGpu gpu;
+    gfx::UploadQueue queue(gpu.funcs(), 1024);
+    auto copies = queue.copy_command_buffer();
+    auto blas_0 = queue.create_command_buffer();
+    CHECK(queue.copy_command_buffer() == copies); // Still the same copy batch, which runs before `blas_0`
+    auto blas_1 = queue.create_command_buffer();
+    auto tlas = queue.create_command_buffer();
+    CHECK(copies->fence_value < blas_0->fence_value);
+    CHECK(blas_0->fence_value < blas_1->fence_value);
+    CHECK(blas_1->fence_value < tlas->fence_value);
+
+    queue.flush();
+    CHECK(gpu.executed == std::vector<std::shared_ptr<gfx::CommandBuffer>>({ copies, blas_0, blas_1, tlas }));
+    CHECK(gpu.signaled_values.back() == tlas->fence_value); // One signal for the whole batch, after the last command buffer
+
+    // Copies recorded after the flush go after everything from before it
+    auto later_copies = queue.copy_command_buffer();
+    queue.flush();
+    CHECK(gpu.executed.back() == later_copies);
+    CHECK(later_copies->fence_value > tlas->fence_value);
+}
+
+static void test_keep_alive_until_the_fence_passes() {
+    FakeGpu gpu;
+    gfx::UploadQueue queue(gpu.funcs(), 1024);
+    std::vector<uint32_t> loaded;
+
+    auto scratch_0 = std::make_shared<int>(0);
+    std::weak_ptr<int> scratch_0_weak = scratch_0;
+    queue.create_command_buffer();
+    queue.keep_alive(std::move(scratch_0));
+    queue.flush();
+
+    auto scratch_1 = std::make_shared<int>(1);
+    std::weak_ptr<int> scratch_1_weak = scratch_1;
+    queue.create_command_buffer();
+    queue.keep_alive(std::move(scratch_1));
+    CHECK(queue.has_kept_alive_resources());
+
+    queue.update(loaded);
+    CHECK(!scratch_0_weak.expired());
+
+    // The first batch is done, the second one wasn't even submitted yet
+    gpu.complete_all();
+    queue.update(loaded);
+    CHECK(scratch_0_weak.expired());
+    CHECK(!scratch_1_weak.expired());
+
+    queue.flush();
+    gpu.complete_all();
+    queue.update(loaded);
+    CHECK(scratch_1_weak.expired());
+    CHECK(!queue.has_kept_alive_resources());
+}
+
+static void test_full_staging_ring_waits_on_the_cpu() {
+    FakeGpu gpu;
+    gfx::UploadQueue queue(gpu.funcs(), 1024);
+    std::vector<uint32_t> loaded;
+
+    const uint64_t offset_0 = queue.allocate_staging(512, 16);
+    auto cmd_0 = queue.copy_command_buffer();
+    const uint64_t offset_1 = queue.allocate_staging(512, 16);
+    queue.copy_command_buffer();
+    CHECK(offset_0 != offset_1);
+    CHECK(gpu.signaled_values.empty());
+
+    // Doesn't fit, so it has to submit the copies that are using the ring, and wait for them
+    const uint64_t offset_2 = queue.allocate_staging(512, 16);
+    CHECK(gpu.signaled_values == std::vector<uint64_t>({ cmd_0->fence_value }));
+    CHECK(gpu.cpu_waits == std::vector<uint64_t>({ cmd_0->fence_value }));
+    CHECK(offset_2 + 512 <= 1024);
+    CHECK(queue.staging_ring_stats().n_full == 1);
+
+    // The next copy doesn't go into the batch that was submitted
+    auto cmd_1 = queue.copy_command_buffer();
+    CHECK(cmd_1 != cmd_0);
+}
+
+static void test_wait_idle() {
+    FakeGpu gpu;
+    gfx::UploadQueue queue(gpu.funcs(), 1024);
+    std::vector<uint32_t> loaded;
+    queue.copy_command_buffer();
+    queue.track_load(1);
+    auto build = queue.create_command_buffer();
+    queue.keep_alive(std::make_shared<int>(2));
+
+    queue.wait_idle();
+    CHECK(gpu.signaled_values.back() == build->fence_value);
+    CHECK(gpu.cpu_waits.back() == build->fence_value);
+    queue.update(loaded);
+    CHECK(loaded == std::vector<uint32_t>({ 1 }));
+    CHECK(!queue.has_kept_alive_resources());
+}
+
+static void test_random_schedule() {
+    // Copies, separate command buffers, keep-alives, loads, flushes and GPU progress interleaved at random. Command buffers have to
+    // run in the order they were made, with fence values that never go down, and nothing can be released or reported before the
+    // GPU got past the batch it was recorded in
+    std::mt19937 rng(1234);
+    FakeGpu gpu;
+    gfx::UploadQueue queue(gpu.funcs(), 4096);
+    struct Tracked {
+        std::weak_ptr<int> resource;
+        uint64_t fence_value;
+    };
+    std::vector<Tracked> kept_alive;
+    std::vector<uint64_t> load_fence_values; // Per resource id
+    std::vector<uint32_t> loaded;
+    uint32_t n_reported = 0;
+
+    for (int step = 0; step < 5000; ++step) {
+        switch (rng() % 6) {
+        case 0:
+            queue.allocate_staging(64 + rng() % 1024, 256);
+            queue.copy_command_buffer();
+            break;
+        case 1:
+            queue.create_command_buffer();
+            break;
+        case 2: {
+            auto resource = std::make_shared<int>(step);
+            kept_alive.push_back({ resource, queue.fence_value() });
+            queue.keep_alive(std::move(resource));
+            break;
+        }
+        case 3:
+            queue.track_load((uint32_t)load_fence_values.size());
+            load_fence_values.push_back(queue.fence_value());
+            break;
+        case 4:
+            queue.flush();
+            break;
+        case 5:
+            if (!gpu.signaled_values.empty()) gpu.complete_up_to(gpu.signaled_values[rng() % gpu.signaled_values.size()]);
+            break;
+        }
+
+        loaded.clear();
+        queue.update(loaded);
+        for (uint32_t id : loaded) {
+            CHECK(id == n_reported);
+            CHECK(load_fence_values[id] <= gpu.completed_value);
+            ++n_reported;
+        }
+        for (const Tracked& tracked : kept_alive) {
+            CHECK(tracked.resource.expired() == (tracked.fence_value <= gpu.completed_value));
+        }
+    }
+
+    for (size_t i = 0; i < gpu.executed.size(); ++i) {
+        CHECK(gpu.executed[i]->creation_index == i);
+        if (i > 0) CHECK(gpu.executed[i]->fence_value >= gpu.executed[i - 1]->fence_value);
+    }
+    for (size_t i = 1; i < gpu.signaled_values.size(); ++i) CHECK(gpu.signaled_values[i] >= gpu.signaled_values[i - 1]);
+    CHECK(gpu.signaled_values == gpu.graphics_waits);
+
+    queue.wait_idle();
+    loaded.clear();
+    queue.update(loaded);
+    n_reported += (uint32_t)loaded.size();
+    CHECK(n_reported == load_fence_values.size());
+    CHECK(!queue.has_kept_alive_resources());
+    CHECK(gpu.executed.size() == gpu.created.size());
+}
+
+int main() {
+    test_flush_signals_and_waits_on_the_gpu();
+    test_own_command_buffers_run_after_earlier_copies();
+    test_keep_alive_until_the_fence_passes();
+    test_full_staging_ring_waits_on_the_cpu();
+    test_wait_idle();
+    test_random_schedule();
+    Log::flush();
+    return test_result();
+}
@@ -0,0 +1,110 @@
+// Drives the upload tracker with a fake fence, that completes upload batches whenever the test says so
+#include <random>
+#include <vector>
+#include "upload_tracker.h"
+#include "log.h"
+#include "test.h"
+
+// Stand-in for the upload queue and its fence: every submit gets the next fence value, and `complete()` makes the GPU catch up
+struct FakeUploadQueue {
+    uint64_t next_fence_value = 1;
+    uint64_t completed_value = 0;
+
+    uint64_t submit() { return next_fence_value++; }
+    void complete(uint64_t value) { if (value > completed_value) completed_value = value; }
+};
+
+static void test_loads_wait_for_their_fence() {
+    FakeUploadQueue queue;
+    gfx::UploadTracker tracker;
+    std::vector<uint32_t> loaded;
+
+    const uint64_t batch_0 = queue.submit();
+    tracker.track_load(10, batch_0);
+    tracker.track_load(11, batch_0);
+    const uint64_t batch_1 = queue.submit();
+    tracker.track_load(12, batch_1);
+    CHECK(tracker.stats().n_pending_loads == 3);
+
+    // Nothing's done yet, the fence starts at 0
+    tracker.update(queue.completed_value, loaded);
+    CHECK(loaded.empty());
+
+    queue.complete(batch_0);
+    tracker.update(queue.completed_value, loaded);
+    CHECK(loaded == std::vector<uint32_t>({ 10, 11 }));
+    CHECK(tracker.stats().n_pending_loads == 1);
+
+    // Updating again with the same value doesn't report anything twice
+    loaded.clear();
+    tracker.update(queue.completed_value, loaded);
+    CHECK(loaded.empty());
+
+    queue.complete(batch_1);
+    tracker.update(queue.completed_value, loaded);
+    CHECK(loaded == std::vector<uint32_t>({ 12 }));
+    CHECK(tracker.stats().n_pending_loads == 0);
+}
+
+static void test_fence_skipping_ahead() {
+    // The fence can pass several batches between two updates
+    FakeUploadQueue queue;
+    gfx::UploadTracker tracker;
+    std::vector<uint32_t> loaded;
+    for (uint32_t i = 0; i < 5; ++i) tracker.track_load(i, queue.submit());
+    queue.complete(4);
+    tracker.update(queue.completed_value, loaded);
+    CHECK(loaded == std::vector<uint32_t>({ 0, 1, 2, 3 }));
+    CHECK(tracker.stats().n_pending_loads == 1);
+}
+
+static void test_random_schedule() {
+    // Submits and completions interleaved at random. Every resource has to show up exactly once, in order, and never before its batch is done
+    std::mt19937 rng(4321);
+    FakeUploadQueue queue;
+    gfx::UploadTracker tracker;
+    std::vector<uint64_t> fence_values; // Per resource id
+    std::vector<uint32_t> loaded;
+    uint32_t next_id = 0;
+    uint32_t n_checked = 0;
+    for (int step = 0; step < 10000; ++step) {
+        if (rng() % 3 != 0) {
+            const uint64_t fence_value = queue.submit();
+            for (uint32_t i = 0, n = rng() % 4; i < n; ++i) {
+                tracker.track_load(next_id++, fence_value);
+                fence_values.push_back(fence_value);
+            }
+        }
+        if (rng() % 2 == 0) {
+            queue.complete(queue.completed_value + rng() % 3);
+            if (queue.completed_value >= queue.next_fence_value) queue.completed_value = queue.next_fence_value - 1;
+        }
+
+        loaded.clear();
+        tracker.update(queue.completed_value, loaded);
+        for (uint32_t id : loaded) {
+            CHECK(id == n_checked);
+            CHECK(fence_values[id] <= queue.completed_value);
+            ++n_checked;
+        }
+
+        // Everything not reported yet has to still be waiting on the fence
+        CHECK(n_checked + tracker.stats().n_pending_loads == next_id);
+        if (n_checked < next_id) CHECK(fence_values[n_checked] > queue.completed_value);
+    }
+
+    queue.complete(queue.next_fence_value - 1);
+    loaded.clear();
+    tracker.update(queue.completed_value, loaded);
+    n_checked += (uint32_t)loaded.size();
+    CHECK(n_checked == next_id);
+    CHECK(tracker.stats().n_pending_loads == 0);
+}
+
+int main() {
+    test_loads_wait_for_their_fence();
+    test_fence_skipping_ahead();
+    test_random_schedule();
+    Log::flush();
+    return test_result();
+}